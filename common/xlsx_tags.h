@@ -0,0 +1,163 @@
+/*
+** xlsx_tags.h - SpreadsheetML tag and attribute dispatch for the importers
+**
+** The worksheet callbacks run once per element of every sheet, so a chain
+** of strcmp() calls per tag, per attribute and per type value costs about
+** as much as Expat itself on large sheets.  The few names the importers
+** care about are all short and mostly differ in their first byte, so they
+** are recognised here by switching on the first byte and then checking the
+** remaining bytes and the terminator.
+**
+** Header only: each importer is a single translation unit and includes this
+** file directly, so there is nothing extra to link.
+*/
+#ifndef XLSX_TAGS_H
+#define XLSX_TAGS_H
+
+/* Elements seen in sharedStrings.xml and sheetN.xml */
+enum {
+  XLSX_TAG_OTHER = 0,
+  XLSX_TAG_C,     /* <c>   cell */
+  XLSX_TAG_V,     /* <v>   cell value */
+  XLSX_TAG_T,     /* <t>   text run */
+  XLSX_TAG_IS,    /* <is>  inline string */
+  XLSX_TAG_SI,    /* <si>  shared string item */
+  XLSX_TAG_ROW,   /* <row> */
+  XLSX_TAG_RPH,   /* <rPh> phonetic run */
+  XLSX_TAG_SST    /* <sst> shared string table */
+};
+
+/* Attributes of <row> and <c> */
+enum {
+  XLSX_ATTR_OTHER = 0,
+  XLSX_ATTR_R,    /* r: cell reference or row number */
+  XLSX_ATTR_T,    /* t: cell type */
+  XLSX_ATTR_S     /* s: style index */
+};
+
+/* Upper bound for parsed numbers; anything larger is treated as corrupt */
+#define XLSX_MAX_NUMBER 0x7FFFFFFF
+
+static inline int xlsx_tag(const char *name) {
+  switch (name[0]) {
+  case 'c':
+    return name[1] == '\0' ? XLSX_TAG_C : XLSX_TAG_OTHER;
+  case 'v':
+    return name[1] == '\0' ? XLSX_TAG_V : XLSX_TAG_OTHER;
+  case 't':
+    return name[1] == '\0' ? XLSX_TAG_T : XLSX_TAG_OTHER;
+  case 'i':
+    return name[1] == 's' && name[2] == '\0' ? XLSX_TAG_IS : XLSX_TAG_OTHER;
+  case 'r':
+    if (name[1] == 'o' && name[2] == 'w' && name[3] == '\0')
+      return XLSX_TAG_ROW;
+    if (name[1] == 'P' && name[2] == 'h' && name[3] == '\0')
+      return XLSX_TAG_RPH;
+    return XLSX_TAG_OTHER;
+  case 's':
+    if (name[1] == 'i' && name[2] == '\0')
+      return XLSX_TAG_SI;
+    if (name[1] == 's' && name[2] == 't' && name[3] == '\0')
+      return XLSX_TAG_SST;
+    return XLSX_TAG_OTHER;
+  default:
+    return XLSX_TAG_OTHER;
+  }
+}
+
+static inline int xlsx_attr(const char *name) {
+  if (name[0] == '\0' || name[1] != '\0')
+    return XLSX_ATTR_OTHER;
+  switch (name[0]) {
+  case 'r':
+    return XLSX_ATTR_R;
+  case 't':
+    return XLSX_ATTR_T;
+  case 's':
+    return XLSX_ATTR_S;
+  default:
+    return XLSX_ATTR_OTHER;
+  }
+}
+
+/*
+** Map the value of a cell's t attribute to a one-letter code:
+** 's' shared string, 'i' inline string, 'b' boolean, 'f' formula string
+** result ("str"), 'e' error, 'd' ISO 8601 date, 'n' number (the default).
+*/
+static inline char xlsx_cell_type(const char *value) {
+  switch (value[0]) {
+  case 's':
+    if (value[1] == '\0')
+      return 's';
+    if (value[1] == 't' && value[2] == 'r' && value[3] == '\0')
+      return 'f';
+    return 'n';
+  case 'i':
+    return 'i'; /* inlineStr is the only type starting with 'i' */
+  case 'b':
+    return value[1] == '\0' ? 'b' : 'n';
+  case 'e':
+    return value[1] == '\0' ? 'e' : 'n';
+  case 'd':
+    return value[1] == '\0' ? 'd' : 'n';
+  default:
+    return 'n';
+  }
+}
+
+/*
+** Parse a non-negative decimal number such as a row number or a shared
+** string index.  Leading and trailing blanks are not expected in
+** SpreadsheetML and stop the scan.  Returns -1 when there are no digits or
+** the value exceeds XLSX_MAX_NUMBER.
+*/
+static inline int xlsx_parse_uint(const char *s) {
+  int n = 0;
+  if (*s < '0' || *s > '9')
+    return -1;
+  for (; *s >= '0' && *s <= '9'; s++) {
+    int d = *s - '0';
+    if (n > (XLSX_MAX_NUMBER - d) / 10)
+      return -1;
+    n = n * 10 + d;
+  }
+  return n;
+}
+
+/*
+** Parse a cell reference like "AB67" in a single pass.  Returns the 1-based
+** column number (0 when there are no letters) and stores the 1-based row
+** number in *pRow (0 when there are no digits).  Out of range parts are
+** reported as 0 as well.  pRow may be NULL.
+*/
+static inline int xlsx_parse_ref(const char *ref, int *pRow) {
+  int col = 0;
+  int row = 0;
+  const char *p = ref;
+
+  for (;; p++) {
+    unsigned c = (unsigned char)*p | 0x20; /* fold to lower case */
+    if (c - 'a' >= 26u)
+      break;
+    if (col > (XLSX_MAX_NUMBER - 26) / 26)
+      col = -1;
+    if (col >= 0)
+      col = col * 26 + (int)(c - 'a' + 1);
+  }
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (row > (XLSX_MAX_NUMBER - 9) / 10)
+      row = -1;
+    if (row >= 0)
+      row = row * 10 + (*p - '0');
+  }
+  if (col < 0)
+    col = 0;
+  if (row < 0)
+    row = 0;
+  if (pRow)
+    *pRow = row;
+  return col;
+}
+
+#endif /* XLSX_TAGS_H */
@@ -0,0 +1,94 @@
+/*
+** xlsx_zipfile.h - archive access through the zipfile virtual table
+**
+** The copilot and gemini importers read the parts of a workbook with
+** "SELECT data FROM zipfile(?1) WHERE name = ?2".  Given a file name,
+** zipfile opens the file and walks its central directory again for every
+** entry, which dominates imports of workbooks with many parts.  The reader
+** below prepares the query once per import and binds the archive as a
+** BLOB, so the directory is read from memory:
+**
+**   - an archive passed to the SQL function as a BLOB is bound in place;
+**     the argument stays valid for the whole call;
+**   - a file name is mapped read-only where mmap() exists and the file
+**     fits SQLITE_LIMIT_LENGTH;
+**   - otherwise the file name itself is bound.
+**
+** Header only, like xlsx_tags.h.  Include it after SQLITE_EXTENSION_INIT1.
+*/
+#ifndef XLSX_ZIPFILE_H
+#define XLSX_ZIPFILE_H
+
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+  sqlite3_stmt *stmt; /* ?1 bound to the archive, ?2 to the entry name */
+  void *map;          /* Mapped archive, or NULL */
+  size_t map_len;
+} XlsxZipReader;
+
+/*
+** Prepare the reader for archive, a file name or a BLOB.  Returns
+** SQLITE_OK, SQLITE_MISUSE when archive is NULL, or the error of preparing
+** the query (the message is in db).
+*/
+static inline int xlsx_zip_reader_open(sqlite3 *db, sqlite3_value *archive,
+                                       XlsxZipReader *zr) {
+  const char *zipname = NULL;
+  int rc;
+
+  memset(zr, 0, sizeof(*zr));
+  if (sqlite3_value_type(archive) != SQLITE_BLOB) {
+    zipname = (const char *)sqlite3_value_text(archive);
+    if (!zipname)
+      return SQLITE_MISUSE;
+  }
+  rc = sqlite3_prepare_v2(db, "SELECT data FROM zipfile(?) WHERE name = ?",
+                          -1, &zr->stmt, NULL);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  if (!zipname) {
+    sqlite3_bind_blob(zr->stmt, 1, sqlite3_value_blob(archive),
+                      sqlite3_value_bytes(archive), SQLITE_STATIC);
+    return SQLITE_OK;
+  }
+#ifndef _WIN32
+  int fd = open(zipname, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        st.st_size <= sqlite3_limit(db, SQLITE_LIMIT_LENGTH, -1)) {
+      void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (m != MAP_FAILED) {
+        zr->map = m;
+        zr->map_len = (size_t)st.st_size;
+      }
+    }
+    close(fd);
+  }
+#endif
+  if (zr->map)
+    sqlite3_bind_blob(zr->stmt, 1, zr->map, (int)zr->map_len, SQLITE_STATIC);
+  else
+    sqlite3_bind_text(zr->stmt, 1, zipname, -1, SQLITE_TRANSIENT);
+  return SQLITE_OK;
+}
+
+/* Finalize the query and unmap the archive; safe on a failed open */
+static inline void xlsx_zip_reader_close(XlsxZipReader *zr) {
+  sqlite3_finalize(zr->stmt);
+#ifndef _WIN32
+  if (zr->map)
+    munmap(zr->map, zr->map_len);
+#endif
+  memset(zr, 0, sizeof(*zr));
+}
+
+#endif /* XLSX_ZIPFILE_H */
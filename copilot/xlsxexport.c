@@ -40,6 +40,10 @@ SQLite loadable extension implementing:
     Numeric types are written as numbers; text uses sharedStrings (t="s").
     Text is truncated to Excel's ~32K character limit per cell.
 
+  - xlsx_export_query(filename, sheet1, sql1, sheet2, sql2, ...)
+    Same as xlsx_export, but each sheet holds the rows of a single read-only
+    SELECT statement, with its result column names as the header row.
+
   - xlsx_export_version()
     Returns "2025-12-30 Copilot Think Deeper (GPT 5.1?)".
 
@@ -398,6 +402,8 @@ static char *build_workbook_xml(char **sheet_names, int sheet_count){
 
 /* ---------- Worksheet builder (uses sharedStrings) ---------- */
 
+static int write_worksheet_rows(sqlite3_stmt *pStmt, char **colnames, int colcount, int header_style_index, sst *sstp, memwriter *out);
+
 /* Build worksheet XML for a given table name. header_style_index is the xf index for header (1).
    sst is updated with any strings encountered; worksheet XML references shared string indices (t="s").
 */
@@ -465,7 +471,14 @@ static int build_worksheet_xml_with_sst(sqlite3 *db, const char *table, int head
         return rc;
     }
 
-    rc = mw_init(out);
+    return write_worksheet_rows(pStmt, colnames, colcount, header_style_index, sstp, out);
+}
+
+/* Write the header and data rows of a prepared statement into out.
+   Finalizes pStmt and frees colnames (colcount entries) in every case.
+*/
+static int write_worksheet_rows(sqlite3_stmt *pStmt, char **colnames, int colcount, int header_style_index, sst *sstp, memwriter *out){
+    int rc = mw_init(out);
     if(rc != SQLITE_OK){
         sqlite3_finalize(pStmt);
         for(int i=0;i<colcount;i++) free(colnames[i]);
@@ -576,6 +589,37 @@ static int build_worksheet_xml_with_sst(sqlite3 *db, const char *table, int head
     return SQLITE_OK;
 }
 
+/* Build worksheet XML for the rows of a query; the header comes from its result columns.
+   The query must be a single read-only statement.
+*/
+static int build_query_worksheet_xml_with_sst(sqlite3 *db, const char *sheet, const char *query, int header_style_index, sst *sstp, memwriter *out, char **pzErrMsg){
+    sqlite3_stmt *pStmt = NULL;
+    const char *tail = NULL;
+    int rc = sqlite3_prepare_v2(db, query, -1, &pStmt, &tail);
+    if(rc != SQLITE_OK){
+        if(pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to prepare query for sheet %s: %s", sheet, sqlite3_errmsg(db));
+        return rc;
+    }
+    while(tail && (isspace((unsigned char)*tail) || *tail == ';')) tail++;
+    if(!pStmt || (tail && *tail) || !sqlite3_stmt_readonly(pStmt)){
+        sqlite3_finalize(pStmt);
+        if(pzErrMsg) *pzErrMsg = sqlite3_mprintf("Query for sheet %s must be a single read-only statement", sheet);
+        return SQLITE_ERROR;
+    }
+
+    int colcount = sqlite3_column_count(pStmt);
+    char **colnames = (char**)calloc(colcount ? colcount : 1, sizeof(char*));
+    if(!colnames){
+        sqlite3_finalize(pStmt);
+        return SQLITE_NOMEM;
+    }
+    for(int c=0;c<colcount;c++){
+        const char *cname = sqlite3_column_name(pStmt, c);
+        colnames[c] = xstrdup(cname ? cname : "");
+    }
+    return write_worksheet_rows(pStmt, colnames, colcount, header_style_index, sstp, out);
+}
+
 /* ---------- Zipfile virtual table insertion helper ---------- */
 
 /*
@@ -670,35 +714,56 @@ static int zipfile_insert_via_vtab(sqlite3 *db, const char *archive_filename, co
 
 /* ---------- xlsx_export function (uses sharedStrings and creates directories) ---------- */
 
-static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value **argv){
+/* Write the workbook for xlsx_export (arguments filename, table1, table2, ...)
+   or, when with_queries is set, for xlsx_export_query (filename, sheet1, sql1, ...).
+*/
+static void export_workbook(sqlite3_context *context, int argc, sqlite3_value **argv, int with_queries){
     sqlite3 *db = sqlite3_context_db_handle(context);
-    if(argc < 2){
+    if(!with_queries && argc < 2){
         sqlite3_result_error(context, "Usage: xlsx_export(filename, table1, table2, ...)", -1);
         return;
     }
+    if(with_queries && (argc < 3 || argc % 2 == 0)){
+        sqlite3_result_error(context, "Usage: xlsx_export_query(filename, sheet1, sql1, sheet2, sql2, ...)", -1);
+        return;
+    }
     const unsigned char *filename = sqlite3_value_text(argv[0]);
     if(!filename){
         sqlite3_result_error(context, "filename must be a text value", -1);
         return;
     }
 
-    int sheet_count = argc - 1;
+    int step = with_queries ? 2 : 1;
+    int sheet_count = (argc - 1) / step;
+    const char **queries = NULL;
+    if(with_queries){
+        queries = (const char**)malloc(sizeof(char*) * sheet_count);
+        if(!queries){ sqlite3_result_error_nomem(context); return; }
+        for(int i=0;i<sheet_count;i++){
+            queries[i] = (const char*)sqlite3_value_text(argv[2 + i*2]);
+            if(!queries[i]){
+                free(queries);
+                sqlite3_result_error(context, "queries must be text values", -1);
+                return;
+            }
+        }
+    }
     char **raw_table_names = (char**)malloc(sizeof(char*) * sheet_count);
-    if(!raw_table_names){ sqlite3_result_error_nomem(context); return; }
+    if(!raw_table_names){ free(queries); sqlite3_result_error_nomem(context); return; }
     for(int i=0;i<sheet_count;i++){
-        const unsigned char *t = sqlite3_value_text(argv[i+1]);
+        const unsigned char *t = sqlite3_value_text(argv[1 + i*step]);
         raw_table_names[i] = t ? xstrdup((const char*)t) : xstrdup("");
     }
 
     /* Sanitize sheet names */
     char **sheet_names = (char**)malloc(sizeof(char*) * sheet_count);
-    if(!sheet_names){ for(int i=0;i<sheet_count;i++) free(raw_table_names[i]); free(raw_table_names); sqlite3_result_error_nomem(context); return; }
+    if(!sheet_names){ for(int i=0;i<sheet_count;i++) free(raw_table_names[i]); free(raw_table_names); free(queries); sqlite3_result_error_nomem(context); return; }
     for(int i=0;i<sheet_count;i++){
         sheet_names[i] = sanitize_sheet_name(raw_table_names[i], i, sheet_names, i);
         if(!sheet_names[i]){
             for(int j=0;j<=i;j++) if(sheet_names[j]) free(sheet_names[j]);
             for(int j=0;j<sheet_count;j++) free(raw_table_names[j]);
-            free(raw_table_names); free(sheet_names);
+            free(raw_table_names); free(sheet_names); free(queries);
             sqlite3_result_error_nomem(context);
             return;
         }
@@ -716,7 +781,10 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
     if(!worksheets){ rc = SQLITE_NOMEM; goto cleanup_error; }
     for(int i=0;i<sheet_count;i++){
         if(mw_init(&worksheets[i]) != SQLITE_OK){ rc = SQLITE_NOMEM; goto cleanup_error; }
-        rc = build_worksheet_xml_with_sst(db, raw_table_names[i], 1, &shared, &worksheets[i], &pzErrMsg);
+        if(with_queries)
+            rc = build_query_worksheet_xml_with_sst(db, raw_table_names[i], queries[i], 1, &shared, &worksheets[i], &pzErrMsg);
+        else
+            rc = build_worksheet_xml_with_sst(db, raw_table_names[i], 1, &shared, &worksheets[i], &pzErrMsg);
         if(rc != SQLITE_OK){
             goto cleanup_error;
         }
@@ -799,6 +867,7 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
     free(worksheets);
     free(raw_table_names);
     free(sheet_names);
+    free(queries);
     sst_free(&shared);
     sqlite3_result_int(context, 0);
     return;
@@ -818,6 +887,7 @@ cleanup_error:
     }
     if(raw_table_names) free(raw_table_names);
     if(sheet_names) free(sheet_names);
+    free(queries);
     if(sheet_count && worksheets){
         for(int i=0;i<sheet_count;i++) mw_free(&worksheets[i]);
         free(worksheets);
@@ -826,6 +896,16 @@ cleanup_error:
     return;
 }
 
+static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value **argv){
+    export_workbook(context, argc, argv, 0);
+}
+
+/* ---------- xlsx_export_query ---------- */
+
+static void xlsx_export_query_func(sqlite3_context *context, int argc, sqlite3_value **argv){
+    export_workbook(context, argc, argv, 1);
+}
+
 /* ---------- xlsx_export_version ---------- */
 
 static void xlsx_export_version(sqlite3_context *context, int argc, sqlite3_value **argv){
@@ -846,6 +926,11 @@ int sqlite3_xlsxexport_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_rout
         if(pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export: %s", sqlite3_errmsg(db));
         return rc;
     }
+    rc = sqlite3_create_function(db, "xlsx_export_query", -1, SQLITE_UTF8, NULL, xlsx_export_query_func, NULL, NULL);
+    if(rc != SQLITE_OK){
+        if(pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export_query: %s", sqlite3_errmsg(db));
+        return rc;
+    }
     rc = sqlite3_create_function(db, "xlsx_export_version", 0, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, xlsx_export_version, NULL, NULL);
     if(rc != SQLITE_OK){
         if(pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export_version: %s", sqlite3_errmsg(db));
@@ -23,6 +23,7 @@ SELECT xlsx_import('filename.xlsx');  -- Import all sheets
 SELECT xlsx_import('filename.xlsx', 'Sheet1', 'Sheet2');  -- Import specific sheets by name
 SELECT xlsx_import('filename.xlsx', 1, 3);  -- Import sheets by number (1-based)
 SELECT xlsx_import('filename.xlsx', 'Sheet1', 2);  -- Mix of names and numbers
+SELECT xlsx_import(readfile('filename.xlsx'));  -- The file as a BLOB
 SELECT xlsx_import_version();
 */
 
@@ -42,6 +43,9 @@ Limitations and notes:
 #include <sqlite3ext.h>
 SQLITE_EXTENSION_INIT1
 
+#include "../common/xlsx_tags.h"
+#include "../common/xlsx_zipfile.h"
+
 /* Version function */
 static void xlsx_import_version(sqlite3_context *context, int argc, sqlite3_value **argv){
     (void)argc; (void)argv;
@@ -138,17 +142,6 @@ static void sstrings_free(sstrings *ss){
     ss->items = NULL; ss->n = ss->cap = 0;
 }
 
-/* Helper: convert Excel column letters to 0-based index (A->0, B->1, Z->25, AA->26) */
-static int colname_to_index(const char *col){
-    int idx = 0;
-    for(const char *p = col; *p; ++p){
-        if(*p >= 'A' && *p <= 'Z') idx = idx*26 + (*p - 'A' + 1);
-        else if(*p >= 'a' && *p <= 'z') idx = idx*26 + (*p - 'a' + 1);
-        else break;
-    }
-    return idx - 1;
-}
-
 /* --- Expat parsers --- */
 
 /* Parser for sharedStrings.xml */
@@ -163,20 +156,22 @@ typedef struct {
 static void ss_start(void *userData, const XML_Char *name, const XML_Char **atts){
     (void)atts;
     ss_parser_ctx *ctx = (ss_parser_ctx*)userData;
-    if(strcmp(name, "si")==0){
+    int tag = xlsx_tag(name);
+    if(tag == XLSX_TAG_SI){
         ctx->in_si = 1;
         ctx->cur.len = 0;
         ctx->cur.buf[0] = '\0';
-    } else if(strcmp(name, "t")==0 && ctx->in_si){
+    } else if(tag == XLSX_TAG_T && ctx->in_si){
         ctx->in_t = 1;
     }
 }
 static void ss_end(void *userData, const XML_Char *name){
     ss_parser_ctx *ctx = (ss_parser_ctx*)userData;
-    if(strcmp(name, "si")==0){
+    int tag = xlsx_tag(name);
+    if(tag == XLSX_TAG_SI){
         ctx->in_si = 0;
         sstrings_add(ctx->ss, ctx->cur.buf);
-    } else if(strcmp(name, "t")==0){
+    } else if(tag == XLSX_TAG_T){
         ctx->in_t = 0;
     }
 }
@@ -239,8 +234,8 @@ typedef struct {
     int in_t;
     int in_is;
     int in_c;
-    char cur_cell_ref[64];
-    char cur_cell_type[32];
+    int cur_col;        /* 0-based column of the current cell */
+    char cur_cell_type; /* xlsx_cell_type() code, 'n' by default */
     strbuf cur_text;
     int current_row;
     char **rowbuf;
@@ -261,10 +256,14 @@ static void ensure_rowcap(sheet_parser_ctx *ctx, size_t cols){
 
 static void sheet_start(void *userData, const XML_Char *name, const XML_Char **atts){
     sheet_parser_ctx *ctx = (sheet_parser_ctx*)userData;
-    if(strcmp(name, "row")==0){
+    int tag = xlsx_tag(name);
+    if(tag == XLSX_TAG_ROW){
         ctx->current_row = 0;
         for(int i=0; atts[i]; i+=2){
-            if(strcmp(atts[i], "r")==0) ctx->current_row = atoi(atts[i+1]);
+            if(xlsx_attr(atts[i]) == XLSX_ATTR_R){
+                int r = xlsx_parse_uint(atts[i+1]);
+                ctx->current_row = r > 0 ? r : 0;
+            }
         }
         if(ctx->rowbuf){
             for(size_t i=0;i<ctx->rowcap;i++){
@@ -272,40 +271,38 @@ static void sheet_start(void *userData, const XML_Char *name, const XML_Char **a
             }
         }
         ctx->maxcol = 0;
-    } else if(strcmp(name, "c")==0){
+    } else if(tag == XLSX_TAG_C){
         ctx->in_c = 1;
-        ctx->cur_cell_ref[0] = '\0';
-        ctx->cur_cell_type[0] = '\0';
+        ctx->cur_col = 0;
+        ctx->cur_cell_type = 'n';
         for(int i=0; atts[i]; i+=2){
-            if(strcmp(atts[i], "r")==0) strncpy(ctx->cur_cell_ref, atts[i+1], sizeof(ctx->cur_cell_ref)-1);
-            else if(strcmp(atts[i], "t")==0) strncpy(ctx->cur_cell_type, atts[i+1], sizeof(ctx->cur_cell_type)-1);
+            int attr = xlsx_attr(atts[i]);
+            if(attr == XLSX_ATTR_R){
+                int col = xlsx_parse_ref(atts[i+1], NULL);
+                ctx->cur_col = col > 0 ? col - 1 : 0;
+            } else if(attr == XLSX_ATTR_T){
+                ctx->cur_cell_type = xlsx_cell_type(atts[i+1]);
+            }
         }
         ctx->cur_text.len = 0;
         ctx->cur_text.buf[0] = '\0';
-    } else if(strcmp(name, "v")==0){
+    } else if(tag == XLSX_TAG_V){
         ctx->in_v = 1;
-    } else if(strcmp(name, "is")==0){
+    } else if(tag == XLSX_TAG_IS){
         ctx->in_is = 1;
-    } else if(strcmp(name, "t")==0){
+    } else if(tag == XLSX_TAG_T){
         ctx->in_t = 1;
     }
 }
 static void sheet_end(void *userData, const XML_Char *name){
     sheet_parser_ctx *ctx = (sheet_parser_ctx*)userData;
-    if(strcmp(name, "c")==0){
-        char colletters[32] = {0};
-        int i=0;
-        while(ctx->cur_cell_ref[i] && !isdigit((unsigned char)ctx->cur_cell_ref[i]) && i < (int)sizeof(colletters)-1){
-            colletters[i] = ctx->cur_cell_ref[i];
-            i++;
-        }
-        colletters[i] = '\0';
-        int colidx = colname_to_index(colletters);
-        if(colidx < 0) colidx = 0;
+    int tag = xlsx_tag(name);
+    if(tag == XLSX_TAG_C){
+        int colidx = ctx->cur_col;
         ensure_rowcap(ctx, (size_t)colidx+1);
         char *val = NULL;
-        if(ctx->cur_cell_type[0] == 's' && ctx->cur_text.len > 0){
-            int idx = atoi(ctx->cur_text.buf);
+        if(ctx->cur_cell_type == 's' && ctx->cur_text.len > 0){
+            int idx = xlsx_parse_uint(ctx->cur_text.buf);
             if(idx >= 0 && (size_t)idx < ctx->shared->n){
                 val = strdup(ctx->shared->items[idx]);
             } else {
@@ -326,17 +323,17 @@ static void sheet_end(void *userData, const XML_Char *name){
         ctx->in_is = 0;
         ctx->cur_text.len = 0;
         ctx->cur_text.buf[0] = '\0';
-    } else if(strcmp(name, "row")==0){
+    } else if(tag == XLSX_TAG_ROW){
         ctx->emit_row(ctx->current_row, ctx->rowbuf, ctx->maxcol, ctx->emit_udata);
         for(size_t i=0;i<ctx->rowcap;i++){
             if(ctx->rowbuf[i]) { free(ctx->rowbuf[i]); ctx->rowbuf[i] = NULL; }
         }
         ctx->maxcol = 0;
-    } else if(strcmp(name, "v")==0){
+    } else if(tag == XLSX_TAG_V){
         ctx->in_v = 0;
-    } else if(strcmp(name, "t")==0){
+    } else if(tag == XLSX_TAG_T){
         ctx->in_t = 0;
-    } else if(strcmp(name, "is")==0){
+    } else if(tag == XLSX_TAG_IS){
         ctx->in_is = 0;
     }
 }
@@ -348,25 +345,17 @@ static void sheet_char(void *userData, const XML_Char *s, int len){
 }
 
 /* Helper: read a file from the .xlsx archive using the SQLite zipfile extension.
-   This function queries the zipfile virtual table for the given archive and internal name.
    It returns a malloc'd null-terminated buffer (caller must free) and optionally sets out_len.
    If the file is not found, returns NULL.
 */
-static char *read_zip_file_sqlite(sqlite3 *db, const char *archive, const char *internal_name, size_t *out_len){
-    if(!db || !archive || !internal_name) return NULL;
-    const char *sql =
-        "SELECT data FROM zipfile(?) WHERE name = ? LIMIT 1;";
-    sqlite3_stmt *stmt = NULL;
-    if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK){
-        return NULL;
-    }
-    sqlite3_bind_text(stmt, 1, archive, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, internal_name, -1, SQLITE_TRANSIENT);
+static char *read_zip_file_sqlite(XlsxZipReader *zr, const char *internal_name, size_t *out_len){
+    if(!zr->stmt || !internal_name) return NULL;
+    sqlite3_bind_text(zr->stmt, 2, internal_name, -1, SQLITE_TRANSIENT);
     char *result = NULL;
-    int rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(zr->stmt);
     if(rc == SQLITE_ROW){
-        const void *blob = sqlite3_column_blob(stmt, 0);
-        int bytes = sqlite3_column_bytes(stmt, 0);
+        const void *blob = sqlite3_column_blob(zr->stmt, 0);
+        int bytes = sqlite3_column_bytes(zr->stmt, 0);
         if(blob && bytes > 0){
             result = (char*)malloc((size_t)bytes + 1);
             memcpy(result, blob, (size_t)bytes);
@@ -378,7 +367,7 @@ static char *read_zip_file_sqlite(sqlite3 *db, const char *archive, const char *
             if(out_len) *out_len = 0;
         }
     }
-    sqlite3_finalize(stmt);
+    sqlite3_reset(zr->stmt);
     return result;
 }
 
@@ -462,19 +451,25 @@ static int should_import_sheet(const wb_parser_ctx *wb, size_t si, int sheetId,
    New: accepts selectors array (sheet names or integers as strings) and selector_count.
    Uses quoting for table and column identifiers instead of sanitization.
 */
-static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **selectors, int selector_count, sqlite3_context *ctx){
-    if(!db || !filename){
+static int import_xlsx_to_db(sqlite3 *db, sqlite3_value *archive, const char **selectors, int selector_count, sqlite3_context *ctx){
+    if(!db || !archive){
         sqlite3_result_error(ctx, "Invalid arguments to import_xlsx_to_db", -1);
         return SQLITE_ERROR;
     }
     int tables_created = 0;
 
+    XlsxZipReader zr;
+    if(xlsx_zip_reader_open(db, archive, &zr) != SQLITE_OK){
+        sqlite3_result_error(ctx, sqlite3_errmsg(db), -1);
+        return SQLITE_ERROR;
+    }
+
     /* 1) Read sharedStrings.xml if present */
     sstrings ss;
     sstrings_init(&ss);
 
     size_t tmp_len = 0;
-    char *shared_buf = read_zip_file_sqlite(db, filename, "xl/sharedStrings.xml", &tmp_len);
+    char *shared_buf = read_zip_file_sqlite(&zr, "xl/sharedStrings.xml", &tmp_len);
     if(shared_buf){
         ss_parser_ctx sctx;
         sctx.parser = XML_ParserCreate(NULL);
@@ -495,7 +490,7 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
     /* 2) Read workbook.xml to get sheet names and sheetIds */
     wb_parser_ctx wb;
     wb_init(&wb);
-    char *wb_buf = read_zip_file_sqlite(db, filename, "xl/workbook.xml", &tmp_len);
+    char *wb_buf = read_zip_file_sqlite(&zr, "xl/workbook.xml", &tmp_len);
     if(wb_buf){
         XML_Parser p = XML_ParserCreate(NULL);
         XML_SetUserData(p, &wb);
@@ -506,6 +501,7 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
         free(wb_buf);
     } else {
         sqlite3_result_error(ctx, "xl/workbook.xml not found in archive (zipfile)", -1);
+        xlsx_zip_reader_close(&zr);
         sstrings_free(&ss);
         wb_free(&wb);
         return SQLITE_ERROR;
@@ -523,11 +519,11 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
         char sheet_internal[256];
         snprintf(sheet_internal, sizeof(sheet_internal), "xl/worksheets/sheet%d.xml", sheetId);
 
-        char *sheet_buf = read_zip_file_sqlite(db, filename, sheet_internal, &tmp_len);
+        char *sheet_buf = read_zip_file_sqlite(&zr, sheet_internal, &tmp_len);
         if(!sheet_buf){
             /* fallback to sequential index */
             snprintf(sheet_internal, sizeof(sheet_internal), "xl/worksheets/sheet%lu.xml", (unsigned long)(si + 1));
-            sheet_buf = read_zip_file_sqlite(db, filename, sheet_internal, &tmp_len);
+            sheet_buf = read_zip_file_sqlite(&zr, sheet_internal, &tmp_len);
             if(!sheet_buf){
                 /* skip missing sheet */
                 continue;
@@ -541,8 +537,8 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
         sp.parser = XML_ParserCreate(NULL);
         sp.shared = &ss;
         sp.in_v = sp.in_t = sp.in_is = sp.in_c = 0;
-        sp.cur_cell_ref[0] = '\0';
-        sp.cur_cell_type[0] = '\0';
+        sp.cur_col = 0;
+        sp.cur_cell_type = 'n';
         sb_init(&sp.cur_text);
         sp.rowbuf = NULL;
         sp.rowcap = 0;
@@ -700,6 +696,7 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
         tables_created++;
     }
 
+    xlsx_zip_reader_close(&zr);
     sstrings_free(&ss);
     wb_free(&wb);
 
@@ -708,6 +705,7 @@ static int import_xlsx_to_db(sqlite3 *db, const char *filename, const char **sel
 }
 
 /* SQLite user function wrapper: xlsx_import(filename, [sheet1, sheet2, ...])
+   - filename may also be a BLOB holding the XLSX file, e.g. readfile('file.xlsx').
    - If only filename is provided, import all sheets.
    - Additional parameters may be sheet names (string) or integers (sheet number or sheetId).
    - Example:
@@ -720,8 +718,7 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
         sqlite3_result_error(context, "xlsx_import requires a filename argument", -1);
         return;
     }
-    const unsigned char *fname = sqlite3_value_text(argv[0]);
-    if(!fname){
+    if(sqlite3_value_type(argv[0]) != SQLITE_BLOB && !sqlite3_value_text(argv[0])){
         sqlite3_result_error(context, "Invalid filename", -1);
         return;
     }
@@ -744,7 +741,7 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
     }
 
     /* Call main importer with selectors */
-    import_xlsx_to_db(db, (const char*)fname, selectors, selector_count, context);
+    import_xlsx_to_db(db, argv[0], selectors, selector_count, context);
 
     /* free selectors */
     if(selectors){
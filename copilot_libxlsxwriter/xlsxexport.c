@@ -22,6 +22,7 @@ Build notes:
     .load ./xlsxexport
 - Usage:
     SELECT xlsx_export('out.xlsx', 'table1', 'table2', 'table3');
+    SELECT xlsx_export_query('out.xlsx', 'Paid', 'SELECT * FROM orders WHERE paid');
     SELECT xlsx_export_version();
 */
 
@@ -156,15 +157,21 @@ static char **list_all_tables(sqlite3 *db, int *out_count, char **err_msg) {
 /* Main function: xlsx_export(filename TEXT, table1 TEXT, table2 TEXT, ...)
    - filename: output XLSX file path (required)
    - table names: one or more table names (arguments 2..N). Each must be non-NULL.
+   With with_queries set it implements xlsx_export_query(filename, sheet1, sql1, ...)
+   instead, where each sheet name is followed by a read-only SELECT for its rows.
    Returns INTEGER 0 on success, or raises an SQLite error on failure.
 */
-static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+static void export_workbook(sqlite3_context *context, int argc, sqlite3_value **argv, int with_queries) {
     sqlite3 *db = sqlite3_context_db_handle(context);
 
-    if (argc < 2) {
+    if (!with_queries && argc < 2) {
         sqlite3_result_error(context, "xlsx_export: requires at least filename and one table name", -1);
         return;
     }
+    if (with_queries && (argc < 3 || argc % 2 == 0)) {
+        sqlite3_result_error(context, "xlsx_export_query: requires filename and sheet name, query pairs", -1);
+        return;
+    }
 
     if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
         sqlite3_result_error(context, "xlsx_export: filename must not be NULL", -1);
@@ -172,15 +179,22 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
     }
     const char *filename = (const char*)sqlite3_value_text(argv[0]);
 
-    /* Collect table names from argv[1]..argv[argc-1] */
-    int table_count = argc - 1;
+    /* Collect table names from argv[1]..argv[argc-1], or every other argument with queries */
+    int step = with_queries ? 2 : 1;
+    int table_count = (argc - 1) / step;
     char **tables = malloc(sizeof(char*) * table_count);
     if (!tables) {
         sqlite3_result_error(context, "xlsx_export: memory allocation failed", -1);
         return;
     }
     for (int i = 0; i < table_count; ++i) {
-        sqlite3_value *v = argv[i + 1];
+        sqlite3_value *v = argv[1 + i * step];
+        if (with_queries && sqlite3_value_type(argv[2 + i * 2]) == SQLITE_NULL) {
+            for (int j = 0; j < i; ++j) free(tables[j]);
+            free(tables);
+            sqlite3_result_error(context, "xlsx_export_query: queries must not be NULL", -1);
+            return;
+        }
         if (!v || sqlite3_value_type(v) == SQLITE_NULL) {
             /* free allocated names so far */
             for (int j = 0; j < i; ++j) free(tables[j]);
@@ -247,9 +261,13 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
             return;
         }
 
-        /* Prepare SELECT * FROM "table" */
+        /* Prepare SELECT * FROM "table", or the sheet's query */
         char *sql = NULL;
-        if (asprintf(&sql, "SELECT * FROM \"%s\";", tbl) == -1) sql = NULL;
+        if (with_queries) {
+            sql = strdup((const char*)sqlite3_value_text(argv[2 + t * 2]));
+        } else if (asprintf(&sql, "SELECT * FROM \"%s\";", tbl) == -1) {
+            sql = NULL;
+        }
         if (!sql) {
             workbook_close(workbook);
             sqlite3_result_error(context, "xlsx_export: memory allocation failed", -1);
@@ -259,15 +277,30 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
         }
 
         sqlite3_stmt *stmt = NULL;
-        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        free(sql);
+        const char *tail = NULL;
+        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
         if (rc != SQLITE_OK) {
+            free(sql);
             workbook_close(workbook);
             sqlite3_result_error(context, sqlite3_errmsg(db), -1);
             for (int i = 0; i < table_count; ++i) { free(tables[i]); free(sheet_names[i]); }
             free(tables); free(sheet_names);
             return;
         }
+        /* A query must be a single read-only statement */
+        if (with_queries) {
+            while (tail && (isspace((unsigned char)*tail) || *tail == ';')) tail++;
+            if (!stmt || (tail && *tail) || !sqlite3_stmt_readonly(stmt)) {
+                free(sql);
+                sqlite3_finalize(stmt);
+                workbook_close(workbook);
+                sqlite3_result_error(context, "xlsx_export_query: each query must be a single read-only statement", -1);
+                for (int i = 0; i < table_count; ++i) { free(tables[i]); free(sheet_names[i]); }
+                free(tables); free(sheet_names);
+                return;
+            }
+        }
+        free(sql);
 
         /* Write header row */
         int col_count = sqlite3_column_count(stmt);
@@ -338,6 +371,15 @@ static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value *
     sqlite3_result_int(context, 0);
 }
 
+static void xlsx_export_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    export_workbook(context, argc, argv, 0);
+}
+
+/* xlsx_export_query(filename TEXT, sheet1 TEXT, sql1 TEXT, ...) -> 0 */
+static void xlsx_export_query_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    export_workbook(context, argc, argv, 1);
+}
+
 /* xlsx_export_version() -> TEXT */
 static void xlsx_export_version_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
     (void)argc; (void)argv;
@@ -359,6 +401,12 @@ int sqlite3_xlsxexport_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_rout
         if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export: %s", sqlite3_errmsg(db));
         return rc;
     }
+    /* Register xlsx_export_query. Arguments: filename, sheet1, sql1, sheet2, sql2, ... */
+    rc = sqlite3_create_function(db, "xlsx_export_query", -1, SQLITE_UTF8, NULL, xlsx_export_query_func, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export_query: %s", sqlite3_errmsg(db));
+        return rc;
+    }
     rc = sqlite3_create_function(db, "xlsx_export_version", 0, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, xlsx_export_version_func, NULL, NULL);
     if (rc != SQLITE_OK) {
         if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to register xlsx_export_version: %s", sqlite3_errmsg(db));
@@ -126,6 +126,38 @@ static void int_to_col(int n, char *buf) {
     buf[i] = '\0';
 }
 
+/* Append a bold header cell for column col (0-based) of row 1 */
+static void append_header_cell(StrBuf *sb, int col, const char *name) {
+    char col_ref[16];
+    int_to_col(col, col_ref);
+    
+    char cell_open[64];
+    /* s=1 style applies bold */
+    warn_snprintf(cell_open, sizeof(cell_open), "      <c r=\"%s1\" t=\"inlineStr\" s=\"1\"><is><t>", col_ref);
+    strbuf_append(sb, cell_open, -1);
+    strbuf_append_xml_escaped(sb, name ? name : "");
+    strbuf_append(sb, "</t></is></c>\n", -1);
+}
+
+/* Check that sql is a single read-only statement.
+   Returns NULL if it is, else an error message to be freed with sqlite3_free().
+*/
+static char *check_sheet_query(sqlite3 *db, const char *sheet, const char *sql) {
+    sqlite3_stmt *stmt = NULL;
+    const char *tail = NULL;
+    char *err = NULL;
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, &tail) != SQLITE_OK) {
+        return sqlite3_mprintf("Failed to prepare query for sheet '%s': %s", sheet, sqlite3_errmsg(db));
+    }
+    while (tail && (isspace((unsigned char)*tail) || *tail == ';')) tail++;
+    if (!stmt || (tail && *tail) || !sqlite3_stmt_readonly(stmt)) {
+        err = sqlite3_mprintf("Query for sheet '%s' must be a single read-only statement", sheet);
+    }
+    sqlite3_finalize(stmt);
+    return err;
+}
+
 /* Helper to write file to zipfile table */
 static int write_to_zip(sqlite3 *db, const char *zip_table, const char *filename, const char *data, int len) {
     sqlite3_stmt *stmt;
@@ -218,16 +250,48 @@ static void generate_workbook_rels(StrBuf *sb, int num_sheets) {
     strbuf_append(sb, "</Relationships>", -1);
 }
 
-/* Main Export Function */
-static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv) {
+/* Main Export Function, for xlsx_export and (with_queries) xlsx_export_query */
+static void export_workbook(sqlite3_context *context, int argc, sqlite3_value **argv, int with_queries) {
     if (argc < 1) {
         sqlite3_result_error(context, "Usage: xlsx_export(filename [, table_name1, ...])", -1);
         return;
     }
+    if (with_queries && (argc < 3 || argc % 2 == 0)) {
+        sqlite3_result_error(context, "Usage: xlsx_export_query(filename, sheet_name1, sql1 [, ...])", -1);
+        return;
+    }
 
     const char *filename = (const char *)sqlite3_value_text(argv[0]);
     sqlite3 *db = sqlite3_context_db_handle(context);
     
+    /* Check the queries before the archive is created */
+    const char **queries = NULL;
+    if (with_queries) {
+        int q, num_queries = (argc - 1) / 2;
+        queries = sqlite3_malloc(num_queries * sizeof(char*));
+        if (!queries) {
+            sqlite3_result_error_nomem(context);
+            return;
+        }
+        for (q = 0; q < num_queries; q++) {
+            const char *sheet = (const char *)sqlite3_value_text(argv[1 + 2*q]);
+            char *err;
+            queries[q] = (const char *)sqlite3_value_text(argv[2 + 2*q]);
+            if (!sheet) sheet = "";
+            if (queries[q]) {
+                err = check_sheet_query(db, sheet, queries[q]);
+            } else {
+                err = sqlite3_mprintf("Query for sheet '%s' must be text", sheet);
+            }
+            if (err) {
+                sqlite3_result_error(context, err, -1);
+                sqlite3_free(err);
+                sqlite3_free(queries);
+                return;
+            }
+        }
+    }
+    
     char zip_table_name[64];
     /* Create a unique temp table name */
     warn_snprintf(zip_table_name, sizeof(zip_table_name), "temp_xlsx_zip_%p", (void*)filename);
@@ -243,6 +307,7 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
     sqlite3_free(sql);
     
     if (rc != SQLITE_OK) {
+        sqlite3_free(queries);
         sqlite3_result_error(context, "Failed to create internal zipfile table. Is zipfile extension loaded?", -1);
         return;
     }
@@ -280,13 +345,13 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
             }
         }
     } else {
-        /* Export specified tables */
-        num_sheets = argc - 1;
+        /* Export specified tables, or sheet name and query pairs */
+        num_sheets = queries ? (argc - 1) / 2 : argc - 1;
         sheet_names = sqlite3_malloc(num_sheets * sizeof(char*));
         table_names = sqlite3_malloc(num_sheets * sizeof(char*));
         
         for (t = 0; t < num_sheets; t++) {
-            const char *tbl = (const char *)sqlite3_value_text(argv[t+1]);
+            const char *tbl = (const char *)sqlite3_value_text(argv[queries ? 1 + 2*t : t+1]);
             table_names[t] = sqlite3_mprintf("%s", tbl);
             sheet_names[t] = sanitize_sheet_name(tbl);
         }
@@ -298,6 +363,7 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
         sql = sqlite3_mprintf("DROP TABLE \"%w\"", zip_table_name);
         sqlite3_exec(db, sql, NULL, NULL, NULL);
         sqlite3_free(sql);
+        sqlite3_free(queries);
         sqlite3_result_error(context, "No tables to export", -1);
         return;
     }
@@ -346,53 +412,56 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
         strbuf_append(&sb, "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">\n", -1);
         strbuf_append(&sb, "  <sheetData>\n", -1);
         
-        /* Get Columns */
         sqlite3_stmt *stmt;
-        sql = sqlite3_mprintf("PRAGMA table_info(\"%w\")", tbl_in);
-        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        sqlite3_free(sql);
-        
         int col_count = 0;
         char **cols = NULL;
         
-        if (rc == SQLITE_OK) {
-             /* Row 1: Header */
-             strbuf_append(&sb, "    <row r=\"1\">\n", -1);
-             
-             while (sqlite3_step(stmt) == SQLITE_ROW) {
-                 const char *cname = (const char *)sqlite3_column_text(stmt, 1);
-                 cols = sqlite3_realloc(cols, (col_count + 1) * sizeof(char*));
-                 cols[col_count] = sqlite3_mprintf("%s", cname);
-                 
-                 char col_ref[16];
-                 int_to_col(col_count, col_ref);
-                 
-                 char cell_open[64];
-                 /* s=1 style applies bold */
-                 warn_snprintf(cell_open, sizeof(cell_open), "      <c r=\"%s1\" t=\"inlineStr\" s=\"1\"><is><t>", col_ref);
-                 strbuf_append(&sb, cell_open, -1);
-                 strbuf_append_xml_escaped(&sb, cname);
-                 strbuf_append(&sb, "</t></is></c>\n", -1);
-                 
-                 col_count++;
-             }
-             strbuf_append(&sb, "    </row>\n", -1);
-             sqlite3_finalize(stmt);
+        if (queries) {
+            /* Query sheet: the header comes from its result columns */
+            rc = sqlite3_prepare_v2(db, queries[t], -1, &stmt, NULL);
+            if (rc == SQLITE_OK) col_count = sqlite3_column_count(stmt);
+            
+            strbuf_append(&sb, "    <row r=\"1\">\n", -1);
+            int c;
+            for (c = 0; c < col_count; c++) {
+                append_header_cell(&sb, c, sqlite3_column_name(stmt, c));
+            }
+            strbuf_append(&sb, "    </row>\n", -1);
         } else {
-             /* Table might not exist */
-             strbuf_append(&sb, "  </sheetData>\n</worksheet>", -1);
-             char path[64];
-             warn_snprintf(path, sizeof(path), "xl/worksheets/sheet%d.xml", t+1);
-             write_to_zip(db, zip_table_name, path, sb.data, (int)sb.len);
-             strbuf_free(&sb);
-             continue;
+            /* Get Columns */
+            sql = sqlite3_mprintf("PRAGMA table_info(\"%w\")", tbl_in);
+            rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+            sqlite3_free(sql);
+            
+            if (rc == SQLITE_OK) {
+                /* Row 1: Header */
+                strbuf_append(&sb, "    <row r=\"1\">\n", -1);
+                
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    const char *cname = (const char *)sqlite3_column_text(stmt, 1);
+                    cols = sqlite3_realloc(cols, (col_count + 1) * sizeof(char*));
+                    cols[col_count] = sqlite3_mprintf("%s", cname);
+                    append_header_cell(&sb, col_count, cname);
+                    col_count++;
+                }
+                strbuf_append(&sb, "    </row>\n", -1);
+                sqlite3_finalize(stmt);
+            } else {
+                /* Table might not exist */
+                strbuf_append(&sb, "  </sheetData>\n</worksheet>", -1);
+                char path[64];
+                warn_snprintf(path, sizeof(path), "xl/worksheets/sheet%d.xml", t+1);
+                write_to_zip(db, zip_table_name, path, sb.data, (int)sb.len);
+                strbuf_free(&sb);
+                continue;
+            }
+            
+            /* Get Data */
+            sql = sqlite3_mprintf("SELECT * FROM \"%w\"", tbl_in);
+            rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+            sqlite3_free(sql);
         }
         
-        /* Get Data */
-        sql = sqlite3_mprintf("SELECT * FROM \"%w\"", tbl_in);
-        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        sqlite3_free(sql);
-        
         int r_idx = 2; /* 1-based, header was 1 */
         while (sqlite3_step(stmt) == SQLITE_ROW) {
             char row_open[32];
@@ -467,7 +536,7 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
         
         /* Cleanup cols */
         int z;
-        for (z = 0; z < col_count; z++) sqlite3_free(cols[z]);
+        for (z = 0; cols && z < col_count; z++) sqlite3_free(cols[z]);
         sqlite3_free(cols);
     }
     
@@ -478,6 +547,7 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
     }
     sqlite3_free(sheet_names);
     sqlite3_free(table_names);
+    sqlite3_free(queries);
     
     /* Close zip (DROP TABLE) */
     sql = sqlite3_mprintf("DROP TABLE \"%w\"", zip_table_name);
@@ -485,6 +555,15 @@ static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv
     sqlite3_free(sql);
 }
 
+static void xlsx_export(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    export_workbook(context, argc, argv, 0);
+}
+
+/* xlsx_export_query(filename, sheet_name1, sql1 [, sheet_name2, sql2, ...]) */
+static void xlsx_export_query(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    export_workbook(context, argc, argv, 1);
+}
+
 /* Version Function */
 static void xlsx_export_version(sqlite3_context *context, int argc, sqlite3_value **argv) {
     (void)argc; (void)argv;
@@ -501,6 +580,9 @@ int sqlite3_xlsxexport_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_rout
     (void)pzErrMsg;
     
     rc = sqlite3_create_function(db, "xlsx_export", -1, SQLITE_UTF8, NULL, xlsx_export, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "xlsx_export_query", -1, SQLITE_UTF8, NULL, xlsx_export_query, NULL, NULL);
+    }
     if (rc == SQLITE_OK) {
         rc = sqlite3_create_function(db, "xlsx_export_version", 0, SQLITE_UTF8, NULL, xlsx_export_version, NULL, NULL);
     }
@@ -27,6 +27,9 @@ SQLITE_EXTENSION_INIT1
 #include <string.h>
 #include <ctype.h>
 
+#include "../common/xlsx_tags.h"
+#include "../common/xlsx_zipfile.h"
+
 /* String Buffer Helper */
 typedef struct {
     char *data;
@@ -70,7 +73,7 @@ typedef struct {
 static void shared_strings_start(void *userData, const char *name, const char **atts) {
     SharedStrings *ss = (SharedStrings *)userData;
     (void)atts;
-    if (strcmp(name, "t") == 0) {
+    if (xlsx_tag(name) == XLSX_TAG_T) {
         ss->in_t_tag = 1;
         strbuf_init(&ss->current_str);
     }
@@ -78,7 +81,7 @@ static void shared_strings_start(void *userData, const char *name, const char **
 
 static void shared_strings_end(void *userData, const char *name) {
     SharedStrings *ss = (SharedStrings *)userData;
-    if (strcmp(name, "t") == 0) {
+    if (xlsx_tag(name) == XLSX_TAG_T) {
         ss->in_t_tag = 0;
         if (ss->count == ss->cap) {
             ss->cap = ss->cap ? ss->cap * 2 : 1024;
@@ -95,28 +98,6 @@ static void shared_strings_char(void *userData, const XML_Char *s, int len) {
     }
 }
 
-/* Base-26 Column Conversion */
-static int col_to_int(const char *col) {
-    int res = 0;
-    while (*col && isalpha(*col)) {
-        res = res * 26 + (toupper(*col) - 'A' + 1);
-        col++;
-    }
-    return res;
-}
-
-static void extract_col_row(const char *ref, int *col, int *row) {
-    const char *p = ref;
-    while (*p && isalpha(*p)) p++;
-    size_t len = p - ref;
-    char c_part[16];
-    if (len >= sizeof(c_part)) len = sizeof(c_part) - 1;
-    memcpy(c_part, ref, len);
-    c_part[len] = '\0';
-    *col = col_to_int(c_part);
-    *row = atoi(p);
-}
-
 /* Workbook / Sheets Info */
 typedef struct {
     char *name;
@@ -174,7 +155,7 @@ typedef struct {
     int in_v;
     int in_t; /* inlineStr value */
     char col_ref[16];
-    char cell_type[16]; /* "s", "inlineStr", etc. */
+    char cell_type; /* xlsx_cell_type(): 's', 'i' (inlineStr), etc. */
     StrBuf cell_val;
     
     /* SQL generation */
@@ -187,15 +168,16 @@ typedef struct {
 static void sheet_start(void *userData, const char *name, const char **atts) {
     SheetCtx *ctx = (SheetCtx *)userData;
     int i;
+    int tag = xlsx_tag(name);
     
-    if (strcmp(name, "row") == 0) {
+    if (tag == XLSX_TAG_ROW) {
         ctx->in_row = 1;
         const char *r_attr = NULL;
         for (i = 0; atts[i]; i += 2) {
-            if (strcmp(atts[i], "r") == 0) r_attr = atts[i+1];
+            if (xlsx_attr(atts[i]) == XLSX_ATTR_R) r_attr = atts[i+1];
         }
-        if (r_attr) ctx->current_row = atoi(r_attr);
-        ctx->current_col = 0; /* Convert 1..N to 0..N-1? No, col_to_int returns 1-based */
+        if (r_attr) ctx->current_row = xlsx_parse_uint(r_attr);
+        ctx->current_col = 0; /* Convert 1..N to 0..N-1? No, xlsx_parse_ref returns 1-based */
         
         if (ctx->header_row_processed) {
             strbuf_init(&ctx->sql_buf);
@@ -203,13 +185,13 @@ static void sheet_start(void *userData, const char *name, const char **atts) {
             strbuf_append(&ctx->sql_buf, ctx->table_name, -1);
             strbuf_append(&ctx->sql_buf, "\" VALUES (", -1);
         }
-    } else if (strcmp(name, "c") == 0) {
+    } else if (tag == XLSX_TAG_C) {
         ctx->in_c = 1;
-        ctx->cell_type[0] = '\0';
+        ctx->cell_type = 'n';
         for (i = 0; atts[i]; i += 2) {
-            if (strcmp(atts[i], "r") == 0) {
-                int c, r;
-                extract_col_row(atts[i+1], &c, &r);
+            int attr = xlsx_attr(atts[i]);
+            if (attr == XLSX_ATTR_R) {
+                int c = xlsx_parse_ref(atts[i+1], NULL);
                 /* Calculate gap */
                 /* If new row, current_col is 0. If data is B2 (col 2), gap is 1 (A). */
                 /* But wait, if header row processed, we need to fill gaps with NULL in INSERT */
@@ -229,13 +211,13 @@ static void sheet_start(void *userData, const char *name, const char **atts) {
                 }
                 ctx->current_col = c;
             }
-            if (strcmp(atts[i], "t") == 0) strncpy(ctx->cell_type, atts[i+1], 15);
+            if (attr == XLSX_ATTR_T) ctx->cell_type = xlsx_cell_type(atts[i+1]);
         }
         strbuf_init(&ctx->cell_val);
-    } else if (strcmp(name, "v") == 0 || strcmp(name, "t") == 0) { 
+    } else if (tag == XLSX_TAG_V || tag == XLSX_TAG_T) { 
         /* 'v' for value, 't' can be used inside inlineStr */
-        if (strcmp(name, "v") == 0) ctx->in_v = 1;
-        if (strcmp(name, "t") == 0 && strcmp(ctx->cell_type, "inlineStr") == 0) ctx->in_t = 1;
+        if (tag == XLSX_TAG_V) ctx->in_v = 1;
+        if (tag == XLSX_TAG_T && ctx->cell_type == 'i') ctx->in_t = 1;
     }
 }
 
@@ -248,22 +230,23 @@ static void sheet_char(void *userData, const XML_Char *s, int len) {
 
 static void sheet_end(void *userData, const char *name) {
     SheetCtx *ctx = (SheetCtx *)userData;
+    int tag = xlsx_tag(name);
     
-    if (strcmp(name, "v") == 0) ctx->in_v = 0;
-    else if (strcmp(name, "t") == 0) ctx->in_t = 0;
-    else if (strcmp(name, "c") == 0) {
+    if (tag == XLSX_TAG_V) ctx->in_v = 0;
+    else if (tag == XLSX_TAG_T) ctx->in_t = 0;
+    else if (tag == XLSX_TAG_C) {
         ctx->in_c = 0;
         char *val = ctx->cell_val.data; /* can be NULL */
         char *final_val = NULL;
 
         if (val) {
-             if (strcmp(ctx->cell_type, "s") == 0) {
+             if (ctx->cell_type == 's') {
                  /* Shared string index */
-                 int idx = atoi(val);
+                 int idx = xlsx_parse_uint(val);
                  if (ctx->ss && idx >= 0 && idx < ctx->ss->count) {
                      final_val = ctx->ss->strings[idx];
                  }
-             } else if (strcmp(ctx->cell_type, "inlineStr") == 0) {
+             } else if (ctx->cell_type == 'i') {
                  final_val = val;
              } else {
                  final_val = val; /* Number or other */
@@ -334,7 +317,7 @@ static void sheet_end(void *userData, const char *name) {
         }
         
         strbuf_free(&ctx->cell_val);
-    } else if (strcmp(name, "row") == 0) {
+    } else if (tag == XLSX_TAG_ROW) {
         ctx->in_row = 0;
         if (!ctx->header_row_processed) {
             /* Create table */
@@ -358,14 +341,10 @@ static void sheet_end(void *userData, const char *name) {
 }
 
 /* Helper to get file content from zipfile */
-static int get_zip_content(sqlite3 *db, const char *zipname, const char *filename, void **buf, int *len) {
-    sqlite3_stmt *stmt;
-    //fprintf(stderr, "get_zip_content(%s, %s)\n", zipname, filename);
-    char *sql = "SELECT data FROM zipfile(?) WHERE name = ?";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) return rc;
-    
-    sqlite3_bind_text(stmt, 1, zipname, -1, SQLITE_STATIC);
+static int get_zip_content(XlsxZipReader *zr, const char *filename, void **buf, int *len) {
+    sqlite3_stmt *stmt = zr->stmt;
+    int rc;
+    if (!stmt) return SQLITE_ERROR;
     sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
     
     rc = sqlite3_step(stmt);
@@ -379,8 +358,7 @@ static int get_zip_content(sqlite3 *db, const char *zipname, const char *filenam
     } else {
         rc = SQLITE_ERROR;
     }
-    //fprintf(stderr, "get_zip_content(%d)\n", *len);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return rc;
 }
 
@@ -408,15 +386,19 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
         sqlite3_result_error(context, "xlsx_import requires at least 1 argument", -1);
         return;
     }
-    const char *fname = (const char *)sqlite3_value_text(argv[0]);
     sqlite3 *db = sqlite3_context_db_handle(context);
+    XlsxZipReader zr;
+    if (xlsx_zip_reader_open(db, argv[0], &zr) != SQLITE_OK) {
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+        return;
+    }
     
     /* 1. Parse Shared Strings */
     SharedStrings ss = {0};
     void *xml_data = NULL;
     int xml_len = 0;
     
-    if (get_zip_content(db, fname, "xl/sharedStrings.xml", &xml_data, &xml_len) == SQLITE_OK) {
+    if (get_zip_content(&zr, "xl/sharedStrings.xml", &xml_data, &xml_len) == SQLITE_OK) {
         XML_Parser parser = XML_ParserCreate(NULL);
         XML_SetUserData(parser, &ss);
         XML_SetElementHandler(parser, shared_strings_start, shared_strings_end);
@@ -428,7 +410,7 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
     
     /* 2. Parse Workbook to get sheets */
     Workbook wb = {0};
-    if (get_zip_content(db, fname, "xl/workbook.xml", &xml_data, &xml_len) == SQLITE_OK) {
+    if (get_zip_content(&zr, "xl/workbook.xml", &xml_data, &xml_len) == SQLITE_OK) {
         XML_Parser parser = XML_ParserCreate(NULL);
         XML_SetUserData(parser, &wb);
         XML_SetElementHandler(parser, workbook_start, NULL);
@@ -448,7 +430,7 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
         /* Using the index from loop + 1 matches strict sequential file naming regardless of internal relationship IDs */
         snprintf(sheet_info_path, sizeof(sheet_info_path), "xl/worksheets/sheet%d.xml", i+1);
         
-        if (get_zip_content(db, fname, sheet_info_path, &xml_data, &xml_len) == SQLITE_OK) {
+        if (get_zip_content(&zr, sheet_info_path, &xml_data, &xml_len) == SQLITE_OK) {
             SheetCtx ctx = {0};
             ctx.db = db;
             ctx.table_name = wb.sheets[i].name;
@@ -469,6 +451,7 @@ static void xlsx_import_func(sqlite3_context *context, int argc, sqlite3_value *
     }
     
     /* Cleanup */
+    xlsx_zip_reader_close(&zr);
     for (i = 0; i < ss.count; i++) sqlite3_free(ss.strings[i]);
     sqlite3_free(ss.strings);
     workbook_free(&wb);
@@ -571,13 +554,17 @@ static int sheetnames_filter(sqlite3_vtab_cursor *cur, int idxNum, const char *i
         return SQLITE_ERROR;
     }
     
-    const char *fname = (const char *)sqlite3_value_text(argv[0]);
+    const char *fname = sqlite3_value_type(argv[0]) == SQLITE_BLOB
+        ? "BLOB" : (const char *)sqlite3_value_text(argv[0]);
     if (!fname) return SQLITE_ERROR;
     
     void *xml_data = NULL;
     int xml_len = 0;
     
-    int rc = get_zip_content(vtab->db, fname, "xl/workbook.xml", &xml_data, &xml_len);
+    XlsxZipReader zr;
+    int rc = xlsx_zip_reader_open(vtab->db, argv[0], &zr);
+    if (rc == SQLITE_OK) rc = get_zip_content(&zr, "xl/workbook.xml", &xml_data, &xml_len);
+    xlsx_zip_reader_close(&zr);
     if (rc != SQLITE_OK) {
         vtab->base.zErrMsg = sqlite3_mprintf("Failed to read workbook from %s", fname);
         return SQLITE_ERROR;
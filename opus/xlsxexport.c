@@ -14,24 +14,42 @@ Sanitize the sheet names to conform to Excel restrictions.
 Include as comments the prompts used.
 
 USAGE IN SQLITE:
-    .load zipfile
     .load xlsxexport
     SELECT xlsx_export('output.xlsx');  -- Export all tables in the schema
     SELECT xlsx_export('output.xlsx', 'table1', 'table2', 'table3');
     -- or with a single table:
     SELECT xlsx_export('output.xlsx', 'mytable');
+    -- or with the rows of queries, one sheet per name and query pair:
+    SELECT xlsx_export_query('output.xlsx', 'Paid', 'SELECT * FROM orders WHERE paid');
+    SELECT xlsx_export_config('sharedstrings', 1);  -- Repeated text stored once
+    SELECT xlsx_export_config('threads', 4);  -- Write up to 4 sheets at once
+    SELECT xlsx_export_config('progress', 'my_progress');  -- App-defined function
+    SELECT xlsx_export_config('cache', '/var/cache/reports');  -- Reuse unchanged sheets
+    SELECT xlsx_export_config('compression', 1);  -- Faster, larger worksheets
+    SELECT json_group_object(name, value) FROM xlsx_export_stats;  -- Last export
 
 NOTES:
-    - Requires the zipfile extension to be loaded first
+    - Writes the ZIP container itself (zlib), streaming each worksheet to the
+      output file in 64 KB deflated chunks, so a table is never held in memory
     - Generates XLSX-compliant XML files manually
     - Headers are bold (using styles.xml) with autofilter enabled
     - Warns if cell content exceeds Excel's 32,767 character limit
     - Sheet names are sanitized (max 31 chars, no \ / ? * [ ] :, no "History")
+    - xlsx_export_config() gets or sets per-connection options
+      ("sharedstrings", "sharedstrings_max", "threads", "progress",
+      "progress_rows", "cache", "cache_version", "compression",
+      "compression_parts")
+    - xlsx_export_stats returns the timings and counters of the last export
 */
 
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
 #include "sqlite3ext.h"
 
 SQLITE_EXTENSION_INIT1
@@ -47,6 +65,76 @@ typedef struct ExportWarnings {
     const char *first_truncated_table;
 } ExportWarnings;
 
+/*
+** Timings and counters of one export, returned by xlsx_export_stats.
+** Times are in nanoseconds of the monotonic clock. With several threads
+** generate_ns, deflate_ns and write_ns add up the time of every worker.
+*/
+typedef struct ExportStats {
+    sqlite3_int64 result;           /* SQLite result code of the call */
+    sqlite3_int64 total_ns;         /* The whole call */
+    sqlite3_int64 sheets_ns;        /* Writing the worksheets */
+    sqlite3_int64 generate_ns;      /* Reading rows and building sheet XML */
+    sqlite3_int64 deflate_ns;       /* In deflate(), for every entry */
+    sqlite3_int64 write_ns;         /* Writing the archive and the spools */
+    sqlite3_int64 shared_strings_ns; /* Building xl/sharedStrings.xml */
+    sqlite3_int64 bytes_xml;        /* XML bytes deflated */
+    sqlite3_int64 bytes_written;    /* Size of the archive */
+    sqlite3_int64 shared_strings;   /* Entries of the shared string table */
+    sqlite3_int64 sheets;           /* Worksheets written */
+    sqlite3_int64 sheets_cached;    /* Of which copied from the export cache */
+    sqlite3_int64 rows;             /* Data rows written */
+    sqlite3_int64 cells;            /* Non-empty cells written */
+    sqlite3_int64 threads;          /* Worker threads, 0 for a serial export */
+} ExportStats;
+
+/* Per-connection settings, shared by the SQL functions */
+typedef struct ExportConfig {
+    int shared_strings;      /* Write text cells through xl/sharedStrings.xml */
+    int shared_strings_max;  /* New shared strings allowed per column */
+    int threads;             /* Worker threads for multi-sheet exports */
+    char *progress;          /* SQL function reporting the progress, or NULL */
+    int progress_rows;       /* Rows between two calls of progress */
+    char *cache;             /* Directory of the export cache, or NULL */
+    char *cache_version;     /* Column whose maximum versions a table */
+    int level;               /* zlib level of the sheets and shared strings */
+    int level_parts;         /* zlib level of the other, small parts */
+    ExportStats last;        /* Statistics of the last export */
+} ExportConfig;
+
+#define DEFAULT_PROGRESS_ROWS 100000
+
+/* Destructor of the configuration, run when xlsx_export is unregistered */
+static void export_config_free(void *p) {
+    ExportConfig *cfg = (ExportConfig *)p;
+    sqlite3_free(cfg->progress);
+    sqlite3_free(cfg->cache);
+    sqlite3_free(cfg->cache_version);
+    sqlite3_free(cfg);
+}
+
+/*
+** Progress of one export. Every "every" rows the progress function is
+** called with the sheet name, the rows written so far and the size of the
+** archive; a true result cancels the export. Worker threads cannot call
+** it, they only watch for sqlite3_interrupt() on the caller's connection.
+*/
+typedef struct ExportProgress {
+    sqlite3_stmt *callback;     /* SELECT fn(?1, ?2, ?3, NULL), or NULL */
+    sqlite3 *watch;             /* Connection to check for interrupts, or NULL */
+    int every;                  /* Rows between two calls */
+    sqlite3_int64 rows;         /* Rows written so far, in all the sheets */
+    sqlite3_int64 next;         /* Value of rows at the next call */
+    int interrupted;            /* Cancelled or interrupted */
+} ExportProgress;
+
+/* Monotonic clock in nanoseconds, for the timings of xlsx_export_stats */
+static sqlite3_int64 xlsx_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /* String buffer for dynamic string building */
 typedef struct StrBuf {
     char *str;
@@ -67,21 +155,31 @@ static void strbuf_free(StrBuf *sb) {
     sb->cap = 0;
 }
 
-static int strbuf_append(StrBuf *sb, const char *s) {
-    size_t slen = strlen(s);
-    if (sb->len + slen + 1 > sb->cap) {
+/* Make room for n more bytes and a NUL. Returns 0 on success. */
+static int strbuf_reserve(StrBuf *sb, size_t n) {
+    if (sb->len + n + 1 > sb->cap) {
         size_t newcap = (sb->cap == 0) ? 4096 : sb->cap * 2;
-        while (newcap < sb->len + slen + 1) newcap *= 2;
-        char *newstr = sqlite3_realloc(sb->str, newcap);
+        while (newcap < sb->len + n + 1) newcap *= 2;
+        char *newstr = sqlite3_realloc64(sb->str, newcap);
         if (!newstr) return 1;
         sb->str = newstr;
         sb->cap = newcap;
     }
-    memcpy(sb->str + sb->len, s, slen + 1);
+    return 0;
+}
+
+static int strbuf_append_len(StrBuf *sb, const char *s, size_t slen) {
+    if (strbuf_reserve(sb, slen)) return 1;
+    memcpy(sb->str + sb->len, s, slen);
     sb->len += slen;
+    sb->str[sb->len] = '\0';
     return 0;
 }
 
+static int strbuf_append(StrBuf *sb, const char *s) {
+    return strbuf_append_len(sb, s, strlen(s));
+}
+
 static int strbuf_appendf(StrBuf *sb, const char *fmt, ...) {
     va_list ap;
     char *s;
@@ -112,29 +210,265 @@ static void col_to_letter(int col, char *buf) {
     buf[i] = '\0';
 }
 
-/* Escape XML special characters */
+/*
+** Fast emitters for the worksheet writer
+**
+** The functions below write straight into memory the caller has reserved
+** and return the end of what they wrote, so a cell costs a few stores
+** instead of a vsnprintf() call and a temporary allocation.
+*/
+
+/* Largest output of xml_escape_to() per input byte ("&quot;") */
+#define XML_ESCAPE_MAX 6
+
+/* Room for a cell reference, a number and the markup around them */
+#define CELL_MAX_NUMBER 96
+
+/*
+** XML escaping of each byte: 0 copy, 1 drop (control characters that XML
+** does not allow), or an index into xml_entities.
+*/
+static const unsigned char xml_escape_class[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 2, 0, 0, 0, 3, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 6, 0
+};
+
+static const char *const xml_entities[] = {
+    NULL, NULL, "&quot;", "&amp;", "&apos;", "&lt;", "&gt;"
+};
+
+/*
+** Escape XML special characters of s into p, which must have room for
+** len * XML_ESCAPE_MAX bytes. Stops at a NUL byte like the C string the
+** text used to be handled as.
+*/
+static char *xml_escape_to(char *p, const char *s, size_t len) {
+    const unsigned char *q = (const unsigned char *)s;
+    const unsigned char *end = q + len;
+    while (q < end && *q) {
+        unsigned char k = xml_escape_class[*q];
+        if (k == 0) {
+            *p++ = (char)*q;
+        } else if (k > 1) {
+            const char *e = xml_entities[k];
+            while (*e) *p++ = *e++;
+        }
+        q++;
+    }
+    return p;
+}
+
+/* Escape XML special characters, returning a new string */
 static char *xml_escape(const char *s) {
     StrBuf sb;
+    size_t len = strlen(s);
     strbuf_init(&sb);
-    const char *p;
-    for (p = s; *p; p++) {
-        switch (*p) {
-            case '&':  strbuf_append(&sb, "&amp;"); break;
-            case '<':  strbuf_append(&sb, "&lt;"); break;
-            case '>':  strbuf_append(&sb, "&gt;"); break;
-            case '"':  strbuf_append(&sb, "&quot;"); break;
-            case '\'': strbuf_append(&sb, "&apos;"); break;
-            default:
-                if ((unsigned char)*p < 32 && *p != '\t' && *p != '\n' && *p != '\r') {
-                    /* Skip invalid XML characters */
-                } else {
-                    char c[2] = {*p, 0};
-                    strbuf_append(&sb, c);
+    if (strbuf_reserve(&sb, len * XML_ESCAPE_MAX)) return NULL;
+    sb.len = (size_t)(xml_escape_to(sb.str, s, len) - sb.str);
+    sb.str[sb.len] = '\0';
+    return sb.str;
+}
+
+/* Copy a literal, without its NUL */
+static char *put_str(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+#define PUT_LIT(p, lit) put_str((p), (lit), sizeof(lit) - 1)
+
+/* Write the decimal digits of v */
+static char *put_uint64(char *p, sqlite3_uint64 v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n > 0) *p++ = tmp[--n];
+    return p;
+}
+
+static char *put_int64(char *p, sqlite3_int64 v) {
+    if (v < 0) {
+        *p++ = '-';
+        return put_uint64(p, (sqlite3_uint64)0 - (sqlite3_uint64)v);
+    }
+    return put_uint64(p, (sqlite3_uint64)v);
+}
+
+/*
+** Write the shortest decimal that reads back as exactly v.
+**
+** Most values in a table have only a few decimals, so v * 10^k is tried
+** first for small k: when the rounded product n is below 2^53 and
+** n / 10^k gives v back, n with k decimals is the answer. Both operands are
+** exact in a double and the division is correctly rounded, so the digits
+** and v name the same number.
+**
+** Otherwise the 17 significant digits from one snprintf() call, which
+** always round-trip, are cut to 15 and then 16 digits. Both neighbours at
+** that length are tried, the nearer first, since rounding an already
+** rounded string can pick the wrong one. The check uses the same exact
+** multiplication or division when it can and strtod() when it cannot. The
+** result is laid out like printf's %g at the precision found.
+*/
+#define FMT_EXACT_LIMIT 9007199254740992.0  /* 2^53 */
+
+static const double fmt_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Does digits[0..nd) x 10^exp10 read back as v? */
+static int fmt_round_trips(const char *digits, int nd, int exp10, double v) {
+    sqlite3_uint64 d = 0;
+    char buf[40];
+    int i;
+    for (i = 0; i < nd; i++) d = d * 10 + (sqlite3_uint64)(digits[i] - '0');
+    if ((double)d < FMT_EXACT_LIMIT && exp10 >= -22 && exp10 <= 22) {
+        double t = exp10 < 0 ? (double)d / fmt_pow10[-exp10]
+                             : (double)d * fmt_pow10[exp10];
+        return t == v;
+    }
+    /* No decimal point, so the locale does not matter */
+    memcpy(buf, digits, (size_t)nd);
+    snprintf(buf + nd, sizeof(buf) - (size_t)nd, "e%d", exp10);
+    return strtod(buf, NULL) == v;
+}
+
+static char *put_double(char *p, double v) {
+    char buf[40];
+    char digits[18];
+    int nd;
+    int prec;
+    int x;  /* Decimal exponent of the first digit */
+    int k;
+
+    if (v != v || v - v != 0.0) {
+        /* NaN or infinity; not representable in a cell anyway */
+        sqlite3_snprintf(32, p, "%.15g", v);
+        return p + strlen(p);
+    }
+    if (v < 0.0 || (v == 0.0 && 1.0 / v < 0.0)) {
+        *p++ = '-';
+        v = -v;
+    }
+    for (k = 0; k < 10; k++) {
+        double scaled = v * fmt_pow10[k];
+        sqlite3_uint64 n;
+        if (scaled >= FMT_EXACT_LIMIT) break;
+        n = (sqlite3_uint64)(scaled + 0.5);
+        if ((double)n / fmt_pow10[k] == v) {
+            char *d = put_uint64(digits, n);
+            nd = (int)(d - digits);
+            if (k == 0) return put_str(p, digits, (size_t)nd);
+            if (nd <= k) {
+                *p++ = '0';
+                *p++ = '.';
+                while (nd < k) {
+                    *p++ = '0';
+                    k--;
+                }
+                return put_str(p, digits, (size_t)nd);
+            }
+            p = put_str(p, digits, (size_t)(nd - k));
+            *p++ = '.';
+            return put_str(p, digits + nd - k, (size_t)k);
+        }
+    }
+
+    /* "d.dddddddddddddddde+XX"; buf[1] is the locale's decimal point */
+    snprintf(buf, sizeof(buf), "%.16e", v);
+    x = atoi(buf + 19);
+    digits[0] = buf[0];
+    memcpy(digits + 1, buf + 2, 16);
+    for (prec = 15; prec < 17; prec++) {
+        char up[18];
+        int up_x = x;
+        int i;
+        int found = 0;
+        int try_up_first = digits[prec] >= '5';
+        int t;
+
+        /* up = digits[0..prec) + 1 in the last place */
+        memcpy(up, digits, (size_t)prec);
+        for (i = prec - 1; i >= 0 && up[i] == '9'; i--) up[i] = '0';
+        if (i >= 0) {
+            up[i]++;
+        } else {
+            /* 99...9 rounded up to 100...0 */
+            up[0] = '1';
+            up_x++;
+        }
+        for (t = 0; t < 2 && !found; t++) {
+            if ((t == 0) == try_up_first) {
+                if (fmt_round_trips(up, prec, up_x + 1 - prec, v)) {
+                    memcpy(digits, up, (size_t)prec);
+                    x = up_x;
+                    found = 1;
                 }
-                break;
+            } else if (fmt_round_trips(digits, prec, x + 1 - prec, v)) {
+                found = 1;
+            }
         }
+        if (found) break;
+    }
+    nd = prec;
+    while (nd > 1 && digits[nd - 1] == '0') nd--;
+
+    if (x < -4 || x >= prec) {
+        *p++ = digits[0];
+        if (nd > 1) {
+            *p++ = '.';
+            p = put_str(p, digits + 1, (size_t)nd - 1);
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        if (x < 0) x = -x;
+        if (x < 10) *p++ = '0';
+        return put_uint64(p, (sqlite3_uint64)x);
+    }
+    if (x < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (k = x + 1; k < 0; k++) *p++ = '0';
+        return put_str(p, digits, (size_t)nd);
+    }
+    if (nd <= x + 1) {
+        p = put_str(p, digits, (size_t)nd);
+        for (k = nd; k <= x; k++) *p++ = '0';
+        return p;
+    }
+    p = put_str(p, digits, (size_t)x + 1);
+    *p++ = '.';
+    return put_str(p, digits + x + 1, (size_t)(nd - x - 1));
+}
+
+/* Letters of a worksheet column, computed once per statement */
+typedef struct ColRef {
+    char letters[8];
+    int len;
+} ColRef;
+
+/* Write '<c r="' and the cell reference, leaving the attribute open */
+static char *put_cell_ref(char *p, const ColRef *c, const char *row,
+                          int row_len) {
+    p = PUT_LIT(p, "<c r=\"");
+    p = put_str(p, c->letters, (size_t)c->len);
+    return put_str(p, row, (size_t)row_len);
+}
+
+/* Write the hex digits of a BLOB */
+static char *put_hex(char *p, const unsigned char *blob, int n) {
+    static const char hex_digits[] = "0123456789ABCDEF";
+    int i;
+    for (i = 0; i < n; i++) {
+        *p++ = hex_digits[blob[i] >> 4];
+        *p++ = hex_digits[blob[i] & 15];
     }
-    return sb.str ? sb.str : sqlite3_mprintf("");
+    return p;
 }
 
 /* Excel sheet name maximum length */
@@ -210,187 +544,1065 @@ static char *sanitize_sheet_name(const char *name) {
     return result;
 }
 
-/* Generate [Content_Types].xml */
-static char *gen_content_types(int sheet_count) {
-    StrBuf sb;
-    strbuf_init(&sb);
-    
-    strbuf_append(&sb, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
-        "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
-        "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
-        "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
-        "<Override PartName=\"/xl/styles.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>");
-    
-    int i;
-    for (i = 1; i <= sheet_count; i++) {
-        strbuf_appendf(&sb, 
-            "<Override PartName=\"/xl/worksheets/sheet%d.xml\" "
-            "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>", i);
-    }
-    
-    strbuf_append(&sb, "</Types>");
-    return sb.str;
+/*
+** ZIP writer
+**
+** Entries are deflated in ZIP_CHUNK_SIZE pieces and written to the output
+** file as they are produced. The sizes and CRC-32 of an entry are only
+** known once it is complete, so they follow the data in a data descriptor
+** and are repeated in the central directory. ZIP64 records are added when
+** an entry or the archive outgrows the 32-bit fields. An entry that may
+** reach 4 GB, such as a worksheet, has no size known in advance: its local
+** header announces version 4.5 and carries a ZIP64 extra field with zeroed
+** sizes, and its data descriptor always has 64-bit sizes.
+**
+** The bytes of an entry do not depend on where it lands in the archive, so
+** worker threads write their sheets to spool archives in temporary files
+** and zip_writer_append() copies them into the real one in order.
+**
+** Each entry has its own zlib level. Level 0 stores the data as is
+** (method 0) instead of running deflate; since a reader cannot find the
+** end of stored data by itself, its local header is rewritten with the CRC
+** and sizes once the entry is complete, and it gets no data descriptor.
+*/
+
+#define ZIP_CHUNK_SIZE 65536
+
+#define ZIP_LFH_SIG 0x04034b50u       /* Local file header */
+#define ZIP_DD_SIG 0x08074b50u        /* Data descriptor */
+#define ZIP_CDH_SIG 0x02014b50u       /* Central directory file header */
+#define ZIP_EOCD_SIG 0x06054b50u      /* End of central directory */
+#define ZIP64_EOCD_SIG 0x06064b50u    /* ZIP64 end of central directory */
+#define ZIP64_LOCATOR_SIG 0x07064b50u /* ZIP64 end of central dir locator */
+
+#define ZIP_MAX32 0xFFFFFFFFu
+#define ZIP64_LFH_EXTRA 20            /* ZIP64 extra field of a local header */
+
+#ifdef _WIN32
+#define zip_fseek _fseeki64
+#define zip_ftell _ftelli64
+typedef __int64 zip_off_t;
+#else
+#define zip_fseek fseeko
+#define zip_ftell ftello
+typedef off_t zip_off_t;
+#endif
+
+/* zlib level of the entries when no option says otherwise */
+#define ZIP_DEFAULT_LEVEL 6
+
+typedef struct ZipWriterEntry {
+    char *name;
+    int method;                 /* 0 = stored, 8 = deflated */
+    int flags;                  /* 0x0008 when sizes follow the data */
+    int zip64;                  /* The local header has a ZIP64 extra field */
+    unsigned long crc;
+    sqlite3_uint64 comp_size;
+    sqlite3_uint64 uncomp_size;
+    sqlite3_uint64 local_offset;
+} ZipWriterEntry;
+
+typedef struct ZipWriter {
+    FILE *fp;
+    sqlite3_uint64 offset;      /* Bytes written so far */
+    unsigned dos_time;          /* Modification time of all the entries */
+    unsigned dos_date;
+    ZipWriterEntry *entries;
+    int n_entries;
+    int cap_entries;
+    z_stream zs;                /* Deflate state of the open entry */
+    int in_entry;               /* entries[n_entries - 1] is being written */
+    int failed;                 /* A write failed or memory ran out */
+    sqlite3_int64 deflate_ns;   /* Time spent in deflate() */
+    sqlite3_int64 write_ns;     /* Time spent writing the file */
+    sqlite3_uint64 bytes_in;    /* Uncompressed bytes of all the entries */
+    unsigned char out[ZIP_CHUNK_SIZE];
+} ZipWriter;
+
+static void zip_put16(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
 }
 
-/* Generate _rels/.rels */
-static char *gen_rels(void) {
-    return sqlite3_mprintf(
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
-        "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"xl/workbook.xml\"/>"
-        "</Relationships>");
+static void zip_put32(unsigned char *p, sqlite3_uint64 v) {
+    zip_put16(p, (unsigned)(v & 0xFFFF));
+    zip_put16(p + 2, (unsigned)((v >> 16) & 0xFFFF));
 }
 
-/* Generate xl/_rels/workbook.xml.rels */
-static char *gen_workbook_rels(int sheet_count) {
-    StrBuf sb;
-    strbuf_init(&sb);
-    
-    strbuf_append(&sb, 
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
-        "<Relationship Id=\"rIdStyles\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/styles\" Target=\"styles.xml\"/>");
-    
-    int i;
-    for (i = 1; i <= sheet_count; i++) {
-        strbuf_appendf(&sb,
-            "<Relationship Id=\"rId%d\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet\" Target=\"worksheets/sheet%d.xml\"/>",
-            i, i);
+static void zip_put64(unsigned char *p, sqlite3_uint64 v) {
+    zip_put32(p, v & ZIP_MAX32);
+    zip_put32(p + 4, v >> 32);
+}
+
+static int zip_out(ZipWriter *zw, const void *data, size_t len) {
+    sqlite3_int64 t0;
+    size_t written;
+
+    if (zw->failed) return 1;
+    if (len == 0) return 0;
+    t0 = xlsx_now_ns();
+    written = fwrite(data, 1, len, zw->fp);
+    zw->write_ns += xlsx_now_ns() - t0;
+    if (written != len) {
+        zw->failed = 1;
+        return 1;
     }
-    
-    strbuf_append(&sb, "</Relationships>");
-    return sb.str;
+    zw->offset += len;
+    return 0;
 }
 
-/* Generate xl/workbook.xml */
-static char *gen_workbook(const char **sheet_names, int sheet_count) {
-    StrBuf sb;
-    strbuf_init(&sb);
-    
-    strbuf_append(&sb,
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<workbook xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
-        "xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
-        "<sheets>");
-    
-    int i;
-    for (i = 0; i < sheet_count; i++) {
-        char *sanitized_name = sanitize_sheet_name(sheet_names[i]);
-        char *escaped_name = xml_escape(sanitized_name ? sanitized_name : "Sheet");
-        strbuf_appendf(&sb, "<sheet name=\"%s\" sheetId=\"%d\" r:id=\"rId%d\"/>",
-            escaped_name, i + 1, i + 1);
-        sqlite3_free(escaped_name);
-        sqlite3_free(sanitized_name);
+/* Create filename and start an empty archive. Returns 0 on success. */
+static int zip_writer_open(ZipWriter *zw, const char *filename) {
+    time_t now = time(NULL);
+    struct tm *tm = localtime(&now);
+
+    memset(zw, 0, sizeof(*zw));
+    zw->fp = fopen(filename, "wb");
+    if (!zw->fp) return 1;
+    if (tm && tm->tm_year >= 80) {
+        zw->dos_time = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+        zw->dos_date = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+    } else {
+        zw->dos_date = (1 << 5) | 1; /* 1980-01-01 */
     }
-    
-    strbuf_append(&sb, "</sheets></workbook>");
-    return sb.str;
+    return 0;
 }
 
-/* Generate xl/styles.xml with bold style for headers */
-static char *gen_styles(void) {
-    return sqlite3_mprintf(
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<styleSheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
-        "<fonts count=\"2\">"
-        "<font><sz val=\"11\"/><name val=\"Calibri\"/></font>"
-        "<font><b/><sz val=\"11\"/><name val=\"Calibri\"/></font>"
-        "</fonts>"
-        "<fills count=\"1\"><fill><patternFill patternType=\"none\"/></fill></fills>"
-        "<borders count=\"1\"><border/></borders>"
-        "<cellStyleXfs count=\"1\"><xf/></cellStyleXfs>"
-        "<cellXfs count=\"2\">"
-        "<xf fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/>"
-        "<xf fontId=\"1\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyFont=\"1\"/>"
-        "</cellXfs>"
-        "</styleSheet>");
+/*
+** Open an anonymous temporary file. The Windows tmpfile() creates it in the
+** root of the current drive, which users may not write to, so there it is
+** made in the TMP directory and deleted when closed ("D").
+*/
+static FILE *zip_temp_file(void) {
+#ifdef _WIN32
+    char *path = _tempnam(NULL, "xlsx");
+    FILE *fp = path ? fopen(path, "w+bTD") : NULL;
+    free(path);
+    return fp;
+#else
+    return tmpfile();
+#endif
 }
 
-/* Generate xl/worksheets/sheetN.xml for a table */
-static char *gen_worksheet(sqlite3 *db, const char *table_name, char **err_msg, 
-                           ExportWarnings *warnings) {
-    StrBuf sb;
-    strbuf_init(&sb);
-    sqlite3_stmt *stmt = NULL;
-    char *sql = NULL;
-    int rc;
-    int col_count;
-    int row_num;
-    int col;
-    char col_letter[16];
-    int last_row = 1;
-    
-    /* Build SELECT query */
-    sql = sqlite3_mprintf("SELECT * FROM \"%w\"", table_name);
-    if (!sql) {
-        *err_msg = sqlite3_mprintf("Out of memory");
+/*
+** Start a spool archive in a temporary file, stamped with the time of the
+** archive it will be appended to. Returns 0 on success.
+*/
+static int zip_writer_spool(ZipWriter *spool, const ZipWriter *archive) {
+    memset(spool, 0, sizeof(*spool));
+    spool->fp = zip_temp_file();
+    if (!spool->fp) return 1;
+    spool->dos_time = archive->dos_time;
+    spool->dos_date = archive->dos_date;
+    return 0;
+}
+
+/* Add a cleared entry to the central directory list, or NULL on OOM */
+static ZipWriterEntry *zip_add_entry(ZipWriter *zw) {
+    if (zw->n_entries >= zw->cap_entries) {
+        int new_cap = zw->cap_entries ? zw->cap_entries * 2 : 16;
+        ZipWriterEntry *new_entries = sqlite3_realloc64(zw->entries, sizeof(ZipWriterEntry) * new_cap);
+        if (!new_entries) {
+            zw->failed = 1;
+            return NULL;
+        }
+        zw->entries = new_entries;
+        zw->cap_entries = new_cap;
+    }
+    ZipWriterEntry *e = &zw->entries[zw->n_entries++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+/*
+** Add an entry of the given method starting here and write its local file
+** header, with a ZIP64 extra field when zip64 is set
+*/
+static ZipWriterEntry *zip_entry_header(ZipWriter *zw, const char *name,
+                                        int method, int zip64) {
+    unsigned char lfh[30];
+    unsigned char extra[ZIP64_LFH_EXTRA];
+    size_t name_len = strlen(name);
+
+    if (zw->failed || zw->in_entry) return NULL;
+    ZipWriterEntry *e = zip_add_entry(zw);
+    if (!e) return NULL;
+    e->name = sqlite3_mprintf("%s", name);
+    e->local_offset = zw->offset;
+    e->method = method;
+    e->flags = 0x0008;
+    e->zip64 = zip64;
+    e->crc = crc32(0L, Z_NULL, 0);
+    if (!e->name) {
+        zw->failed = 1;
         return NULL;
     }
-    
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    sqlite3_free(sql);
-    
-    if (rc != SQLITE_OK) {
-        *err_msg = sqlite3_mprintf("Failed to prepare query for table '%s': %s",
-            table_name, sqlite3_errmsg(db));
+
+    /* CRC and sizes are left 0, they follow in the data descriptor */
+    memset(lfh, 0, sizeof(lfh));
+    zip_put32(lfh, ZIP_LFH_SIG);
+    zip_put16(lfh + 4, zip64 ? 45 : 20); /* Version needed to extract */
+    zip_put16(lfh + 6, e->flags);   /* Sizes in data descriptor */
+    zip_put16(lfh + 8, (unsigned)method);
+    zip_put16(lfh + 10, zw->dos_time);
+    zip_put16(lfh + 12, zw->dos_date);
+    zip_put16(lfh + 26, (unsigned)name_len);
+    zip_put16(lfh + 28, zip64 ? ZIP64_LFH_EXTRA : 0);
+    memset(extra, 0, sizeof(extra));
+    zip_put16(extra, 0x0001);
+    zip_put16(extra + 2, ZIP64_LFH_EXTRA - 4);
+    if (zip_out(zw, lfh, sizeof(lfh)) || zip_out(zw, name, name_len) ||
+        (zip64 && zip_out(zw, extra, sizeof(extra)))) {
         return NULL;
     }
-    
-    col_count = sqlite3_column_count(stmt);
-    
-    /* Start worksheet XML */
-    strbuf_append(&sb,
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
-        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
-        "xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
-        "<sheetData>");
-    
-    /* Write header row with column names (style 1 = bold) */
-    strbuf_append(&sb, "<row r=\"1\">");
-    for (col = 0; col < col_count; col++) {
-        const char *col_name = sqlite3_column_name(stmt, col);
-        char *escaped = xml_escape(col_name);
-        col_to_letter(col, col_letter);
-        strbuf_appendf(&sb, "<c r=\"%s1\" t=\"inlineStr\" s=\"1\"><is><t>%s</t></is></c>",
-            col_letter, escaped);
-        sqlite3_free(escaped);
+    return e;
+}
+
+/*
+** Start a new entry compressed at level (0 to 9, 0 = stored); its data
+** follows with zip_entry_write(). zip64 is set when the entry may reach
+** 4 GB.
+*/
+static int zip_entry_begin(ZipWriter *zw, const char *name, int level,
+                           int zip64) {
+    if (!zip_entry_header(zw, name, level == 0 ? 0 : 8, zip64)) return 1;
+
+    zw->in_entry = 1;
+    if (level == 0) return 0;
+    memset(&zw->zs, 0, sizeof(zw->zs));
+    if (deflateInit2(&zw->zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        zw->in_entry = 0;
+        zw->failed = 1;
+        return 1;
     }
-    strbuf_append(&sb, "</row>");
-    
-    /* Write data rows */
-    row_num = 2;
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        strbuf_appendf(&sb, "<row r=\"%d\">", row_num);
-        
-        for (col = 0; col < col_count; col++) {
-            int col_type = sqlite3_column_type(stmt, col);
-            col_to_letter(col, col_letter);
-            
-            switch (col_type) {
-                case SQLITE_INTEGER:
-                    strbuf_appendf(&sb, "<c r=\"%s%d\"><v>%lld</v></c>",
-                        col_letter, row_num, sqlite3_column_int64(stmt, col));
-                    break;
-                    
-                case SQLITE_FLOAT:
-                    strbuf_appendf(&sb, "<c r=\"%s%d\"><v>%.15g</v></c>",
-                        col_letter, row_num, sqlite3_column_double(stmt, col));
-                    break;
-                    
-                case SQLITE_TEXT: {
-                    const char *text = (const char *)sqlite3_column_text(stmt, col);
+    return 0;
+}
+
+/* Run deflate over the pending input, writing every full output buffer */
+static int zip_deflate(ZipWriter *zw, int flush) {
+    ZipWriterEntry *e = &zw->entries[zw->n_entries - 1];
+    int zrc;
+
+    do {
+        sqlite3_int64 t0 = xlsx_now_ns();
+        zw->zs.next_out = zw->out;
+        zw->zs.avail_out = ZIP_CHUNK_SIZE;
+        zrc = deflate(&zw->zs, flush);
+        zw->deflate_ns += xlsx_now_ns() - t0;
+        if (zrc == Z_STREAM_ERROR) {
+            zw->failed = 1;
+            return 1;
+        }
+        size_t produced = ZIP_CHUNK_SIZE - zw->zs.avail_out;
+        e->comp_size += produced;
+        if (zip_out(zw, zw->out, produced)) return 1;
+    } while (zw->zs.avail_out == 0 || (flush == Z_FINISH && zrc != Z_STREAM_END));
+    return 0;
+}
+
+/* Append data to the open entry */
+static int zip_entry_write(ZipWriter *zw, const char *data, size_t len) {
+    ZipWriterEntry *e;
+
+    if (zw->failed || !zw->in_entry) return 1;
+    e = &zw->entries[zw->n_entries - 1];
+    while (len > 0) {
+        uInt n = len > ZIP_CHUNK_SIZE ? ZIP_CHUNK_SIZE : (uInt)len;
+        e->crc = crc32(e->crc, (const Bytef *)data, n);
+        e->uncomp_size += n;
+        zw->bytes_in += n;
+        if (e->method == 0) {
+            e->comp_size += n;
+            if (zip_out(zw, data, n)) return 1;
+        } else {
+            zw->zs.next_in = (Bytef *)data;
+            zw->zs.avail_in = n;
+            if (zip_deflate(zw, Z_NO_FLUSH)) return 1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+** Complete e, the entry just written: write its data descriptor or, for a
+** stored entry that fits the 32-bit fields or has a ZIP64 extra field, put
+** the CRC and sizes in its local header
+*/
+static int zip_entry_descriptor(ZipWriter *zw, ZipWriterEntry *e) {
+    unsigned char dd[24];
+    size_t dd_len;
+    int big = e->comp_size >= ZIP_MAX32 || e->uncomp_size >= ZIP_MAX32;
+
+    /* Without the extra field the local header cannot describe it */
+    if (big && !e->zip64) {
+        zw->failed = 1;
+        return 1;
+    }
+
+    if (e->method == 0 && (!big || e->zip64)) {
+        unsigned char lfh[20];
+        unsigned char sizes[16];
+        zip_put16(lfh, 0);          /* Flags: no data descriptor */
+        zip_put16(lfh + 2, 0);      /* Stored */
+        zip_put16(lfh + 4, zw->dos_time);
+        zip_put16(lfh + 6, zw->dos_date);
+        zip_put32(lfh + 8, e->crc);
+        zip_put32(lfh + 12, big ? ZIP_MAX32 : e->comp_size);
+        zip_put32(lfh + 16, big ? ZIP_MAX32 : e->uncomp_size);
+        zip_put64(sizes, e->uncomp_size);
+        zip_put64(sizes + 8, e->comp_size);
+        e->flags = 0;
+        if (zw->failed || fflush(zw->fp) != 0 ||
+            zip_fseek(zw->fp, (zip_off_t)(e->local_offset + 6), SEEK_SET) != 0 ||
+            fwrite(lfh, 1, sizeof(lfh), zw->fp) != sizeof(lfh) ||
+            (big &&
+             (zip_fseek(zw->fp, (zip_off_t)(e->local_offset + 34 + strlen(e->name)),
+                        SEEK_SET) != 0 ||
+              fwrite(sizes, 1, sizeof(sizes), zw->fp) != sizeof(sizes))) ||
+            fflush(zw->fp) != 0 ||
+            zip_fseek(zw->fp, (zip_off_t)zw->offset, SEEK_SET) != 0) {
+            zw->failed = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    zip_put32(dd, ZIP_DD_SIG);
+    zip_put32(dd + 4, e->crc);
+    if (e->zip64) {
+        zip_put64(dd + 8, e->comp_size);
+        zip_put64(dd + 16, e->uncomp_size);
+        dd_len = 24;
+    } else {
+        zip_put32(dd + 8, e->comp_size);
+        zip_put32(dd + 12, e->uncomp_size);
+        dd_len = 16;
+    }
+    return zip_out(zw, dd, dd_len);
+}
+
+/* Finish the open entry and write its data descriptor */
+static int zip_entry_end(ZipWriter *zw) {
+    ZipWriterEntry *e;
+
+    if (!zw->in_entry) return 1;
+    e = &zw->entries[zw->n_entries - 1];
+    zw->in_entry = 0;
+    if (e->method != 0) {
+        zw->zs.next_in = NULL;
+        zw->zs.avail_in = 0;
+        int rc = zip_deflate(zw, Z_FINISH);
+        deflateEnd(&zw->zs);
+        if (rc) return 1;
+    }
+    return zip_entry_descriptor(zw, e);
+}
+
+/*
+** Write an entry whose data, comp_size bytes compressed with method, is
+** read from fp, as kept by the export cache. Returns 0 on success.
+*/
+static int zip_entry_copy(ZipWriter *zw, const char *name, FILE *fp,
+                          int method, unsigned long crc,
+                          sqlite3_uint64 comp_size, sqlite3_uint64 uncomp_size) {
+    ZipWriterEntry *e = zip_entry_header(zw, name, method,
+                                         comp_size >= ZIP_MAX32 ||
+                                         uncomp_size >= ZIP_MAX32);
+    sqlite3_uint64 left = comp_size;
+
+    if (!e) return 1;
+    while (left > 0 && !zw->failed) {
+        size_t n = left > ZIP_CHUNK_SIZE ? ZIP_CHUNK_SIZE : (size_t)left;
+        if (fread(zw->out, 1, n, fp) != n) {
+            zw->failed = 1;
+            break;
+        }
+        zip_out(zw, zw->out, n);
+        left -= n;
+    }
+    if (zw->failed) return 1;
+    e->crc = crc;
+    e->comp_size = comp_size;
+    e->uncomp_size = uncomp_size;
+    return zip_entry_descriptor(zw, e);
+}
+
+/* Write a whole entry from a NUL-terminated string */
+static int zip_write_entry(ZipWriter *zw, const char *name, const char *data,
+                           int level) {
+    size_t len = strlen(data);
+    /* Half the limit leaves room for deflate to grow incompressible data */
+    if (zip_entry_begin(zw, name, level, len >= ZIP_MAX32 / 2)) return 1;
+    if (zip_entry_write(zw, data, len)) return 1;
+    return zip_entry_end(zw);
+}
+
+static void zip_writer_free(ZipWriter *zw) {
+    int i;
+    if (zw->in_entry) {
+        if (zw->entries[zw->n_entries - 1].method != 0) deflateEnd(&zw->zs);
+        zw->in_entry = 0;
+    }
+    for (i = 0; i < zw->n_entries; i++) {
+        sqlite3_free(zw->entries[i].name);
+    }
+    sqlite3_free(zw->entries);
+    zw->entries = NULL;
+    zw->n_entries = 0;
+}
+
+/* Write the central directory and close the file. Returns 0 on success. */
+static int zip_writer_close(ZipWriter *zw) {
+    sqlite3_uint64 cd_offset = zw->offset;
+    int i;
+
+    for (i = 0; i < zw->n_entries && !zw->failed; i++) {
+        ZipWriterEntry *e = &zw->entries[i];
+        unsigned char cdh[46];
+        unsigned char extra[28];
+        size_t extra_len = 0;
+        size_t name_len = strlen(e->name);
+
+        /* Fields that do not fit are 0xFFFFFFFF and stored in a ZIP64 extra field */
+        if (e->uncomp_size >= ZIP_MAX32) {
+            zip_put64(extra + 4 + extra_len, e->uncomp_size);
+            extra_len += 8;
+        }
+        if (e->comp_size >= ZIP_MAX32) {
+            zip_put64(extra + 4 + extra_len, e->comp_size);
+            extra_len += 8;
+        }
+        if (e->local_offset >= ZIP_MAX32) {
+            zip_put64(extra + 4 + extra_len, e->local_offset);
+            extra_len += 8;
+        }
+        if (extra_len > 0) {
+            zip_put16(extra, 0x0001);
+            zip_put16(extra + 2, (unsigned)extra_len);
+            extra_len += 4;
+        }
+
+        memset(cdh, 0, sizeof(cdh));
+        zip_put32(cdh, ZIP_CDH_SIG);
+        zip_put16(cdh + 4, 45);                     /* Version made by */
+        zip_put16(cdh + 6, extra_len || e->zip64 ? 45 : 20); /* Version needed */
+        zip_put16(cdh + 8, (unsigned)e->flags);
+        zip_put16(cdh + 10, (unsigned)e->method);
+        zip_put16(cdh + 12, zw->dos_time);
+        zip_put16(cdh + 14, zw->dos_date);
+        zip_put32(cdh + 16, e->crc);
+        zip_put32(cdh + 20, e->comp_size >= ZIP_MAX32 ? ZIP_MAX32 : e->comp_size);
+        zip_put32(cdh + 24, e->uncomp_size >= ZIP_MAX32 ? ZIP_MAX32 : e->uncomp_size);
+        zip_put16(cdh + 28, (unsigned)name_len);
+        zip_put16(cdh + 30, (unsigned)extra_len);
+        zip_put32(cdh + 42, e->local_offset >= ZIP_MAX32 ? ZIP_MAX32 : e->local_offset);
+        zip_out(zw, cdh, sizeof(cdh));
+        zip_out(zw, e->name, name_len);
+        zip_out(zw, extra, extra_len);
+    }
+
+    sqlite3_uint64 cd_size = zw->offset - cd_offset;
+    int zip64 = zw->n_entries >= 0xFFFF || cd_offset >= ZIP_MAX32 || cd_size >= ZIP_MAX32;
+    if (zip64) {
+        unsigned char eocd64[56];
+        unsigned char locator[20];
+        sqlite3_uint64 eocd64_offset = zw->offset;
+
+        memset(eocd64, 0, sizeof(eocd64));
+        zip_put32(eocd64, ZIP64_EOCD_SIG);
+        zip_put64(eocd64 + 4, sizeof(eocd64) - 12);
+        zip_put16(eocd64 + 12, 45);
+        zip_put16(eocd64 + 14, 45);
+        zip_put64(eocd64 + 24, zw->n_entries);
+        zip_put64(eocd64 + 32, zw->n_entries);
+        zip_put64(eocd64 + 40, cd_size);
+        zip_put64(eocd64 + 48, cd_offset);
+        zip_out(zw, eocd64, sizeof(eocd64));
+
+        memset(locator, 0, sizeof(locator));
+        zip_put32(locator, ZIP64_LOCATOR_SIG);
+        zip_put64(locator + 8, eocd64_offset);
+        zip_put32(locator + 16, 1);                 /* Number of disks */
+        zip_out(zw, locator, sizeof(locator));
+    }
+
+    unsigned char eocd[22];
+    unsigned n16 = zw->n_entries >= 0xFFFF ? 0xFFFF : (unsigned)zw->n_entries;
+    memset(eocd, 0, sizeof(eocd));
+    zip_put32(eocd, ZIP_EOCD_SIG);
+    zip_put16(eocd + 8, n16);
+    zip_put16(eocd + 10, n16);
+    zip_put32(eocd + 12, cd_size >= ZIP_MAX32 ? ZIP_MAX32 : cd_size);
+    zip_put32(eocd + 16, cd_offset >= ZIP_MAX32 ? ZIP_MAX32 : cd_offset);
+    zip_out(zw, eocd, sizeof(eocd));
+
+    sqlite3_int64 t0 = xlsx_now_ns();
+    if (fclose(zw->fp) != 0) zw->failed = 1;
+    zw->write_ns += xlsx_now_ns() - t0;
+    zw->fp = NULL;
+    zip_writer_free(zw);
+    return zw->failed;
+}
+
+/*
+** Give up on the archive: close and delete the partial file. Spools pass
+** NULL, their temporary file goes away when it is closed.
+*/
+static void zip_writer_abort(ZipWriter *zw, const char *filename) {
+    if (zw->fp) {
+        fclose(zw->fp);
+        zw->fp = NULL;
+        if (filename) remove(filename);
+    }
+    zip_writer_free(zw);
+}
+
+/*
+** Copy the finished entries of a spool archive to the end of zw, then
+** discard the spool. Returns 0 on success.
+*/
+static int zip_writer_append(ZipWriter *zw, ZipWriter *spool) {
+    sqlite3_uint64 base = zw->offset;
+    sqlite3_uint64 left = spool->offset;
+    int i;
+
+    if (zw->failed || zw->in_entry || spool->failed || spool->in_entry ||
+        fflush(spool->fp) != 0 || fseek(spool->fp, 0, SEEK_SET) != 0) {
+        zw->failed = 1;
+    }
+    while (left > 0 && !zw->failed) {
+        size_t n = left > ZIP_CHUNK_SIZE ? ZIP_CHUNK_SIZE : (size_t)left;
+        if (fread(zw->out, 1, n, spool->fp) != n) {
+            zw->failed = 1;
+            break;
+        }
+        zip_out(zw, zw->out, n);
+        left -= n;
+    }
+    for (i = 0; i < spool->n_entries && !zw->failed; i++) {
+        ZipWriterEntry *e = zip_add_entry(zw);
+        if (!e) break;
+        *e = spool->entries[i];
+        e->local_offset += base;
+        spool->entries[i].name = NULL;  /* Now owned by zw */
+    }
+    zip_writer_abort(spool, NULL);
+    return zw->failed;
+}
+
+/*
+** Shared string table
+**
+** With the "sharedstrings" option set through xlsx_export_config(), text
+** cells are interned while the rows stream: each distinct string is stored
+** once in xl/sharedStrings.xml and the cells refer to it by index (t="s").
+** The strings live in one arena, NUL-terminated, and are looked up through
+** an open-addressing hash table that is kept at most half full.
+**
+** A column stops adding strings once it has contributed max_per_col of them
+** (keys, free text, ...). Its further new values are written inline, which
+** bounds the memory used and keeps the table for values that repeat.
+** Strings longer than SST_MAX_STRING_LEN bytes are always written inline.
+*/
+
+#define SST_DEFAULT_MAX_PER_COL 65536
+#define SST_MAX_STRING_LEN 1024
+
+typedef struct SstString {
+    size_t offset;      /* Start of the text in the arena */
+    int len;            /* Length in bytes, without the NUL */
+    unsigned hash;      /* Hash of the text, kept for rehashing */
+} SstString;
+
+typedef struct SharedStrings {
+    char *arena;                /* Text of all strings */
+    size_t arena_len;
+    size_t arena_cap;
+    SstString *strings;         /* Strings by index */
+    int n_strings;
+    int cap_strings;
+    int *slots;                 /* Hash table of index + 1, 0 when empty */
+    int n_slots;                /* Power of two */
+    sqlite3_int64 n_refs;       /* Number of t="s" cells written */
+    int max_per_col;            /* New strings allowed per column */
+    pthread_mutex_t *mutex;     /* Held around lookups when sheets are
+                                ** written by several threads, or NULL */
+} SharedStrings;
+
+static void sst_init(SharedStrings *sst, int max_per_col) {
+    memset(sst, 0, sizeof(*sst));
+    sst->max_per_col = max_per_col;
+}
+
+static void sst_free(SharedStrings *sst) {
+    sqlite3_free(sst->arena);
+    sqlite3_free(sst->strings);
+    sqlite3_free(sst->slots);
+    memset(sst, 0, sizeof(*sst));
+}
+
+/* FNV-1a */
+static unsigned sst_hash(const char *s, int len) {
+    unsigned h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Double the hash table and reinsert all strings. Returns 0 on success. */
+static int sst_grow_slots(SharedStrings *sst) {
+    int n = sst->n_slots ? sst->n_slots * 2 : 1024;
+    int i;
+    int *slots;
+    if (n <= 0) return 1;
+    slots = sqlite3_malloc64(sizeof(int) * (sqlite3_uint64)n);
+    if (!slots) return 1;
+    memset(slots, 0, sizeof(int) * (size_t)n);
+    for (i = 0; i < sst->n_strings; i++) {
+        unsigned j = sst->strings[i].hash & (unsigned)(n - 1);
+        while (slots[j]) j = (j + 1) & (unsigned)(n - 1);
+        slots[j] = i + 1;
+    }
+    sqlite3_free(sst->slots);
+    sst->slots = slots;
+    sst->n_slots = n;
+    return 0;
+}
+
+/* sst_intern() without the locking */
+static int sst_intern_unlocked(SharedStrings *sst, const char *text, int len,
+                               int *col_added) {
+    unsigned h;
+    unsigned mask;
+    unsigned j;
+    SstString *s;
+
+    if (len > SST_MAX_STRING_LEN) return -1;
+    if (sst->n_slots == 0 && sst_grow_slots(sst)) return -1;
+
+    h = sst_hash(text, len);
+    mask = (unsigned)(sst->n_slots - 1);
+    for (j = h & mask; sst->slots[j]; j = (j + 1) & mask) {
+        s = &sst->strings[sst->slots[j] - 1];
+        if (s->hash == h && s->len == len &&
+            memcmp(sst->arena + s->offset, text, (size_t)len) == 0) {
+            sst->n_refs++;
+            return sst->slots[j] - 1;
+        }
+    }
+    if (*col_added >= sst->max_per_col) return -1;
+
+    /* Make room for the new string; on failure the cell goes inline */
+    if ((sst->n_strings + 1) * 2 > sst->n_slots) {
+        if (sst_grow_slots(sst)) return -1;
+        mask = (unsigned)(sst->n_slots - 1);
+        for (j = h & mask; sst->slots[j]; j = (j + 1) & mask) {}
+    }
+    if (sst->n_strings >= sst->cap_strings) {
+        int new_cap = sst->cap_strings ? sst->cap_strings * 2 : 1024;
+        SstString *new_strings = sqlite3_realloc64(sst->strings,
+            sizeof(SstString) * (sqlite3_uint64)new_cap);
+        if (!new_strings) return -1;
+        sst->strings = new_strings;
+        sst->cap_strings = new_cap;
+    }
+    if (sst->arena_len + (size_t)len + 1 > sst->arena_cap) {
+        size_t new_cap = sst->arena_cap ? sst->arena_cap * 2 : 65536;
+        char *new_arena;
+        while (new_cap < sst->arena_len + (size_t)len + 1) new_cap *= 2;
+        new_arena = sqlite3_realloc64(sst->arena, new_cap);
+        if (!new_arena) return -1;
+        sst->arena = new_arena;
+        sst->arena_cap = new_cap;
+    }
+
+    s = &sst->strings[sst->n_strings];
+    s->offset = sst->arena_len;
+    s->len = len;
+    s->hash = h;
+    memcpy(sst->arena + sst->arena_len, text, (size_t)len);
+    sst->arena[sst->arena_len + len] = '\0';
+    sst->arena_len += (size_t)len + 1;
+    sst->slots[j] = ++sst->n_strings;
+    sst->n_refs++;
+    (*col_added)++;
+    return sst->n_strings - 1;
+}
+
+/*
+** Return the index of text in the table, adding it if it is new and the
+** column (whose count of added strings is *col_added) is still under its
+** cap. Returns -1 when the cell must be written inline instead.
+*/
+static int sst_intern(SharedStrings *sst, const char *text, int len,
+                      int *col_added) {
+    int index;
+    if (!sst->mutex) return sst_intern_unlocked(sst, text, len, col_added);
+    pthread_mutex_lock(sst->mutex);
+    index = sst_intern_unlocked(sst, text, len, col_added);
+    pthread_mutex_unlock(sst->mutex);
+    return index;
+}
+
+/*
+** Write xl/sharedStrings.xml into the open entry of zw.
+** Returns 0 on success, non-zero on error.
+*/
+static int gen_shared_strings(const SharedStrings *sst, ZipWriter *zw) {
+    StrBuf sb;
+    int i;
+    int rc;
+    strbuf_init(&sb);
+
+    rc = strbuf_appendf(&sb,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<sst xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
+        "count=\"%lld\" uniqueCount=\"%d\">", sst->n_refs, sst->n_strings);
+
+    for (i = 0; i < sst->n_strings && rc == 0; i++) {
+        char *escaped = xml_escape(sst->arena + sst->strings[i].offset);
+        if (!escaped) {
+            rc = 1;
+            break;
+        }
+        rc = strbuf_append(&sb, "<si><t>") || strbuf_append(&sb, escaped) ||
+             strbuf_append(&sb, "</t></si>");
+        sqlite3_free(escaped);
+        if (rc == 0 && sb.len >= ZIP_CHUNK_SIZE) {
+            rc = zip_entry_write(zw, sb.str, sb.len);
+            sb.len = 0;
+        }
+    }
+
+    if (rc == 0) {
+        rc = strbuf_append(&sb, "</sst>") ||
+             zip_entry_write(zw, sb.str, sb.len);
+    }
+    strbuf_free(&sb);
+    return rc;
+}
+
+/* Generate [Content_Types].xml */
+static char *gen_content_types(int sheet_count, int shared_strings) {
+    StrBuf sb;
+    strbuf_init(&sb);
+    
+    strbuf_append(&sb, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+        "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+        "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+        "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+        "<Override PartName=\"/xl/styles.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>");
+    
+    int i;
+    for (i = 1; i <= sheet_count; i++) {
+        strbuf_appendf(&sb, 
+            "<Override PartName=\"/xl/worksheets/sheet%d.xml\" "
+            "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>", i);
+    }
+    
+    if (shared_strings) {
+        strbuf_append(&sb,
+            "<Override PartName=\"/xl/sharedStrings.xml\" "
+            "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sharedStrings+xml\"/>");
+    }
+    
+    strbuf_append(&sb, "</Types>");
+    return sb.str;
+}
+
+/* Generate _rels/.rels */
+static char *gen_rels(void) {
+    return sqlite3_mprintf(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+        "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"xl/workbook.xml\"/>"
+        "</Relationships>");
+}
+
+/* Generate xl/_rels/workbook.xml.rels */
+static char *gen_workbook_rels(int sheet_count, int shared_strings) {
+    StrBuf sb;
+    strbuf_init(&sb);
+    
+    strbuf_append(&sb, 
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+        "<Relationship Id=\"rIdStyles\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/styles\" Target=\"styles.xml\"/>");
+    
+    int i;
+    for (i = 1; i <= sheet_count; i++) {
+        strbuf_appendf(&sb,
+            "<Relationship Id=\"rId%d\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet\" Target=\"worksheets/sheet%d.xml\"/>",
+            i, i);
+    }
+    
+    if (shared_strings) {
+        strbuf_append(&sb,
+            "<Relationship Id=\"rIdSharedStrings\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings\" Target=\"sharedStrings.xml\"/>");
+    }
+    
+    strbuf_append(&sb, "</Relationships>");
+    return sb.str;
+}
+
+/* Generate xl/workbook.xml */
+static char *gen_workbook(const char **sheet_names, int sheet_count) {
+    StrBuf sb;
+    strbuf_init(&sb);
+    
+    strbuf_append(&sb,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<workbook xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
+        "xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
+        "<sheets>");
+    
+    int i;
+    for (i = 0; i < sheet_count; i++) {
+        char *sanitized_name = sanitize_sheet_name(sheet_names[i]);
+        char *escaped_name = xml_escape(sanitized_name ? sanitized_name : "Sheet");
+        strbuf_appendf(&sb, "<sheet name=\"%s\" sheetId=\"%d\" r:id=\"rId%d\"/>",
+            escaped_name, i + 1, i + 1);
+        sqlite3_free(escaped_name);
+        sqlite3_free(sanitized_name);
+    }
+    
+    strbuf_append(&sb, "</sheets></workbook>");
+    return sb.str;
+}
+
+/* Generate xl/styles.xml with bold style for headers */
+static char *gen_styles(void) {
+    return sqlite3_mprintf(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<styleSheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+        "<fonts count=\"2\">"
+        "<font><sz val=\"11\"/><name val=\"Calibri\"/></font>"
+        "<font><b/><sz val=\"11\"/><name val=\"Calibri\"/></font>"
+        "</fonts>"
+        "<fills count=\"1\"><fill><patternFill patternType=\"none\"/></fill></fills>"
+        "<borders count=\"1\"><border/></borders>"
+        "<cellStyleXfs count=\"1\"><xf/></cellStyleXfs>"
+        "<cellXfs count=\"2\">"
+        "<xf fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/>"
+        "<xf fontId=\"1\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyFont=\"1\"/>"
+        "</cellXfs>"
+        "</styleSheet>");
+}
+
+/*
+** True once sqlite3_interrupt() was called on db. sqlite3_is_interrupted()
+** only exists from SQLite 3.41; before that only the statements that read
+** the rows notice an interrupt, and export workers finish their sheet.
+*/
+static int export_interrupted(sqlite3 *db) {
+#if SQLITE_VERSION_NUMBER >= 3041000
+    return sqlite3_libversion_number() >= 3041000 && sqlite3_is_interrupted(db);
+#else
+    (void)db;
+    return 0;
+#endif
+}
+
+/*
+** Count n more rows written and call the progress function when it is due.
+** Returns SQLITE_OK to go on, SQLITE_INTERRUPT to stop, or the error of the
+** progress function.
+*/
+static int export_progress_add(ExportProgress *pg, const char *sheet_name,
+                               const ZipWriter *zw, sqlite3_int64 n) {
+    int rc;
+    int cancel;
+
+    pg->rows += n;
+    if (pg->watch && export_interrupted(pg->watch)) {
+        pg->interrupted = 1;
+        return SQLITE_INTERRUPT;
+    }
+    if (!pg->callback || pg->rows < pg->next) return SQLITE_OK;
+
+    pg->next = pg->rows + pg->every;
+    sqlite3_bind_text(pg->callback, 1, sheet_name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pg->callback, 2, pg->rows);
+    sqlite3_bind_int64(pg->callback, 3, (sqlite3_int64)zw->offset);
+    rc = sqlite3_step(pg->callback);
+    cancel = rc == SQLITE_ROW && sqlite3_column_int(pg->callback, 0) != 0;
+    if (rc == SQLITE_ROW || rc == SQLITE_DONE) rc = SQLITE_OK;
+    sqlite3_reset(pg->callback);
+    if (rc == SQLITE_OK && cancel) rc = SQLITE_INTERRUPT;
+    if (rc == SQLITE_INTERRUPT) pg->interrupted = 1;
+    return rc;
+}
+
+/*
+** Write xl/worksheets/sheetN.xml for a table into the open entry of zw.
+** The XML is collected in a buffer that is handed to the ZIP writer every
+** ZIP_CHUNK_SIZE bytes, so memory use does not depend on the table size.
+** When query is not NULL its rows are written instead, and table_name is
+** only the sheet name used in messages.
+** Text cells are interned in sst when it is not NULL. The rows and cells
+** written are added to stats, and every row is reported to progress.
+** Returns 0 on success, non-zero on error.
+*/
+static int gen_worksheet(sqlite3 *db, const char *table_name,
+                         const char *query, ZipWriter *zw,
+                         SharedStrings *sst, char **err_msg,
+                         ExportWarnings *warnings, ExportStats *stats,
+                         ExportProgress *progress) {
+    StrBuf sb;
+    strbuf_init(&sb);
+    sqlite3_stmt *stmt = NULL;
+    char *sql = NULL;
+    int rc;
+    int col_count;
+    int row_num;
+    int col;
+    int last_row = 1;
+    int oom = 0;
+    int progress_rc = SQLITE_OK;
+    sqlite3_int64 cells = 0;
+    ColRef *cols = NULL;      /* Column letters, computed once */
+    int *col_strings = NULL;  /* Strings each column added to sst */
+    const char *what = query ? "sheet" : "table";
+    const char *tail = NULL;
+    char *p;
+    
+    /* Build SELECT query */
+    sql = query ? sqlite3_mprintf("%s", query)
+                : sqlite3_mprintf("SELECT * FROM \"%w\"", table_name);
+    if (!sql) {
+        *err_msg = sqlite3_mprintf("Out of memory");
+        return 1;
+    }
+    
+    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
+    
+    if (rc != SQLITE_OK) {
+        sqlite3_free(sql);
+        *err_msg = sqlite3_mprintf("Failed to prepare query for %s '%s': %s",
+            what, table_name, sqlite3_errmsg(db));
+        return 1;
+    }
+    
+    /* A query must be a single statement that only reads */
+    if (query) {
+        while (tail && (*tail == ' ' || *tail == '\t' || *tail == '\n' ||
+                        *tail == '\r' || *tail == ';')) {
+            tail++;
+        }
+        if (!stmt || (tail && *tail) || !sqlite3_stmt_readonly(stmt)) {
+            sqlite3_finalize(stmt);
+            sqlite3_free(sql);
+            *err_msg = sqlite3_mprintf(
+                "Query for sheet '%s' must be a single read-only statement",
+                table_name);
+            return 1;
+        }
+    }
+    sqlite3_free(sql);
+    
+    col_count = sqlite3_column_count(stmt);
+    
+    if (col_count > 0) {
+        cols = sqlite3_malloc64(sizeof(ColRef) * (sqlite3_uint64)col_count);
+        if (sst) {
+            col_strings = sqlite3_malloc64(sizeof(int) * (sqlite3_uint64)col_count);
+        }
+        if (!cols || (sst && !col_strings)) {
+            sqlite3_free(cols);
+            sqlite3_free(col_strings);
+            sqlite3_finalize(stmt);
+            *err_msg = sqlite3_mprintf("Out of memory");
+            return 1;
+        }
+        for (col = 0; col < col_count; col++) {
+            col_to_letter(col, cols[col].letters);
+            cols[col].len = (int)strlen(cols[col].letters);
+        }
+        if (col_strings) memset(col_strings, 0, sizeof(int) * (size_t)col_count);
+    }
+    
+    /* Start worksheet XML */
+    strbuf_append(&sb,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
+        "xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
+        "<sheetData>");
+    
+    /* Write header row with column names (style 1 = bold) */
+    strbuf_append(&sb, "<row r=\"1\">");
+    for (col = 0; col < col_count && !oom; col++) {
+        const char *col_name = sqlite3_column_name(stmt, col);
+        size_t name_len = col_name ? strlen(col_name) : 0;
+        if (strbuf_reserve(&sb, CELL_MAX_NUMBER + name_len * XML_ESCAPE_MAX)) {
+            oom = 1;
+            break;
+        }
+        p = put_cell_ref(sb.str + sb.len, &cols[col], "1", 1);
+        p = PUT_LIT(p, "\" t=\"inlineStr\" s=\"1\"><is><t>");
+        p = xml_escape_to(p, col_name ? col_name : "", name_len);
+        p = PUT_LIT(p, "</t></is></c>");
+        sb.len = (size_t)(p - sb.str);
+    }
+    if (!oom) oom = strbuf_append(&sb, "</row>");
+    
+    /* Write data rows */
+    row_num = 2;
+    while (!oom && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char row_ref[12];
+        int row_len = (int)(put_int64(row_ref, row_num) - row_ref);
+        
+        if (strbuf_reserve(&sb, CELL_MAX_NUMBER)) {
+            oom = 1;
+            break;
+        }
+        p = PUT_LIT(sb.str + sb.len, "<row r=\"");
+        p = put_str(p, row_ref, (size_t)row_len);
+        p = PUT_LIT(p, "\">");
+        sb.len = (size_t)(p - sb.str);
+        
+        for (col = 0; col < col_count && !oom; col++) {
+            int col_type = sqlite3_column_type(stmt, col);
+            
+            switch (col_type) {
+                case SQLITE_INTEGER:
+                case SQLITE_FLOAT:
+                    if (strbuf_reserve(&sb, CELL_MAX_NUMBER)) {
+                        oom = 1;
+                        break;
+                    }
+                    p = put_cell_ref(sb.str + sb.len, &cols[col], row_ref, row_len);
+                    p = PUT_LIT(p, "\"><v>");
+                    if (col_type == SQLITE_INTEGER) {
+                        p = put_int64(p, sqlite3_column_int64(stmt, col));
+                    } else {
+                        p = put_double(p, sqlite3_column_double(stmt, col));
+                    }
+                    p = PUT_LIT(p, "</v></c>");
+                    sb.len = (size_t)(p - sb.str);
+                    cells++;
+                    break;
+                    
+                case SQLITE_TEXT: {
+                    const char *text = (const char *)sqlite3_column_text(stmt, col);
                     int text_len = sqlite3_column_bytes(stmt, col);
-                    char *text_to_escape = NULL;
+                    int sst_index = -1;
+                    
+                    if (!text) {
+                        text = "";
+                        text_len = 0;
+                    }
                     
                     /* Check for Excel cell size limit */
                     if (text_len > EXCEL_MAX_CELL_SIZE) {
                         /* Truncate the text */
-                        text_to_escape = sqlite3_malloc(EXCEL_MAX_CELL_SIZE + 1);
-                        if (text_to_escape) {
-                            memcpy(text_to_escape, text, EXCEL_MAX_CELL_SIZE);
-                            text_to_escape[EXCEL_MAX_CELL_SIZE] = '\0';
-                        }
+                        text_len = EXCEL_MAX_CELL_SIZE;
                         /* Track warning */
                         warnings->cells_truncated++;
                         if (warnings->cells_truncated == 1) {
@@ -400,25 +1612,36 @@ static char *gen_worksheet(sqlite3 *db, const char *table_name, char **err_msg,
                         }
                     }
                     
-                    char *escaped = xml_escape(text_to_escape ? text_to_escape : text);
-                    strbuf_appendf(&sb, "<c r=\"%s%d\" t=\"inlineStr\"><is><t>%s</t></is></c>",
-                        col_letter, row_num, escaped);
-                    sqlite3_free(escaped);
-                    sqlite3_free(text_to_escape);
+                    if (col_strings) {
+                        sst_index = sst_intern(sst, text, text_len, &col_strings[col]);
+                    }
+                    if (strbuf_reserve(&sb, CELL_MAX_NUMBER +
+                                       (size_t)text_len * XML_ESCAPE_MAX)) {
+                        oom = 1;
+                        break;
+                    }
+                    p = put_cell_ref(sb.str + sb.len, &cols[col], row_ref, row_len);
+                    if (sst_index >= 0) {
+                        p = PUT_LIT(p, "\" t=\"s\"><v>");
+                        p = put_int64(p, sst_index);
+                        p = PUT_LIT(p, "</v></c>");
+                    } else {
+                        p = PUT_LIT(p, "\" t=\"inlineStr\"><is><t>");
+                        p = xml_escape_to(p, text, (size_t)text_len);
+                        p = PUT_LIT(p, "</t></is></c>");
+                    }
+                    sb.len = (size_t)(p - sb.str);
+                    cells++;
                     break;
                 }
                     
                 case SQLITE_BLOB: {
                     /* Write BLOBs as hex strings */
                     int blob_size = sqlite3_column_bytes(stmt, col);
-                    int hex_len = blob_size * 2;
-                    int truncated = 0;
                     
                     /* Check for Excel cell size limit (hex is 2x blob size) */
-                    if (hex_len > EXCEL_MAX_CELL_SIZE) {
+                    if (blob_size * 2 > EXCEL_MAX_CELL_SIZE) {
                         blob_size = EXCEL_MAX_CELL_SIZE / 2;
-                        hex_len = blob_size * 2;
-                        truncated = 1;
                         /* Track warning */
                         warnings->cells_truncated++;
                         if (warnings->cells_truncated == 1) {
@@ -429,18 +1652,16 @@ static char *gen_worksheet(sqlite3 *db, const char *table_name, char **err_msg,
                     }
                     
                     const unsigned char *blob = sqlite3_column_blob(stmt, col);
-                    char *hex = sqlite3_malloc(hex_len + 1);
-                    if (hex) {
-                        int i;
-                        for (i = 0; i < blob_size; i++) {
-                            sprintf(hex + i * 2, "%02X", blob[i]);
-                        }
-                        hex[hex_len] = '\0';
-                        strbuf_appendf(&sb, "<c r=\"%s%d\" t=\"inlineStr\"><is><t>%s</t></is></c>",
-                            col_letter, row_num, hex);
-                        sqlite3_free(hex);
+                    if (strbuf_reserve(&sb, CELL_MAX_NUMBER + (size_t)blob_size * 2)) {
+                        oom = 1;
+                        break;
                     }
-                    (void)truncated; /* Used for tracking only */
+                    p = put_cell_ref(sb.str + sb.len, &cols[col], row_ref, row_len);
+                    p = PUT_LIT(p, "\" t=\"inlineStr\"><is><t>");
+                    p = put_hex(p, blob, blob ? blob_size : 0);
+                    p = PUT_LIT(p, "</t></is></c>");
+                    sb.len = (size_t)(p - sb.str);
+                    cells++;
                     break;
                 }
                     
@@ -450,39 +1671,958 @@ static char *gen_worksheet(sqlite3 *db, const char *table_name, char **err_msg,
                     break;
             }
         }
-        
-        strbuf_append(&sb, "</row>");
-        row_num++;
+        if (oom) break;
+        
+        oom = strbuf_append(&sb, "</row>");
+        row_num++;
+        
+        /* Hand full chunks to the ZIP writer */
+        if (sb.len >= ZIP_CHUNK_SIZE) {
+            if (zip_entry_write(zw, sb.str, sb.len)) break;
+            sb.len = 0;
+        }
+        
+        progress_rc = export_progress_add(progress, table_name, zw, 1);
+        if (progress_rc != SQLITE_OK) break;
+    }
+    last_row = row_num - 1;
+    stats->rows += last_row - 1;
+    stats->cells += cells;
+    sqlite3_free(col_strings);
+    
+    if (rc == SQLITE_INTERRUPT) progress->interrupted = 1;
+    
+    if (oom || rc == SQLITE_ROW) {
+        sqlite3_finalize(stmt);
+        if (oom) {
+            *err_msg = sqlite3_mprintf("Out of memory");
+        } else if (progress_rc == SQLITE_INTERRUPT) {
+            *err_msg = sqlite3_mprintf("xlsx_export interrupted");
+        } else if (progress_rc != SQLITE_OK) {
+            *err_msg = sqlite3_mprintf("Progress function failed: %s",
+                sqlite3_errmsg(db));
+        } else {
+            *err_msg = sqlite3_mprintf("Failed to write worksheet for %s '%s'",
+                what, table_name);
+        }
+        sqlite3_free(cols);
+        strbuf_free(&sb);
+        return 1;
+    }
+    
+    sqlite3_finalize(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        *err_msg = sqlite3_mprintf("Error reading %s '%s': %s",
+            what, table_name, sqlite3_errmsg(db));
+        sqlite3_free(cols);
+        strbuf_free(&sb);
+        return 1;
+    }
+    
+    strbuf_append(&sb, "</sheetData>");
+    
+    /* Add autofilter for columns A through last column, rows 1 through last_row */
+    if (col_count > 0) {
+        strbuf_appendf(&sb, "<autoFilter ref=\"A1:%s%d\"/>",
+            cols[col_count - 1].letters, last_row);
+    }
+    sqlite3_free(cols);
+    
+    strbuf_append(&sb, "</worksheet>");
+    
+    rc = zip_entry_write(zw, sb.str, sb.len);
+    strbuf_free(&sb);
+    if (rc) {
+        *err_msg = sqlite3_mprintf("Failed to write worksheet for %s '%s'",
+            what, table_name);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+** Export cache
+**
+** With xlsx_export_config('cache', dir), xlsx_export() keeps the deflated
+** worksheet of every table it writes in dir, one file per database and
+** table, together with a fingerprint of the table. When a later export
+** finds the fingerprint unchanged, the worksheet bytes are copied from the
+** cache instead of being generated and deflated again. The XML of a
+** worksheet only depends on its table, so the bytes are valid at any
+** position of any workbook.
+**
+** The fingerprint covers the column names and, with
+** xlsx_export_config('cache_version', column), the row count and the
+** largest value of that column, which an index makes cheap. Without it, or
+** for a table lacking the column, it is a checksum of every value in the
+** table: reading the table once is still much cheaper than building and
+** deflating its XML. Sheets written with shared strings, of queries, or
+** with truncated cells are not cached.
+**
+** A cache file holds, little-endian: CACHE_MAGIC (changed whenever the
+** worksheet XML changes), the CRC-32, compressed and uncompressed sizes of
+** the worksheet, the length of the key, the key (database file, table name,
+** fingerprint and compression level) and the entry data: a raw deflate
+** stream, or the XML itself at level 0.
+*/
+
+#define CACHE_MAGIC "XLSXWS01"
+#define CACHE_HEADER_SIZE 32
+
+typedef struct CacheSheet {
+    char *key;                  /* NULL when the sheet is not cached */
+    char *path;                 /* Cache file of the sheet */
+    FILE *fp;                   /* Open at the data of a valid entry, or NULL */
+    int method;                 /* ZIP method of the data, from the level */
+    unsigned long crc;          /* Entry of the cache file, or as written */
+    sqlite3_uint64 comp_size;
+    sqlite3_uint64 uncomp_size;
+    sqlite3_uint64 data_offset; /* Where the written entry's data starts */
+    int written;                /* The sheet was generated into the archive */
+} CacheSheet;
+
+static unsigned long cache_get32(const unsigned char *p) {
+    return p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 |
+           (unsigned long)p[3] << 24;
+}
+
+static sqlite3_uint64 cache_get64(const unsigned char *p) {
+    return cache_get32(p) | (sqlite3_uint64)cache_get32(p + 4) << 32;
+}
+
+static void cache_hash(uLong *crc, uLong *adler, const void *data, size_t len) {
+    *crc = crc32(*crc, (const Bytef *)data, (uInt)len);
+    *adler = adler32(*adler, (const Bytef *)data, (uInt)len);
+}
+
+/*
+** Fingerprint of a table as described above, or NULL if it cannot be read
+** (the export then reports the error when it reads the table itself).
+*/
+static char *cache_fingerprint(sqlite3 *db, const char *table_name,
+                               const char *version_col) {
+    sqlite3_stmt *stmt = NULL;
+    char *sql = sqlite3_mprintf("SELECT * FROM \"%w\"", table_name);
+    char *fingerprint = NULL;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uLong adler = adler32(0L, Z_NULL, 0);
+    sqlite3_int64 rows = 0;
+    int has_version = 0;
+    int col_count;
+    int col;
+    int rc;
+
+    rc = sql ? sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+    col_count = sqlite3_column_count(stmt);
+    for (col = 0; col < col_count; col++) {
+        const char *name = sqlite3_column_name(stmt, col);
+        if (name) cache_hash(&crc, &adler, name, strlen(name) + 1);
+        if (name && version_col && sqlite3_stricmp(name, version_col) == 0) {
+            has_version = 1;
+        }
+    }
+
+    /* Only a real column: an unknown "name" would be read as a string */
+    if (has_version) {
+        sqlite3_stmt *version = NULL;
+        sql = sqlite3_mprintf("SELECT count(*), quote(max(\"%w\")) FROM \"%w\"",
+                              version_col, table_name);
+        if (sql && sqlite3_prepare_v2(db, sql, -1, &version, NULL) == SQLITE_OK &&
+            sqlite3_step(version) == SQLITE_ROW) {
+            fingerprint = sqlite3_mprintf("version %08lx %lld %s",
+                (unsigned long)crc, sqlite3_column_int64(version, 0),
+                (const char *)sqlite3_column_text(version, 1));
+        }
+        sqlite3_free(sql);
+        sqlite3_finalize(version);
+        if (fingerprint) {
+            sqlite3_finalize(stmt);
+            return fingerprint;
+        }
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        for (col = 0; col < col_count; col++) {
+            unsigned char head[9];
+            int type = sqlite3_column_type(stmt, col);
+            head[0] = (unsigned char)type;
+            switch (type) {
+                case SQLITE_INTEGER:
+                    zip_put64(head + 1, (sqlite3_uint64)sqlite3_column_int64(stmt, col));
+                    cache_hash(&crc, &adler, head, 9);
+                    break;
+                case SQLITE_FLOAT: {
+                    double d = sqlite3_column_double(stmt, col);
+                    memcpy(head + 1, &d, 8);
+                    cache_hash(&crc, &adler, head, 9);
+                    break;
+                }
+                case SQLITE_TEXT:
+                case SQLITE_BLOB: {
+                    const void *data = type == SQLITE_TEXT
+                        ? (const void *)sqlite3_column_text(stmt, col)
+                        : sqlite3_column_blob(stmt, col);
+                    int len = sqlite3_column_bytes(stmt, col);
+                    zip_put32(head + 1, (sqlite3_uint64)len);
+                    cache_hash(&crc, &adler, head, 5);
+                    if (data && len > 0) cache_hash(&crc, &adler, data, (size_t)len);
+                    break;
+                }
+                default:
+                    cache_hash(&crc, &adler, head, 1);
+                    break;
+            }
+        }
+        rows++;
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return NULL;
+    return sqlite3_mprintf("checksum %08lx %08lx %lld", (unsigned long)crc,
+                           (unsigned long)adler, rows);
+}
+
+/*
+** Open the cache file of cs and check that it holds the worksheet for
+** cs->key. On success cs->fp is left at the start of the deflate stream.
+*/
+static void cache_open(CacheSheet *cs) {
+    unsigned char head[CACHE_HEADER_SIZE];
+    size_t key_len = strlen(cs->key);
+    char *key = NULL;
+    FILE *fp = fopen(cs->path, "rb");
+    zip_off_t end;
+
+    if (!fp) return;
+    if (fread(head, 1, sizeof(head), fp) != sizeof(head) ||
+        memcmp(head, CACHE_MAGIC, 8) != 0 ||
+        cache_get32(head + 28) != key_len ||
+        !(key = sqlite3_malloc64(key_len + 1)) ||
+        fread(key, 1, key_len, fp) != key_len ||
+        memcmp(key, cs->key, key_len) != 0 ||
+        zip_fseek(fp, 0, SEEK_END) != 0 || (end = zip_ftell(fp)) < 0 ||
+        (sqlite3_uint64)end != CACHE_HEADER_SIZE + key_len + cache_get64(head + 12) ||
+        zip_fseek(fp, (zip_off_t)(CACHE_HEADER_SIZE + key_len), SEEK_SET) != 0) {
+        sqlite3_free(key);
+        fclose(fp);
+        return;
+    }
+    sqlite3_free(key);
+    cs->crc = cache_get32(head + 8);
+    cs->comp_size = cache_get64(head + 12);
+    cs->uncomp_size = cache_get64(head + 20);
+    cs->fp = fp;
+}
+
+/*
+** Find the cached worksheet of a table of db, fingerprinted through reader,
+** the connection the sheet will be read from. cs->fp is set on a hit;
+** cs->key is left NULL when the sheet cannot be cached. In-memory and
+** temporary databases have no file name to key the cache on, and are not
+** cached.
+*/
+static void cache_lookup(CacheSheet *cs, sqlite3 *db, sqlite3 *reader,
+                         const char *dir, const char *table_name,
+                         const char *version_col, int level) {
+    const char *db_file = sqlite3_db_filename(db, "main");
+    char *fingerprint;
+    sqlite3_uint64 h = 14695981039346656037ULL;  /* FNV-1a of file and table */
+    const char *p;
+
+    memset(cs, 0, sizeof(*cs));
+    if (!db_file || !db_file[0]) return;
+    fingerprint = cache_fingerprint(reader, table_name, version_col);
+    if (!fingerprint) return;
+    for (p = db_file; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    h *= 1099511628211ULL;
+    for (p = table_name; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+
+    cs->key = sqlite3_mprintf("%d:%s %d:%s %s level %d", (int)strlen(db_file),
+                              db_file, (int)strlen(table_name), table_name,
+                              fingerprint, level);
+    cs->method = level == 0 ? 0 : 8;
+    cs->path = sqlite3_mprintf("%s/%016llx.xlsxsheet", dir, (unsigned long long)h);
+    sqlite3_free(fingerprint);
+    if (!cs->key || !cs->path) {
+        sqlite3_free(cs->key);
+        sqlite3_free(cs->path);
+        cs->key = cs->path = NULL;
+        return;
+    }
+    cache_open(cs);
+}
+
+/* Copy the cached worksheet of cs into zw as entry_name */
+static int cache_copy(ZipWriter *zw, const char *entry_name, CacheSheet *cs) {
+    int rc = zip_entry_copy(zw, entry_name, cs->fp, cs->method, cs->crc,
+                            cs->comp_size, cs->uncomp_size);
+    fclose(cs->fp);
+    cs->fp = NULL;
+    return rc;
+}
+
+/* Remember where the worksheet just written to zw is, to cache it later */
+static void cache_note_entry(CacheSheet *cs, const ZipWriter *zw) {
+    const ZipWriterEntry *e = &zw->entries[zw->n_entries - 1];
+    if (!cs->key) return;
+    cs->crc = e->crc;
+    cs->comp_size = e->comp_size;
+    cs->uncomp_size = e->uncomp_size;
+    cs->data_offset = e->local_offset + 30 + strlen(e->name) +
+                      (e->zip64 ? ZIP64_LFH_EXTRA : 0);
+    cs->written = 1;
+}
+
+/*
+** Save the worksheet of cs from the finished archive. The cache is only an
+** optimisation, so failures just leave the previous cache file, if any.
+*/
+static void cache_store(const CacheSheet *cs, FILE *archive) {
+    unsigned char head[CACHE_HEADER_SIZE];
+    unsigned char buf[ZIP_CHUNK_SIZE];
+    size_t key_len = strlen(cs->key);
+    sqlite3_uint64 left = cs->comp_size;
+    char *tmp = sqlite3_mprintf("%s.tmp", cs->path);
+    FILE *fp = tmp ? fopen(tmp, "wb") : NULL;
+    int ok = fp != NULL;
+
+    memcpy(head, CACHE_MAGIC, 8);
+    zip_put32(head + 8, cs->crc);
+    zip_put64(head + 12, cs->comp_size);
+    zip_put64(head + 20, cs->uncomp_size);
+    zip_put32(head + 28, key_len);
+    ok = ok && fwrite(head, 1, sizeof(head), fp) == sizeof(head) &&
+         fwrite(cs->key, 1, key_len, fp) == key_len &&
+         zip_fseek(archive, (zip_off_t)cs->data_offset, SEEK_SET) == 0;
+    while (ok && left > 0) {
+        size_t n = left > sizeof(buf) ? sizeof(buf) : (size_t)left;
+        ok = fread(buf, 1, n, archive) == n && fwrite(buf, 1, n, fp) == n;
+        left -= n;
+    }
+    if (fp && fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, cs->path) != 0) {
+        /* Windows does not replace an existing file */
+        remove(cs->path);
+        ok = rename(tmp, cs->path) == 0;
+    }
+    if (!ok && tmp) remove(tmp);
+    sqlite3_free(tmp);
+}
+
+static void cache_free(CacheSheet *cache, int n) {
+    int i;
+    for (i = 0; cache && i < n; i++) {
+        if (cache[i].fp) fclose(cache[i].fp);
+        sqlite3_free(cache[i].key);
+        sqlite3_free(cache[i].path);
+    }
+    sqlite3_free(cache);
+}
+
+/*
+** Parallel export
+**
+** With xlsx_export_config('threads', N) and more than one sheet, up to N
+** worker threads each take the next sheet in order, read it through their
+** own read-only connection and write it, deflated, to a spool archive.
+** The calling thread appends the spools to the output in sheet order as
+** they complete, so the file is the same as a serial export (the order of
+** shared strings aside).
+**
+** All the readers must see the same data. SQLite does not offer its WAL
+** snapshot functions to loadable extensions, so the calling connection
+** instead holds the write lock (BEGIN IMMEDIATE) while every reader starts
+** its read transaction: no commit can happen in between, in WAL or
+** rollback journal mode. The lock is released before any sheet is read.
+**
+** Tables that another connection cannot see the same way (temp or attached
+** schemas, virtual tables and views that need this connection's modules
+** or functions, an in-memory database, uncommitted changes of an open
+** transaction) are exported serially instead.
+*/
+
+#define MAX_EXPORT_THREADS 64
+
+/* How long a reader waits for a lock while starting its transaction */
+#define EXPORT_READER_BUSY_MS 2000
+
+typedef struct SheetJob {
+    const char *table_name;
+    int sheet_num;              /* 1-based, names the worksheet part */
+    ZipWriter *spool;           /* The finished worksheet entry */
+    ExportWarnings warnings;
+    ExportStats stats;          /* Work done for this sheet */
+    ExportProgress progress;    /* Interrupt watch, without a callback */
+    CacheSheet *cache;          /* Cache entry of the sheet, or NULL */
+    char *err_msg;              /* Error from gen_worksheet(), or NULL */
+    int done;                   /* Worker finished; rc is valid */
+    int rc;
+} SheetJob;
+
+typedef struct ExportPool {
+    const ZipWriter *archive;   /* Output archive, for the entry time */
+    SharedStrings *sst;         /* Shared string table, or NULL */
+    int level;                  /* zlib level of the worksheets */
+    SheetJob *jobs;
+    int n_jobs;
+    int next_job;               /* Next job to hand to a worker */
+    int cancel;                 /* Set by the writer to stop the workers */
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;    /* Signalled when a job is done */
+} ExportPool;
+
+typedef struct ExportWorker {
+    ExportPool *pool;
+    sqlite3 *db;                /* This worker's read-only connection */
+    pthread_t thread;
+} ExportWorker;
+
+static void *export_worker_main(void *arg) {
+    ExportWorker *w = (ExportWorker *)arg;
+    ExportPool *pool = w->pool;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->cancel || pool->next_job >= pool->n_jobs) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        SheetJob *job = &pool->jobs[pool->next_job++];
+        if (job->cache && job->cache->fp) {
+            /* The writer copies it from the cache */
+            job->done = 1;
+            pthread_cond_broadcast(&pool->finished);
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        char entry_name[64];
+        int rc = 1;
+        sqlite3_int64 t0 = xlsx_now_ns();
+        snprintf(entry_name, sizeof(entry_name), "xl/worksheets/sheet%d.xml",
+                 job->sheet_num);
+        job->spool = sqlite3_malloc(sizeof(ZipWriter));
+        if (job->spool && zip_writer_spool(job->spool, pool->archive) == 0 &&
+            zip_entry_begin(job->spool, entry_name, pool->level, 1) == 0 &&
+            gen_worksheet(w->db, job->table_name, NULL, job->spool, pool->sst,
+                          &job->err_msg, &job->warnings, &job->stats,
+                          &job->progress) == 0 &&
+            zip_entry_end(job->spool) == 0) {
+            rc = 0;
+        }
+        if (job->spool) {
+            job->stats.deflate_ns = job->spool->deflate_ns;
+            job->stats.write_ns = job->spool->write_ns;
+            job->stats.bytes_xml = (sqlite3_int64)job->spool->bytes_in;
+            job->stats.generate_ns = xlsx_now_ns() - t0 -
+                job->stats.deflate_ns - job->stats.write_ns;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        job->rc = rc;
+        job->done = 1;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return NULL;
+}
+
+static void export_readers_close(sqlite3 **readers, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (readers[i]) {
+            sqlite3_exec(readers[i], "COMMIT", NULL, NULL, NULL);
+            sqlite3_close(readers[i]);
+            readers[i] = NULL;
+        }
+    }
+}
+
+/* Is every table visible, and readable, through reader as through db? */
+static int export_tables_shareable(sqlite3 *db, sqlite3 *reader,
+                                   const char **table_names, int n) {
+    sqlite3_stmt *stmt = NULL;
+    int ok = 1;
+    int i;
+
+    /* Must be in main and not hidden by a temp object of the same name */
+    if (sqlite3_prepare_v2(db,
+            "SELECT EXISTS (SELECT 1 FROM main.sqlite_master "
+            "WHERE type IN ('table', 'view') AND name = ?1 COLLATE NOCASE) "
+            "AND NOT EXISTS (SELECT 1 FROM temp.sqlite_master "
+            "WHERE name = ?1 COLLATE NOCASE)", -1, &stmt, NULL) != SQLITE_OK) {
+        return 0;
+    }
+    for (i = 0; i < n && ok; i++) {
+        sqlite3_bind_text(stmt, 1, table_names[i], -1, SQLITE_STATIC);
+        ok = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    /* Preparing catches modules, functions and collations it lacks */
+    for (i = 0; i < n && ok; i++) {
+        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\"", table_names[i]);
+        ok = sql && sqlite3_prepare_v2(reader, sql, -1, &stmt, NULL) == SQLITE_OK;
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+        sqlite3_free(sql);
+    }
+    return ok;
+}
+
+/* Can a spool archive be created? */
+static int export_spool_available(const ZipWriter *zw) {
+    ZipWriter spool;
+    if (zip_writer_spool(&spool, zw)) return 0;
+    zip_writer_abort(&spool, NULL);
+    return 1;
+}
+
+/*
+** Open n read-only connections to the main database of db, each in a read
+** transaction on the same committed state. Returns n, or 0 (with nothing
+** left open) when the tables must be exported serially.
+*/
+static int export_readers_open(sqlite3 *db, const char **table_names,
+                               int n_tables, sqlite3 **readers, int n) {
+    const char *path = sqlite3_db_filename(db, "main");
+    int rc = SQLITE_OK;
+    int i;
+
+    if (!sqlite3_threadsafe() || !path || !path[0] ||
+        sqlite3_txn_state(db, NULL) != SQLITE_TXN_NONE) {
+        return 0;
+    }
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK) {
+        return 0;
+    }
+    for (i = 0; i < n && rc == SQLITE_OK; i++) {
+        rc = sqlite3_open_v2(path, &readers[i], SQLITE_OPEN_READONLY, NULL);
+        if (rc == SQLITE_OK) {
+            sqlite3_busy_timeout(readers[i], EXPORT_READER_BUSY_MS);
+            rc = sqlite3_exec(readers[i],
+                "BEGIN; SELECT count(*) FROM sqlite_master", NULL, NULL, NULL);
+        }
+    }
+    if (rc == SQLITE_OK &&
+        !export_tables_shareable(db, readers[0], table_names, n_tables)) {
+        rc = SQLITE_ERROR;
+    }
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+    if (rc != SQLITE_OK) {
+        export_readers_close(readers, n);
+        return 0;
+    }
+    return n;
+}
+
+/* Keep the first truncation warning of the workbook */
+static void export_merge_warnings(ExportWarnings *into, const ExportWarnings *w) {
+    if (w->cells_truncated == 0) return;
+    if (into->cells_truncated == 0) {
+        into->first_truncated_row = w->first_truncated_row;
+        into->first_truncated_col = w->first_truncated_col;
+        into->first_truncated_table = w->first_truncated_table;
+    }
+    into->cells_truncated += w->cells_truncated;
+}
+
+/* Add the work of a sheet written by a worker */
+static void export_merge_stats(ExportStats *into, const ExportStats *s) {
+    into->generate_ns += s->generate_ns;
+    into->deflate_ns += s->deflate_ns;
+    into->write_ns += s->write_ns;
+    into->bytes_xml += s->bytes_xml;
+    into->rows += s->rows;
+    into->cells += s->cells;
+}
+
+/*
+** Write the worksheets of table_names into zw with one worker per reader,
+** compressed at level. Returns 0 on success. On failure *err_msg is NULL for a ZIP write error.
+*/
+static int export_sheets_parallel(ZipWriter *zw, const char **table_names,
+                                  int n_tables, sqlite3 **readers,
+                                  int n_readers, SharedStrings *sst,
+                                  ExportWarnings *warnings, ExportStats *stats,
+                                  ExportProgress *progress, CacheSheet *cache,
+                                  int level, char **err_msg) {
+    ExportPool pool;
+    ExportWorker workers[MAX_EXPORT_THREADS];
+    pthread_mutex_t sst_mutex;
+    int n_started = 0;
+    int rc = 0;
+    int i;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.jobs = sqlite3_malloc64(sizeof(SheetJob) * (sqlite3_uint64)n_tables);
+    if (!pool.jobs) {
+        *err_msg = sqlite3_mprintf("Out of memory");
+        return 1;
+    }
+    memset(pool.jobs, 0, sizeof(SheetJob) * (size_t)n_tables);
+    for (i = 0; i < n_tables; i++) {
+        pool.jobs[i].table_name = table_names[i];
+        pool.jobs[i].sheet_num = i + 1;
+        pool.jobs[i].progress.watch = progress->watch;
+        pool.jobs[i].cache = cache ? &cache[i] : NULL;
+    }
+    pool.n_jobs = n_tables;
+    pool.archive = zw;
+    pool.sst = sst;
+    pool.level = level;
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    if (sst) {
+        pthread_mutex_init(&sst_mutex, NULL);
+        sst->mutex = &sst_mutex;
+    }
+
+    for (i = 0; i < n_readers; i++) {
+        workers[n_started].pool = &pool;
+        workers[n_started].db = readers[i];
+        if (pthread_create(&workers[n_started].thread, NULL,
+                           export_worker_main, &workers[n_started]) != 0) {
+            break;
+        }
+        n_started++;
+    }
+    if (n_started == 0) {
+        *err_msg = sqlite3_mprintf("Cannot start export threads");
+        rc = 1;
+    }
+    stats->threads = n_started;
+
+    for (i = 0; i < n_tables && rc == 0; i++) {
+        SheetJob *job = &pool.jobs[i];
+        pthread_mutex_lock(&pool.mutex);
+        while (!job->done) {
+            pthread_cond_wait(&pool.finished, &pool.mutex);
+        }
+        pthread_mutex_unlock(&pool.mutex);
+
+        if (job->rc) {
+            *err_msg = job->err_msg;
+            job->err_msg = NULL;
+            if (job->progress.interrupted) progress->interrupted = 1;
+            rc = 1;
+            break;
+        }
+        if (job->cache && job->cache->fp) {
+            char entry_name[64];
+            snprintf(entry_name, sizeof(entry_name), "xl/worksheets/sheet%d.xml",
+                     job->sheet_num);
+            rc = cache_copy(zw, entry_name, job->cache);
+            stats->sheets++;
+            stats->sheets_cached++;
+            continue;
+        }
+        export_merge_warnings(warnings, &job->warnings);
+        export_merge_stats(stats, &job->stats);
+        rc = zip_writer_append(zw, job->spool);
+        sqlite3_free(job->spool);
+        job->spool = NULL;
+        stats->sheets++;
+        if (rc == 0 && job->cache && job->warnings.cells_truncated == 0) {
+            cache_note_entry(job->cache, zw);
+        }
+        
+        /* Progress is reported by this thread, once per sheet */
+        if (rc == 0) {
+            int prc = export_progress_add(progress, job->table_name, zw,
+                                          job->stats.rows);
+            if (prc != SQLITE_OK) {
+                *err_msg = prc == SQLITE_INTERRUPT
+                    ? sqlite3_mprintf("xlsx_export interrupted")
+                    : sqlite3_mprintf("Progress function failed: %s",
+                                      sqlite3_errmsg(progress->watch));
+                rc = 1;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.cancel = 1;
+    pthread_mutex_unlock(&pool.mutex);
+    for (i = 0; i < n_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < n_tables; i++) {
+        if (pool.jobs[i].spool) {
+            zip_writer_abort(pool.jobs[i].spool, NULL);
+            sqlite3_free(pool.jobs[i].spool);
+        }
+        sqlite3_free(pool.jobs[i].err_msg);
+    }
+    sqlite3_free(pool.jobs);
+    if (sst) {
+        sst->mutex = NULL;
+        pthread_mutex_destroy(&sst_mutex);
+    }
+    pthread_cond_destroy(&pool.finished);
+    pthread_mutex_destroy(&pool.mutex);
+    return rc;
+}
+
+/*
+** Write the workbook filename with one sheet per entry of sheet_names and
+** set the result of context. The sheets are the tables of those names, or
+** the rows of queries[i] when queries is not NULL.
+*/
+static void export_workbook(
+    sqlite3_context *context,
+    const char *filename,
+    const char **sheet_names,
+    const char **queries,
+    int sheet_count
+) {
+    ExportConfig *cfg = (ExportConfig *)sqlite3_user_data(context);
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    char *err_msg = NULL;
+    int i;
+    char *content_types = NULL;
+    char *rels = NULL;
+    char *workbook_rels = NULL;
+    char *workbook = NULL;
+    char *styles = NULL;
+    int rc;
+    ExportWarnings warnings = {0, 0, 0, NULL};
+    ZipWriter zw;
+    int zw_open = 0;
+    int zw_used = 0;          /* zw holds counters for the statistics */
+    SharedStrings sst;
+    sqlite3 *readers[MAX_EXPORT_THREADS];
+    int n_readers = 0;
+    ExportStats stats;
+    ExportProgress progress;
+    CacheSheet *cache = NULL;
+    int n_generate = sheet_count;   /* Sheets not found in the cache */
+    sqlite3_int64 start = xlsx_now_ns();
+    sqlite3_int64 t0;
+    
+    memset(&stats, 0, sizeof(stats));
+    stats.result = SQLITE_ERROR;
+    memset(&progress, 0, sizeof(progress));
+    progress.watch = db;
+    progress.every = cfg->progress_rows;
+    progress.next = cfg->progress_rows;
+    sst_init(&sst, cfg->shared_strings_max);
+    
+    if (cfg->progress) {
+        char *sql = sqlite3_mprintf("SELECT \"%w\"(?1, ?2, ?3, NULL)", cfg->progress);
+        rc = sql ? sqlite3_prepare_v2(db, sql, -1, &progress.callback, NULL)
+                 : SQLITE_NOMEM;
+        sqlite3_free(sql);
+        if (rc != SQLITE_OK) {
+            err_msg = sqlite3_mprintf("Cannot call progress function '%s': %s",
+                                      cfg->progress, sqlite3_errmsg(db));
+            sqlite3_result_error(context, err_msg, -1);
+            sqlite3_free(err_msg);
+            goto cleanup;
+        }
+    }
+    
+    /* Generate the XML parts that do not depend on the table contents */
+    content_types = gen_content_types(sheet_count, cfg->shared_strings);
+    rels = gen_rels();
+    workbook_rels = gen_workbook_rels(sheet_count, cfg->shared_strings);
+    workbook = gen_workbook(sheet_names, sheet_count);
+    styles = gen_styles();
+    
+    if (!content_types || !rels || !workbook_rels || !workbook || !styles) {
+        sqlite3_result_error(context, "Failed to generate XML content", -1);
+        goto cleanup;
+    }
+    
+    /* Write the archive, streaming each worksheet as its rows are read */
+    zw_used = 1;
+    if (zip_writer_open(&zw, filename)) {
+        err_msg = sqlite3_mprintf("Cannot create file '%s'", filename);
+        sqlite3_result_error(context, err_msg, -1);
+        sqlite3_free(err_msg);
+        goto cleanup;
+    }
+    zw_open = 1;
+    
+    if (zip_write_entry(&zw, "[Content_Types].xml", content_types,
+                        cfg->level_parts) ||
+        zip_write_entry(&zw, "_rels/.rels", rels, cfg->level_parts) ||
+        zip_write_entry(&zw, "xl/_rels/workbook.xml.rels", workbook_rels,
+                        cfg->level_parts) ||
+        zip_write_entry(&zw, "xl/workbook.xml", workbook,
+                        cfg->level_parts)) {
+        goto write_error;
+    }
+    
+    /*
+    ** Queries may use this connection's temp objects and functions. The
+    ** workers need temporary files for their spools, otherwise the sheets
+    ** are written serially.
+    */
+    t0 = xlsx_now_ns();
+    if (cfg->threads > 1 && sheet_count > 1 && !queries &&
+        export_spool_available(&zw)) {
+        n_readers = cfg->threads < sheet_count ? cfg->threads : sheet_count;
+        n_readers = export_readers_open(db, sheet_names, sheet_count,
+                                        readers, n_readers);
+    }
+    
+    /*
+    ** Worksheets of unchanged tables come from the cache. Fingerprints are
+    ** taken in the snapshot of the readers, which the sheets are read from.
+    */
+    if (cfg->cache && !queries && !cfg->shared_strings) {
+        cache = sqlite3_malloc64(sizeof(CacheSheet) * (sqlite3_uint64)sheet_count);
+        if (!cache) goto write_error;
+        for (i = 0; i < sheet_count; i++) {
+            cache_lookup(&cache[i], db, n_readers > 0 ? readers[0] : db,
+                         cfg->cache, sheet_names[i], cfg->cache_version,
+                         cfg->level);
+            if (cache[i].fp) n_generate--;
+        }
+    }
+    
+    /* Sheets copied from the cache need no worker */
+    if (n_readers > 1 && n_readers > n_generate) {
+        int keep = n_generate > 1 ? n_generate : 1;
+        export_readers_close(readers + keep, n_readers - keep);
+        n_readers = keep;
+    }
+    
+    if (n_readers > 0) {
+        rc = export_sheets_parallel(&zw, sheet_names, sheet_count,
+                                    readers, n_readers,
+                                    cfg->shared_strings ? &sst : NULL,
+                                    &warnings, &stats, &progress, cache,
+                                    cfg->level, &err_msg);
+        export_readers_close(readers, n_readers);
+        if (rc) {
+            if (!err_msg) goto write_error;
+            sqlite3_result_error(context, err_msg, -1);
+            sqlite3_free(err_msg);
+            goto cleanup;
+        }
+    } else {
+        for (i = 0; i < sheet_count; i++) {
+            char entry_name[64];
+            sqlite3_int64 sheet_start = xlsx_now_ns();
+            sqlite3_int64 deflate_ns = zw.deflate_ns;
+            sqlite3_int64 write_ns = zw.write_ns;
+            int truncated = warnings.cells_truncated;
+            snprintf(entry_name, sizeof(entry_name), "xl/worksheets/sheet%d.xml", i + 1);
+            if (cache && cache[i].fp) {
+                if (cache_copy(&zw, entry_name, &cache[i])) goto write_error;
+                stats.sheets++;
+                stats.sheets_cached++;
+                continue;
+            }
+            if (zip_entry_begin(&zw, entry_name, cfg->level, 1)) goto write_error;
+            if (gen_worksheet(db, sheet_names[i], queries ? queries[i] : NULL,
+                              &zw, cfg->shared_strings ? &sst : NULL,
+                              &err_msg, &warnings, &stats, &progress)) {
+                sqlite3_result_error(context, err_msg, -1);
+                sqlite3_free(err_msg);
+                goto cleanup;
+            }
+            if (zip_entry_end(&zw)) goto write_error;
+            if (cache && warnings.cells_truncated == truncated) {
+                cache_note_entry(&cache[i], &zw);
+            }
+            stats.generate_ns += xlsx_now_ns() - sheet_start -
+                (zw.deflate_ns - deflate_ns) - (zw.write_ns - write_ns);
+            stats.sheets++;
+        }
     }
-    last_row = row_num - 1;
+    stats.sheets_ns = xlsx_now_ns() - t0;
     
-    sqlite3_finalize(stmt);
+    /* The string table is complete once every sheet has been written */
+    if (cfg->shared_strings) {
+        t0 = xlsx_now_ns();
+        if (zip_entry_begin(&zw, "xl/sharedStrings.xml", cfg->level, 1) ||
+            gen_shared_strings(&sst, &zw) ||
+            zip_entry_end(&zw)) {
+            goto write_error;
+        }
+        stats.shared_strings_ns = xlsx_now_ns() - t0;
+        stats.shared_strings = sst.n_strings;
+    }
     
-    if (rc != SQLITE_DONE) {
-        *err_msg = sqlite3_mprintf("Error reading table '%s': %s",
-            table_name, sqlite3_errmsg(db));
-        strbuf_free(&sb);
-        return NULL;
+    if (zip_write_entry(&zw, "xl/styles.xml", styles, cfg->level_parts)) {
+        goto write_error;
+    }
+    zw_open = 0;
+    if (zip_writer_close(&zw)) {
+        remove(filename);
+        goto write_error;
     }
     
-    strbuf_append(&sb, "</sheetData>");
+    /* Keep the worksheets just generated for the next export */
+    if (cache) {
+        FILE *archive = fopen(filename, "rb");
+        for (i = 0; archive && i < sheet_count; i++) {
+            if (cache[i].written) cache_store(&cache[i], archive);
+        }
+        if (archive) fclose(archive);
+    }
     
-    /* Add autofilter for columns A through last column, rows 1 through last_row */
-    if (col_count > 0) {
-        char last_col_letter[16];
-        col_to_letter(col_count - 1, last_col_letter);
-        strbuf_appendf(&sb, "<autoFilter ref=\"A1:%s%d\"/>", last_col_letter, last_row);
+    /* Return the filename on success, with warning if cells were truncated */
+    if (warnings.cells_truncated > 0) {
+        char *result = sqlite3_mprintf(
+            "%s (WARNING: %d cell(s) exceeded Excel's %d character limit and were truncated. "
+            "First occurrence: table '%s', row %d, column %d)",
+            filename, warnings.cells_truncated, EXCEL_MAX_CELL_SIZE,
+            warnings.first_truncated_table, warnings.first_truncated_row,
+            warnings.first_truncated_col);
+        sqlite3_result_text(context, result, -1, sqlite3_free);
+    } else {
+        sqlite3_result_text(context, filename, -1, SQLITE_TRANSIENT);
     }
+    stats.result = SQLITE_OK;
+    goto cleanup;
     
-    strbuf_append(&sb, "</worksheet>");
+write_error:
+    err_msg = sqlite3_mprintf("Failed to write ZIP file '%s'", filename);
+    sqlite3_result_error(context, err_msg, -1);
+    sqlite3_free(err_msg);
     
-    return sb.str;
+cleanup:
+    if (zw_open) zip_writer_abort(&zw, filename);
+    export_readers_close(readers, n_readers);
+    sqlite3_finalize(progress.callback);
+    if (stats.result != SQLITE_OK && progress.interrupted) {
+        stats.result = SQLITE_INTERRUPT;
+        sqlite3_result_error_code(context, SQLITE_INTERRUPT);
+    }
+    if (zw_used) {
+        stats.deflate_ns += zw.deflate_ns;
+        stats.write_ns += zw.write_ns;
+        stats.bytes_xml += (sqlite3_int64)zw.bytes_in;
+        stats.bytes_written = (sqlite3_int64)zw.offset;
+    }
+    stats.total_ns = xlsx_now_ns() - start;
+    cfg->last = stats;
+    cache_free(cache, sheet_count);
+    sst_free(&sst);
+    sqlite3_free(content_types);
+    sqlite3_free(rels);
+    sqlite3_free(workbook_rels);
+    sqlite3_free(workbook);
+    sqlite3_free(styles);
 }
 
 /*
 ** SQL function: xlsx_export(filename [, table1, table2, ...])
 **
-** Exports tables to an XLSX file using the zipfile extension.
+** Exports tables to an XLSX file, written with the built-in ZIP writer.
 ** The first argument is the output filename.
 ** If no table names are provided, all tables in the schema are exported.
 ** If table names are provided, only those tables are exported.
@@ -495,21 +2635,11 @@ static void xlsx_export_func(
 ) {
     sqlite3 *db;
     const char *filename;
-    char *err_msg = NULL;
     int i;
     int sheet_count;
     const char **sheet_names = NULL;
     char **sheet_names_allocated = NULL;  /* For freeing dynamically allocated names */
-    char **sheet_contents = NULL;
-    char *content_types = NULL;
-    char *rels = NULL;
-    char *workbook_rels = NULL;
-    char *workbook = NULL;
-    char *styles = NULL;
-    sqlite3_stmt *stmt = NULL;
-    char *sql = NULL;
     int rc;
-    ExportWarnings warnings = {0, 0, 0, NULL};
     int names_need_free = 0;  /* Flag to indicate if we need to free sheet_names_allocated */
     
     /* Need at least the filename */
@@ -610,143 +2740,343 @@ static void xlsx_export_func(
         }
     }
     
-    /* Allocate sheet_contents array */
-    sheet_contents = sqlite3_malloc(sizeof(char *) * sheet_count);
-    if (!sheet_contents) {
-        sqlite3_result_error(context, "Out of memory", -1);
-        goto cleanup;
-    }
-    memset(sheet_contents, 0, sizeof(char *) * sheet_count);
+    export_workbook(context, filename, sheet_names, NULL, sheet_count);
     
-    /* Generate all worksheet contents */
-    for (i = 0; i < sheet_count; i++) {
-        sheet_contents[i] = gen_worksheet(db, sheet_names[i], &err_msg, &warnings);
-        if (!sheet_contents[i]) {
-            sqlite3_result_error(context, err_msg, -1);
-            sqlite3_free(err_msg);
-            goto cleanup;
+    if (names_need_free) {
+        for (i = 0; i < sheet_count; i++) {
+            sqlite3_free((char *)sheet_names[i]);
         }
     }
+    sqlite3_free((void *)sheet_names);
+}
+
+/*
+** SQL function: xlsx_export_query(filename, sheet1, sql1 [, sheet2, sql2, ...])
+**
+** Exports the rows of SELECT statements to an XLSX file, one sheet per
+** pair of arguments, without copying them to a table first. Each statement
+** must be a single read-only statement; its result column names form the
+** header row. Returns the filename on success.
+*/
+static void xlsx_export_query_func(
+    sqlite3_context *context,
+    int argc,
+    sqlite3_value **argv
+) {
+    const char *filename;
+    const char **sheet_names;
+    const char **queries;
+    int sheet_count;
+    int i;
     
-    /* Generate other XML files */
-    content_types = gen_content_types(sheet_count);
-    rels = gen_rels();
-    workbook_rels = gen_workbook_rels(sheet_count);
-    workbook = gen_workbook(sheet_names, sheet_count);
-    styles = gen_styles();
-    
-    if (!content_types || !rels || !workbook_rels || !workbook || !styles) {
-        sqlite3_result_error(context, "Failed to generate XML content", -1);
-        goto cleanup;
+    if (argc < 3 || argc % 2 == 0) {
+        sqlite3_result_error(context,
+            "xlsx_export_query requires a filename and sheet name, query pairs", -1);
+        return;
+    }
+    for (i = 0; i < argc; i++) {
+        if (sqlite3_value_type(argv[i]) != SQLITE_TEXT) {
+            sqlite3_result_error(context,
+                "The filename, sheet names and queries must be strings", -1);
+            return;
+        }
     }
+    filename = (const char *)sqlite3_value_text(argv[0]);
+    sheet_count = (argc - 1) / 2;
     
-    /* Delete existing file first using writefile if it exists */
-    sql = sqlite3_mprintf("SELECT writefile(%Q, zeroblob(0))", filename);
-    sqlite3_exec(db, sql, NULL, NULL, NULL);
-    sqlite3_free(sql);
+    sheet_names = sqlite3_malloc(sizeof(char *) * 2 * sheet_count);
+    if (!sheet_names) {
+        sqlite3_result_error(context, "Out of memory", -1);
+        return;
+    }
+    queries = sheet_names + sheet_count;
+    for (i = 0; i < sheet_count; i++) {
+        sheet_names[i] = (const char *)sqlite3_value_text(argv[1 + 2 * i]);
+        queries[i] = (const char *)sqlite3_value_text(argv[2 + 2 * i]);
+    }
     
-    /* Now we need to use zipfile() to create the archive */
-    /* First, delete the file if it exists */
-    sql = sqlite3_mprintf("SELECT writefile(%Q, NULL)", filename);
-    sqlite3_exec(db, sql, NULL, NULL, NULL);
-    sqlite3_free(sql);
+    export_workbook(context, filename, sheet_names, queries, sheet_count);
+    sqlite3_free((void *)sheet_names);
+}
+
+/*
+** SQL function: xlsx_export_config(name [, value])
+**
+** Gets or sets an export option for this connection. Returns the value of
+** the option after any change.
+**
+** Options:
+**   sharedstrings     - 0 or 1 (default 0). Store text cells once in
+**                       xl/sharedStrings.xml and refer to them by index.
+**   sharedstrings_max - 1 or more (default 65536). Distinct strings a
+**                       column may add to the table; later new values of
+**                       that column are written inline.
+**   threads           - 1 to 64 (default 1). Number of threads that read
+**                       and deflate sheets when several tables are exported.
+**   progress          - Name of an SQL function called during exports as
+**                       fn(sheet_name, rows, bytes_written, NULL), or NULL
+**                       (default) for none. A true result cancels the
+**                       export. With threads it is called once per sheet.
+**   progress_rows     - 1 or more (default 100000). Rows between two calls
+**                       of the progress function.
+**   cache             - Directory of the export cache, or NULL (default)
+**                       for none. xlsx_export() keeps each table's deflated
+**                       worksheet there and reuses it while the table is
+**                       unchanged.
+**   cache_version     - Column whose maximum, with the row count, tells
+**                       whether a table changed, or NULL (default) to
+**                       compare a checksum of the whole table.
+**   compression       - 0 to 9 (default 6). zlib level of the worksheets
+**                       and xl/sharedStrings.xml: 1 is fastest, 9 smallest,
+**                       0 stores them uncompressed.
+**   compression_parts - 0 to 9 (default 6). The same for the other parts of
+**                       the workbook ([Content_Types].xml, the relationships,
+**                       xl/workbook.xml and xl/styles.xml).
+*/
+static void xlsx_export_config_func(
+    sqlite3_context *context,
+    int argc,
+    sqlite3_value **argv
+) {
+    ExportConfig *cfg = (ExportConfig *)sqlite3_user_data(context);
+    const char *name = (const char *)sqlite3_value_text(argv[0]);
     
-    /* Build the complete ZIP using zipfile() Aggregate Function */
-    {
-        StrBuf insert_sql;
-        strbuf_init(&insert_sql);
-        strbuf_append(&insert_sql, "WITH contents(name, data) AS (\n");
-        
-        /* [Content_Types].xml */
-        strbuf_append(&insert_sql, "VALUES('[Content_Types].xml', ?) UNION ALL \n");
-        
-        /* _rels/.rels */
-        strbuf_append(&insert_sql, "VALUES('_rels/.rels', ?) UNION ALL \n");
-        
-        /* xl/_rels/workbook.xml.rels */
-        strbuf_append(&insert_sql, "VALUES('xl/_rels/workbook.xml.rels', ?) UNION ALL \n");
-        
-        /* xl/workbook.xml */
-        strbuf_append(&insert_sql, "VALUES('xl/workbook.xml', ?) UNION ALL \n");
-        
-        /* xl/worksheets/sheetN.xml for each sheet */
-        for (i = 0; i < sheet_count; i++) {
-            strbuf_appendf(&insert_sql, "VALUES('xl/worksheets/sheet%d.xml', ?) UNION ALL \n", i + 1);
+    if (name && sqlite3_stricmp(name, "sharedstrings") == 0) {
+        if (argc > 1) {
+            cfg->shared_strings = sqlite3_value_int(argv[1]) != 0;
         }
-        
-        /* xl/styles.xml */
-        strbuf_append(&insert_sql, "VALUES('xl/styles.xml', ?)) \n");
-
-        strbuf_append(&insert_sql, "SELECT writefile(?, (SELECT zipfile(name, data) FROM contents))");
-
-        //fprintf(stderr, "zipfile_insert_via_vtab() %s\n", insert_sql.str);
-        rc = sqlite3_prepare_v2(db, insert_sql.str, -1, &stmt, NULL);
-        strbuf_free(&insert_sql);
-        
-        if (rc != SQLITE_OK) {
-            sqlite3_result_error(context, 
-                "Failed to prepare zipfile statement. Is the zipfile extension loaded?", -1);
-            goto cleanup;
+        sqlite3_result_int(context, cfg->shared_strings);
+    } else if (name && sqlite3_stricmp(name, "sharedstrings_max") == 0) {
+        if (argc > 1) {
+            int n = sqlite3_value_int(argv[1]);
+            cfg->shared_strings_max = n < 1 ? 1 : n;
         }
-        
-        /* Bind all parameters */
-        int param = 1;
-        sqlite3_bind_text(stmt, param++, content_types, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, param++, rels, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, param++, workbook_rels, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, param++, workbook, -1, SQLITE_STATIC);
-        for (i = 0; i < sheet_count; i++) {
-            sqlite3_bind_text(stmt, param++, sheet_contents[i], -1, SQLITE_STATIC);
+        sqlite3_result_int(context, cfg->shared_strings_max);
+    } else if (name && sqlite3_stricmp(name, "threads") == 0) {
+        if (argc > 1) {
+            int n = sqlite3_value_int(argv[1]);
+            cfg->threads =
+                n < 1 ? 1 : (n > MAX_EXPORT_THREADS ? MAX_EXPORT_THREADS : n);
         }
-        sqlite3_bind_text(stmt, param++, styles, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, param++, filename, -1, SQLITE_STATIC);
-        
-        rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
-        stmt = NULL;
-        
-        if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
-            err_msg = sqlite3_mprintf("Failed to create ZIP file: %s", sqlite3_errmsg(db));
-            sqlite3_result_error(context, err_msg, -1);
-            sqlite3_free(err_msg);
-            goto cleanup;
+        sqlite3_result_int(context, cfg->threads);
+    } else if (name && sqlite3_stricmp(name, "progress") == 0) {
+        if (argc > 1) {
+            const char *fn = (const char *)sqlite3_value_text(argv[1]);
+            char *copy = fn && *fn ? sqlite3_mprintf("%s", fn) : NULL;
+            if (fn && *fn && !copy) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            sqlite3_free(cfg->progress);
+            cfg->progress = copy;
         }
-    }
-    
-    /* Return the filename on success, with warning if cells were truncated */
-    if (warnings.cells_truncated > 0) {
-        char *result = sqlite3_mprintf(
-            "%s (WARNING: %d cell(s) exceeded Excel's %d character limit and were truncated. "
-            "First occurrence: table '%s', row %d, column %d)",
-            filename, warnings.cells_truncated, EXCEL_MAX_CELL_SIZE,
-            warnings.first_truncated_table, warnings.first_truncated_row,
-            warnings.first_truncated_col);
-        sqlite3_result_text(context, result, -1, sqlite3_free);
-    } else {
-        sqlite3_result_text(context, filename, -1, SQLITE_TRANSIENT);
-    }
-    
-cleanup:
-    if (stmt) sqlite3_finalize(stmt);
-    if (names_need_free && sheet_names) {
-        for (i = 0; i < sheet_count; i++) {
-            sqlite3_free((char *)sheet_names[i]);
+        if (cfg->progress) {
+            sqlite3_result_text(context, cfg->progress, -1, SQLITE_TRANSIENT);
+        } else {
+            sqlite3_result_null(context);
         }
-    }
-    if (sheet_names) sqlite3_free((void *)sheet_names);
-    if (sheet_contents) {
-        for (i = 0; i < sheet_count; i++) {
-            sqlite3_free(sheet_contents[i]);
+    } else if (name && sqlite3_stricmp(name, "progress_rows") == 0) {
+        if (argc > 1) {
+            int n = sqlite3_value_int(argv[1]);
+            cfg->progress_rows = n < 1 ? 1 : n;
+        }
+        sqlite3_result_int(context, cfg->progress_rows);
+    } else if (name && (sqlite3_stricmp(name, "cache") == 0 ||
+                        sqlite3_stricmp(name, "cache_version") == 0)) {
+        char **option = sqlite3_stricmp(name, "cache") == 0
+            ? &cfg->cache : &cfg->cache_version;
+        if (argc > 1) {
+            const char *value = (const char *)sqlite3_value_text(argv[1]);
+            char *copy = value && *value ? sqlite3_mprintf("%s", value) : NULL;
+            if (value && *value && !copy) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            sqlite3_free(*option);
+            *option = copy;
+        }
+        if (*option) {
+            sqlite3_result_text(context, *option, -1, SQLITE_TRANSIENT);
+        } else {
+            sqlite3_result_null(context);
+        }
+    } else if (name && (sqlite3_stricmp(name, "compression") == 0 ||
+                        sqlite3_stricmp(name, "compression_parts") == 0)) {
+        int *level = sqlite3_stricmp(name, "compression") == 0
+            ? &cfg->level : &cfg->level_parts;
+        if (argc > 1) {
+            int n = sqlite3_value_int(argv[1]);
+            *level = n < 0 ? 0 : (n > 9 ? 9 : n);
         }
-        sqlite3_free(sheet_contents);
+        sqlite3_result_int(context, *level);
+    } else {
+        char *msg = sqlite3_mprintf("Unknown xlsx_export option '%s'",
+                                    name ? name : "");
+        sqlite3_result_error(context, msg, -1);
+        sqlite3_free(msg);
     }
-    sqlite3_free(content_types);
-    sqlite3_free(rels);
-    sqlite3_free(workbook_rels);
-    sqlite3_free(workbook);
-    sqlite3_free(styles);
 }
 
+/*
+** Table-valued function: xlsx_export_stats
+**
+** Returns the statistics of the last xlsx_export() or xlsx_export_query()
+** call on this connection, one row per counter, with the columns name and
+** value. Calls rejected for their arguments, before anything is written,
+** leave the statistics unchanged.
+**
+**   SELECT json_group_object(name, value) FROM xlsx_export_stats;
+*/
+static const struct {
+    const char *name;
+    size_t offset;
+} export_stat_fields[] = {
+    { "result", offsetof(ExportStats, result) },
+    { "total_ns", offsetof(ExportStats, total_ns) },
+    { "sheets_ns", offsetof(ExportStats, sheets_ns) },
+    { "generate_ns", offsetof(ExportStats, generate_ns) },
+    { "deflate_ns", offsetof(ExportStats, deflate_ns) },
+    { "write_ns", offsetof(ExportStats, write_ns) },
+    { "shared_strings_ns", offsetof(ExportStats, shared_strings_ns) },
+    { "bytes_xml", offsetof(ExportStats, bytes_xml) },
+    { "bytes_written", offsetof(ExportStats, bytes_written) },
+    { "shared_strings", offsetof(ExportStats, shared_strings) },
+    { "sheets", offsetof(ExportStats, sheets) },
+    { "sheets_cached", offsetof(ExportStats, sheets_cached) },
+    { "rows", offsetof(ExportStats, rows) },
+    { "cells", offsetof(ExportStats, cells) },
+    { "threads", offsetof(ExportStats, threads) },
+};
+
+#define N_EXPORT_STATS \
+    ((int)(sizeof(export_stat_fields) / sizeof(export_stat_fields[0])))
+
+typedef struct StatsVtab {
+    sqlite3_vtab base;
+    const ExportConfig *cfg;    /* Connection settings holding the stats */
+} StatsVtab;
+
+typedef struct StatsCursor {
+    sqlite3_vtab_cursor base;
+    ExportStats stats;          /* Copy taken by xFilter */
+    int current;                /* Index into export_stat_fields */
+} StatsCursor;
+
+static int stats_connect(sqlite3 *db, void *pAux, int argc,
+                         const char *const *argv, sqlite3_vtab **ppVtab,
+                         char **pzErr) {
+    StatsVtab *vtab;
+    int rc;
+    (void)argc;
+    (void)argv;
+    (void)pzErr;
+
+    rc = sqlite3_declare_vtab(db, "CREATE TABLE x(name TEXT, value INTEGER)");
+    if (rc != SQLITE_OK) return rc;
+    vtab = sqlite3_malloc(sizeof(StatsVtab));
+    if (!vtab) return SQLITE_NOMEM;
+    memset(vtab, 0, sizeof(*vtab));
+    vtab->cfg = (const ExportConfig *)pAux;
+    *ppVtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int stats_disconnect(sqlite3_vtab *vtab) {
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+static int stats_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    (void)vtab;
+    info->estimatedCost = 1.0;
+    info->estimatedRows = N_EXPORT_STATS;
+    return SQLITE_OK;
+}
+
+static int stats_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **ppCursor) {
+    StatsCursor *cur = sqlite3_malloc(sizeof(StatsCursor));
+    (void)vtab;
+    if (!cur) return SQLITE_NOMEM;
+    memset(cur, 0, sizeof(*cur));
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int stats_close(sqlite3_vtab_cursor *cur) {
+    sqlite3_free(cur);
+    return SQLITE_OK;
+}
+
+static int stats_filter(sqlite3_vtab_cursor *base, int idxNum,
+                        const char *idxStr, int argc, sqlite3_value **argv) {
+    StatsCursor *cur = (StatsCursor *)base;
+    (void)idxNum;
+    (void)idxStr;
+    (void)argc;
+    (void)argv;
+    cur->stats = ((StatsVtab *)base->pVtab)->cfg->last;
+    cur->current = 0;
+    return SQLITE_OK;
+}
+
+static int stats_next(sqlite3_vtab_cursor *cur) {
+    ((StatsCursor *)cur)->current++;
+    return SQLITE_OK;
+}
+
+static int stats_eof(sqlite3_vtab_cursor *cur) {
+    return ((StatsCursor *)cur)->current >= N_EXPORT_STATS;
+}
+
+static int stats_column(sqlite3_vtab_cursor *base, sqlite3_context *context,
+                        int col) {
+    StatsCursor *cur = (StatsCursor *)base;
+    if (col == 0) {
+        sqlite3_result_text(context, export_stat_fields[cur->current].name,
+                            -1, SQLITE_STATIC);
+    } else {
+        sqlite3_int64 value;
+        memcpy(&value, (const char *)&cur->stats +
+               export_stat_fields[cur->current].offset, sizeof(value));
+        sqlite3_result_int64(context, value);
+    }
+    return SQLITE_OK;
+}
+
+static int stats_rowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid) {
+    *pRowid = ((StatsCursor *)cur)->current + 1;
+    return SQLITE_OK;
+}
+
+/* Eponymous only, so there is no xCreate */
+static sqlite3_module stats_module = {
+    0,                  /* iVersion */
+    0,                  /* xCreate */
+    stats_connect,      /* xConnect */
+    stats_best_index,   /* xBestIndex */
+    stats_disconnect,   /* xDisconnect */
+    0,                  /* xDestroy */
+    stats_open,         /* xOpen */
+    stats_close,        /* xClose */
+    stats_filter,       /* xFilter */
+    stats_next,         /* xNext */
+    stats_eof,          /* xEof */
+    stats_column,       /* xColumn */
+    stats_rowid,        /* xRowid */
+    0,                  /* xUpdate */
+    0,                  /* xBegin */
+    0,                  /* xSync */
+    0,                  /* xCommit */
+    0,                  /* xRollback */
+    0,                  /* xFindFunction */
+    0,                  /* xRename */
+    0,                  /* xSavepoint */
+    0,                  /* xRelease */
+    0,                  /* xRollbackTo */
+    0,                  /* xShadowName */
+    0                   /* xIntegrity */
+};
+
 /*
 ** SQL function: xlsx_export_version()
 **
@@ -778,18 +3108,41 @@ int sqlite3_xlsxexport_init(
     
     (void)pzErrMsg;  /* Unused parameter */
     
-    /* Register the xlsx_export function */
-    rc = sqlite3_create_function(
+    ExportConfig *cfg = sqlite3_malloc(sizeof(ExportConfig));
+    if (!cfg) return SQLITE_NOMEM;
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->shared_strings_max = SST_DEFAULT_MAX_PER_COL;
+    cfg->threads = 1;
+    cfg->progress_rows = DEFAULT_PROGRESS_ROWS;
+    cfg->level = ZIP_DEFAULT_LEVEL;
+    cfg->level_parts = ZIP_DEFAULT_LEVEL;
+    
+    /* Register the xlsx_export function; it owns the configuration */
+    rc = sqlite3_create_function_v2(
         db,
         "xlsx_export",      /* Function name */
         -1,                 /* Variable number of arguments */
         SQLITE_UTF8,
-        NULL,               /* User data */
+        cfg,                /* User data */
         xlsx_export_func,   /* Function implementation */
         NULL,               /* Step (for aggregate functions) */
-        NULL                /* Final (for aggregate functions) */
+        NULL,               /* Final (for aggregate functions) */
+        export_config_free  /* Frees the configuration */
     );
 
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "xlsx_export_query", -1, SQLITE_UTF8,
+                                     cfg, xlsx_export_query_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "xlsx_export_config", 1, SQLITE_UTF8,
+                                     cfg, xlsx_export_config_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "xlsx_export_config", 2, SQLITE_UTF8,
+                                     cfg, xlsx_export_config_func, NULL, NULL);
+    }
+
     if (rc == SQLITE_OK) {
         rc = sqlite3_create_function(
             db,
@@ -803,5 +3156,10 @@ int sqlite3_xlsxexport_init(
         );
     }
     
+    /* The statistics live in cfg, which outlives every vtab of the module */
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_module(db, "xlsx_export_stats", &stats_module, cfg);
+    }
+    
     return rc;
 }
@@ -1,14 +1,26 @@
 /*
 xlsximport.c - SQLite extension to import XLSX files
 
-Uses the SQLite zipfile extension to read XLSX archives and expat for XML
-parsing.
-Three SQL functions defined
+Uses a built-in streaming ZIP reader (zlib) to read XLSX archives and expat
+for XML parsing.
+Four SQL functions defined
 xlsx_import() creates one table for each sheet in the XLSX file, with table name
 equal to sheet name, and column names equal to the values in the first row of
-the sheet. The first parameter is the XLSX filename. Subsequent optional parameters
+the sheet. The first parameter is the XLSX filename, or a BLOB holding the XLSX
+file, which is then read in place. Subsequent optional parameters
 are sheet names or sheet numbers (1-based) to import. The return value is the number of sheets imported.
 xlsx_import_sheetnames() is a table-valued function that returns the names of the sheets in the file.
+xlsx_import_sheetinfo() also returns each sheet's dimension and header row,
+reading only the start of each sheet.
+xlsx_sheet is a virtual table that queries a sheet without importing it.
+xlsx_import_stats is a table-valued function with the timings and counters
+of the last xlsx_import() call on the connection.
+xlsx_import_config() gets or sets per-connection options ("bulk", "threads",
+"typed", "fastscan", "progress", "progress_rows", "incremental", "dates",
+"memory_budget").
+In incremental mode sheets unchanged since the last import of the same file,
+by the CRC-32 and size in the ZIP directory, are skipped; the fingerprints are
+kept in the xlsx_import_manifest table. BLOB arguments are always imported.
 xlsx_import_version() returns the version string.
 
 Usage:
@@ -17,15 +29,29 @@ SELECT xlsx_import('filename.xlsx');  -- Import all sheets
 SELECT xlsx_import('filename.xlsx', 'Sheet1', 'Sheet2');  -- Import specific sheets by name
 SELECT xlsx_import('filename.xlsx', 1, 3);  -- Import sheets by number (1-based)
 SELECT xlsx_import('filename.xlsx', 'Sheet1', 2);  -- Mix of names and numbers
+SELECT xlsx_import(data) FROM uploads WHERE id = 1;  -- File held in a BLOB
 SELECT sheet_num, sheet_name FROM xlsx_import_sheetnames('filename.xlsx');
+SELECT sheet_name, rows, cols, header_json FROM xlsx_import_sheetinfo('filename.xlsx');
+CREATE VIRTUAL TABLE s USING xlsx_sheet('filename.xlsx', 'Sheet1');
+SELECT * FROM s LIMIT 10;  -- Columns named after the header row
+SELECT row_num, cells FROM xlsx_sheet('filename.xlsx', 'Sheet1');
+SELECT json_group_object(name, value) FROM xlsx_import_stats;
+SELECT xlsx_import_config('bulk', 1);  -- Faster, non-durable imports
+SELECT xlsx_import_config('threads', 4);  -- Parse up to 4 sheets at once
+SELECT xlsx_import_config('typed', 1);  -- Numbers as INTEGER/REAL columns
+SELECT xlsx_import_config('fastscan', 1);  -- Skip Expat for regular sheets
+SELECT xlsx_import_config('progress', 'my_progress');  -- App-defined function
+SELECT xlsx_import_config('incremental', 1);  -- Re-import changed sheets only
+SELECT xlsx_import_config('dates', 'iso');  -- Date cells as ISO 8601 text
+SELECT xlsx_import_config('memory_budget', 64 << 20);  -- Hold 64 MiB of rows
 SELECT xlsx_import_version();
 **
 ** ============================================================================
 ** REQUIREMENTS / DESIGN NOTES
 ** ============================================================================
 **
-** This extension uses the SQLite zipfile extension to open XLSX files and
-** gather the following content:
+** This extension reads the ZIP container of XLSX files directly and gathers
+** the following content:
 **   - xl/sharedStrings.xml
 **   - xl/worksheets/sheet1.xml to xl/worksheets/sheetN.xml
 **   - xl/workbook.xml
@@ -48,6 +74,17 @@ SELECT xlsx_import_version();
 ** base-26 system. We use a simple conversion method from base-26 to decimal
 ** and then use subtraction to find empty cells between columns.
 **
+** STREAMING IMPORT:
+** Worksheets are never materialized in memory. The Expat handlers collect
+** one row at a time and hand each completed <row> to a RowCallback, which
+** inserts it through a prepared INSERT statement. Only the header and one
+** reusable row buffer are kept, so memory does not grow with the sheet size.
+** The table is created when row 1 (the header) arrives; a row wider than
+** the header adds "colN" columns with ALTER TABLE.
+** Each ZIP entry is inflated in 64 KB chunks that are fed to XML_Parse as
+** they are produced, so neither the compressed nor the uncompressed part is
+** ever held in memory as a whole.
+**
 ** XML STRUCTURE NOTES:
 **   - xl/sharedStrings.xml has "sst:uniqueCount" with count of unique strings
 **   - xl/worksheets/sheet*.xml has "dimension:ref" with enclosing cell range
@@ -63,10 +100,22 @@ SELECT xlsx_import_version();
 SQLITE_EXTENSION_INIT1
 
 #include <ctype.h>
+#include <errno.h>
 #include <expat.h>
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <zlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "../common/xlsx_tags.h"
 
 /*
 ** ============================================================================
@@ -74,27 +123,710 @@ SQLITE_EXTENSION_INIT1
 ** ============================================================================
 */
 
+/* Monotonic clock in nanoseconds, for the timings of xlsx_import_stats */
+static sqlite3_int64 xlsx_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /*
-** Parse a cell reference like "AB67" into column number and row number.
-** Returns the column number (1-based) and sets *row to the row number
-* (1-based).
+** Parse the decimal number in text (len bytes): an optional sign, digits
+** with an optional '.', and an optional exponent, as in the <v> of a number
+** cell. Hex, whitespace, inf and nan are not numbers, and the decimal point
+** is always '.', whatever the C locale. Returns SQLITE_INTEGER with the
+** value in *pInt when there is no point or exponent and it fits,
+** SQLITE_FLOAT with the value in *pReal, or SQLITE_TEXT.
+**
+** Up to 19 significant digits with an exponent of at most 22 convert
+** exactly with one multiplication or division, as both operands are exact
+** doubles; anything else goes through strtod() with the locale's point.
 */
-static int parse_cell_ref(const char *ref, int *row) {
-  int col = 0;
-  const char *p = ref;
-
-  /* Parse column letters */
-  while (*p && isalpha((unsigned char)*p)) {
-    col = col * 26 + (toupper((unsigned char)*p) - 'A' + 1);
+static int xlsx_parse_number(const char *text, int len, sqlite3_int64 *pInt,
+                             double *pReal) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *p = text, *end = text + len;
+  int neg = 0, digits = 0, exp10 = 0, is_int = 1, dot = 0;
+  sqlite3_uint64 mant = 0;
+
+  if (p < end && (*p == '+' || *p == '-'))
+    neg = *p++ == '-';
+  for (; p < end; p++) {
+    if (*p >= '0' && *p <= '9') {
+      if (mant < 1000000000000000000ULL) {
+        mant = mant * 10 + (sqlite3_uint64)(*p - '0');
+        if (dot)
+          exp10--;
+      } else if (!dot) {
+        exp10++; /* Past 19 digits only the integer part adds magnitude */
+      }
+      digits++;
+    } else if (*p == '.' && !dot) {
+      dot = 1;
+      is_int = 0;
+    } else {
+      break;
+    }
+  }
+  if (digits == 0)
+    return SQLITE_TEXT;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int eneg = 0, e = 0, edigits = 0;
+    is_int = 0;
     p++;
+    if (p < end && (*p == '+' || *p == '-'))
+      eneg = *p++ == '-';
+    for (; p < end && *p >= '0' && *p <= '9'; p++, edigits++) {
+      if (e < 100000)
+        e = e * 10 + (*p - '0');
+    }
+    if (edigits == 0)
+      return SQLITE_TEXT;
+    exp10 += eneg ? -e : e;
+  }
+  if (p != end)
+    return SQLITE_TEXT;
+
+  if (is_int && exp10 == 0 &&
+      mant <= (sqlite3_uint64)9223372036854775807LL + (unsigned)neg) {
+    *pInt = neg ? (sqlite3_int64)(0 - mant) : (sqlite3_int64)mant;
+    return SQLITE_INTEGER;
+  }
+
+  double d;
+  if (mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+    d = exp10 < 0 ? (double)mant / pow10[-exp10] : (double)mant * pow10[exp10];
+  } else {
+    /* Rare: let strtod round it, with the point it expects */
+    char stack[64];
+    char *buf = len < (int)sizeof(stack) ? stack : sqlite3_malloc(len + 1);
+    if (!buf)
+      return SQLITE_TEXT;
+    memcpy(buf, text, (size_t)len);
+    buf[len] = '\0';
+    const struct lconv *lc = localeconv();
+    char *q = memchr(buf, '.', (size_t)len);
+    if (q && lc && lc->decimal_point && lc->decimal_point[0] &&
+        !lc->decimal_point[1])
+      *q = lc->decimal_point[0];
+    d = strtod(buf, NULL);
+    if (buf != stack)
+      sqlite3_free(buf);
+    neg = 0; /* strtod read the sign */
+  }
+  if (!isfinite(d))
+    return SQLITE_TEXT;
+  *pReal = neg ? -d : d;
+  return SQLITE_FLOAT;
+}
+
+/* True if the number text reads back as d */
+static int xlsx_same_double(const char *text, double d) {
+  sqlite3_int64 iv;
+  double rv;
+  switch (xlsx_parse_number(text, (int)strlen(text), &iv, &rv)) {
+  case SQLITE_INTEGER:
+    return (double)iv == d;
+  case SQLITE_FLOAT:
+    return rv == d;
+  default:
+    return 0;
+  }
+}
+
+/*
+** ============================================================================
+** ZIP Archive Reader
+** ============================================================================
+**
+** A minimal reader for the ZIP container. zip_open() reads the central
+** directory once and indexes it by entry name, so every later lookup is a
+** hash probe without any I/O. Entries are inflated in ZIP_CHUNK_SIZE
+** pieces that are handed to a callback; nothing is ever inflated in one
+** piece, so a worksheet is parsed while it is being decompressed.
+** Stored (0) and deflated (8) entries are supported, including ZIP64 sizes.
+**
+** Where mmap() is available the whole file is mapped read-only: the central
+** directory and compressed data are then used in place instead of being
+** copied through stdio buffers. Otherwise (Windows, or a failed mapping)
+** the file is read with fseek() and fread(). An archive given as a BLOB is
+** read in place the same way, without touching the filesystem.
+*/
+
+#define ZIP_CHUNK_SIZE 65536
+
+/* Compressed bytes handed to inflate() at a time from a mapped file */
+#define ZIP_MAP_CHUNK (1 << 24)
+
+#define ZIP_EOCD_SIG 0x06054b50u      /* End of central directory */
+#define ZIP64_EOCD_SIG 0x06064b50u    /* ZIP64 end of central directory */
+#define ZIP64_LOCATOR_SIG 0x07064b50u /* ZIP64 end of central dir locator */
+#define ZIP_CDH_SIG 0x02014b50u       /* Central directory file header */
+#define ZIP_LFH_SIG 0x04034b50u       /* Local file header */
+
+#ifdef _WIN32
+#define zip_fseek _fseeki64
+#define zip_ftell _ftelli64
+#else
+#define ZIP_HAVE_MMAP 1
+#define zip_fseek fseeko
+#define zip_ftell ftello
+#endif
+
+typedef struct {
+  int method;                 /* 0 = stored, 8 = deflated */
+  unsigned int crc;           /* CRC-32 of the uncompressed data */
+  sqlite3_int64 comp_size;    /* Compressed size */
+  sqlite3_int64 uncomp_size;  /* Uncompressed size */
+  sqlite3_int64 local_offset; /* Offset of the local file header */
+} ZipEntry;
+
+/* One central directory record; name points into ZipArchive.cd */
+typedef struct {
+  const char *name;
+  unsigned int name_len;
+  unsigned int hash;
+  int encrypted;
+  ZipEntry entry;
+} ZipIndexEntry;
+
+typedef struct {
+  FILE *fp;                   /* Archive file, NULL when mapped */
+  const unsigned char *map;   /* The whole file when mapped, else NULL */
+  int mmapped;                /* map comes from mmap() */
+  unsigned char *map_owned;   /* map when it is a private copy */
+  sqlite3_int64 file_size;
+  const unsigned char *cd;    /* Central directory (in map, or owned) */
+  unsigned char *cd_owned;    /* cd when it was read into memory */
+  ZipIndexEntry *index;       /* Central directory records in order */
+  int n_index;
+  int *slots;                 /* Open addressing table of index + 1 */
+  int n_slots;                /* Power of two, at least 2 * n_index */
+  sqlite3_int64 inflate_ns;   /* Time spent in inflate() by every stream */
+  sqlite3_int64 bytes_read;   /* Compressed bytes read by every stream */
+  sqlite3_int64 bytes_inflated; /* Uncompressed bytes returned */
+} ZipArchive;
+
+/* Receives consecutive pieces of an entry; non-SQLITE_OK stops reading */
+typedef int (*ZipSink)(void *arg, const char *data, int len);
+
+/*
+** Where an archive is read from: a file, or a ZIP image in memory (a BLOB
+** argument), which must stay valid while the archive is open
+*/
+typedef struct {
+  const char *filename;       /* NULL for an image */
+  const unsigned char *data;  /* The image */
+  sqlite3_int64 size;
+  const char *label;          /* filename, or "BLOB", for messages */
+} ZipSource;
+
+/* A BLOB argument is an archive image, any other value a filename */
+static int zip_source_init(ZipSource *src, sqlite3_value *value) {
+  memset(src, 0, sizeof(*src));
+  if (sqlite3_value_type(value) == SQLITE_BLOB) {
+    src->data = sqlite3_value_blob(value);
+    src->size = sqlite3_value_bytes(value);
+    src->label = "BLOB";
+    return SQLITE_OK;
+  }
+  src->filename = (const char *)sqlite3_value_text(value);
+  src->label = src->filename;
+  return src->filename ? SQLITE_OK : SQLITE_MISUSE;
+}
+
+static void zip_source_file(ZipSource *src, const char *filename) {
+  memset(src, 0, sizeof(*src));
+  src->filename = filename;
+  src->label = filename;
+}
+
+static unsigned int zip_u16(const unsigned char *p) {
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned int zip_u32(const unsigned char *p) {
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+         ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static sqlite3_int64 zip_u64(const unsigned char *p) {
+  return (sqlite3_int64)((sqlite3_uint64)zip_u32(p) |
+                         ((sqlite3_uint64)zip_u32(p + 4) << 32));
+}
+
+/* FNV-1a hash of an entry name */
+static unsigned int zip_hash(const char *s, size_t len) {
+  unsigned int h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int zip_read_at(ZipArchive *za, sqlite3_int64 offset, void *buf,
+                       size_t len) {
+  if (offset < 0 || (sqlite3_uint64)offset + len > (sqlite3_uint64)za->file_size)
+    return SQLITE_CORRUPT;
+  if (za->map) {
+    memcpy(buf, za->map + offset, len);
+    return SQLITE_OK;
+  }
+  if (zip_fseek(za->fp, offset, SEEK_SET) != 0)
+    return SQLITE_IOERR;
+  if (fread(buf, 1, len, za->fp) != len)
+    return SQLITE_CORRUPT;
+  return SQLITE_OK;
+}
+
+static void zip_close(ZipArchive *za) {
+  if (za->fp)
+    fclose(za->fp);
+#ifdef ZIP_HAVE_MMAP
+  if (za->mmapped)
+    munmap((void *)za->map, (size_t)za->file_size);
+#endif
+  free(za->map_owned);
+  free(za->cd_owned);
+  free(za->index);
+  free(za->slots);
+  memset(za, 0, sizeof(*za));
+}
+
+/*
+** Parse the n_entries records of the central directory at za->cd into
+** za->index and hash them by name. The first of several entries with the
+** same name is the one found.
+*/
+static int zip_build_index(ZipArchive *za, sqlite3_int64 cd_size,
+                           sqlite3_int64 n_entries) {
+  /* Every record takes at least 46 bytes, which bounds a bogus count */
+  if (n_entries > cd_size / 46)
+    return SQLITE_CORRUPT;
+
+  int n_slots = 16;
+  while (n_slots < 2 * n_entries)
+    n_slots *= 2;
+  za->index = malloc(sizeof(ZipIndexEntry) * (size_t)(n_entries ? n_entries : 1));
+  za->slots = calloc((size_t)n_slots, sizeof(int));
+  if (!za->index || !za->slots)
+    return SQLITE_NOMEM;
+  za->n_slots = n_slots;
+
+  const unsigned char *p = za->cd;
+  const unsigned char *end = za->cd + cd_size;
+  for (sqlite3_int64 i = 0; i < n_entries; i++) {
+    if (end - p < 46 || zip_u32(p) != ZIP_CDH_SIG)
+      return SQLITE_CORRUPT;
+    unsigned int n_name = zip_u16(p + 28);
+    unsigned int n_extra = zip_u16(p + 30);
+    unsigned int n_comment = zip_u16(p + 32);
+    if ((size_t)(end - p) < 46 + (size_t)n_name + n_extra + n_comment)
+      return SQLITE_CORRUPT;
+
+    ZipIndexEntry *ie = &za->index[za->n_index];
+    ie->name = (const char *)p + 46;
+    ie->name_len = n_name;
+    ie->hash = zip_hash(ie->name, n_name);
+    ie->encrypted = (zip_u16(p + 8) & 1) != 0;
+    ie->entry.method = (int)zip_u16(p + 10);
+    ie->entry.crc = zip_u32(p + 16);
+    ie->entry.comp_size = zip_u32(p + 20);
+    ie->entry.uncomp_size = zip_u32(p + 24);
+    ie->entry.local_offset = zip_u32(p + 42);
+
+    /* ZIP64 extra field (id 1) holds the values that overflowed */
+    const unsigned char *x = p + 46 + n_name;
+    const unsigned char *x_end = x + n_extra;
+    while (x + 4 <= x_end) {
+      unsigned int id = zip_u16(x), sz = zip_u16(x + 2);
+      const unsigned char *v = x + 4;
+      if (id == 1) {
+        if (ie->entry.uncomp_size == 0xFFFFFFFF && v + 8 <= x_end) {
+          ie->entry.uncomp_size = zip_u64(v);
+          v += 8;
+        }
+        if (ie->entry.comp_size == 0xFFFFFFFF && v + 8 <= x_end) {
+          ie->entry.comp_size = zip_u64(v);
+          v += 8;
+        }
+        if (ie->entry.local_offset == 0xFFFFFFFF && v + 8 <= x_end) {
+          ie->entry.local_offset = zip_u64(v);
+        }
+      }
+      x += 4 + sz;
+    }
+
+    unsigned int slot = ie->hash & (unsigned int)(n_slots - 1);
+    int dup = 0;
+    while (za->slots[slot]) {
+      const ZipIndexEntry *o = &za->index[za->slots[slot] - 1];
+      if (o->hash == ie->hash && o->name_len == n_name &&
+          memcmp(o->name, ie->name, n_name) == 0) {
+        dup = 1;
+        break;
+      }
+      slot = (slot + 1) & (unsigned int)(n_slots - 1);
+    }
+    if (!dup)
+      za->slots[slot] = za->n_index + 1;
+    za->n_index++;
+    p += 46 + n_name + n_extra + n_comment;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Locate the central directory of the archive just opened, from the file or
+** the mapping, and index it. Closes za on error.
+*/
+static int zip_read_directory(ZipArchive *za) {
+  /* The EOCD record is at the end, followed by a comment of up to 64K */
+  sqlite3_int64 file_size = za->file_size;
+  sqlite3_int64 tail_len = file_size < 65557 ? file_size : 65557;
+  if (tail_len < 22) {
+    zip_close(za);
+    return SQLITE_CORRUPT;
+  }
+
+  unsigned char *tail_buf = NULL;
+  const unsigned char *tail;
+  int rc = SQLITE_OK;
+  if (za->map) {
+    tail = za->map + (file_size - tail_len);
+  } else {
+    tail_buf = malloc((size_t)tail_len);
+    if (!tail_buf) {
+      zip_close(za);
+      return SQLITE_NOMEM;
+    }
+    rc = zip_read_at(za, file_size - tail_len, tail_buf, (size_t)tail_len);
+    tail = tail_buf;
+  }
+  sqlite3_int64 eocd = -1;
+  for (sqlite3_int64 i = tail_len - 22; rc == SQLITE_OK && i >= 0; i--) {
+    if (zip_u32(tail + i) == ZIP_EOCD_SIG) {
+      eocd = i;
+      break;
+    }
+  }
+  if (rc != SQLITE_OK || eocd < 0) {
+    free(tail_buf);
+    zip_close(za);
+    return rc != SQLITE_OK ? rc : SQLITE_CORRUPT;
+  }
+
+  const unsigned char *e = tail + eocd;
+  sqlite3_int64 n_entries = zip_u16(e + 10);
+  sqlite3_int64 cd_size = zip_u32(e + 12);
+  sqlite3_int64 cd_offset = zip_u32(e + 16);
+
+  /* ZIP64: the real values are in the ZIP64 EOCD record */
+  if (n_entries == 0xFFFF || cd_size == 0xFFFFFFFF ||
+      cd_offset == 0xFFFFFFFF) {
+    unsigned char rec[56];
+    rc = SQLITE_CORRUPT;
+    if (eocd >= 20 && zip_u32(e - 20) == ZIP64_LOCATOR_SIG &&
+        zip_read_at(za, zip_u64(e - 20 + 8), rec, sizeof(rec)) == SQLITE_OK &&
+        zip_u32(rec) == ZIP64_EOCD_SIG) {
+      n_entries = zip_u64(rec + 32);
+      cd_size = zip_u64(rec + 40);
+      cd_offset = zip_u64(rec + 48);
+      rc = SQLITE_OK;
+    }
+  }
+  free(tail_buf);
+
+  if (rc == SQLITE_OK &&
+      (cd_offset < 0 || cd_size < 0 || cd_offset + cd_size > file_size))
+    rc = SQLITE_CORRUPT;
+
+  /* The central directory is used in place when mapped, else read once */
+  if (rc == SQLITE_OK) {
+    if (za->map) {
+      za->cd = za->map + cd_offset;
+    } else {
+      za->cd_owned = malloc((size_t)(cd_size ? cd_size : 1));
+      if (!za->cd_owned)
+        rc = SQLITE_NOMEM;
+      else
+        rc = zip_read_at(za, cd_offset, za->cd_owned, (size_t)cd_size);
+      za->cd = za->cd_owned;
+    }
+  }
+  if (rc == SQLITE_OK)
+    rc = zip_build_index(za, cd_size, n_entries);
+  if (rc != SQLITE_OK)
+    zip_close(za);
+  return rc;
+}
+
+/* Open the archive file path, mapped when possible */
+static int zip_open_file(ZipArchive *za, const char *path) {
+  memset(za, 0, sizeof(*za));
+  za->fp = fopen(path, "rb");
+  if (!za->fp)
+    return SQLITE_CANTOPEN;
+
+  if (zip_fseek(za->fp, 0, SEEK_END) != 0) {
+    zip_close(za);
+    return SQLITE_IOERR;
+  }
+  za->file_size = zip_ftell(za->fp);
+
+#ifdef ZIP_HAVE_MMAP
+  if (za->file_size >= 22 && (sqlite3_uint64)za->file_size <= (size_t)-1) {
+    void *map = mmap(NULL, (size_t)za->file_size, PROT_READ, MAP_SHARED,
+                     fileno(za->fp), 0);
+    if (map != MAP_FAILED) {
+      za->map = map;
+      za->mmapped = 1;
+      fclose(za->fp);
+      za->fp = NULL;
+    }
+  }
+#endif
+  return zip_read_directory(za);
+}
+
+/*
+** Open an archive, locate its central directory and index it.
+** Returns SQLITE_CANTOPEN if the file cannot be opened and SQLITE_CORRUPT if
+** it is not a ZIP archive.
+*/
+static int zip_open(ZipArchive *za, const ZipSource *src) {
+  if (src->filename)
+    return zip_open_file(za, src->filename);
+  memset(za, 0, sizeof(*za));
+  za->map = src->data;
+  za->file_size = src->size;
+  return zip_read_directory(za);
+}
+
+/*
+** Look up an entry by name in the index of the central directory.
+** Returns SQLITE_OK, SQLITE_NOTFOUND, or an error code.
+*/
+static int zip_find(ZipArchive *za, const char *name, ZipEntry *entry) {
+  size_t name_len = strlen(name);
+  unsigned int hash = zip_hash(name, name_len);
+  unsigned int slot = hash & (unsigned int)(za->n_slots - 1);
+
+  while (za->slots[slot]) {
+    const ZipIndexEntry *ie = &za->index[za->slots[slot] - 1];
+    if (ie->hash == hash && ie->name_len == name_len &&
+        memcmp(ie->name, name, name_len) == 0) {
+      /* Encrypted entries are not supported */
+      if (ie->encrypted)
+        return SQLITE_CORRUPT;
+      *entry = ie->entry;
+      return SQLITE_OK;
+    }
+    slot = (slot + 1) & (unsigned int)(za->n_slots - 1);
+  }
+  return SQLITE_NOTFOUND;
+}
+
+/*
+** Pull-style reader for one entry: every zip_stream_read() returns the next
+** piece of at most ZIP_CHUNK_SIZE uncompressed bytes. The stream tracks its
+** own file position, so several streams may share one ZipArchive.
+*/
+typedef struct {
+  ZipArchive *za;
+  ZipEntry entry;
+  z_stream zs;
+  int zs_init;              /* zs needs inflateEnd() */
+  unsigned char *in;        /* Compressed input buffer, unless mapped */
+  unsigned char *out;       /* Uncompressed output buffer */
+  sqlite3_int64 pos;        /* File offset of the next compressed byte */
+  sqlite3_int64 remaining;  /* Compressed bytes not read yet */
+  uLong crc;                /* Running CRC-32 of the output */
+  int z_end;                /* inflate() returned Z_STREAM_END */
+  int done;                 /* All output returned and CRC checked */
+} ZipStream;
+
+static void zip_stream_close(ZipStream *st) {
+  if (st->zs_init)
+    inflateEnd(&st->zs);
+  free(st->in);
+  free(st->out);
+  memset(st, 0, sizeof(*st));
+}
+
+static int zip_stream_open(ZipStream *st, ZipArchive *za,
+                           const ZipEntry *entry) {
+  unsigned char lfh[30];
+
+  memset(st, 0, sizeof(*st));
+  int rc = zip_read_at(za, entry->local_offset, lfh, sizeof(lfh));
+  if (rc != SQLITE_OK)
+    return rc;
+  if (zip_u32(lfh) != ZIP_LFH_SIG)
+    return SQLITE_CORRUPT;
+  if (entry->method != 0 && entry->method != 8)
+    return SQLITE_CORRUPT;
+
+  st->za = za;
+  st->entry = *entry;
+  st->pos = entry->local_offset + 30 + zip_u16(lfh + 26) + zip_u16(lfh + 28);
+  st->remaining = entry->comp_size;
+  st->crc = crc32(0L, Z_NULL, 0);
+  if (!za->map)
+    st->in = malloc(ZIP_CHUNK_SIZE);
+  st->out = malloc(ZIP_CHUNK_SIZE);
+  if ((!za->map && !st->in) || !st->out) {
+    zip_stream_close(st);
+    return SQLITE_NOMEM;
+  }
+  if (entry->method == 8) {
+    if (inflateInit2(&st->zs, -MAX_WBITS) != Z_OK) {
+      zip_stream_close(st);
+      return SQLITE_NOMEM;
+    }
+    st->zs_init = 1;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Get the next chunk of at most max compressed bytes in *pIn: read into
+** st->in, or in place when the archive is mapped.
+*/
+static int zip_stream_fill(ZipStream *st, size_t max,
+                           const unsigned char **pIn, size_t *pN) {
+  size_t n = st->remaining < (sqlite3_int64)max ? (size_t)st->remaining : max;
+  if (st->za->map) {
+    if (st->pos + (sqlite3_int64)n > st->za->file_size)
+      return SQLITE_CORRUPT;
+    *pIn = st->za->map + st->pos;
+  } else {
+    int rc = zip_read_at(st->za, st->pos, st->in, n);
+    if (rc != SQLITE_OK)
+      return rc;
+    *pIn = st->in;
+  }
+  st->pos += (sqlite3_int64)n;
+  st->remaining -= (sqlite3_int64)n;
+  st->za->bytes_read += (sqlite3_int64)n;
+  *pN = n;
+  return SQLITE_OK;
+}
+
+/*
+** Return the next piece of the entry in *pData and *pLen. The data stays valid
+** until the next call. *pLen is 0 once the entry is exhausted, at which
+** point its CRC-32 has been verified.
+*/
+static int zip_stream_read(ZipStream *st, const char **pData, int *pLen) {
+  int rc;
+  size_t n;
+  const unsigned char *in;
+
+  *pData = (const char *)st->out;
+  *pLen = 0;
+  if (st->done)
+    return SQLITE_OK;
+
+  if (st->entry.method == 0) {
+    if (st->remaining > 0) {
+      rc = zip_stream_fill(st, ZIP_CHUNK_SIZE, &in, &n);
+      if (rc != SQLITE_OK)
+        return rc;
+      st->crc = crc32(st->crc, in, (uInt)n);
+      st->za->bytes_inflated += (sqlite3_int64)n;
+      *pData = (const char *)in;
+      *pLen = (int)n;
+      return SQLITE_OK;
+    }
+  } else {
+    while (!st->z_end) {
+      if (st->zs.avail_in == 0) {
+        if (st->remaining == 0)
+          return SQLITE_CORRUPT; /* Deflate stream is truncated */
+        rc = zip_stream_fill(st, st->za->map ? ZIP_MAP_CHUNK : ZIP_CHUNK_SIZE,
+                             &in, &n);
+        if (rc != SQLITE_OK)
+          return rc;
+        st->zs.next_in = (Bytef *)in;
+        st->zs.avail_in = (uInt)n;
+      }
+
+      st->zs.next_out = st->out;
+      st->zs.avail_out = ZIP_CHUNK_SIZE;
+      sqlite3_int64 t0 = xlsx_now_ns();
+      int zrc = inflate(&st->zs, Z_NO_FLUSH);
+      st->za->inflate_ns += xlsx_now_ns() - t0;
+      if (zrc != Z_OK && zrc != Z_STREAM_END)
+        return zrc == Z_MEM_ERROR ? SQLITE_NOMEM : SQLITE_CORRUPT;
+
+      int produced = ZIP_CHUNK_SIZE - (int)st->zs.avail_out;
+      st->za->bytes_inflated += produced;
+      st->crc = crc32(st->crc, st->out, (uInt)produced);
+      st->z_end = zrc == Z_STREAM_END;
+      if (produced > 0) {
+        *pLen = produced;
+        return SQLITE_OK;
+      }
+    }
   }
 
-  /* Parse row number */
-  if (row) {
-    *row = atoi(p);
+  st->done = 1;
+  return (unsigned int)st->crc == st->entry.crc ? SQLITE_OK : SQLITE_CORRUPT;
+}
+
+/*
+** Decompress an entry, passing it to sink in chunks of at most
+** ZIP_CHUNK_SIZE bytes. The CRC-32 is checked after the last chunk.
+*/
+static int zip_read_entry(ZipArchive *za, const ZipEntry *entry, ZipSink sink,
+                          void *arg) {
+  ZipStream st;
+  int rc = zip_stream_open(&st, za, entry);
+
+  while (rc == SQLITE_OK) {
+    const char *data;
+    int len;
+    rc = zip_stream_read(&st, &data, &len);
+    if (rc != SQLITE_OK || len == 0)
+      break;
+    rc = sink(arg, data, len);
   }
 
-  return col;
+  zip_stream_close(&st);
+  return rc;
+}
+
+/* ZipSink feeding an Expat parser */
+static int zip_xml_sink(void *arg, const char *data, int len) {
+  XML_Parser parser = (XML_Parser)arg;
+  if (XML_Parse(parser, data, len, 0) == XML_STATUS_ERROR)
+    return SQLITE_ERROR;
+  return SQLITE_OK;
+}
+
+/*
+** Stream the entry named name through parser.
+** Returns SQLITE_OK, SQLITE_NOTFOUND if the entry is missing or empty,
+** SQLITE_ERROR if the XML is malformed (or a handler stopped the parser), or
+** another error code if the archive could not be read.
+*/
+static int zip_parse_xml(ZipArchive *za, const char *name, XML_Parser parser) {
+  ZipEntry entry;
+  int rc = zip_find(za, name, &entry);
+  if (rc != SQLITE_OK)
+    return rc;
+  if (entry.uncomp_size == 0)
+    return SQLITE_NOTFOUND;
+
+  rc = zip_read_entry(za, &entry, zip_xml_sink, parser);
+  if (rc == SQLITE_OK && XML_Parse(parser, NULL, 0, 1) == XML_STATUS_ERROR)
+    rc = SQLITE_ERROR;
+  return rc;
 }
 
 /*
@@ -103,79 +835,154 @@ static int parse_cell_ref(const char *ref, int *row) {
 ** ============================================================================
 */
 
+/*
+** All shared strings live back to back in one arena, each followed by a NUL
+** so they can also be used as C strings. The text of the string being
+** parsed is appended at the end of the arena and becomes an entry of the
+** index when its </si> is seen. Both buffers are presized from the
+** uniqueCount attribute of <sst>.
+**
+** The arena is only reallocated while parsing; once parse_shared_strings()
+** returns, pointers into it stay valid until ss_free().
+*/
+typedef struct {
+  size_t offset; /* Offset of the string in the arena */
+  int len;       /* Length in bytes, excluding the terminating NUL */
+} SharedString;
+
 typedef struct {
-  char **strings;  /* Array of string values */
-  int count;       /* Number of strings */
-  int capacity;    /* Allocated capacity */
-  int in_t;        /* Currently inside <t> element */
-  char *current;   /* Current string being built */
-  int current_len; /* Length of current string */
-  int current_cap; /* Capacity of current string buffer */
+  char *arena;          /* String bytes */
+  size_t arena_len;     /* Bytes used, including the string being parsed */
+  size_t arena_cap;     /* Bytes allocated */
+  SharedString *index;  /* One entry per <si> */
+  int count;            /* Number of strings */
+  int capacity;         /* Allocated index entries */
+  int in_t;             /* Currently inside <t> element */
+  int in_rph;           /* Currently inside <rPh> (phonetic run) */
+  size_t current;       /* Offset where the string being parsed starts */
+  int oom;              /* An allocation failed while parsing */
+  int limit;            /* Stop after this many strings, 0 for all */
+  XML_Parser parser;    /* Parser to stop at the limit */
 } SharedStrings;
 
+/* Largest uniqueCount trusted for presizing, to survive bogus values */
+#define SS_MAX_PRESIZE (1 << 24)
+/* Arena bytes reserved per string when presizing */
+#define SS_PRESIZE_BYTES 16
+
 static void ss_init(SharedStrings *ss) { memset(ss, 0, sizeof(*ss)); }
 
 static void ss_free(SharedStrings *ss) {
-  for (int i = 0; i < ss->count; i++) {
-    free(ss->strings[i]);
-  }
-  free(ss->strings);
-  free(ss->current);
+  free(ss->arena);
+  free(ss->index);
   memset(ss, 0, sizeof(*ss));
 }
 
-static void ss_add_string(SharedStrings *ss, const char *str) {
-  if (ss->count >= ss->capacity) {
-    int new_cap = ss->capacity ? ss->capacity * 2 : 64;
-    char **new_strings = realloc(ss->strings, new_cap * sizeof(char *));
-    if (!new_strings)
-      return;
-    ss->strings = new_strings;
-    ss->capacity = new_cap;
+/* Return string idx and its length, or NULL if idx is out of range */
+static const char *ss_get(const SharedStrings *ss, int idx, int *pLen) {
+  if (idx < 0 || idx >= ss->count)
+    return NULL;
+  *pLen = ss->index[idx].len;
+  return ss->arena + ss->index[idx].offset;
+}
+
+static int ss_reserve_index(SharedStrings *ss, int n) {
+  if (n <= ss->capacity)
+    return 1;
+  SharedString *new_index = realloc(ss->index, n * sizeof(SharedString));
+  if (!new_index) {
+    ss->oom = 1;
+    return 0;
   }
-  ss->strings[ss->count++] = strdup(str ? str : "");
+  ss->index = new_index;
+  ss->capacity = n;
+  return 1;
 }
 
-static void ss_append_text(SharedStrings *ss, const char *text, int len) {
-  if (ss->current_len + len >= ss->current_cap) {
-    int new_cap = ss->current_cap ? ss->current_cap * 2 : 256;
-    while (new_cap <= ss->current_len + len)
-      new_cap *= 2;
-    char *new_current = realloc(ss->current, new_cap);
-    if (!new_current)
-      return;
-    ss->current = new_current;
-    ss->current_cap = new_cap;
+static int ss_reserve_arena(SharedStrings *ss, size_t n) {
+  if (n <= ss->arena_cap)
+    return 1;
+  size_t new_cap = ss->arena_cap ? ss->arena_cap : 4096;
+  while (new_cap < n)
+    new_cap *= 2;
+  char *new_arena = realloc(ss->arena, new_cap);
+  if (!new_arena) {
+    ss->oom = 1;
+    return 0;
   }
-  memcpy(ss->current + ss->current_len, text, len);
-  ss->current_len += len;
-  ss->current[ss->current_len] = '\0';
+  ss->arena = new_arena;
+  ss->arena_cap = new_cap;
+  return 1;
+}
+
+/* Terminate the string being parsed and add it to the index */
+static void ss_add_string(SharedStrings *ss) {
+  if (ss->count >= ss->capacity &&
+      !ss_reserve_index(ss, ss->capacity ? ss->capacity * 2 : 64))
+    return;
+  if (!ss_reserve_arena(ss, ss->arena_len + 1))
+    return;
+  ss->arena[ss->arena_len] = '\0';
+  ss->index[ss->count].offset = ss->current;
+  ss->index[ss->count].len = (int)(ss->arena_len - ss->current);
+  ss->count++;
+  ss->arena_len++;
+  ss->current = ss->arena_len;
+}
+
+static void ss_append_text(SharedStrings *ss, const char *text, int len) {
+  /* Keep room for the terminating NUL */
+  if (!ss_reserve_arena(ss, ss->arena_len + len + 1))
+    return;
+  memcpy(ss->arena + ss->arena_len, text, len);
+  ss->arena_len += len;
 }
 
 static void XMLCALL ss_start_element(void *userData, const XML_Char *name,
                                      const XML_Char **atts) {
   SharedStrings *ss = (SharedStrings *)userData;
-  (void)atts;
 
-  if (strcmp(name, "t") == 0) {
-    ss->in_t = 1;
-    ss->current_len = 0;
-    if (ss->current)
-      ss->current[0] = '\0';
+  switch (xlsx_tag(name)) {
+  case XLSX_TAG_T:
+    /* Rich text runs are concatenated; phonetic hints are not text */
+    ss->in_t = !ss->in_rph;
+    break;
+  case XLSX_TAG_RPH:
+    ss->in_rph = 1;
+    break;
+  case XLSX_TAG_SST:
+    for (int i = 0; atts[i]; i += 2) {
+      if (strcmp(atts[i], "uniqueCount") == 0) {
+        long n = atol(atts[i + 1]);
+        if (ss->limit > 0 && n > ss->limit)
+          n = ss->limit;
+        if (n > 0 && n <= SS_MAX_PRESIZE) {
+          ss_reserve_index(ss, (int)n);
+          ss_reserve_arena(ss, (size_t)n * SS_PRESIZE_BYTES);
+          ss->oom = 0; /* Presizing is only a hint */
+        }
+      }
+    }
+    break;
   }
 }
 
 static void XMLCALL ss_end_element(void *userData, const XML_Char *name) {
   SharedStrings *ss = (SharedStrings *)userData;
 
-  if (strcmp(name, "si") == 0) {
+  switch (xlsx_tag(name)) {
+  case XLSX_TAG_SI:
     /* End of string item - add accumulated text */
-    ss_add_string(ss, ss->current ? ss->current : "");
-    ss->current_len = 0;
-    if (ss->current)
-      ss->current[0] = '\0';
-  } else if (strcmp(name, "t") == 0) {
+    ss_add_string(ss);
+    if (ss->limit > 0 && ss->count >= ss->limit)
+      XML_StopParser(ss->parser, XML_FALSE);
+    break;
+  case XLSX_TAG_T:
     ss->in_t = 0;
+    break;
+  case XLSX_TAG_RPH:
+    ss->in_rph = 0;
+    break;
   }
 }
 
@@ -187,26 +994,41 @@ static void XMLCALL ss_char_data(void *userData, const XML_Char *s, int len) {
   }
 }
 
-static int parse_shared_strings(const char *xml, int xml_len,
-                                SharedStrings *ss) {
+/*
+** Parse xl/sharedStrings.xml. A missing entry leaves ss empty and is not an
+** error. With limit > 0 only the first limit strings are read.
+*/
+static int parse_shared_strings(ZipArchive *za, SharedStrings *ss,
+                                int limit) {
   XML_Parser parser = XML_ParserCreate(NULL);
   if (!parser)
-    return -1;
+    return SQLITE_NOMEM;
 
   ss_init(ss);
+  ss->limit = limit;
+  ss->parser = parser;
 
   XML_SetUserData(parser, ss);
   XML_SetElementHandler(parser, ss_start_element, ss_end_element);
   XML_SetCharacterDataHandler(parser, ss_char_data);
 
-  if (XML_Parse(parser, xml, xml_len, 1) == XML_STATUS_ERROR) {
-    XML_ParserFree(parser);
+  int rc = zip_parse_xml(za, "xl/sharedStrings.xml", parser);
+  XML_ParserFree(parser);
+
+  if (rc == SQLITE_NOTFOUND) {
+    rc = SQLITE_OK;
+  }
+  if (rc == SQLITE_ERROR && limit > 0 && ss->count >= limit) {
+    rc = SQLITE_OK; /* Stopped at the limit */
+  }
+  ss->parser = NULL;
+  if (rc == SQLITE_OK && ss->oom) {
+    rc = SQLITE_NOMEM;
+  }
+  if (rc != SQLITE_OK) {
     ss_free(ss);
-    return -1;
   }
-
-  XML_ParserFree(parser);
-  return 0;
+  return rc;
 }
 
 /*
@@ -215,15 +1037,30 @@ static int parse_shared_strings(const char *xml, int xml_len,
 ** ============================================================================
 */
 
+/*
+** Each <sheet> of workbook.xml names its worksheet part indirectly, through
+** an r:id that xl/_rels/workbook.xml.rels maps to a target path. Excel keeps
+** the part names when sheets are reordered or deleted, so sheet N is not
+** necessarily xl/worksheets/sheetN.xml. parse_workbook() resolves every
+** sheet's path from the relationships and only falls back to the sheetN.xml
+** convention when the workbook has no relationship for the sheet.
+*/
+
 typedef struct {
   char *name;  /* Sheet name */
   int sheetId; /* Sheet ID */
+  char *rid;   /* r:id of the sheet, or NULL */
+  char *path;  /* Worksheet part, or NULL if the sheet has none */
+  int resolved; /* path comes from workbook.xml.rels */
 } SheetInfo;
 
 typedef struct {
   SheetInfo *sheets; /* Array of sheet info */
   int count;         /* Number of sheets */
   int capacity;      /* Allocated capacity */
+  int next_rel;      /* Where the next relationship lookup starts */
+  int oom;           /* A relationship target could not be stored */
+  int date1904;      /* Dates count days from 1904-01-01 */
 } Workbook;
 
 static void wb_init(Workbook *wb) { memset(wb, 0, sizeof(*wb)); }
@@ -231,12 +1068,15 @@ static void wb_init(Workbook *wb) { memset(wb, 0, sizeof(*wb)); }
 static void wb_free(Workbook *wb) {
   for (int i = 0; i < wb->count; i++) {
     free(wb->sheets[i].name);
+    free(wb->sheets[i].rid);
+    free(wb->sheets[i].path);
   }
   free(wb->sheets);
   memset(wb, 0, sizeof(*wb));
 }
 
-static void wb_add_sheet(Workbook *wb, const char *name, int sheetId) {
+static void wb_add_sheet(Workbook *wb, const char *name, int sheetId,
+                         const char *rid) {
   if (wb->count >= wb->capacity) {
     int new_cap = wb->capacity ? wb->capacity * 2 : 8;
     SheetInfo *new_sheets = realloc(wb->sheets, new_cap * sizeof(SheetInfo));
@@ -245,8 +1085,11 @@ static void wb_add_sheet(Workbook *wb, const char *name, int sheetId) {
     wb->sheets = new_sheets;
     wb->capacity = new_cap;
   }
-  wb->sheets[wb->count].name = strdup(name ? name : "");
-  wb->sheets[wb->count].sheetId = sheetId;
+  SheetInfo *sheet = &wb->sheets[wb->count];
+  memset(sheet, 0, sizeof(*sheet));
+  sheet->name = strdup(name ? name : "");
+  sheet->sheetId = sheetId;
+  sheet->rid = rid ? strdup(rid) : NULL;
   wb->count++;
 }
 
@@ -256,18 +1099,29 @@ static void XMLCALL wb_start_element(void *userData, const XML_Char *name,
 
   if (strcmp(name, "sheet") == 0) {
     const char *sheet_name = NULL;
+    const char *rid = NULL;
     int sheetId = 0;
 
     for (int i = 0; atts[i]; i += 2) {
+      const char *colon = strchr(atts[i], ':');
       if (strcmp(atts[i], "name") == 0) {
         sheet_name = atts[i + 1];
       } else if (strcmp(atts[i], "sheetId") == 0) {
         sheetId = atoi(atts[i + 1]);
+      } else if (colon && strcmp(colon + 1, "id") == 0) {
+        /* r:id, whatever prefix the relationships namespace uses */
+        rid = atts[i + 1];
       }
     }
 
     if (sheet_name) {
-      wb_add_sheet(wb, sheet_name, sheetId);
+      wb_add_sheet(wb, sheet_name, sheetId, rid);
+    }
+  } else if (strcmp(name, "workbookPr") == 0) {
+    for (int i = 0; atts[i]; i += 2) {
+      if (strcmp(atts[i], "date1904") == 0)
+        wb->date1904 = strcmp(atts[i + 1], "1") == 0 ||
+                       strcmp(atts[i + 1], "true") == 0;
     }
   }
 }
@@ -277,59 +1131,559 @@ static void XMLCALL wb_end_element(void *userData, const XML_Char *name) {
   (void)name;
 }
 
-static int parse_workbook(const char *xml, int xml_len, Workbook *wb) {
-  XML_Parser parser = XML_ParserCreate(NULL);
-  if (!parser)
-    return -1;
-
-  wb_init(wb);
-
-  XML_SetUserData(parser, wb);
-  XML_SetElementHandler(parser, wb_start_element, wb_end_element);
+/*
+** Resolve a relationship target against xl/, the directory of workbook.xml.
+** Absolute targets start at the root of the archive.
+*/
+static char *wb_resolve_target(const char *target) {
+  const char *base = "xl/";
+  size_t base_len = 3;
 
-  if (XML_Parse(parser, xml, xml_len, 1) == XML_STATUS_ERROR) {
-    XML_ParserFree(parser);
-    wb_free(wb);
-    return -1;
+  if (target[0] == '/') {
+    base_len = 0;
+    target++;
+  }
+  for (;;) {
+    if (strncmp(target, "./", 2) == 0) {
+      target += 2;
+    } else if (strncmp(target, "../", 3) == 0) {
+      base_len = 0;
+      target += 3;
+    } else {
+      break;
+    }
   }
 
-  XML_ParserFree(parser);
-  return 0;
+  size_t n = strlen(target);
+  char *path = malloc(base_len + n + 1);
+  if (!path)
+    return NULL;
+  memcpy(path, base, base_len);
+  memcpy(path + base_len, target, n + 1);
+  return path;
 }
 
-/*
-** ============================================================================
-** Worksheet Parser
-** ============================================================================
-*/
+/* Does a relationship Type end in /worksheet (transitional or strict)? */
+static int wb_is_worksheet_rel(const char *type) {
+  size_t n = strlen(type);
+  return n >= 10 && strcmp(type + n - 10, "/worksheet") == 0;
+}
 
-typedef struct {
-  char *value; /* Cell value (string or numeric as string) */
-  int is_null; /* Whether this cell is empty/null */
-} CellValue;
+static void XMLCALL rels_start_element(void *userData, const XML_Char *name,
+                                       const XML_Char **atts) {
+  Workbook *wb = (Workbook *)userData;
+  const char *id = NULL, *type = NULL, *target = NULL;
+  int external = 0;
 
-typedef struct {
-  CellValue *cells; /* Row of cells */
-  int count;        /* Number of cells in row */
-  int capacity;     /* Allocated capacity */
-} Row;
+  if (strcmp(name, "Relationship") != 0 || wb->count == 0)
+    return;
+  for (int i = 0; atts[i]; i += 2) {
+    if (strcmp(atts[i], "Id") == 0)
+      id = atts[i + 1];
+    else if (strcmp(atts[i], "Type") == 0)
+      type = atts[i + 1];
+    else if (strcmp(atts[i], "Target") == 0)
+      target = atts[i + 1];
+    else if (strcmp(atts[i], "TargetMode") == 0)
+      external = strcmp(atts[i + 1], "External") == 0;
+  }
+  if (!id || !type || !target)
+    return;
+
+  /* Relationships usually come in sheet order; start after the last match */
+  for (int k = 0; k < wb->count; k++) {
+    int i = (wb->next_rel + k) % wb->count;
+    SheetInfo *sheet = &wb->sheets[i];
+    if (!sheet->rid || sheet->resolved || strcmp(sheet->rid, id) != 0)
+      continue;
+    if (wb_is_worksheet_rel(type) && !external) {
+      sheet->path = wb_resolve_target(target);
+      if (!sheet->path) {
+        wb->oom = 1;
+        return;
+      }
+    }
+    sheet->resolved = 1;
+    wb->next_rel = i + 1;
+    break;
+  }
+}
+
+/*
+** Parse xl/workbook.xml and its relationships. Returns SQLITE_NOTFOUND if
+** there is no workbook. On success every sheet has its worksheet path, or a
+** NULL path when the sheet is not a worksheet (a chartsheet, say).
+*/
+static int parse_workbook(ZipArchive *za, Workbook *wb) {
+  XML_Parser parser = XML_ParserCreate(NULL);
+  if (!parser)
+    return SQLITE_NOMEM;
+
+  wb_init(wb);
+
+  XML_SetUserData(parser, wb);
+  XML_SetElementHandler(parser, wb_start_element, wb_end_element);
+
+  int rc = zip_parse_xml(za, "xl/workbook.xml", parser);
+  XML_ParserFree(parser);
+
+  if (rc == SQLITE_OK && wb->count > 0) {
+    /* A missing or malformed rels part leaves the sheets unresolved */
+    parser = XML_ParserCreate(NULL);
+    if (!parser) {
+      rc = SQLITE_NOMEM;
+    } else {
+      XML_SetUserData(parser, wb);
+      XML_SetElementHandler(parser, rels_start_element, wb_end_element);
+      int rels_rc = zip_parse_xml(za, "xl/_rels/workbook.xml.rels", parser);
+      XML_ParserFree(parser);
+      if (wb->oom)
+        rc = SQLITE_NOMEM;
+      else if (rels_rc != SQLITE_OK && rels_rc != SQLITE_NOTFOUND &&
+               rels_rc != SQLITE_ERROR)
+        rc = rels_rc;
+    }
+  }
+
+  for (int i = 0; rc == SQLITE_OK && i < wb->count; i++) {
+    SheetInfo *sheet = &wb->sheets[i];
+    if (sheet->resolved)
+      continue;
+    char fallback[40];
+    snprintf(fallback, sizeof(fallback), "xl/worksheets/sheet%d.xml", i + 1);
+    sheet->path = strdup(fallback);
+    if (!sheet->path)
+      rc = SQLITE_NOMEM;
+  }
+
+  if (rc != SQLITE_OK) {
+    wb_free(wb);
+  }
+  return rc;
+}
+
+/*
+** ============================================================================
+** Cell Styles (Dates and Times)
+** ============================================================================
+**
+** Excel stores dates and times as serial numbers: days since 1899-12-31,
+** or since 1904-01-01 in workbooks with date1904 set, with the time of day
+** as the fraction. Only the number format of the cell's style tells them
+** from other numbers: the s attribute of <c> indexes the cellXfs list of
+** xl/styles.xml, whose numFmtId is either a built-in format or one of the
+** numFmts of the workbook. parse_styles() reads styles.xml once per import
+** into one StyleKind byte per cellXfs entry, so the worksheet handlers tell
+** a date from a number with a single array lookup.
+**
+** The 1900 date system keeps Lotus 1-2-3's leap day: serial 60 is the
+** nonexistent 1900-02-29, so serials up to 59 count from 1899-12-31 and
+** later ones from 1899-12-30. Serial 60, negative serials and serials past
+** 9999-12-31 are left as numbers. Elapsed times ([h]:mm and the like) are
+** durations rather than times of day and stay numbers as well.
+*/
+
+typedef enum {
+  STYLE_PLAIN = 0, /* A number */
+  STYLE_DATE,      /* Date only */
+  STYLE_TIME,      /* Time of day only */
+  STYLE_DATETIME   /* Date and time */
+} StyleKind;
+
+/* What date cells become (xlsx_import_config('dates')) */
+typedef enum {
+  DATES_SERIAL = 0, /* The serial number, unchanged */
+  DATES_ISO,        /* ISO 8601 text: YYYY-MM-DD, HH:MM:SS or both */
+  DATES_JULIAN      /* Julian day number, as SQLite's julianday() */
+} DatesMode;
+
+/* Last serial number of the 1900 system, 9999-12-31 */
+#define STYLE_MAX_SERIAL 2958465
+
+typedef struct {
+  int id;
+  unsigned char kind;
+} StyleFormat;
+
+typedef struct {
+  unsigned char *kinds; /* StyleKind of each cellXfs entry */
+  int count;
+  int date1904;         /* Serials count days from 1904-01-01 */
+  int mode;             /* DatesMode, never DATES_SERIAL */
+
+  /* Parse state */
+  StyleFormat *formats; /* Custom numFmts */
+  int n_formats;
+  int *xf_formats;      /* numFmtId of each cellXfs entry */
+  int n_xfs;
+  int cap_xfs;
+  int in_cell_xfs;      /* Inside <cellXfs> */
+  int oom;
+} CellStyles;
+
+static void styles_free(CellStyles *st) {
+  free(st->kinds);
+  free(st->formats);
+  free(st->xf_formats);
+  memset(st, 0, sizeof(*st));
+}
+
+/* Kind of a built-in number format (ECMA-376 Part 1, 18.8.30) */
+static int style_builtin_kind(int id) {
+  if ((id >= 14 && id <= 17) || (id >= 27 && id <= 36) ||
+      (id >= 50 && id <= 58))
+    return STYLE_DATE;
+  if ((id >= 18 && id <= 21) || id == 45 || id == 47)
+    return STYLE_TIME;
+  if (id == 22)
+    return STYLE_DATETIME;
+  return STYLE_PLAIN;
+}
+
+/*
+** Kind of a custom format code, from the date and time letters of its first
+** section. Quoted text, escaped characters and [...] (colours, conditions,
+** locales) do not count. m is a month unless the format has hours or
+** seconds, where it is minutes.
+*/
+static int style_format_kind(const char *code) {
+  int date = 0, time = 0, month_or_minute = 0;
+
+  for (const char *p = code; *p && *p != ';'; p++) {
+    switch (*p) {
+    case '"':
+      while (p[1] && p[1] != '"')
+        p++;
+      if (p[1])
+        p++;
+      break;
+    case '\\':
+    case '_':
+    case '*':
+      if (p[1])
+        p++;
+      break;
+    case '[':
+      /* [h], [mm], [ss]: an elapsed time */
+      if (p[1] && strchr("hHmMsS", p[1]))
+        return STYLE_PLAIN;
+      while (p[1] && p[1] != ']')
+        p++;
+      if (p[1])
+        p++;
+      break;
+    case 'y':
+    case 'Y':
+    case 'd':
+    case 'D':
+      date = 1;
+      break;
+    case 'h':
+    case 'H':
+    case 's':
+    case 'S':
+      time = 1;
+      break;
+    case 'm':
+    case 'M':
+      month_or_minute = 1;
+      break;
+    case 'a':
+    case 'A':
+      /* AM/PM and A/P */
+      if (sqlite3_strnicmp(p, "AM/PM", 5) == 0) {
+        time = 1;
+        p += 4;
+      } else if (sqlite3_strnicmp(p, "A/P", 3) == 0) {
+        time = 1;
+        p += 2;
+      }
+      break;
+    }
+  }
+  if (month_or_minute && !time)
+    date = 1;
+  if (date && time)
+    return STYLE_DATETIME;
+  return date ? STYLE_DATE : time ? STYLE_TIME : STYLE_PLAIN;
+}
+
+static void XMLCALL styles_start_element(void *userData, const XML_Char *name,
+                                         const XML_Char **atts) {
+  CellStyles *st = (CellStyles *)userData;
+
+  if (strcmp(name, "numFmt") == 0) {
+    const char *code = NULL;
+    int id = -1;
+    for (int i = 0; atts[i]; i += 2) {
+      if (strcmp(atts[i], "numFmtId") == 0)
+        id = xlsx_parse_uint(atts[i + 1]);
+      else if (strcmp(atts[i], "formatCode") == 0)
+        code = atts[i + 1];
+    }
+    if (id < 0 || !code)
+      return;
+    StyleFormat *formats =
+        realloc(st->formats, (st->n_formats + 1) * sizeof(StyleFormat));
+    if (!formats) {
+      st->oom = 1;
+      return;
+    }
+    st->formats = formats;
+    st->formats[st->n_formats].id = id;
+    st->formats[st->n_formats].kind = (unsigned char)style_format_kind(code);
+    st->n_formats++;
+  } else if (strcmp(name, "cellXfs") == 0) {
+    st->in_cell_xfs = 1;
+  } else if (strcmp(name, "xf") == 0 && st->in_cell_xfs) {
+    int id = 0;
+    for (int i = 0; atts[i]; i += 2) {
+      if (strcmp(atts[i], "numFmtId") == 0)
+        id = xlsx_parse_uint(atts[i + 1]);
+    }
+    if (st->n_xfs >= st->cap_xfs) {
+      int new_cap = st->cap_xfs ? st->cap_xfs * 2 : 64;
+      int *xfs = realloc(st->xf_formats, new_cap * sizeof(int));
+      if (!xfs) {
+        st->oom = 1;
+        return;
+      }
+      st->xf_formats = xfs;
+      st->cap_xfs = new_cap;
+    }
+    st->xf_formats[st->n_xfs++] = id;
+  }
+}
+
+static void XMLCALL styles_end_element(void *userData, const XML_Char *name) {
+  CellStyles *st = (CellStyles *)userData;
+  if (strcmp(name, "cellXfs") == 0)
+    st->in_cell_xfs = 0;
+}
+
+/*
+** Read the kinds of the cell styles from xl/styles.xml. A workbook without
+** styles, or with unreadable ones, leaves every cell a number.
+*/
+static int parse_styles(ZipArchive *za, const Workbook *wb, int mode,
+                        CellStyles *st) {
+  memset(st, 0, sizeof(*st));
+  st->date1904 = wb->date1904;
+  st->mode = mode;
+
+  XML_Parser parser = XML_ParserCreate(NULL);
+  if (!parser)
+    return SQLITE_NOMEM;
+  XML_SetUserData(parser, st);
+  XML_SetElementHandler(parser, styles_start_element, styles_end_element);
+  int rc = zip_parse_xml(za, "xl/styles.xml", parser);
+  XML_ParserFree(parser);
+  if (st->oom)
+    rc = SQLITE_NOMEM;
+  else if (rc == SQLITE_NOTFOUND || rc == SQLITE_ERROR)
+    rc = SQLITE_OK;
+
+  if (rc == SQLITE_OK && st->n_xfs > 0) {
+    st->kinds = malloc((size_t)st->n_xfs);
+    if (!st->kinds)
+      rc = SQLITE_NOMEM;
+  }
+  for (int i = 0; rc == SQLITE_OK && i < st->n_xfs; i++) {
+    int id = st->xf_formats[i];
+    int kind = style_builtin_kind(id);
+    /* A custom format may also redefine a built-in id */
+    for (int k = 0; k < st->n_formats; k++) {
+      if (st->formats[k].id == id)
+        kind = st->formats[k].kind;
+    }
+    st->kinds[i] = (unsigned char)kind;
+  }
+  if (rc == SQLITE_OK)
+    st->count = st->n_xfs;
+  free(st->formats);
+  free(st->xf_formats);
+  st->formats = NULL;
+  st->xf_formats = NULL;
+  if (rc != SQLITE_OK)
+    styles_free(st);
+  return rc;
+}
+
+/* Write n as width digits at p, with leading zeros */
+static char *style_put_digits(char *p, int n, int width) {
+  for (int i = width - 1; i >= 0; i--) {
+    p[i] = (char)('0' + n % 10);
+    n /= 10;
+  }
+  return p + width;
+}
+
+/*
+** Convert the serial number text of a cell of the given kind. Writes the
+** value to buf (at least 32 bytes) and returns its length, setting *pType
+** to the type of the new cell, or returns 0 to keep the cell as it is.
+*/
+static int styles_convert(const CellStyles *st, int kind, const char *text,
+                          char *buf, char *pType) {
+  sqlite3_int64 iv;
+  double serial;
+  switch (xlsx_parse_number(text, (int)strlen(text), &iv, &serial)) {
+  case SQLITE_INTEGER:
+    serial = (double)iv;
+    break;
+  case SQLITE_FLOAT:
+    break;
+  default:
+    return 0;
+  }
+  if (!(serial >= 0 && serial < STYLE_MAX_SERIAL + 1.0))
+    return 0;
+
+  /* Milliseconds since serial 0, split into days and time of day */
+  sqlite3_int64 ms = (sqlite3_int64)(serial * 86400000.0 + 0.5);
+  sqlite3_int64 days = ms / 86400000;
+  int msday = (int)(ms % 86400000);
+
+  /* Days since 1970-01-01 */
+  if (st->date1904)
+    days -= 24107;
+  else if (days >= 61)
+    days -= 25569;
+  else if (days < 60)
+    days -= 25568;
+  else
+    return 0; /* 1900-02-29 */
+
+  char *p = buf;
+  if (st->mode == DATES_JULIAN && kind != STYLE_TIME) {
+    double jd = (double)days + 2440587.5;
+    if (kind == STYLE_DATETIME)
+      jd += msday / 86400000.0;
+    *pType = 'n';
+    sqlite3_snprintf(32, buf, "%.15g", jd);
+    if (!xlsx_same_double(buf, jd))
+      sqlite3_snprintf(32, buf, "%.17g", jd);
+    return (int)strlen(buf);
+  }
+
+  if (kind != STYLE_TIME) {
+    /* Civil date from a day count (H. Hinnant's days_from_civil inverse) */
+    sqlite3_int64 z = days + 719468;
+    sqlite3_int64 era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = (int)(z - era * 146097);
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int d = doy - (153 * mp + 2) / 5 + 1;
+    int m = mp < 10 ? mp + 3 : mp - 9;
+    int y = (int)(yoe + era * 400) + (m <= 2);
+    p = style_put_digits(p, y, 4);
+    *p++ = '-';
+    p = style_put_digits(p, m, 2);
+    *p++ = '-';
+    p = style_put_digits(p, d, 2);
+  }
+  if (kind != STYLE_DATE) {
+    int sec = msday / 1000;
+    if (p > buf)
+      *p++ = ' ';
+    p = style_put_digits(p, sec / 3600, 2);
+    *p++ = ':';
+    p = style_put_digits(p, sec / 60 % 60, 2);
+    *p++ = ':';
+    p = style_put_digits(p, sec % 60, 2);
+    if (msday % 1000) {
+      *p++ = '.';
+      p = style_put_digits(p, msday % 1000, 3);
+    }
+  }
+  *p = '\0';
+  *pType = 'd';
+  return (int)(p - buf);
+}
+
+/*
+** ============================================================================
+** Worksheet Parser
+** ============================================================================
+*/
+
+/*
+** A cell is a view on its text: shared strings point into the shared string
+** arena, every other value points into the scratch buffer of its row. No
+** cell owns memory, so filling and clearing a row does not allocate once the
+** row buffers have grown to size.
+**
+** A row is sparse: it holds only the cells present in the XML, in column
+** order, and its width separately. A lone cell in column XFD costs one
+** CellValue rather than 16384 of them. Rows written by Excel have a cell
+** in every column, so cell i is nearly always column i and a lookup is a
+** single comparison; other rows are searched by bisection.
+*/
+typedef enum {
+  CELL_NULL = 0, /* Empty cell */
+  CELL_SHARED,   /* Text is ptr, borrowed from SharedStrings */
+  CELL_SCRATCH   /* Text is at offset in the row scratch buffer */
+} CellKind;
 
 typedef struct {
-  Row *rows;    /* Array of rows */
-  int count;    /* Number of rows */
-  int capacity; /* Allocated capacity */
-  int max_col;  /* Maximum column number seen */
-} Worksheet;
+  const char *ptr; /* CELL_SHARED: the text */
+  size_t offset;   /* CELL_SCRATCH: offset of the text in Row.scratch */
+  int col;         /* Column, 0-based */
+  int len;         /* Length of the text in bytes */
+  int kind;        /* CellKind */
+  char type;       /* Cell type from the t attribute, as in cur_type */
+} CellValue;
 
 typedef struct {
-  Worksheet *ws;     /* Worksheet being built */
-  SharedStrings *ss; /* Shared strings reference */
+  CellValue *cells;   /* Cells present in the row, in column order */
+  int n_cells;        /* Number of entries in cells */
+  int capacity;       /* Allocated capacity */
+  int count;          /* Width of the row: its highest column */
+  char *scratch;      /* NUL-terminated texts of the CELL_SCRATCH cells */
+  size_t scratch_len; /* Bytes used in scratch */
+  size_t scratch_cap; /* Bytes allocated for scratch */
+} Row;
 
-  /* Current cell state */
-  int cur_row;   /* Current row number (1-based) */
+/*
+** Called by the worksheet parser at each </row> that contained at least one
+** cell. The Row buffer is reused for the next row, so the callback must copy
+** anything it wants to keep. A return value other than SQLITE_OK stops the
+** parser and is passed back by parse_worksheet().
+*/
+typedef int (*RowCallback)(void *udata, int row_num, Row *row);
+
+typedef struct {
+  SharedStrings *ss;    /* Shared strings reference */
+  const CellStyles *styles; /* Date styles to convert, or NULL */
+  XML_Parser parser;    /* Expat parser driving this state, or NULL */
+  RowCallback emit_row; /* Row sink */
+  void *emit_udata;     /* First argument to emit_row */
+  int rc;               /* First error returned by emit_row */
+  int n_emitted;        /* Rows handed to emit_row so far */
+  int skip_rows;        /* Rows to parse without emitting (fast scan replay) */
+  size_t max_row_bytes; /* Memory a row may use before SQLITE_TOOBIG, or 0 */
+  Row row;              /* Reusable buffer for the row being parsed */
+
+  /*
+  ** Columns to keep: bit i stands for column i+1, bit 63 for every column
+  ** from 64 on. Cells in other columns are not collected. col_limit, when
+  ** not 0, also drops the columns after it.
+  */
+  sqlite3_uint64 cols;
+  int col_limit;
+
+  /* Current row/cell state */
+  int row_num;      /* Number of the row being parsed, 0 if not known yet */
+  int last_row_num; /* Number of the previous row */
+  int row_cells;    /* Number of <c> elements seen in this row */
+  int max_col;      /* Highest column seen in this row */
+  int skip_cell;    /* The current cell is in a column that is not kept */
+  int cur_row;      /* Current row number (1-based) */
   int cur_col;   /* Current column number (1-based) */
   char cur_type; /* Cell type: 's'=shared string, 'n'=number, 'i'=inline,
                     'b'=boolean */
+  int cur_style; /* Style index (s attribute), read when styles is set */
   int in_v;      /* Inside <v> element */
   int in_t;      /* Inside <t> element (for inline strings) */
   int in_is;     /* Inside <is> element (inline string container) */
@@ -338,222 +1692,1072 @@ typedef struct {
   int text_cap;  /* Capacity of text buffer */
 } WorksheetParser;
 
-static void ws_init(Worksheet *ws) { memset(ws, 0, sizeof(*ws)); }
+static void row_reset(Row *row) {
+  row->n_cells = 0;
+  row->count = 0;
+  row->scratch_len = 0;
+}
 
-static void ws_free(Worksheet *ws) {
-  for (int i = 0; i < ws->count; i++) {
-    for (int j = 0; j < ws->rows[i].count; j++) {
-      free(ws->rows[i].cells[j].value);
-    }
-    free(ws->rows[i].cells);
+static void row_free(Row *row) {
+  free(row->cells);
+  free(row->scratch);
+  memset(row, 0, sizeof(*row));
+}
+
+/* Bytes allocated by the row, for the memory budget */
+static size_t row_bytes(const Row *row) {
+  return (size_t)row->capacity * sizeof(CellValue) + row->scratch_cap;
+}
+
+/* Index of the first cell at or after column col (0-based) */
+static int row_search(const Row *row, int col) {
+  int lo = 0, hi = row->n_cells < col + 1 ? row->n_cells : col + 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (row->cells[mid].col < col)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-  free(ws->rows);
-  memset(ws, 0, sizeof(*ws));
+  return lo;
 }
 
-static Row *ws_get_row(Worksheet *ws, int row_num) {
-  /* Ensure we have enough rows (row_num is 1-based) */
-  while (ws->count < row_num) {
-    if (ws->count >= ws->capacity) {
-      int new_cap = ws->capacity ? ws->capacity * 2 : 64;
-      Row *new_rows = realloc(ws->rows, new_cap * sizeof(Row));
-      if (!new_rows)
-        return NULL;
-      ws->rows = new_rows;
-      ws->capacity = new_cap;
-    }
-    memset(&ws->rows[ws->count], 0, sizeof(Row));
-    ws->count++;
+/* Cell of column col (0-based), or NULL if the row has none there */
+static const CellValue *row_find(const Row *row, int col) {
+  if (col < 0 || col >= row->count)
+    return NULL;
+  if (col < row->n_cells && row->cells[col].col == col)
+    return &row->cells[col];
+  int i = row_search(row, col);
+  return i < row->n_cells && row->cells[i].col == col ? &row->cells[i] : NULL;
+}
+
+/* Text of cell and its length, or NULL if cell is NULL or empty */
+static const char *row_value_text(const Row *row, const CellValue *cell,
+                                  int *pLen) {
+  if (!cell)
+    return NULL;
+  *pLen = cell->len;
+  switch (cell->kind) {
+  case CELL_SHARED:
+    return cell->ptr;
+  case CELL_SCRATCH:
+    return row->scratch + cell->offset;
+  default:
+    return NULL;
   }
-  return &ws->rows[row_num - 1];
 }
 
-static void ws_set_cell(Worksheet *ws, int row_num, int col_num,
-                        const char *value) {
-  Row *row = ws_get_row(ws, row_num);
-  if (!row)
-    return;
+/* Type of cell col (0-based) as in cur_type, or 0 if the cell is missing */
+static char row_cell_type(const Row *row, int col) {
+  const CellValue *cell = row_find(row, col);
+  return cell ? cell->type : 0;
+}
 
-  /* Ensure we have enough columns (col_num is 1-based) */
-  while (row->count < col_num) {
-    if (row->count >= row->capacity) {
-      int new_cap = row->capacity ? row->capacity * 2 : 16;
-      CellValue *new_cells = realloc(row->cells, new_cap * sizeof(CellValue));
-      if (!new_cells)
-        return;
-      row->cells = new_cells;
-      row->capacity = new_cap;
+/*
+** Return the text of cell col (0-based) and its length, or NULL if the cell
+** is empty. The text is NUL-terminated and valid until the row is reset.
+*/
+static const char *row_cell_text(const Row *row, int col, int *pLen) {
+  return row_value_text(row, row_find(row, col), pLen);
+}
+
+/*
+** Return cell col_num (1-based) cleared to empty, inserting it in column
+** order if the row has none there, and widen the row to it
+*/
+static CellValue *row_cell(Row *row, int col_num) {
+  int col = col_num - 1;
+  int i = row->n_cells;
+
+  /* Cells nearly always arrive in column order: append */
+  if (i > 0 && row->cells[i - 1].col >= col) {
+    i = row_search(row, col);
+    if (row->cells[i].col == col) {
+      row->cells[i].kind = CELL_NULL;
+      return &row->cells[i];
     }
-    row->cells[row->count].value = NULL;
-    row->cells[row->count].is_null = 1;
-    row->count++;
   }
+  if (row->n_cells >= row->capacity) {
+    int new_cap = row->capacity ? row->capacity * 2 : 16;
+    CellValue *new_cells = realloc(row->cells, new_cap * sizeof(CellValue));
+    if (!new_cells)
+      return NULL;
+    row->cells = new_cells;
+    row->capacity = new_cap;
+  }
+  memmove(&row->cells[i + 1], &row->cells[i],
+          (size_t)(row->n_cells - i) * sizeof(CellValue));
+  row->n_cells++;
+  if (col_num > row->count)
+    row->count = col_num;
+
+  CellValue *cell = &row->cells[i];
+  cell->col = col;
+  cell->kind = CELL_NULL;
+  return cell;
+}
+
+/*
+** Set a cell of the given type to value (len bytes, copied into the row
+** scratch), or to NULL. An empty cell only widens the row, unless it
+** replaces an earlier cell of the same column. Returns SQLITE_OK or
+** SQLITE_NOMEM.
+*/
+static int row_set_cell(Row *row, int col_num, const char *value, int len,
+                        char type) {
+  if (!value) {
+    CellValue *cell = (CellValue *)row_find(row, col_num - 1);
+    if (cell)
+      cell->kind = CELL_NULL;
+    else if (col_num > row->count)
+      row->count = col_num;
+    return SQLITE_OK;
+  }
+  CellValue *cell = row_cell(row, col_num);
+  if (!cell)
+    return SQLITE_NOMEM;
+
+  size_t need = row->scratch_len + (size_t)len + 1;
+  if (need > row->scratch_cap) {
+    size_t new_cap = row->scratch_cap ? row->scratch_cap * 2 : 256;
+    while (new_cap < need)
+      new_cap *= 2;
+    char *new_scratch = realloc(row->scratch, new_cap);
+    if (!new_scratch)
+      return SQLITE_NOMEM;
+    row->scratch = new_scratch;
+    row->scratch_cap = new_cap;
+  }
+
+  memcpy(row->scratch + row->scratch_len, value, len);
+  row->scratch[row->scratch_len + len] = '\0';
+  cell->offset = row->scratch_len;
+  cell->len = len;
+  cell->kind = CELL_SCRATCH;
+  cell->type = type;
+  row->scratch_len = need;
+  return SQLITE_OK;
+}
 
-  /* Set the cell value */
-  free(row->cells[col_num - 1].value);
-  row->cells[col_num - 1].value = value ? strdup(value) : NULL;
-  row->cells[col_num - 1].is_null = (value == NULL);
+/*
+** Set a cell to value without copying it. value must be NUL-terminated and
+** outlive the row (used for shared strings), or NULL for an empty cell.
+** Returns SQLITE_OK or SQLITE_NOMEM.
+*/
+static int row_set_ref(Row *row, int col_num, const char *value, int len) {
+  if (!value)
+    return row_set_cell(row, col_num, NULL, 0, 's');
+  CellValue *cell = row_cell(row, col_num);
+  if (!cell)
+    return SQLITE_NOMEM;
+  cell->ptr = value;
+  cell->len = len;
+  cell->kind = CELL_SHARED;
+  cell->type = 's';
+  return SQLITE_OK;
+}
 
-  /* Track max column */
-  if (col_num > ws->max_col) {
-    ws->max_col = col_num;
+/* Make dst a deep copy of src, reusing the buffers dst already has */
+static int row_assign(Row *dst, const Row *src) {
+  if (src->n_cells > dst->capacity) {
+    CellValue *cells = realloc(dst->cells, src->n_cells * sizeof(CellValue));
+    if (!cells)
+      return SQLITE_NOMEM;
+    dst->cells = cells;
+    dst->capacity = src->n_cells;
+  }
+  if (src->scratch_len > dst->scratch_cap) {
+    char *scratch = realloc(dst->scratch, src->scratch_len);
+    if (!scratch)
+      return SQLITE_NOMEM;
+    dst->scratch = scratch;
+    dst->scratch_cap = src->scratch_len;
   }
+  if (src->n_cells > 0)
+    memcpy(dst->cells, src->cells, src->n_cells * sizeof(CellValue));
+  if (src->scratch_len > 0)
+    memcpy(dst->scratch, src->scratch, src->scratch_len);
+  dst->n_cells = src->n_cells;
+  dst->count = src->count;
+  dst->scratch_len = src->scratch_len;
+  return SQLITE_OK;
+}
+
+/* Make dst a deep copy of src; dst must be empty */
+static int row_copy(Row *dst, const Row *src) {
+  memset(dst, 0, sizeof(*dst));
+  int rc = row_assign(dst, src);
+  if (rc != SQLITE_OK)
+    row_free(dst);
+  return rc;
 }
 
-static void wsp_init(WorksheetParser *wsp, Worksheet *ws, SharedStrings *ss) {
+static void wsp_init(WorksheetParser *wsp, SharedStrings *ss,
+                     RowCallback emit_row, void *emit_udata) {
   memset(wsp, 0, sizeof(*wsp));
-  wsp->ws = ws;
   wsp->ss = ss;
+  wsp->emit_row = emit_row;
+  wsp->emit_udata = emit_udata;
+  wsp->cols = ~(sqlite3_uint64)0;
   wsp->cur_type = 'n'; /* Default to number */
 }
 
-static void wsp_free(WorksheetParser *wsp) { free(wsp->text); }
+/* True if cells of column col (1-based) are to be collected */
+static int wsp_col_wanted(const WorksheetParser *wsp, int col) {
+  if (wsp->col_limit > 0 && col > wsp->col_limit)
+    return 0;
+  return (wsp->cols >> (col <= 64 ? col - 1 : 63)) & 1;
+}
+
+static void wsp_free(WorksheetParser *wsp) {
+  row_free(&wsp->row);
+  free(wsp->text);
+}
+
+/* Record the first error and stop the parser */
+static void wsp_fail(WorksheetParser *wsp, int rc) {
+  if (wsp->rc != SQLITE_OK)
+    return;
+  wsp->rc = rc;
+  if (wsp->parser)
+    XML_StopParser(wsp->parser, XML_FALSE);
+}
+
+/* Fail with SQLITE_TOOBIG once the row outgrows max_row_bytes */
+static void wsp_check_size(WorksheetParser *wsp) {
+  if (wsp->max_row_bytes &&
+      row_bytes(&wsp->row) + (size_t)wsp->text_cap > wsp->max_row_bytes)
+    wsp_fail(wsp, SQLITE_TOOBIG);
+}
 
-static void wsp_append_text(WorksheetParser *wsp, const char *s, int len) {
+static int wsp_append_text(WorksheetParser *wsp, const char *s, int len) {
   if (wsp->text_len + len >= wsp->text_cap) {
     int new_cap = wsp->text_cap ? wsp->text_cap * 2 : 256;
     while (new_cap <= wsp->text_len + len)
       new_cap *= 2;
     char *new_text = realloc(wsp->text, new_cap);
     if (!new_text)
-      return;
+      return SQLITE_NOMEM;
     wsp->text = new_text;
     wsp->text_cap = new_cap;
   }
   memcpy(wsp->text + wsp->text_len, s, len);
   wsp->text_len += len;
   wsp->text[wsp->text_len] = '\0';
+  return SQLITE_OK;
 }
 
 static void XMLCALL ws_start_element(void *userData, const XML_Char *name,
                                      const XML_Char **atts) {
   WorksheetParser *wsp = (WorksheetParser *)userData;
 
-  if (strcmp(name, "c") == 0) {
+  switch (xlsx_tag(name)) {
+  case XLSX_TAG_C:
     /* Cell element */
     wsp->cur_type = 'n'; /* Default to number */
+    wsp->cur_style = 0;
     wsp->cur_row = 0;
     wsp->cur_col = 0;
 
     for (int i = 0; atts[i]; i += 2) {
-      if (strcmp(atts[i], "r") == 0) {
-        /* Parse cell reference */
-        wsp->cur_col = parse_cell_ref(atts[i + 1], &wsp->cur_row);
-      } else if (strcmp(atts[i], "t") == 0) {
-        /* Cell type */
-        if (strcmp(atts[i + 1], "s") == 0) {
-          wsp->cur_type = 's'; /* Shared string */
-        } else if (strcmp(atts[i + 1], "inlineStr") == 0) {
-          wsp->cur_type = 'i'; /* Inline string */
-        } else if (strcmp(atts[i + 1], "b") == 0) {
-          wsp->cur_type = 'b'; /* Boolean */
-        } else if (strcmp(atts[i + 1], "str") == 0) {
-          wsp->cur_type = 'f'; /* Formula string result */
-        }
+      switch (xlsx_attr(atts[i])) {
+      case XLSX_ATTR_R:
+        /* Cell reference: column letters and row number in one pass */
+        wsp->cur_col = xlsx_parse_ref(atts[i + 1], &wsp->cur_row);
+        break;
+      case XLSX_ATTR_T:
+        /* Cell type: s, i (inlineStr), b, f (str); anything else is 'n' */
+        wsp->cur_type = xlsx_cell_type(atts[i + 1]);
+        if (wsp->cur_type == 'e' || wsp->cur_type == 'd')
+          wsp->cur_type = 'n';
+        break;
+      case XLSX_ATTR_S:
+        if (wsp->styles)
+          wsp->cur_style = xlsx_parse_uint(atts[i + 1]);
+        break;
       }
     }
 
+    /* The r attribute is optional: continue from the previous cell/row */
+    if (wsp->cur_col == 0) {
+      if (wsp->row_num == 0)
+        wsp->row_num = wsp->last_row_num + 1;
+      wsp->cur_col = wsp->max_col + 1;
+      wsp->cur_row = wsp->row_num;
+    } else if (wsp->row_num == 0) {
+      wsp->row_num = wsp->cur_row;
+    }
+    if (wsp->cur_col > wsp->max_col)
+      wsp->max_col = wsp->cur_col;
+    wsp->row_cells++;
+    wsp->skip_cell = !wsp_col_wanted(wsp, wsp->cur_col);
+
     /* Reset text buffer */
     wsp->text_len = 0;
     if (wsp->text)
       wsp->text[0] = '\0';
-  } else if (strcmp(name, "v") == 0) {
+    break;
+  case XLSX_TAG_V:
     wsp->in_v = 1;
     wsp->text_len = 0;
     if (wsp->text)
       wsp->text[0] = '\0';
-  } else if (strcmp(name, "is") == 0) {
+    break;
+  case XLSX_TAG_IS:
     wsp->in_is = 1;
-  } else if (strcmp(name, "t") == 0 && wsp->in_is) {
+    break;
+  case XLSX_TAG_T:
+    if (!wsp->in_is)
+      break;
     wsp->in_t = 1;
     wsp->text_len = 0;
     if (wsp->text)
       wsp->text[0] = '\0';
+    break;
+  case XLSX_TAG_ROW:
+    /* Without an r attribute the row number comes from its first cell */
+    wsp->row_num = 0;
+    for (int i = 0; atts[i]; i += 2) {
+      if (xlsx_attr(atts[i]) == XLSX_ATTR_R) {
+        int n = xlsx_parse_uint(atts[i + 1]);
+        wsp->row_num = n > 0 ? n : 0;
+      }
+    }
+    row_reset(&wsp->row);
+    wsp->row_cells = 0;
+    wsp->max_col = 0;
+    break;
   }
 }
 
 static void XMLCALL ws_end_element(void *userData, const XML_Char *name) {
   WorksheetParser *wsp = (WorksheetParser *)userData;
 
-  if (strcmp(name, "c") == 0) {
+  switch (xlsx_tag(name)) {
+  case XLSX_TAG_C:
     /* End of cell - store the value */
-    if (wsp->cur_row > 0 && wsp->cur_col > 0) {
-      const char *value = NULL;
-
+    if (wsp->cur_row > 0 && wsp->cur_col > 0 && !wsp->skip_cell &&
+        wsp->rc == SQLITE_OK) {
+      int rc;
       if (wsp->cur_type == 's' && wsp->text && wsp->ss) {
-        /* Shared string - look up by index */
-        int idx = atoi(wsp->text);
-        if (idx >= 0 && idx < wsp->ss->count) {
-          value = wsp->ss->strings[idx];
-        }
+        /* Shared string - point into the shared string arena */
+        int len = 0;
+        const char *value = ss_get(wsp->ss, xlsx_parse_uint(wsp->text), &len);
+        rc = row_set_ref(&wsp->row, wsp->cur_col, value, len);
       } else if (wsp->cur_type == 'i') {
         /* Inline string - use accumulated text */
-        value = wsp->text;
+        rc = row_set_cell(&wsp->row, wsp->cur_col, wsp->text, wsp->text_len,
+                          wsp->cur_type);
       } else if (wsp->text && wsp->text_len > 0) {
-        /* Number or other - use as-is */
-        value = wsp->text;
+        /* Number or other - use as-is, unless its style makes it a date */
+        const CellStyles *st = wsp->styles;
+        char date[32];
+        char type = wsp->cur_type;
+        int len = 0;
+        if (st && type == 'n' && wsp->cur_style >= 0 &&
+            wsp->cur_style < st->count && st->kinds[wsp->cur_style])
+          len = styles_convert(st, st->kinds[wsp->cur_style], wsp->text, date,
+                               &type);
+        if (len > 0)
+          rc = row_set_cell(&wsp->row, wsp->cur_col, date, len, type);
+        else
+          rc = row_set_cell(&wsp->row, wsp->cur_col, wsp->text, wsp->text_len,
+                            wsp->cur_type);
+      } else {
+        rc = row_set_cell(&wsp->row, wsp->cur_col, NULL, 0, wsp->cur_type);
       }
-
-      ws_set_cell(wsp->ws, wsp->cur_row, wsp->cur_col, value);
+      if (rc != SQLITE_OK)
+        wsp_fail(wsp, rc);
+      else
+        wsp_check_size(wsp);
     }
-  } else if (strcmp(name, "v") == 0) {
+    break;
+  case XLSX_TAG_V:
     wsp->in_v = 0;
-  } else if (strcmp(name, "is") == 0) {
+    break;
+  case XLSX_TAG_IS:
     wsp->in_is = 0;
-  } else if (strcmp(name, "t") == 0 && wsp->in_is) {
-    wsp->in_t = 0;
+    break;
+  case XLSX_TAG_T:
+    if (wsp->in_is)
+      wsp->in_t = 0;
+    break;
+  case XLSX_TAG_ROW:
+    /* End of row - hand it to the sink, then reuse the buffer */
+    if (wsp->row_cells > 0 && wsp->row_num > 0 && wsp->skip_rows > 0) {
+      wsp->skip_rows--;
+    } else if (wsp->row_cells > 0 && wsp->row_num > 0) {
+      int rc = wsp->emit_row(wsp->emit_udata, wsp->row_num, &wsp->row);
+      wsp->n_emitted++;
+      if (rc != SQLITE_OK)
+        wsp_fail(wsp, rc);
+    }
+    row_reset(&wsp->row);
+    wsp->row_cells = 0;
+    wsp->max_col = 0;
+    if (wsp->row_num > 0)
+      wsp->last_row_num = wsp->row_num;
+    wsp->row_num = 0;
+    break;
   }
 }
 
 static void XMLCALL ws_char_data(void *userData, const XML_Char *s, int len) {
   WorksheetParser *wsp = (WorksheetParser *)userData;
 
-  if (wsp->in_v || wsp->in_t) {
-    wsp_append_text(wsp, s, len);
+  if ((wsp->in_v || wsp->in_t) && !wsp->skip_cell && wsp->rc == SQLITE_OK) {
+    if (wsp_append_text(wsp, s, len) != SQLITE_OK)
+      wsp_fail(wsp, SQLITE_NOMEM);
+    else
+      wsp_check_size(wsp);
   }
 }
 
-static int parse_worksheet(const char *xml, int xml_len, SharedStrings *ss,
-                           Worksheet *ws) {
-  XML_Parser parser = XML_ParserCreate(NULL);
-  if (!parser)
-    return -1;
-
-  ws_init(ws);
+/*
+** ============================================================================
+** Fast Worksheet Scanner
+** ============================================================================
+**
+** Worksheets written by Excel and by xlsxexport use a small, regular subset
+** of XML: one encoding, no DTD, no comments or CDATA, and only the
+** predefined and numeric character references. The fast scanner tokenizes
+** that subset in place and calls the same ws_start_element(),
+** ws_end_element() and ws_char_data() handlers as Expat, so both engines
+** build identical rows. The next '<', '&' or CR in text, and the next '>'
+** or quote in a tag, are found 16 bytes at a time with SSE2 or NEON.
+**
+** Anything outside the subset, and the well-formedness errors the scanner
+** can see on its way (mismatched tags, bad names or attribute syntax,
+** duplicate attributes, unknown references, invalid UTF-8, "]]>" in text),
+** make it return FS_FALLBACK.
+** parse_worksheet() then parses the sheet again with Expat, skipping the
+** rows already delivered, so the rows seen by the RowCallback do not depend
+** on where the scanner gave up, and errors are reported by Expat.
+**
+** The fast scanner is only used by xlsx_import(); the xlsx_sheet virtual
+** table suspends its parser between rows and always uses Expat.
+*/
 
-  WorksheetParser wsp;
-  wsp_init(&wsp, ws, ss);
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FS_HAVE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define FS_HAVE_NEON 1
+#endif
 
-  XML_SetUserData(parser, &wsp);
-  XML_SetElementHandler(parser, ws_start_element, ws_end_element);
-  XML_SetCharacterDataHandler(parser, ws_char_data);
+#define FS_FALLBACK (-1) /* Input the fast scanner does not handle */
+#define FS_MAX_ATTS 16   /* Attributes per element */
+#define FS_MAX_ENTITY 12 /* Longest character reference, "&#x10FFFF;" */
+#define FS_MAX_DEPTH 32  /* Nesting of elements */
+#define FS_MAX_NAME 48   /* Length of element names, with the NUL */
 
-  int result = 0;
-  if (XML_Parse(parser, xml, xml_len, 1) == XML_STATUS_ERROR) {
-    result = -1;
+typedef struct {
+  WorksheetParser *wsp;
+  char *buf;    /* Unconsumed input, always ends in a partial token */
+  size_t len;   /* Bytes in buf */
+  size_t cap;   /* Bytes allocated for buf */
+  int started;  /* The byte order mark and XML declaration were checked */
+  int depth;    /* Open elements */
+  int seen_root;
+  char open[FS_MAX_DEPTH][FS_MAX_NAME]; /* Names of the open elements */
+} FastScanner;
+
+/* Return the first of a, b or c in [p, end), or end */
+static const char *fs_find3(const char *p, const char *end, char a, char b,
+                            char c) {
+#if defined(FS_HAVE_SSE2)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+        _mm_cmpeq_epi8(v, vc));
+    int mask = _mm_movemask_epi8(m);
+    if (mask)
+      return p + __builtin_ctz((unsigned)mask);
+    p += 16;
   }
-
-  wsp_free(&wsp);
-  XML_ParserFree(parser);
-
-  if (result != 0) {
-    ws_free(ws);
+#elif defined(FS_HAVE_NEON)
+  const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+  const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+  const uint8x16_t vc = vdupq_n_u8((uint8_t)c);
+  while (end - p >= 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+                            vceqq_u8(v, vc));
+    /* Narrow to 4 bits per byte to get a scalar mask */
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll(mask) >> 2);
+    p += 16;
   }
-
-  return result;
+#endif
+  for (; p < end; p++) {
+    if (*p == a || *p == b || *p == c)
+      return p;
+  }
+  return end;
 }
 
 /*
-** ============================================================================
-** Table Name Escaping
-** ============================================================================
+** True if [s, s+n) is valid UTF-8 without the control characters XML does
+** not allow. ASCII text is checked 8 bytes at a time.
 */
+static int fs_text_valid(const unsigned char *s, size_t n) {
+  const unsigned char *end = s + n;
+  while (s < end) {
+    if (end - s >= 8) {
+      sqlite3_uint64 w;
+      memcpy(&w, s, 8);
+      /* High bit set, or a byte below 0x20 */
+      sqlite3_uint64 low = (w - 0x2020202020202020ull) & ~w;
+      if (((w | low) & 0x8080808080808080ull) == 0) {
+        s += 8;
+        continue;
+      }
+    }
+    unsigned c = *s;
+    if (c < 0x80) {
+      if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+        return 0;
+      s++;
+      continue;
+    }
+    int extra;
+    unsigned cp;
+    if (c >= 0xC2 && c <= 0xDF) {
+      extra = 1;
+      cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      extra = 2;
+      cp = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      extra = 3;
+      cp = c & 0x07;
+    } else {
+      return 0;
+    }
+    if (end - s <= extra)
+      return 0;
+    for (int i = 1; i <= extra; i++) {
+      if ((s[i] & 0xC0) != 0x80)
+        return 0;
+      cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    if ((extra == 2 && cp < 0x800) || (extra == 3 && cp < 0x10000) ||
+        cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) || cp == 0xFFFE ||
+        cp == 0xFFFF)
+      return 0;
+    s += extra + 1;
+  }
+  return 1;
+}
 
 /*
-** Escape a sheet name to make it a valid SQLite identifier.
-** Replaces problematic characters and wraps in quotes if necessary.
+** Decode the character reference between '&' at p and ';' at semi into
+** out (at least 4 bytes). Returns the number of bytes written, or 0 for a
+** reference only Expat can resolve or reject.
 */
-static char *escape_identifier(const char *name) {
+static int fs_decode_entity(const char *p, const char *semi, char *out) {
+  const char *name = p + 1;
+  int n = (int)(semi - name);
+
+  if (n == 2 && name[0] == 'l' && name[1] == 't') {
+    out[0] = '<';
+    return 1;
+  } else if (n == 2 && name[0] == 'g' && name[1] == 't') {
+    out[0] = '>';
+    return 1;
+  } else if (n == 3 && memcmp(name, "amp", 3) == 0) {
+    out[0] = '&';
+    return 1;
+  } else if (n == 4 && memcmp(name, "quot", 4) == 0) {
+    out[0] = '"';
+    return 1;
+  } else if (n == 4 && memcmp(name, "apos", 4) == 0) {
+    out[0] = '\'';
+    return 1;
+  } else if (n < 2 || name[0] != '#') {
+    return 0;
+  }
+
+  unsigned cp = 0;
+  const char *q = name + 1;
+  if (*q == 'x') {
+    for (q++; q < semi; q++) {
+      unsigned c = (unsigned char)*q;
+      unsigned d = c - '0' < 10u                ? c - '0'
+                   : (c | 0x20) - 'a' < 6u ? (c | 0x20) - 'a' + 10
+                                                : 16;
+      if (d == 16 || cp > 0x10FFFF)
+        return 0;
+      cp = cp * 16 + d;
+    }
+    if (q == name + 2)
+      return 0;
+  } else {
+    for (; q < semi; q++) {
+      if (*q < '0' || *q > '9' || cp > 0x10FFFF)
+        return 0;
+      cp = cp * 10 + (unsigned)(*q - '0');
+    }
+  }
+
+  /* Only the characters XML allows */
+  if (cp < 0x20 && cp != '\t' && cp != '\n' && cp != '\r')
+    return 0;
+  if ((cp >= 0xD800 && cp <= 0xDFFF) || cp == 0xFFFE || cp == 0xFFFF ||
+      cp > 0x10FFFF)
+    return 0;
+
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  } else if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+static int fs_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* True unless [p, end) is clearly not an XML name */
+static int fs_name_ok(const char *p, const char *end) {
+  if (p == end || (*p >= '0' && *p <= '9') || *p == '-' || *p == '.')
+    return 0;
+  for (; p < end; p++) {
+    switch (*p) {
+    case '<': case '>': case '"': case '\'': case '=': case '/':
+    case '&': case ';': case '!': case '?':
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+** Decode the attribute value [p, end) in place and NUL-terminate it, with
+** the whitespace normalization Expat applies. Returns 0 if the value holds
+** something only Expat can handle.
+*/
+static int fs_decode_attr(char *p, char *end) {
+  char *out = p;
+  while (p < end) {
+    char c = *p;
+    if (c == '&') {
+      char *semi = memchr(p, ';', end - p);
+      char buf[4];
+      int n = semi ? fs_decode_entity(p, semi, buf) : 0;
+      if (n == 0)
+        return 0;
+      memcpy(out, buf, n); /* A reference is never shorter than its value */
+      out += n;
+      p = semi + 1;
+    } else if (c == '<') {
+      return 0;
+    } else if (c == '\r' || c == '\n' || c == '\t') {
+      *out++ = ' ';
+      p += (c == '\r' && p + 1 < end && p[1] == '\n') ? 2 : 1;
+    } else {
+      *out++ = c;
+      p++;
+    }
+  }
+  *out = '\0';
+  return 1;
+}
+
+/*
+** Handle the complete start tag "<name ...>" in [p, gt], gt pointing at
+** the '>'. Returns SQLITE_OK, FS_FALLBACK or the first emit_row error.
+*/
+static int fs_start_tag(FastScanner *fs, char *p, char *gt) {
+  const char *atts[FS_MAX_ATTS * 2 + 1];
+  int n_atts = 0;
+  int empty = gt[-1] == '/';
+  char *end = empty ? gt - 1 : gt;
+  char *name = p + 1;
+
+  p = name;
+  while (p < end && !fs_is_space(*p))
+    p++;
+  char *name_end = p;
+  if (!fs_name_ok(name, name_end))
+    return FS_FALLBACK;
+
+  for (;;) {
+    while (p < end && fs_is_space(*p))
+      p++;
+    if (p == end)
+      break;
+    if (n_atts == FS_MAX_ATTS)
+      return FS_FALLBACK;
+
+    char *att = p;
+    while (p < end && *p != '=' && !fs_is_space(*p))
+      p++;
+    char *att_end = p;
+    while (p < end && fs_is_space(*p))
+      p++;
+    if (p == end || *p != '=' || !fs_name_ok(att, att_end))
+      return FS_FALLBACK;
+    p++;
+    while (p < end && fs_is_space(*p))
+      p++;
+    if (p == end || (*p != '"' && *p != '\''))
+      return FS_FALLBACK;
+    char *value = p + 1;
+    char *close = memchr(value, *p, end - value);
+    if (!close)
+      return FS_FALLBACK;
+    p = close + 1;
+    if (p < end && !fs_is_space(*p))
+      return FS_FALLBACK; /* Attributes must be separated by whitespace */
+
+    *att_end = '\0';
+    for (int i = 0; i < n_atts; i++) {
+      if (strcmp(atts[i * 2], att) == 0)
+        return FS_FALLBACK; /* Duplicate attribute */
+    }
+    if (!fs_decode_attr(value, close))
+      return FS_FALLBACK;
+    atts[n_atts * 2] = att;
+    atts[n_atts * 2 + 1] = value;
+    n_atts++;
+  }
+  atts[n_atts * 2] = NULL;
+  *name_end = '\0';
+
+  if (fs->depth == 0 && fs->seen_root)
+    return FS_FALLBACK; /* A second root element */
+  if (!empty) {
+    if (fs->depth == FS_MAX_DEPTH || name_end - name >= FS_MAX_NAME)
+      return FS_FALLBACK;
+    memcpy(fs->open[fs->depth++], name, name_end - name + 1);
+  }
+  fs->seen_root = 1;
+  ws_start_element(fs->wsp, name, atts);
+  if (empty)
+    ws_end_element(fs->wsp, name);
+  return fs->wsp->rc;
+}
+
+/* Handle the complete end tag "</name>" in [p, gt] */
+static int fs_end_tag(FastScanner *fs, char *p, char *gt) {
+  char *name = p + 2;
+  char *q = name;
+  while (q < gt && !fs_is_space(*q))
+    q++;
+  char *name_end = q;
+  while (q < gt && fs_is_space(*q))
+    q++;
+  if (q != gt || fs->depth == 0)
+    return FS_FALLBACK;
+  *name_end = '\0';
+  if (strcmp(fs->open[fs->depth - 1], name) != 0)
+    return FS_FALLBACK; /* Mismatched tag */
+  fs->depth--;
+  ws_end_element(fs->wsp, name);
+  return fs->wsp->rc;
+}
+
+/* Pass text to the handler, unless Expat would reject it */
+static int fs_text(FastScanner *fs, const char *p, size_t n) {
+  if (n == 0)
+    return SQLITE_OK;
+  if (!fs_text_valid((const unsigned char *)p, n))
+    return FS_FALLBACK;
+  /* "]]>" may not appear in character data. The scanner splits text only
+  ** at '<', '&' and CR, so a literal one is always within a single run. */
+  for (const char *gt = p + 2; gt < p + n;) {
+    gt = memchr(gt, '>', p + n - gt);
+    if (!gt)
+      break;
+    if (gt[-1] == ']' && gt[-2] == ']')
+      return FS_FALLBACK;
+    gt++;
+  }
+  if (fs->depth == 0) {
+    /* Only whitespace may appear outside the root element */
+    for (size_t i = 0; i < n; i++) {
+      if (!fs_is_space(p[i]))
+        return FS_FALLBACK;
+    }
+    return SQLITE_OK;
+  }
+  ws_char_data(fs->wsp, p, (int)n);
+  return fs->wsp->rc;
+}
+
+/*
+** Accept the byte order mark and XML declaration written by Excel: UTF-8
+** only. Returns 0 if there is not enough input yet, 1 when done, or
+** FS_FALLBACK.
+*/
+static int fs_check_prolog(FastScanner *fs, char **pp, char *end, int final) {
+  char *p = *pp;
+  if (end - p < 6 && !final)
+    return 0;
+  if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+    p += 3;
+  else if (end - p >= 2 && ((unsigned char)p[0] == 0xFE ||
+                            (unsigned char)p[0] == 0xFF || p[0] == '\0' ||
+                            p[1] == '\0'))
+    return FS_FALLBACK; /* UTF-16 or UTF-32 */
+
+  if (end - p >= 5 && memcmp(p, "<?xml", 5) == 0) {
+    char *q = p;
+    while ((q = memchr(q, '>', end - q)) != NULL && q[-1] != '?')
+      q++;
+    if (!q)
+      return final ? FS_FALLBACK : 0;
+    /* Any encoding declaration must name UTF-8 */
+    for (char *e = p; e + 8 < q; e++) {
+      if (memcmp(e, "encoding", 8) == 0) {
+        char *v = e + 8;
+        while (v < q && (fs_is_space(*v) || *v == '='))
+          v++;
+        if (v + 6 >= q || (*v != '"' && *v != '\'') ||
+            sqlite3_strnicmp(v + 1, "UTF-8", 5) != 0 || v[6] != *v)
+          return FS_FALLBACK;
+        break;
+      }
+    }
+    p = q + 1;
+  }
+  *pp = p;
+  fs->started = 1;
+  return 1;
+}
+
+/*
+** Consume as much of fs->buf as forms complete tokens, keeping the rest
+** for the next chunk. With final set the input ends here, so nothing may
+** be left over. Returns SQLITE_OK, FS_FALLBACK or the first emit_row error.
+*/
+static int fs_scan(FastScanner *fs, int final) {
+  char *p = fs->buf;
+  char *end = fs->buf + fs->len;
+  int rc = SQLITE_OK;
+
+  if (!fs->started) {
+    rc = fs_check_prolog(fs, &p, end, final);
+    if (rc != 1)
+      return rc == 0 ? SQLITE_OK : rc;
+    rc = SQLITE_OK;
+  }
+
+  while (p < end && rc == SQLITE_OK) {
+    if (*p != '<') {
+      char *q = (char *)fs_find3(p, end, '<', '&', '\r');
+      if (q == end)
+        break; /* Text is passed on once its end is known */
+      rc = fs_text(fs, p, q - p);
+      p = q;
+      if (rc != SQLITE_OK || *q == '<')
+        continue;
+      if (*q == '\r') {
+        /* Line ends are normalized to LF */
+        if (q + 1 == end)
+          break;
+        rc = fs_text(fs, "\n", 1);
+        p = q + (q[1] == '\n' ? 2 : 1);
+      } else {
+        size_t avail = end - q;
+        char *semi = memchr(q, ';',
+                            avail < FS_MAX_ENTITY ? avail : FS_MAX_ENTITY);
+        char buf[4];
+        int n;
+        if (!semi && avail < FS_MAX_ENTITY)
+          break;
+        if (!semi || (n = fs_decode_entity(q, semi, buf)) == 0)
+          return FS_FALLBACK;
+        rc = fs_text(fs, buf, n);
+        p = semi + 1;
+      }
+      continue;
+    }
+
+    if (end - p < 2)
+      break;
+    if (p[1] == '!')
+      return FS_FALLBACK; /* Comment, CDATA section or DOCTYPE */
+    if (p[1] == '?') {
+      /* Processing instructions are ignored, as with Expat */
+      char *q = p + 2;
+      while ((q = memchr(q, '>', end - q)) != NULL && q[-1] != '?')
+        q++;
+      if (!q)
+        break;
+      p = q + 1;
+      continue;
+    }
+
+    /* Find the closing '>', skipping quoted attribute values */
+    char *gt = p + 1;
+    for (;;) {
+      gt = (char *)fs_find3(gt, end, '>', '"', '\'');
+      if (gt == end || *gt == '>')
+        break;
+      char *close = memchr(gt + 1, *gt, end - gt - 1);
+      gt = close ? close + 1 : end;
+    }
+    if (gt == end)
+      break;
+
+    rc = p[1] == '/' ? fs_end_tag(fs, p, gt) : fs_start_tag(fs, p, gt);
+    p = gt + 1;
+  }
+  if (rc != SQLITE_OK)
+    return rc;
+
+  if (final) {
+    /* Whitespace may follow the root element, a partial token may not */
+    if (fs->depth != 0 || !fs->seen_root ||
+        fs_text(fs, p, end - p) != SQLITE_OK)
+      return FS_FALLBACK;
+    p = end;
+  }
+
+  fs->len = end - p;
+  memmove(fs->buf, p, fs->len);
+  return SQLITE_OK;
+}
+
+/* ZipSink feeding the fast scanner */
+static int fs_sink(void *arg, const char *data, int len) {
+  FastScanner *fs = (FastScanner *)arg;
+
+  if (fs->len + len > fs->cap) {
+    size_t new_cap = fs->cap ? fs->cap : ZIP_CHUNK_SIZE;
+    while (new_cap < fs->len + len)
+      new_cap *= 2;
+    char *new_buf = realloc(fs->buf, new_cap);
+    if (!new_buf)
+      return SQLITE_NOMEM;
+    fs->buf = new_buf;
+    fs->cap = new_cap;
+  }
+  memcpy(fs->buf + fs->len, data, len);
+  fs->len += len;
+  return fs_scan(fs, 0);
+}
+
+/*
+** Parse the worksheet entry sheet_path into wsp with the fast scanner.
+** Returns what parse_worksheet() would, or FS_FALLBACK if the sheet must be
+** parsed again with Expat; wsp->n_emitted rows were delivered by then.
+*/
+static int fast_scan_worksheet(ZipArchive *za, const char *sheet_path,
+                               WorksheetParser *wsp) {
+  ZipEntry entry;
+  int rc = zip_find(za, sheet_path, &entry);
+  if (rc != SQLITE_OK)
+    return rc;
+  if (entry.uncomp_size == 0)
+    return SQLITE_NOTFOUND;
+
+  FastScanner fs;
+  memset(&fs, 0, sizeof(fs));
+  fs.wsp = wsp;
+  rc = zip_read_entry(za, &entry, fs_sink, &fs);
+  if (rc == SQLITE_OK)
+    rc = fs_scan(&fs, 1);
+  free(fs.buf);
+  return rc;
+}
+
+/*
+** Parse the worksheet entry sheet_path, calling emit_row for every row as
+** soon as its </row> is seen. Only one row is held in memory at a time.
+** With fast set the fast scanner is tried first.
+** Returns SQLITE_OK, the error returned by emit_row, SQLITE_NOTFOUND if the
+** entry does not exist, SQLITE_ERROR for malformed XML, or SQLITE_TOOBIG if
+** a row needs more than max_row_bytes (when not 0).
+*/
+/* Create an Expat parser driving wsp, or NULL if out of memory */
+static XML_Parser ws_parser_create(WorksheetParser *wsp) {
+  XML_Parser parser = XML_ParserCreate(NULL);
+  if (!parser)
+    return NULL;
+
+  wsp->parser = parser;
+  XML_SetUserData(parser, wsp);
+  XML_SetElementHandler(parser, ws_start_element, ws_end_element);
+  XML_SetCharacterDataHandler(parser, ws_char_data);
+  return parser;
+}
+
+static int parse_worksheet(ZipArchive *za, const char *sheet_path,
+                           SharedStrings *ss, const CellStyles *styles,
+                           int fast, size_t max_row_bytes, RowCallback emit_row,
+                           void *emit_udata) {
+  WorksheetParser wsp;
+  wsp_init(&wsp, ss, emit_row, emit_udata);
+  wsp.styles = styles;
+  wsp.max_row_bytes = max_row_bytes;
+
+  if (fast) {
+    int result = fast_scan_worksheet(za, sheet_path, &wsp);
+    if (result != FS_FALLBACK) {
+      wsp_free(&wsp);
+      return result;
+    }
+    /* Start over with Expat, past the rows that were already emitted */
+    int n_emitted = wsp.n_emitted;
+    wsp_free(&wsp);
+    wsp_init(&wsp, ss, emit_row, emit_udata);
+    wsp.styles = styles;
+    wsp.max_row_bytes = max_row_bytes;
+    wsp.skip_rows = n_emitted;
+  }
+
+  XML_Parser parser = ws_parser_create(&wsp);
+  if (!parser) {
+    wsp_free(&wsp);
+    return SQLITE_NOMEM;
+  }
+
+  int result = zip_parse_xml(za, sheet_path, parser);
+  if (wsp.rc != SQLITE_OK) {
+    result = wsp.rc;
+  }
+
+  wsp_free(&wsp);
+  XML_ParserFree(parser);
+
+  return result;
+}
+
+/*
+** ============================================================================
+** Table Name Escaping
+** ============================================================================
+*/
+
+/*
+** Escape a sheet name to make it a valid SQLite identifier.
+** Replaces problematic characters and wraps in quotes if necessary.
+*/
+static char *escape_identifier(const char *name) {
   if (!name || !*name) {
     return strdup("\"unnamed\"");
   }
@@ -582,408 +2786,3071 @@ static char *escape_identifier(const char *name) {
 
 /*
 ** ============================================================================
-** Main Import Function
+** Import Configuration and Transactions
 ** ============================================================================
+**
+** Each call to xlsx_import() runs inside one SAVEPOINT, so the rows of all
+** sheets are written in a single transaction (instead of one autocommit per
+** row) and a failed import leaves the database untouched.
+**
+** With the "bulk" option set through xlsx_import_config(), synchronous is
+** also turned OFF and a rollback journal is kept in memory while the import
+** runs; both are restored afterwards. Bulk mode is only applied when no
+** transaction is open yet, since these pragmas cannot be changed safely in
+** the middle of one. A crash during a bulk import may corrupt the database.
 */
 
+#define MAX_IMPORT_THREADS 64
+
 /*
-** Read a file from the XLSX archive using the zipfile extension.
+** Timings and counters of one xlsx_import() call, returned by
+** xlsx_import_stats. Times are in nanoseconds of the monotonic clock.
+** inflate_ns and parse_ns add up the time of every worker thread, so with
+** several threads they can exceed sheets_ns.
 */
-static int read_zip_entry(sqlite3 *db, const char *xlsx_path,
-                          const char *entry_name, char **data, int *data_len) {
-  char *sql = sqlite3_mprintf("SELECT data FROM zipfile(%Q) WHERE name = %Q",
-                              xlsx_path, entry_name);
-  if (!sql)
-    return SQLITE_NOMEM;
+typedef struct {
+  sqlite3_int64 result;            /* SQLite result code of the call */
+  sqlite3_int64 total_ns;          /* The whole call */
+  sqlite3_int64 open_ns;           /* Reading the ZIP central directory */
+  sqlite3_int64 shared_strings_ns; /* Inflating and parsing sharedStrings */
+  sqlite3_int64 workbook_ns;       /* workbook.xml and its relationships */
+  sqlite3_int64 sheets_ns;         /* Importing the worksheets */
+  sqlite3_int64 inflate_ns;        /* In inflate(), for every entry */
+  sqlite3_int64 parse_ns;          /* Parsing worksheet XML */
+  sqlite3_int64 insert_ns;         /* CREATE TABLE and INSERT statements */
+  sqlite3_int64 commit_ns;         /* Releasing the savepoint */
+  sqlite3_int64 bytes_compressed;  /* Compressed bytes read */
+  sqlite3_int64 bytes_inflated;    /* XML bytes inflated and parsed */
+  sqlite3_int64 shared_strings;    /* Entries of the shared string table */
+  sqlite3_int64 sheets;            /* Tables created */
+  sqlite3_int64 sheets_unchanged;  /* Incremental: sheets left as they were */
+  sqlite3_int64 rows;              /* Data rows inserted */
+  sqlite3_int64 cells;             /* Non-empty cells inserted */
+  sqlite3_int64 threads;           /* Worker threads, 0 for a serial import */
+} ImportStats;
+
+/* Per-connection settings, shared by all the SQL functions */
+typedef struct {
+  int bulk;    /* Relax durability while importing */
+  int threads; /* Worker threads for multi-sheet imports, 1 = serial */
+  int typed;   /* Store numbers as INTEGER/REAL instead of TEXT */
+  int fastscan; /* Parse worksheets with the fast scanner when possible */
+  int incremental; /* Skip sheets unchanged since the last import */
+  int dates;   /* DatesMode of cells with a date or time style */
+  sqlite3_int64 memory_budget; /* Bytes of rows held at once, 0 = no limit */
+  char *progress;    /* SQL function reporting the progress, or NULL */
+  int progress_rows; /* Rows between two calls of progress */
+  ImportStats last; /* Statistics of the last xlsx_import() call */
+} ImportConfig;
+
+#define DEFAULT_PROGRESS_ROWS 100000
+
+/*
+** Memory budget of an import: how much the parsed rows may take up at once,
+** outside the shared strings. A quarter goes to the row being parsed, which
+** fails with SQLITE_TOOBIG beyond it, a quarter to the rows a sheet
+** importer holds back, and half to the queues of the worker threads.
+*/
+#define DEFAULT_MEMORY_BUDGET ((sqlite3_int64)256 << 20)
+
+/* One part of budget, or 0 (no limit) when budget is 0 */
+static size_t budget_share(sqlite3_int64 budget, int parts) {
+  if (budget <= 0)
+    return 0;
+  sqlite3_uint64 n = (sqlite3_uint64)budget / parts;
+  if (n == 0)
+    n = 1;
+  return (sqlite3_uint64)(size_t)n == n ? (size_t)n : (size_t)-1;
+}
+
+/* Destructor of the configuration, run when xlsx_import is unregistered */
+static void import_config_free(void *p) {
+  ImportConfig *cfg = (ImportConfig *)p;
+  sqlite3_free(cfg->progress);
+  sqlite3_free(cfg);
+}
 
+/* Saved pragma values, restored by bulk_end() */
+typedef struct {
+  int active;
+  int synchronous;
+  char journal_mode[16];
+} BulkState;
+
+static void bulk_begin(sqlite3 *db, const ImportConfig *cfg, BulkState *bs) {
   sqlite3_stmt *stmt = NULL;
-  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-  sqlite3_free(sql);
 
-  if (rc != SQLITE_OK) {
-    return rc;
+  memset(bs, 0, sizeof(*bs));
+  if (!cfg || !cfg->bulk || !sqlite3_get_autocommit(db))
+    return;
+
+  if (sqlite3_prepare_v2(db, "PRAGMA main.synchronous", -1, &stmt, NULL) !=
+      SQLITE_OK)
+    return;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    bs->synchronous = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  stmt = NULL;
+  if (sqlite3_prepare_v2(db, "PRAGMA main.journal_mode", -1, &stmt, NULL) !=
+      SQLITE_OK)
+    return;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+    snprintf(bs->journal_mode, sizeof(bs->journal_mode), "%s",
+             mode ? mode : "");
+  }
+  sqlite3_finalize(stmt);
+
+  bs->active = 1;
+  sqlite3_exec(db, "PRAGMA main.synchronous=OFF", NULL, NULL, NULL);
+  /* WAL already avoids the journal copy, and leaving it is a file change */
+  if (sqlite3_stricmp(bs->journal_mode, "wal") != 0 &&
+      sqlite3_stricmp(bs->journal_mode, "memory") != 0 &&
+      bs->journal_mode[0]) {
+    sqlite3_exec(db, "PRAGMA main.journal_mode=MEMORY", NULL, NULL, NULL);
+  } else {
+    bs->journal_mode[0] = '\0';
+  }
+}
+
+static void bulk_end(sqlite3 *db, BulkState *bs) {
+  if (!bs->active)
+    return;
+
+  if (bs->journal_mode[0]) {
+    char *sql =
+        sqlite3_mprintf("PRAGMA main.journal_mode=%s", bs->journal_mode);
+    if (sql) {
+      sqlite3_exec(db, sql, NULL, NULL, NULL);
+      sqlite3_free(sql);
+    }
+  }
+  char *sql = sqlite3_mprintf("PRAGMA main.synchronous=%d", bs->synchronous);
+  if (sql) {
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    sqlite3_free(sql);
+  }
+  bs->active = 0;
+}
+
+/*
+** Leave the import savepoint: release it when ok is set, otherwise roll
+** back everything the import did first. Returns the result of the RELEASE.
+*/
+static int import_end_savepoint(sqlite3 *db, int ok) {
+  if (!ok)
+    sqlite3_exec(db, "ROLLBACK TO xlsx_import", NULL, NULL, NULL);
+  return sqlite3_exec(db, "RELEASE xlsx_import", NULL, NULL, NULL);
+}
+
+/*
+** xlsx_import_config(name [, value]) - Get or set an import option for this
+** connection. Returns the value of the option after any change.
+**
+** Options:
+**   bulk    - 0 or 1 (default 0). Relax synchronous/journal_mode during
+**             imports.
+**   threads - 1 to 64 (default 1). Number of threads that inflate and parse
+**             sheets when several sheets are imported.
+**   typed   - 0 or 1 (default 0). Bind numbers and booleans as INTEGER/REAL
+**             and declare column types inferred from the first rows.
+**   fastscan - 0 or 1 (default 0). Parse worksheets with the fast scanner,
+**              falling back to Expat for input it does not handle.
+**   progress - Name of an SQL function called during imports as
+**              fn(sheet_name, rows, bytes_done, bytes_total), or NULL
+**              (default) for none. A true result cancels the import.
+**   progress_rows - 1 or more (default 100000). Rows between two calls of
+**                   the progress function.
+**   incremental - 0 or 1 (default 0). Record the CRC-32 and size of each
+**                 imported sheet in xlsx_import_manifest and skip the sheets
+**                 found unchanged on the next import of the same file.
+**   dates - 'serial' (default), 'iso' or 'julian'. Store cells with a date
+**           or time number format as the serial number, as ISO 8601 text
+**           or as a Julian day number.
+**   memory_budget - Bytes (default 256 MiB, 0 for no limit) the parsed rows
+**                   may use at once. Held rows are flushed early and worker
+**                   threads wait when it is reached; a single row too big
+**                   for it fails the import with SQLITE_TOOBIG.
+*/
+static void xlsx_import_config_func(sqlite3_context *ctx, int argc,
+                                    sqlite3_value **argv) {
+  ImportConfig *cfg = (ImportConfig *)sqlite3_user_data(ctx);
+  const char *name = (const char *)sqlite3_value_text(argv[0]);
+
+  if (name && sqlite3_stricmp(name, "bulk") == 0) {
+    if (argc > 1) {
+      cfg->bulk = sqlite3_value_int(argv[1]) != 0;
+    }
+    sqlite3_result_int(ctx, cfg->bulk);
+  } else if (name && sqlite3_stricmp(name, "typed") == 0) {
+    if (argc > 1) {
+      cfg->typed = sqlite3_value_int(argv[1]) != 0;
+    }
+    sqlite3_result_int(ctx, cfg->typed);
+  } else if (name && sqlite3_stricmp(name, "fastscan") == 0) {
+    if (argc > 1) {
+      cfg->fastscan = sqlite3_value_int(argv[1]) != 0;
+    }
+    sqlite3_result_int(ctx, cfg->fastscan);
+  } else if (name && sqlite3_stricmp(name, "incremental") == 0) {
+    if (argc > 1) {
+      cfg->incremental = sqlite3_value_int(argv[1]) != 0;
+    }
+    sqlite3_result_int(ctx, cfg->incremental);
+  } else if (name && sqlite3_stricmp(name, "dates") == 0) {
+    static const char *const modes[] = {"serial", "iso", "julian"};
+    if (argc > 1) {
+      const char *mode = (const char *)sqlite3_value_text(argv[1]);
+      int i = 0;
+      while (i < 3 && !(mode && sqlite3_stricmp(mode, modes[i]) == 0))
+        i++;
+      if (i == 3) {
+        char *msg = sqlite3_mprintf("Unknown dates mode '%s'",
+                                    mode ? mode : "");
+        sqlite3_result_error(ctx, msg, -1);
+        sqlite3_free(msg);
+        return;
+      }
+      cfg->dates = i;
+    }
+    sqlite3_result_text(ctx, modes[cfg->dates], -1, SQLITE_STATIC);
+  } else if (name && sqlite3_stricmp(name, "memory_budget") == 0) {
+    if (argc > 1) {
+      sqlite3_int64 n = sqlite3_value_int64(argv[1]);
+      cfg->memory_budget = n < 0 ? 0 : n;
+    }
+    sqlite3_result_int64(ctx, cfg->memory_budget);
+  } else if (name && sqlite3_stricmp(name, "threads") == 0) {
+    if (argc > 1) {
+      int n = sqlite3_value_int(argv[1]);
+      cfg->threads =
+          n < 1 ? 1 : (n > MAX_IMPORT_THREADS ? MAX_IMPORT_THREADS : n);
+    }
+    sqlite3_result_int(ctx, cfg->threads);
+  } else if (name && sqlite3_stricmp(name, "progress") == 0) {
+    if (argc > 1) {
+      const char *fn = (const char *)sqlite3_value_text(argv[1]);
+      char *copy = fn && *fn ? sqlite3_mprintf("%s", fn) : NULL;
+      if (fn && *fn && !copy) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+      }
+      sqlite3_free(cfg->progress);
+      cfg->progress = copy;
+    }
+    if (cfg->progress)
+      sqlite3_result_text(ctx, cfg->progress, -1, SQLITE_TRANSIENT);
+    else
+      sqlite3_result_null(ctx);
+  } else if (name && sqlite3_stricmp(name, "progress_rows") == 0) {
+    if (argc > 1) {
+      int n = sqlite3_value_int(argv[1]);
+      cfg->progress_rows = n < 1 ? 1 : n;
+    }
+    sqlite3_result_int(ctx, cfg->progress_rows);
+  } else {
+    char *msg = sqlite3_mprintf("Unknown xlsx_import option '%s'",
+                                name ? name : "");
+    sqlite3_result_error(ctx, msg, -1);
+    sqlite3_free(msg);
   }
+}
+
+/*
+** ============================================================================
+** Sheet Importer
+** ============================================================================
+*/
+
+/*
+** Streaming sheet importer. Receives rows from the worksheet parser and
+** inserts them straight into the table, so a sheet is never held in memory.
+** The table is created when the first row arrives: row 1 supplies the
+** column names. Rows wider than the table add columns named colN.
+**
+** In typed mode numbers and booleans are bound as INTEGER or REAL, and the
+** header plus the first TYPE_SAMPLE_ROWS rows are held back so the column
+** affinities of the CREATE TABLE can be inferred from them. si_finish()
+** creates the table for sheets shorter than the sample.
+**
+** Rows are inserted batch_rows at a time by one multi-row INSERT ... VALUES
+** (...), (...) sized to use up to the connection's limit on parameters, so
+** the per-statement cost is paid once per batch instead of once per row.
+** Pending rows are copied into the pending array until the batch is full;
+** what is left at the end of the sheet, or when the table is widened, goes
+** through the single-row INSERT.
+**
+** With a memory budget, the rows held back (sample and pending) are flushed
+** early once they use max_held bytes: the column types are then inferred
+** from fewer rows, and the pending buffers are released after the flush.
+*/
+
+#define TYPE_SAMPLE_ROWS 100
+#define MAX_INSERT_BATCH_ROWS 256
+
+/*
+** A row wider than the table adds its columns with ALTER TABLE, one
+** statement per column, each reparsing the whole schema. A table created by
+** the import that must grow by more columns than this is rebuilt at its new
+** width instead, in one pass over its rows.
+*/
+#define MAX_ALTER_COLUMNS 8
+
+/*
+** Progress of one xlsx_import() call. Every "every" rows the progress
+** function is called with the sheet name, the rows read so far and the
+** worksheet XML parsed out of bytes_total, the uncompressed size of all
+** the selected sheets; a true result cancels the import.
+*/
+typedef struct {
+  sqlite3_stmt *callback;   /* SELECT fn(?1, ?2, ?3, ?4), or NULL */
+  int every;                /* Rows between two calls */
+  sqlite3_int64 rows;       /* Rows read so far, in all the sheets */
+  sqlite3_int64 next;       /* Value of rows at the next call */
+  sqlite3_int64 bytes_done; /* XML bytes of the sheets already finished */
+  sqlite3_int64 bytes_total;
+} ImportProgress;
+
+/*
+** Call the progress function. Returns SQLITE_INTERRUPT if it asks to
+** cancel, or its error.
+*/
+static int progress_report(ImportProgress *pg, const char *sheet_name,
+                           sqlite3_int64 bytes) {
+  sqlite3_stmt *stmt = pg->callback;
+  sqlite3_bind_text(stmt, 1, sheet_name, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, pg->rows);
+  sqlite3_bind_int64(stmt, 3, bytes);
+  sqlite3_bind_int64(stmt, 4, pg->bytes_total);
+
+  int rc = sqlite3_step(stmt);
+  int cancel = rc == SQLITE_ROW && sqlite3_column_int(stmt, 0) != 0;
+  if (rc == SQLITE_ROW || rc == SQLITE_DONE)
+    rc = SQLITE_OK;
+  sqlite3_reset(stmt);
+  if (rc == SQLITE_OK && cancel)
+    rc = SQLITE_INTERRUPT;
+  return rc;
+}
+
+typedef struct {
+  sqlite3 *db;             /* Database connection */
+  const char *table_name;  /* Target table (unescaped sheet name) */
+  char **pzErrMsg;         /* Error message output */
+  int ncols;               /* Number of columns in the table, 0 if none yet */
+  int created;             /* The table did not exist before this sheet */
+  sqlite3_stmt *insert;    /* Prepared INSERT with ncols parameters */
+  sqlite3_stmt *insert_batch; /* INSERT of batch_rows rows, or NULL */
+  int batch_rows;          /* Rows per insert_batch */
+  Row *pending;            /* Rows waiting for insert_batch */
+  int n_pending;           /* Number of rows in pending */
+  int pending_cap;         /* Rows allocated in pending */
+  int typed;               /* Bind numbers natively, infer affinities */
+  unsigned char *text_cols; /* Typed: 1 for the columns declared TEXT */
+  int n_text_cols;         /* Columns in text_cols */
+  int has_header;          /* header holds row 1 (typed mode) */
+  Row header;              /* Copy of row 1 until the table exists */
+  Row *sample;             /* Rows held back until the table exists */
+  int n_sample;            /* Number of rows in sample */
+  size_t max_held;         /* Bytes of held rows that force a flush, or 0 */
+  size_t held;             /* Bytes of the header, sample and pending rows */
+  sqlite3_int64 insert_ns; /* Time spent creating the table and inserting */
+  sqlite3_int64 rows;      /* Rows inserted */
+  sqlite3_int64 cells;     /* Non-NULL values bound */
+  ImportProgress *progress; /* Progress of the whole import, or NULL */
+  const ZipArchive *za;    /* Archive the sheet is inflated from, or NULL */
+  sqlite3_int64 za_base;   /* za->bytes_inflated when the sheet started */
+  sqlite3_int64 bytes;     /* XML parsed when za is NULL */
+} SheetImporter;
+
+static void si_init(SheetImporter *si, sqlite3 *db, const char *table_name,
+                    char **pzErrMsg, int typed) {
+  memset(si, 0, sizeof(*si));
+  si->db = db;
+  si->table_name = table_name;
+  si->pzErrMsg = pzErrMsg;
+  si->typed = typed;
+}
+
+static void si_free_sample(SheetImporter *si) {
+  for (int i = 0; i < si->n_sample; i++) {
+    row_free(&si->sample[i]);
+  }
+  free(si->sample);
+  si->sample = NULL;
+  si->n_sample = 0;
+  row_free(&si->header);
+  si->has_header = 0;
+}
+
+static void si_free(SheetImporter *si) {
+  si_free_sample(si);
+  for (int i = 0; i < si->pending_cap; i++) {
+    row_free(&si->pending[i]);
+  }
+  free(si->pending);
+  si->pending = NULL;
+  si->n_pending = si->pending_cap = 0;
+  sqlite3_finalize(si->insert);
+  sqlite3_finalize(si->insert_batch);
+  si->insert = si->insert_batch = NULL;
+  free(si->text_cols);
+  si->text_cols = NULL;
+  si->n_text_cols = 0;
+}
+
+/* Storage class a cell is bound with in typed mode (SQLITE_NULL if empty) */
+static int cell_value_class(const Row *row, const CellValue *cell,
+                            sqlite3_int64 *pInt, double *pReal) {
+  int len = 0;
+  const char *text = row_value_text(row, cell, &len);
+  if (!text)
+    return SQLITE_NULL;
+  switch (cell->type) {
+  case 'n':
+    return xlsx_parse_number(text, len, pInt, pReal);
+  case 'b':
+    *pInt = text[0] == '1';
+    return SQLITE_INTEGER;
+  default:
+    return SQLITE_TEXT;
+  }
+}
+
+/* Storage class of the cell of column col (0-based) */
+static int cell_class(const Row *row, int col, sqlite3_int64 *pInt,
+                      double *pReal) {
+  return cell_value_class(row, row_find(row, col), pInt, pReal);
+}
+
+/* Declared type for column col inferred from the sample rows */
+static const char *si_column_type(SheetImporter *si, int col) {
+  int seen_int = 0, seen_real = 0;
+  for (int i = 0; i < si->n_sample; i++) {
+    sqlite3_int64 iv;
+    double rv;
+    switch (cell_class(&si->sample[i], col, &iv, &rv)) {
+    case SQLITE_TEXT:
+      return "TEXT";
+    case SQLITE_FLOAT:
+      seen_real = 1;
+      break;
+    case SQLITE_INTEGER:
+      seen_int = 1;
+      break;
+    }
+  }
+  return seen_real ? "REAL" : seen_int ? "INTEGER" : NULL;
+}
+
+static int si_set_error(SheetImporter *si, int rc) {
+  if (si->pzErrMsg && !*si->pzErrMsg) {
+    *si->pzErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(si->db));
+  }
+  return rc;
+}
+
+/* Prepare an INSERT of nrows rows of the current number of columns */
+static int si_prepare_values(SheetImporter *si, int nrows,
+                             sqlite3_stmt **pStmt) {
+  sqlite3_str *sql = sqlite3_str_new(si->db);
+  char *escaped_table = escape_identifier(si->table_name);
+  sqlite3_str_appendf(sql, "INSERT INTO %s VALUES ", escaped_table);
+  free(escaped_table);
+
+  for (int i = 0; i < nrows; i++) {
+    sqlite3_str_appendall(sql, i > 0 ? ", (" : "(");
+    for (int col = 0; col < si->ncols; col++) {
+      if (col > 0)
+        sqlite3_str_appendall(sql, ", ");
+      sqlite3_str_appendall(sql, "?");
+    }
+    sqlite3_str_appendall(sql, ")");
+  }
+
+  char *insert_sql = sqlite3_str_finish(sql);
+  if (!insert_sql) {
+    return SQLITE_NOMEM;
+  }
+
+  int rc = sqlite3_prepare_v2(si->db, insert_sql, -1, pStmt, NULL);
+  sqlite3_free(insert_sql);
+  return rc == SQLITE_OK ? rc : si_set_error(si, rc);
+}
+
+/*
+** (Re)prepare the INSERT statements for the current number of columns. The
+** batch holds as many rows as fit in the parameter limit, up to
+** MAX_INSERT_BATCH_ROWS.
+*/
+static int si_prepare_insert(SheetImporter *si) {
+  sqlite3_finalize(si->insert);
+  sqlite3_finalize(si->insert_batch);
+  si->insert = si->insert_batch = NULL;
+
+  int max_vars = sqlite3_limit(si->db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+  int nrows = si->ncols > 0 ? max_vars / si->ncols : 0;
+  if (nrows > MAX_INSERT_BATCH_ROWS)
+    nrows = MAX_INSERT_BATCH_ROWS;
+  si->batch_rows = nrows > 1 ? nrows : 1;
+
+  if (si->batch_rows > si->pending_cap) {
+    Row *pending = realloc(si->pending, si->batch_rows * sizeof(Row));
+    if (!pending)
+      return SQLITE_NOMEM;
+    memset(pending + si->pending_cap, 0,
+           (si->batch_rows - si->pending_cap) * sizeof(Row));
+    si->pending = pending;
+    si->pending_cap = si->batch_rows;
+  }
+
+  int rc = si_prepare_values(si, 1, &si->insert);
+  if (rc == SQLITE_OK && si->batch_rows > 1)
+    rc = si_prepare_values(si, si->batch_rows, &si->insert_batch);
+  return rc;
+}
+
+/*
+** Create the table with ncols columns. Names come from header (row 1) when
+** given, "colN" otherwise. In typed mode the declared types come from the
+** sample.
+*/
+static int si_create_table(SheetImporter *si, Row *header, int ncols) {
+  sqlite3_str *sql = sqlite3_str_new(si->db);
+
+  char *escaped_table = escape_identifier(si->table_name);
+  sqlite3_str_appendf(sql, "CREATE TABLE IF NOT EXISTS %s (", escaped_table);
+  free(escaped_table);
+
+  sqlite3_stmt *exists = NULL;
+  si->created = 0;
+  if (sqlite3_prepare_v2(si->db, "SELECT 1 FROM pragma_table_info(?1)", -1,
+                         &exists, NULL) == SQLITE_OK) {
+    sqlite3_bind_text(exists, 1, si->table_name, -1, SQLITE_STATIC);
+    si->created = sqlite3_step(exists) == SQLITE_DONE;
+  }
+  sqlite3_finalize(exists);
+
+  if (si->typed && ncols > 0) {
+    si->text_cols = calloc((size_t)ncols, 1);
+    if (!si->text_cols) {
+      sqlite3_free(sqlite3_str_finish(sql));
+      return SQLITE_NOMEM;
+    }
+    si->n_text_cols = ncols;
+  }
+
+  for (int col = 0; col < ncols; col++) {
+    if (col > 0)
+      sqlite3_str_appendall(sql, ", ");
+
+    const char *col_name = NULL;
+    int col_len = 0;
+    if (header) {
+      col_name = row_cell_text(header, col, &col_len);
+    }
+
+    if (col_name && *col_name) {
+      char *escaped_col = escape_identifier(col_name);
+      sqlite3_str_appendall(sql, escaped_col);
+      free(escaped_col);
+    } else {
+      /* Generate default column name */
+      sqlite3_str_appendf(sql, "\"col%d\"", col + 1);
+    }
+
+    const char *col_type = si->typed ? si_column_type(si, col) : NULL;
+    if (col_type) {
+      sqlite3_str_appendf(sql, " %s", col_type);
+      si->text_cols[col] = strcmp(col_type, "TEXT") == 0;
+    }
+  }
+
+  sqlite3_str_appendall(sql, ")");
+
+  char *create_sql = sqlite3_str_finish(sql);
+  if (!create_sql) {
+    return SQLITE_NOMEM;
+  }
+
+  int rc = sqlite3_exec(si->db, create_sql, NULL, NULL, si->pzErrMsg);
+  sqlite3_free(create_sql);
+
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  si->ncols = ncols;
+  return si_prepare_insert(si);
+}
+
+/*
+** Rebuild the table of si with ncols columns: copy its rows into a new
+** table with the same columns plus "colN" ones, then swap it in.
+*/
+static int si_rebuild_table(SheetImporter *si, const char *escaped_table,
+                            int ncols) {
+  sqlite3_str *create = sqlite3_str_new(si->db);
+  sqlite3_str *cols = sqlite3_str_new(si->db);
+  sqlite3_stmt *info = NULL;
+  char *tmp_name = sqlite3_mprintf("%s xlsx_widen", si->table_name);
+  char *escaped_tmp = tmp_name ? escape_identifier(tmp_name) : NULL;
+  int rc = escaped_tmp ? SQLITE_OK : SQLITE_NOMEM;
+
+  if (rc == SQLITE_OK)
+    rc = sqlite3_prepare_v2(si->db,
+                            "SELECT name, type FROM pragma_table_info(?1)", -1,
+                            &info, NULL);
+  if (rc == SQLITE_OK) {
+    sqlite3_bind_text(info, 1, si->table_name, -1, SQLITE_STATIC);
+    sqlite3_str_appendf(create, "CREATE TABLE %s (", escaped_tmp);
+    for (int col = 0; sqlite3_step(info) == SQLITE_ROW; col++) {
+      const char *type = (const char *)sqlite3_column_text(info, 1);
+      char *name = escape_identifier((const char *)sqlite3_column_text(info, 0));
+      if (!name) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      sqlite3_str_appendf(create, "%s%s%s%s", col > 0 ? ", " : "", name,
+                          type && *type ? " " : "", type ? type : "");
+      sqlite3_str_appendf(cols, "%s%s", col > 0 ? ", " : "", name);
+      free(name);
+    }
+    for (int col = si->ncols; col < ncols; col++)
+      sqlite3_str_appendf(create, ", \"col%d\"", col + 1);
+    sqlite3_str_appendall(create, ")");
+  }
+  sqlite3_finalize(info);
+
+  char *create_sql = sqlite3_str_finish(create);
+  char *col_list = sqlite3_str_finish(cols);
+  char *sql = NULL;
+  if (rc == SQLITE_OK && create_sql && col_list)
+    sql = sqlite3_mprintf("%s; INSERT INTO %s (%s) SELECT %s FROM %s; "
+                          "DROP TABLE %s; ALTER TABLE %s RENAME TO %s",
+                          create_sql, escaped_tmp, col_list, col_list,
+                          escaped_table, escaped_table, escaped_tmp,
+                          escaped_table);
+  if (rc == SQLITE_OK && !sql)
+    rc = SQLITE_NOMEM;
+  if (rc == SQLITE_OK) {
+    /* The table is dropped, so nothing may still refer to it */
+    sqlite3_finalize(si->insert);
+    sqlite3_finalize(si->insert_batch);
+    si->insert = si->insert_batch = NULL;
+    rc = sqlite3_exec(si->db, sql, NULL, NULL, si->pzErrMsg);
+  }
+  if (rc == SQLITE_OK)
+    si->ncols = ncols;
+  sqlite3_free(sql);
+  sqlite3_free(create_sql);
+  sqlite3_free(col_list);
+  free(escaped_tmp);
+  sqlite3_free(tmp_name);
+  return rc;
+}
+
+/*
+** Widen the table to ncols columns for a row longer than any before it.
+** The width is checked against SQLITE_LIMIT_COLUMN first, so a row that
+** cannot fit fails before the table is touched.
+*/
+static int si_add_columns(SheetImporter *si, int ncols) {
+  if (ncols > sqlite3_limit(si->db, SQLITE_LIMIT_COLUMN, -1)) {
+    if (si->pzErrMsg && !*si->pzErrMsg)
+      *si->pzErrMsg = sqlite3_mprintf("too many columns on %s", si->table_name);
+    return SQLITE_ERROR;
+  }
+
+  char *escaped_table = escape_identifier(si->table_name);
+  if (!escaped_table)
+    return SQLITE_NOMEM;
+
+  int rc = SQLITE_OK;
+  if (si->created && ncols - si->ncols > MAX_ALTER_COLUMNS) {
+    rc = si_rebuild_table(si, escaped_table, ncols);
+  }
+  for (int col = si->ncols; col < ncols && rc == SQLITE_OK; col++) {
+    char *sql = sqlite3_mprintf("ALTER TABLE %s ADD COLUMN \"col%d\"",
+                                escaped_table, col + 1);
+    if (!sql) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    rc = sqlite3_exec(si->db, sql, NULL, NULL, si->pzErrMsg);
+    sqlite3_free(sql);
+    if (rc == SQLITE_OK)
+      si->ncols = col + 1;
+  }
+  free(escaped_table);
+
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  return si_prepare_insert(si);
+}
+
+/*
+** Bind the cells of row to the ncols parameters of stmt after first. The
+** cell texts stay put until the row is reset or reassigned, which happens
+** only after stmt has run, so SQLite can use them in place. The bindings
+** are replaced before the statement runs again.
+*/
+static void si_bind_row(SheetImporter *si, sqlite3_stmt *stmt, int first,
+                        const Row *row) {
+  int next = 0;
+  for (int col = 0; col < si->ncols; col++) {
+    /* Walk the cells in step with the columns instead of looking them up */
+    const CellValue *cell = NULL;
+    if (next < row->n_cells && row->cells[next].col == col)
+      cell = &row->cells[next++];
+    int len = 0;
+    const char *text = row_value_text(row, cell, &len);
+    sqlite3_int64 iv;
+    double rv;
+    /* A TEXT column keeps the cell as written: 00012 stays 00012 */
+    int as_text = !si->typed ||
+                  (col < si->n_text_cols && si->text_cols[col]);
+    int cls = !text      ? SQLITE_NULL
+              : as_text ? SQLITE_TEXT
+                        : cell_value_class(row, cell, &iv, &rv);
+    int param = first + col + 1;
+    switch (cls) {
+    case SQLITE_INTEGER:
+      sqlite3_bind_int64(stmt, param, iv);
+      si->cells++;
+      break;
+    case SQLITE_FLOAT:
+      sqlite3_bind_double(stmt, param, rv);
+      si->cells++;
+      break;
+    case SQLITE_TEXT:
+      sqlite3_bind_text(stmt, param, text, len, SQLITE_STATIC);
+      si->cells++;
+      break;
+    default:
+      sqlite3_bind_null(stmt, param);
+      break;
+    }
+  }
+}
+
+/* Run stmt, which inserts nrows rows */
+static int si_step_insert(SheetImporter *si, sqlite3_stmt *stmt, int nrows) {
+  int rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  if (rc != SQLITE_DONE) {
+    return si_set_error(si, rc);
+  }
+  si->rows += nrows;
+  return SQLITE_OK;
+}
+
+/*
+** Insert the pending rows: a full batch with one statement, fewer with one
+** statement each
+*/
+static int si_flush_pending(SheetImporter *si) {
+  int n = si->n_pending;
+  int rc = SQLITE_OK;
+
+  si->n_pending = 0;
+  si->held = 0;
+  if (n > 0 && n == si->batch_rows && si->insert_batch) {
+    for (int i = 0; i < n; i++) {
+      si_bind_row(si, si->insert_batch, i * si->ncols, &si->pending[i]);
+    }
+    return si_step_insert(si, si->insert_batch, n);
+  }
+  for (int i = 0; i < n && rc == SQLITE_OK; i++) {
+    si_bind_row(si, si->insert, 0, &si->pending[i]);
+    rc = si_step_insert(si, si->insert, 1);
+  }
+  return rc;
+}
+
+/* Queue a data row for insertion, widening the table first if needed */
+static int si_insert_row(SheetImporter *si, Row *row) {
+  int rc;
+
+  if (row->count > si->ncols) {
+    rc = si_flush_pending(si);
+    if (rc == SQLITE_OK)
+      rc = si_add_columns(si, row->count);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+
+  Row *slot = &si->pending[si->n_pending++];
+  rc = row_assign(slot, row);
+  if (rc != SQLITE_OK)
+    return rc;
+  si->held += row_bytes(slot);
+  if (si->max_held && si->held >= si->max_held) {
+    /* Over budget: insert what is pending and give its buffers back */
+    rc = si_flush_pending(si);
+    for (int i = 0; i < si->pending_cap; i++) {
+      row_free(&si->pending[i]);
+    }
+    return rc;
+  }
+  return si->n_pending == si->batch_rows ? si_flush_pending(si) : SQLITE_OK;
+}
+
+/* Typed mode: create the table from the sample, then insert the sample */
+static int si_flush_sample(SheetImporter *si) {
+  int ncols = si->header.count;
+  for (int i = 0; i < si->n_sample; i++) {
+    if (si->sample[i].count > ncols)
+      ncols = si->sample[i].count;
+  }
+
+  int rc = si_create_table(si, si->has_header ? &si->header : NULL, ncols);
+  si->held = 0;
+  for (int i = 0; i < si->n_sample && rc == SQLITE_OK; i++) {
+    rc = si_insert_row(si, &si->sample[i]);
+  }
+  si_free_sample(si);
+  return rc;
+}
+
+/* Create the table on the first row, insert the others */
+static int si_take_row(SheetImporter *si, int row_num, Row *row) {
+  int rc;
+
+  if (si->ncols == 0 && si->typed) {
+    /* Hold rows back until the column types can be decided */
+    if (row_num == 1 && !si->has_header && si->n_sample == 0) {
+      si->has_header = 1;
+      rc = row_copy(&si->header, row);
+      si->held += row_bytes(&si->header);
+      return rc;
+    }
+    if (!si->sample) {
+      si->sample = calloc(TYPE_SAMPLE_ROWS, sizeof(Row));
+      if (!si->sample)
+        return SQLITE_NOMEM;
+    }
+    rc = row_copy(&si->sample[si->n_sample], row);
+    if (rc != SQLITE_OK)
+      return rc;
+    si->held += row_bytes(&si->sample[si->n_sample]);
+    if (++si->n_sample < TYPE_SAMPLE_ROWS &&
+        !(si->max_held && si->held >= si->max_held))
+      return SQLITE_OK;
+    return si_flush_sample(si);
+  }
+
+  if (si->ncols == 0) {
+    /* Row 1 is the header; a sheet without one gets colN names */
+    if (row_num == 1) {
+      return si_create_table(si, row, row->count);
+    }
+    rc = si_create_table(si, NULL, row->count);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+
+  return si_insert_row(si, row);
+}
+
+/* Call the progress function when it is due */
+static int si_progress(SheetImporter *si) {
+  ImportProgress *pg = si->progress;
+
+  if (!pg || !pg->callback || ++pg->rows < pg->next)
+    return SQLITE_OK;
+
+  pg->next = pg->rows + pg->every;
+  sqlite3_int64 bytes = si->za ? si->za->bytes_inflated - si->za_base
+                               : si->bytes;
+  int rc = progress_report(pg, si->table_name, pg->bytes_done + bytes);
+  return rc == SQLITE_OK || rc == SQLITE_INTERRUPT ? rc : si_set_error(si, rc);
+}
+
+/*
+** RowCallback: si_take_row(), timed for xlsx_import_stats. Any error, such
+** as SQLITE_INTERRUPT from a cancelling progress function or from an INSERT
+** after sqlite3_interrupt(), stops the parser and the import is rolled back.
+*/
+static int si_emit_row(void *udata, int row_num, Row *row) {
+  SheetImporter *si = (SheetImporter *)udata;
+  int rc = si_progress(si);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  sqlite3_int64 t0 = xlsx_now_ns();
+  rc = si_take_row(si, row_num, row);
+  si->insert_ns += xlsx_now_ns() - t0;
+  return rc;
+}
+
+/*
+** Called once the whole sheet was parsed; creates a pending typed table and
+** inserts the rows left in the last batch
+*/
+static int si_finish(SheetImporter *si) {
+  int rc = SQLITE_OK;
+  sqlite3_int64 t0 = xlsx_now_ns();
+  if (si->ncols == 0 && (si->has_header || si->n_sample > 0)) {
+    rc = si_flush_sample(si);
+  }
+  if (rc == SQLITE_OK) {
+    rc = si_flush_pending(si);
+  }
+  si->insert_ns += xlsx_now_ns() - t0;
+  return rc;
+}
+
+/* Add the counters of a finished sheet to stats */
+static void si_add_stats(const SheetImporter *si, ImportStats *stats) {
+  stats->insert_ns += si->insert_ns;
+  stats->rows += si->rows;
+  stats->cells += si->cells;
+}
+
+/*
+** ============================================================================
+** Parallel Sheet Import
+** ============================================================================
+**
+** With xlsx_import_config('threads', N) and more than one sheet selected,
+** sheets are inflated and parsed by up to N worker threads. Each worker has
+** its own ZipArchive handle and takes the next unparsed sheet (in workbook
+** order). Parsed rows are moved into batches of ROW_BATCH_SIZE and queued on
+** their sheet's job. The calling thread is the only one touching the
+** database: it drains the jobs in workbook order and inserts the rows, so
+** the result is identical to a serial import.
+**
+** A job holds at most MAX_QUEUED_BATCHES batches; a worker that gets ahead of
+** the writer waits. Since jobs are handed out in the order the writer drains
+** them, the job being drained always has a worker (or is finished), so this
+** cannot deadlock.
+**
+** With a memory budget, batches are also queued once they hold max_batch
+** bytes, and the batches of the jobs after the one being drained may use
+** max_queued bytes together; their workers wait beyond that. The worker of
+** the job being drained only waits for a free slot, for the same reason as
+** above.
+*/
+
+#define ROW_BATCH_SIZE 256
+#define MAX_QUEUED_BATCHES 16
+
+typedef struct RowBatch {
+  struct RowBatch *next;
+  sqlite3_int64 bytes; /* XML of the sheet parsed up to the last row */
+  size_t size;         /* Memory used by the rows, for the budget */
+  int count;
+  int row_nums[ROW_BATCH_SIZE];
+  Row rows[ROW_BATCH_SIZE];
+} RowBatch;
+
+typedef struct {
+  int sheet_index;  /* 0-based index into the workbook */
+  const char *path; /* Worksheet entry name, owned by the Workbook */
+  sqlite3_int64 size; /* Uncompressed size of the entry */
+  unsigned int crc; /* CRC-32 of the entry */
+  int in_archive;   /* The entry exists, so size and crc are valid */
+  RowBatch *head;   /* Queued batches, oldest first */
+  RowBatch *tail;
+  int n_queued;     /* Number of queued batches */
+  int done;         /* Worker finished parsing; rc is valid */
+  int rc;           /* Result of parse_worksheet() */
+} SheetJob;
+
+typedef struct {
+  const ZipSource *src;  /* Archive, opened separately by every worker */
+  SharedStrings *ss;    /* Shared strings, read only */
+  const CellStyles *styles; /* Date styles, read only, or NULL */
+  int fast;             /* Use the fast scanner */
+  size_t max_row_bytes; /* Memory budget of one row, or 0 */
+  size_t max_batch;     /* Bytes that make a batch full, or 0 */
+  size_t max_queued;    /* Bytes queued ahead of the writer, or 0 */
+  size_t queued;        /* Bytes of the batches queued ahead of the writer */
+  SheetJob *jobs;
+  int n_jobs;
+  int next_job;         /* Next job to hand to a worker */
+  int draining;         /* Job the writer is inserting, -1 before the first */
+  int cancel;           /* Set by the writer to stop the workers */
+  ImportStats stats;    /* Parse and ZIP counters of the workers */
+  pthread_mutex_t mutex;
+  pthread_cond_t produced; /* Signalled when a batch is queued or job done */
+  pthread_cond_t consumed; /* Signalled when a batch is taken, or on cancel */
+} ImportPool;
+
+/* Per-worker state passed to pool_emit_row() */
+typedef struct {
+  ImportPool *pool;
+  SheetJob *job;
+  RowBatch *batch;       /* Batch being filled */
+  sqlite3_int64 wait_ns; /* Time spent waiting for room in the queue */
+  const ZipArchive *za;  /* This worker's archive */
+  sqlite3_int64 za_base; /* za->bytes_inflated when the sheet started */
+} PoolWorker;
+
+static void batch_free(RowBatch *batch) {
+  for (int i = 0; i < batch->count; i++) {
+    row_free(&batch->rows[i]);
+  }
+  free(batch);
+}
+
+/* Queue the worker's batch on its job, waiting while the queue is full */
+static int pool_flush(PoolWorker *w) {
+  ImportPool *pool = w->pool;
+  RowBatch *batch = w->batch;
+  int rc = SQLITE_OK;
+
+  if (!batch || batch->count == 0)
+    return SQLITE_OK;
+  w->batch = NULL;
+  batch->bytes = w->za->bytes_inflated - w->za_base;
+
+  int job = (int)(w->job - pool->jobs);
+  pthread_mutex_lock(&pool->mutex);
+  sqlite3_int64 wait_start = 0;
+  while (!pool->cancel &&
+         (w->job->n_queued >= MAX_QUEUED_BATCHES ||
+          (pool->max_queued && job != pool->draining &&
+           pool->queued + batch->size > pool->max_queued))) {
+    if (!wait_start)
+      wait_start = xlsx_now_ns();
+    pthread_cond_wait(&pool->consumed, &pool->mutex);
+  }
+  if (wait_start)
+    w->wait_ns += xlsx_now_ns() - wait_start;
+  if (pool->cancel) {
+    rc = SQLITE_ABORT;
+  } else {
+    if (w->job->tail)
+      w->job->tail->next = batch;
+    else
+      w->job->head = batch;
+    w->job->tail = batch;
+    w->job->n_queued++;
+    if (job != pool->draining)
+      pool->queued += batch->size;
+    pthread_cond_signal(&pool->produced);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (rc != SQLITE_OK)
+    batch_free(batch);
+  return rc;
+}
+
+/* RowCallback for workers: moves the parsed row into the current batch */
+static int pool_emit_row(void *udata, int row_num, Row *row) {
+  PoolWorker *w = (PoolWorker *)udata;
+
+  if (!w->batch) {
+    w->batch = calloc(1, sizeof(RowBatch));
+    if (!w->batch)
+      return SQLITE_NOMEM;
+  }
+
+  /* Take over the cells; the parser starts the next row with a new buffer */
+  w->batch->row_nums[w->batch->count] = row_num;
+  w->batch->rows[w->batch->count++] = *row;
+  w->batch->size += row_bytes(row);
+  memset(row, 0, sizeof(*row));
+
+  if (w->batch->count == ROW_BATCH_SIZE ||
+      (w->pool->max_batch && w->batch->size >= w->pool->max_batch))
+    return pool_flush(w);
+  return SQLITE_OK;
+}
+
+static void *pool_worker_main(void *arg) {
+  ImportPool *pool = (ImportPool *)arg;
+  ZipArchive za;
+  int open_rc = zip_open(&za, pool->src);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->cancel || pool->next_job >= pool->n_jobs) {
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    SheetJob *job = &pool->jobs[pool->next_job++];
+    pthread_mutex_unlock(&pool->mutex);
+
+    PoolWorker w = {pool, job, NULL, 0, &za, za.bytes_inflated};
+    int rc = open_rc;
+    sqlite3_int64 t0 = xlsx_now_ns();
+    sqlite3_int64 inflate0 = za.inflate_ns;
+    if (rc == SQLITE_OK) {
+      rc = parse_worksheet(&za, job->path, pool->ss, pool->styles, pool->fast,
+                           pool->max_row_bytes, pool_emit_row, &w);
+    }
+    if (rc == SQLITE_OK) {
+      rc = pool_flush(&w);
+    }
+    if (w.batch) {
+      batch_free(w.batch);
+    }
+
+    sqlite3_int64 parse_ns =
+        xlsx_now_ns() - t0 - (za.inflate_ns - inflate0) - w.wait_ns;
+
+    pthread_mutex_lock(&pool->mutex);
+    job->rc = rc;
+    job->done = 1;
+    pool->stats.parse_ns += parse_ns;
+    pthread_cond_signal(&pool->produced);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  if (open_rc == SQLITE_OK) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stats.inflate_ns += za.inflate_ns;
+    pool->stats.bytes_compressed += za.bytes_read;
+    pool->stats.bytes_inflated += za.bytes_inflated;
+    pthread_mutex_unlock(&pool->mutex);
+    zip_close(&za);
+  }
+  return NULL;
+}
+
+/*
+** Insert the rows of one job as the workers produce them.
+** Returns the first error from the worker or from the inserts.
+*/
+static int pool_drain_job(ImportPool *pool, SheetJob *job, SheetImporter *si) {
+  int rc = SQLITE_OK;
+
+  /* The batches of this job no longer count as queued ahead of the writer */
+  pthread_mutex_lock(&pool->mutex);
+  pool->draining = (int)(job - pool->jobs);
+  for (RowBatch *b = job->head; b; b = b->next) {
+    pool->queued -= b->size;
+  }
+  pthread_cond_broadcast(&pool->consumed);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->mutex);
+    while (!job->head && !job->done) {
+      pthread_cond_wait(&pool->produced, &pool->mutex);
+    }
+    RowBatch *batch = job->head;
+    if (batch) {
+      job->head = batch->next;
+      if (!job->head)
+        job->tail = NULL;
+      job->n_queued--;
+      pthread_cond_broadcast(&pool->consumed);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!batch)
+      break;
+    si->bytes = batch->bytes;
+    for (int i = 0; i < batch->count && rc == SQLITE_OK; i++) {
+      rc = si_emit_row(si, batch->row_nums[i], &batch->rows[i]);
+    }
+    batch_free(batch);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+
+  return job->rc;
+}
+
+/*
+** Import all the jobs with n_threads workers. On failure *pFailed is set
+** to the job that failed. Returns SQLITE_OK or the first error. The tables
+** created and the work done are added to stats.
+*/
+static int import_sheets_parallel(sqlite3 *db, const ZipSource *src,
+                                  SharedStrings *ss, const CellStyles *styles,
+                                  Workbook *wb, SheetJob *jobs, int n_jobs,
+                                  int n_threads, int typed, int fast,
+                                  sqlite3_int64 budget,
+                                  ImportProgress *progress, ImportStats *stats,
+                                  int *pFailed, char **pzErrMsg) {
+  ImportPool pool;
+  pthread_t threads[MAX_IMPORT_THREADS];
+  int n_started = 0;
+  int rc = SQLITE_OK;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.src = src;
+  pool.ss = ss;
+  pool.styles = styles;
+  pool.fast = fast;
+  pool.max_row_bytes = budget_share(budget, 4);
+  pool.max_queued = budget_share(budget, 4);
+  pool.max_batch = budget_share(budget, 4 * MAX_QUEUED_BATCHES);
+  pool.jobs = jobs;
+  pool.n_jobs = n_jobs;
+  pool.draining = -1;
+  pthread_mutex_init(&pool.mutex, NULL);
+  pthread_cond_init(&pool.produced, NULL);
+  pthread_cond_init(&pool.consumed, NULL);
+
+  if (n_threads > n_jobs)
+    n_threads = n_jobs;
+  for (int i = 0; i < n_threads; i++) {
+    if (pthread_create(&threads[n_started], NULL, pool_worker_main, &pool) != 0)
+      break;
+    n_started++;
+  }
+  if (n_started == 0)
+    rc = SQLITE_NOMEM;
+
+  for (int i = 0; i < n_jobs && rc == SQLITE_OK; i++) {
+    SheetImporter si;
+    si_init(&si, db, wb->sheets[jobs[i].sheet_index].name, pzErrMsg, typed);
+    si.progress = progress;
+    si.max_held = budget_share(budget, 4);
+    rc = pool_drain_job(&pool, &jobs[i], &si);
+    if (rc == SQLITE_OK)
+      rc = si_finish(&si);
+    si_add_stats(&si, stats);
+    si_free(&si);
+    progress->bytes_done += jobs[i].size;
+
+    /* Sheets without a worksheet part are skipped */
+    if (rc == SQLITE_NOTFOUND) {
+      rc = SQLITE_OK;
+      continue;
+    }
+    if (rc != SQLITE_OK) {
+      *pFailed = i;
+      break;
+    }
+    stats->sheets++;
+  }
+
+  pthread_mutex_lock(&pool.mutex);
+  pool.cancel = 1;
+  pthread_cond_broadcast(&pool.consumed);
+  pthread_mutex_unlock(&pool.mutex);
+  for (int i = 0; i < n_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  stats->threads = n_started;
+  stats->parse_ns += pool.stats.parse_ns;
+  stats->inflate_ns += pool.stats.inflate_ns;
+  stats->bytes_compressed += pool.stats.bytes_compressed;
+  stats->bytes_inflated += pool.stats.bytes_inflated;
+
+  for (int i = 0; i < n_jobs; i++) {
+    while (jobs[i].head) {
+      RowBatch *next = jobs[i].head->next;
+      batch_free(jobs[i].head);
+      jobs[i].head = next;
+    }
+  }
+  pthread_cond_destroy(&pool.consumed);
+  pthread_cond_destroy(&pool.produced);
+  pthread_mutex_destroy(&pool.mutex);
+  return rc;
+}
+
+/* Import the jobs one after the other on the calling thread */
+static int import_sheets_serial(sqlite3 *db, ZipArchive *za, SharedStrings *ss,
+                                const CellStyles *styles, Workbook *wb,
+                                SheetJob *jobs, int n_jobs, int typed, int fast,
+                                sqlite3_int64 budget, ImportProgress *progress,
+                                ImportStats *stats, int *pFailed,
+                                char **pzErrMsg) {
+  for (int i = 0; i < n_jobs; i++) {
+    SheetImporter si;
+    si_init(&si, db, wb->sheets[jobs[i].sheet_index].name, pzErrMsg, typed);
+    si.progress = progress;
+    si.za = za;
+    si.za_base = za->bytes_inflated;
+    si.max_held = budget_share(budget, 4);
+    sqlite3_int64 t0 = xlsx_now_ns();
+    sqlite3_int64 inflate0 = za->inflate_ns;
+    int rc = parse_worksheet(za, jobs[i].path, ss, styles, fast,
+                             budget_share(budget, 4), si_emit_row, &si);
+    if (rc == SQLITE_OK)
+      rc = si_finish(&si);
+    /* Rows are inserted from inside the parser, so take that time out */
+    stats->parse_ns +=
+        xlsx_now_ns() - t0 - (za->inflate_ns - inflate0) - si.insert_ns;
+    si_add_stats(&si, stats);
+    si_free(&si);
+    progress->bytes_done += jobs[i].size;
+
+    /* Sheets without a worksheet part are skipped */
+    if (rc == SQLITE_NOTFOUND) {
+      continue;
+    }
+    if (rc != SQLITE_OK) {
+      *pFailed = i;
+      return rc;
+    }
+    stats->sheets++;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** ============================================================================
+** Main Import Function
+** ============================================================================
+*/
+
+/*
+** Helper function to check if a sheet should be imported based on the
+** optional sheetname1..sheetnameN parameters.
+** If no sheet parameters are provided (argc == 1), all sheets are imported.
+** If sheet parameters are provided:
+**   - Integer parameter: import sheet with that 1-based index
+**   - String parameter: import sheet with that name
+** Returns 1 if the sheet should be imported, 0 otherwise.
+*/
+static int should_import_sheet(int argc, sqlite3_value **argv,
+                               int sheet_index,   /* 0-based index */
+                               const char *sheet_name) {
+  /* If no sheet parameters provided, import all sheets */
+  if (argc <= 1) {
+    return 1;
+  }
+
+  /* Check each sheet parameter (argv[1] through argv[argc-1]) */
+  for (int i = 1; i < argc; i++) {
+    int value_type = sqlite3_value_type(argv[i]);
+
+    if (value_type == SQLITE_INTEGER) {
+      /* Integer parameter: compare with 1-based sheet number */
+      int sheet_num = sqlite3_value_int(argv[i]);
+      if (sheet_num == sheet_index + 1) {
+        return 1;
+      }
+    } else if (value_type == SQLITE_TEXT) {
+      /* String parameter: compare with sheet name */
+      const char *param_name = (const char *)sqlite3_value_text(argv[i]);
+      if (param_name && sheet_name && strcmp(param_name, sheet_name) == 0) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+** Complete the statistics of an xlsx_import() call that returns rc and keep
+** them for xlsx_import_stats. za, when not NULL, must still be open.
+*/
+static void import_save_stats(ImportConfig *cfg, ImportStats *stats,
+                              const ZipArchive *za, int rc,
+                              sqlite3_int64 start) {
+  if (!cfg)
+    return;
+  if (za) {
+    stats->inflate_ns += za->inflate_ns;
+    stats->bytes_compressed += za->bytes_read;
+    stats->bytes_inflated += za->bytes_inflated;
+  }
+  stats->result = rc;
+  stats->total_ns = xlsx_now_ns() - start;
+  cfg->last = *stats;
+}
+
+/*
+** Incremental imports. The ZIP central directory holds the CRC-32 and size
+** of every part, so a sheet whose worksheet part and shared strings are
+** unchanged since the last import of the same file can be recognised
+** without inflating anything. xlsx_import_manifest, in the main schema,
+** keeps those fingerprints:
+**
+**   file               - absolute path of the workbook, or the filename as
+**                        passed to xlsx_import() when it cannot be resolved
+**   sheet              - sheet name, which is also the table name
+**   crc, size          - CRC-32 and uncompressed size of the worksheet part
+**   shared_strings_crc - CRC-32 of xl/sharedStrings.xml, NULL if none
+**
+** A sheet is skipped when its row matches and its table still exists.
+** Otherwise its table is dropped and imported again, and the row replaced.
+** A sheet whose part is missing or empty would import nothing, so it is
+** skipped before anything is dropped and its table is kept. Any other
+** failure rolls back the whole import, drops included.
+*/
+typedef struct {
+  sqlite3_stmt *lookup; /* Is (file, sheet) recorded with this fingerprint? */
+  sqlite3_stmt *save;   /* Record the fingerprint of (file, sheet) */
+  char *filename; /* Canonical path, from sqlite3_malloc() */
+  int has_shared_strings;
+  unsigned int shared_strings_crc;
+} Manifest;
+
+static void manifest_end(Manifest *m) {
+  sqlite3_finalize(m->lookup);
+  sqlite3_finalize(m->save);
+  sqlite3_free(m->filename);
+  memset(m, 0, sizeof(*m));
+}
+
+/*
+** Resolve filename to an absolute path with symbolic links, "." and ".."
+** removed, so that every spelling of a file shares its manifest rows.
+** A name that cannot be resolved is kept as given.
+*/
+static char *manifest_path(const char *filename) {
+#ifdef _WIN32
+  char *full = _fullpath(NULL, filename, 0);
+#else
+  char *full = realpath(filename, NULL);
+#endif
+  char *path = sqlite3_mprintf("%s", full ? full : filename);
+  free(full);
+  return path;
+}
+
+/* Create xlsx_import_manifest if needed and prepare its statements */
+static int manifest_begin(sqlite3 *db, ZipArchive *za, const char *filename,
+                          Manifest *m, char **pzErrMsg) {
+  memset(m, 0, sizeof(*m));
+  m->filename = manifest_path(filename);
+  if (!m->filename)
+    return SQLITE_NOMEM;
+
+  ZipEntry entry;
+  if (zip_find(za, "xl/sharedStrings.xml", &entry) == SQLITE_OK) {
+    m->has_shared_strings = 1;
+    m->shared_strings_crc = entry.crc;
+  }
+
+  int rc = sqlite3_exec(db,
+                        "CREATE TABLE IF NOT EXISTS main.xlsx_import_manifest("
+                        "file TEXT NOT NULL, sheet TEXT NOT NULL, "
+                        "crc INTEGER, size INTEGER, shared_strings_crc INTEGER, "
+                        "PRIMARY KEY (file, sheet))",
+                        NULL, NULL, pzErrMsg);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_prepare_v2(
+        db,
+        "SELECT 1 FROM main.xlsx_import_manifest "
+        "WHERE file = ?1 AND sheet = ?2 AND crc = ?3 AND size = ?4 "
+        "AND shared_strings_crc IS ?5 AND EXISTS (SELECT 1 FROM "
+        "main.sqlite_schema WHERE type = 'table' AND name = ?2 COLLATE NOCASE)",
+        -1, &m->lookup, NULL);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_prepare_v2(db,
+                            "INSERT OR REPLACE INTO main.xlsx_import_manifest "
+                            "VALUES (?1, ?2, ?3, ?4, ?5)",
+                            -1, &m->save, NULL);
+  if (rc != SQLITE_OK && pzErrMsg && !*pzErrMsg)
+    *pzErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  return rc;
+}
+
+static void manifest_bind(Manifest *m, sqlite3_stmt *stmt, const char *sheet,
+                          const SheetJob *job) {
+  sqlite3_bind_text(stmt, 1, m->filename, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, sheet, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 3, job->crc);
+  sqlite3_bind_int64(stmt, 4, job->size);
+  if (m->has_shared_strings)
+    sqlite3_bind_int64(stmt, 5, m->shared_strings_crc);
+  else
+    sqlite3_bind_null(stmt, 5);
+}
+
+/* Sets *pSame when the sheet of job is recorded as imported unchanged */
+static int manifest_unchanged(Manifest *m, const char *sheet,
+                              const SheetJob *job, int *pSame) {
+  *pSame = 0;
+  if (!job->in_archive)
+    return SQLITE_OK;
+  manifest_bind(m, m->lookup, sheet, job);
+  int rc = sqlite3_step(m->lookup);
+  *pSame = rc == SQLITE_ROW;
+  sqlite3_reset(m->lookup);
+  return rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/* Drop the table of a changed sheet so it is imported from scratch */
+static int manifest_drop_table(sqlite3 *db, const char *sheet,
+                               char **pzErrMsg) {
+  char *escaped = escape_identifier(sheet);
+  char *sql =
+      escaped ? sqlite3_mprintf("DROP TABLE IF EXISTS main.%s", escaped) : NULL;
+  free(escaped);
+  if (!sql)
+    return SQLITE_NOMEM;
+  int rc = sqlite3_exec(db, sql, NULL, NULL, pzErrMsg);
+  sqlite3_free(sql);
+  return rc;
+}
+
+/* Record the fingerprint of an imported sheet */
+static int manifest_save(Manifest *m, const char *sheet, const SheetJob *job) {
+  if (!job->in_archive)
+    return SQLITE_OK;
+  manifest_bind(m, m->save, sheet, job);
+  int rc = sqlite3_step(m->save);
+  sqlite3_reset(m->save);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/*
+** xlsx_import(filename, [sheetname1, sheetname2, ...]) - Import sheets from
+** an XLSX file as tables.
+**
+** Parameters:
+**   filename    - Path to the XLSX file to import, or a BLOB holding the
+**                 file, which is read in place
+**   sheetname1..sheetnameN - Optional sheet selectors (string name or integer
+**                            number). If none provided, all sheets are
+**                            imported. Integer parameters specify 1-based
+**                            sheet numbers.
+*/
+static void xlsx_import_func(sqlite3_context *ctx, int argc,
+                             sqlite3_value **argv) {
+  ImportConfig *cfg = (ImportConfig *)sqlite3_user_data(ctx);
+  ImportStats stats;
+  sqlite3_int64 start = xlsx_now_ns();
+  sqlite3_int64 t0 = start;
+  memset(&stats, 0, sizeof(stats));
+
+  if (argc < 1) {
+    import_save_stats(cfg, &stats, NULL, SQLITE_MISUSE, start);
+    sqlite3_result_error(ctx, "xlsx_import requires a filename argument", -1);
+    return;
+  }
+
+  ZipSource src;
+  if (zip_source_init(&src, argv[0]) != SQLITE_OK) {
+    import_save_stats(cfg, &stats, NULL, SQLITE_MISUSE, start);
+    sqlite3_result_error(ctx, "Invalid filename", -1);
+    return;
+  }
+
+  sqlite3 *db = sqlite3_context_db_handle(ctx);
+  int rc;
+  char *errmsg = NULL;
+
+  ZipArchive za;
+  rc = zip_open(&za, &src);
+  stats.open_ns = xlsx_now_ns() - t0;
+  if (rc != SQLITE_OK) {
+    import_save_stats(cfg, &stats, NULL, rc, start);
+    char *msg = sqlite3_mprintf(rc == SQLITE_CANTOPEN
+                                    ? "Cannot open XLSX file '%s'"
+                                    : "Failed to read XLSX file '%s'",
+                                src.label);
+    sqlite3_result_error(ctx, msg, -1);
+    sqlite3_free(msg);
+    return;
+  }
+
+  /* Shared strings and styles are read once the sheets to import are known */
+  SharedStrings ss;
+  memset(&ss, 0, sizeof(ss));
+  CellStyles styles;
+  memset(&styles, 0, sizeof(styles));
+
+  /* Read workbook to get sheet names */
+  Workbook wb;
+  t0 = xlsx_now_ns();
+  rc = parse_workbook(&za, &wb);
+  stats.workbook_ns = xlsx_now_ns() - t0;
+  if (rc != SQLITE_OK) {
+    import_save_stats(cfg, &stats, &za, rc, start);
+    zip_close(&za);
+    ss_free(&ss);
+    sqlite3_result_error(ctx,
+                         rc == SQLITE_NOTFOUND ? "Failed to read workbook"
+                                               : "Failed to parse workbook",
+                         -1);
+    return;
+  }
+
+  /* All sheets are imported in one transaction */
+  BulkState bulk;
+  bulk_begin(db, cfg, &bulk);
+  rc = sqlite3_exec(db, "SAVEPOINT xlsx_import", NULL, NULL, &errmsg);
+  if (rc != SQLITE_OK) {
+    bulk_end(db, &bulk);
+    import_save_stats(cfg, &stats, &za, rc, start);
+    zip_close(&za);
+    wb_free(&wb);
+    ss_free(&ss);
+    sqlite3_result_error(ctx, errmsg ? errmsg : "Failed to begin import", -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  /* The progress function is called through a statement of its own */
+  ImportProgress progress;
+  memset(&progress, 0, sizeof(progress));
+  if (cfg && cfg->progress) {
+    char *sql =
+        sqlite3_mprintf("SELECT \"%w\"(?1, ?2, ?3, ?4)", cfg->progress);
+    rc = sql ? sqlite3_prepare_v2(db, sql, -1, &progress.callback, NULL)
+             : SQLITE_NOMEM;
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK && rc != SQLITE_NOMEM) {
+      errmsg = sqlite3_mprintf("Cannot call progress function '%s': %s",
+                               cfg->progress, sqlite3_errmsg(db));
+    }
+    progress.every = cfg->progress_rows;
+    progress.next = cfg->progress_rows;
+  }
+
+  Manifest manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  /* A BLOB has no name to find its previous import by */
+  int incremental = cfg && cfg->incremental && src.filename;
+  if (rc == SQLITE_OK && incremental)
+    rc = manifest_begin(db, &za, src.filename, &manifest, &errmsg);
+
+  /* Process each selected sheet */
+  SheetJob *jobs = NULL;
+  int n_jobs = 0;
+  if (rc == SQLITE_OK) {
+    jobs = calloc(wb.count ? wb.count : 1, sizeof(SheetJob));
+    if (!jobs)
+      rc = SQLITE_NOMEM;
+  }
+  for (int i = 0; jobs && rc == SQLITE_OK && i < wb.count; i++) {
+    /* Check if this sheet should be imported based on optional parameters */
+    if (!should_import_sheet(argc, argv, i, wb.sheets[i].name)) {
+      continue;
+    }
+    /* Sheets without a worksheet part (chartsheets) are skipped */
+    if (!wb.sheets[i].path) {
+      continue;
+    }
+    ZipEntry entry;
+    jobs[n_jobs].sheet_index = i;
+    jobs[n_jobs].path = wb.sheets[i].path;
+    if (zip_find(&za, wb.sheets[i].path, &entry) == SQLITE_OK) {
+      jobs[n_jobs].size = entry.uncomp_size;
+      jobs[n_jobs].crc = entry.crc;
+      jobs[n_jobs].in_archive = 1;
+    }
+    if (incremental) {
+      int same;
+      /* Nothing would replace the table, so leave it alone */
+      if (!jobs[n_jobs].in_archive || jobs[n_jobs].size == 0)
+        continue;
+      rc = manifest_unchanged(&manifest, wb.sheets[i].name, &jobs[n_jobs],
+                              &same);
+      if (rc == SQLITE_OK && same) {
+        stats.sheets_unchanged++;
+        continue;
+      }
+      if (rc == SQLITE_OK)
+        rc = manifest_drop_table(db, wb.sheets[i].name, &errmsg);
+      if (rc != SQLITE_OK)
+        break;
+    }
+    progress.bytes_total += jobs[n_jobs].size;
+    n_jobs++;
+  }
+
+  /* Nothing to read when every selected sheet is unchanged */
+  if (rc == SQLITE_OK && n_jobs > 0) {
+    t0 = xlsx_now_ns();
+    rc = parse_shared_strings(&za, &ss, 0);
+    stats.shared_strings_ns = xlsx_now_ns() - t0;
+    stats.shared_strings = ss.count;
+    if (rc != SQLITE_OK && !errmsg)
+      errmsg = sqlite3_mprintf("Failed to parse shared strings");
+  }
+  if (rc == SQLITE_OK && n_jobs > 0 && cfg && cfg->dates != DATES_SERIAL) {
+    rc = parse_styles(&za, &wb, cfg->dates, &styles);
+    if (rc != SQLITE_OK && !errmsg)
+      errmsg = sqlite3_mprintf("Failed to parse styles");
+  }
+  const CellStyles *cell_styles = styles.count > 0 ? &styles : NULL;
+
+  int failed = -1;
+  t0 = xlsx_now_ns();
+  if (rc != SQLITE_OK) {
+    /* Nothing imported */
+  } else if (cfg && cfg->threads > 1 && n_jobs > 1) {
+    rc = import_sheets_parallel(db, &src, &ss, cell_styles, &wb, jobs, n_jobs,
+                                cfg->threads, cfg->typed, cfg->fastscan,
+                                cfg->memory_budget, &progress, &stats, &failed,
+                                &errmsg);
+  } else {
+    rc = import_sheets_serial(db, &za, &ss, cell_styles, &wb, jobs, n_jobs,
+                              cfg && cfg->typed, cfg && cfg->fastscan,
+                              cfg ? cfg->memory_budget : DEFAULT_MEMORY_BUDGET,
+                              &progress, &stats, &failed, &errmsg);
+  }
+  stats.sheets_ns = xlsx_now_ns() - t0;
+  sqlite3_finalize(progress.callback);
+  for (int i = 0; incremental && rc == SQLITE_OK && i < n_jobs; i++) {
+    rc = manifest_save(&manifest, wb.sheets[jobs[i].sheet_index].name,
+                       &jobs[i]);
+    if (rc != SQLITE_OK)
+      errmsg = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  }
+  manifest_end(&manifest);
+
+  if (rc != SQLITE_OK) {
+    const char *name = failed >= 0 ? wb.sheets[jobs[failed].sheet_index].name
+                                   : "";
+    if (rc == SQLITE_ERROR && !errmsg) {
+      errmsg = sqlite3_mprintf("Failed to parse worksheet '%s'", name);
+    }
+    if (rc == SQLITE_CORRUPT && !errmsg) {
+      errmsg = sqlite3_mprintf("Corrupt worksheet '%s' in archive", name);
+    }
+    if (rc == SQLITE_INTERRUPT && !errmsg) {
+      errmsg = sqlite3_mprintf("xlsx_import interrupted");
+    }
+    if (rc == SQLITE_TOOBIG && !errmsg) {
+      errmsg = sqlite3_mprintf(
+          "A row of worksheet '%s' exceeds the memory budget", name);
+    }
+
+    import_end_savepoint(db, 0);
+    bulk_end(db, &bulk);
+    import_save_stats(cfg, &stats, &za, rc, start);
+    free(jobs);
+    zip_close(&za);
+    wb_free(&wb);
+    ss_free(&ss);
+    styles_free(&styles);
+    if (errmsg) {
+      sqlite3_result_error(ctx, errmsg, -1);
+      sqlite3_free(errmsg);
+    } else if (rc == SQLITE_NOMEM) {
+      sqlite3_result_error_nomem(ctx);
+    } else {
+      sqlite3_result_error(ctx, "Failed to create table", -1);
+    }
+    if (rc == SQLITE_INTERRUPT)
+      sqlite3_result_error_code(ctx, SQLITE_INTERRUPT);
+    return;
+  }
+  free(jobs);
+
+  t0 = xlsx_now_ns();
+  rc = import_end_savepoint(db, 1);
+  stats.commit_ns = xlsx_now_ns() - t0;
+  bulk_end(db, &bulk);
+  import_save_stats(cfg, &stats, &za, rc, start);
+  zip_close(&za);
+  wb_free(&wb);
+  ss_free(&ss);
+  styles_free(&styles);
+
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(ctx, sqlite3_errmsg(db), -1);
+    return;
+  }
+  sqlite3_result_int(ctx, (int)stats.sheets);
+}
+
+/*
+** xlsx_import_version() - Return the version string.
+*/
+static void xlsx_import_version_func(sqlite3_context *ctx, int argc,
+                                     sqlite3_value **argv) {
+  (void)argc;
+  (void)argv;
+  sqlite3_result_text(ctx, "2025-12-30 Claude Opus 4.5 (Thinking)", -1,
+                      SQLITE_STATIC);
+}
+
+/*
+** ============================================================================
+** Table-Valued Function: xlsx_import_sheetnames
+** ============================================================================
+**
+** Returns the sheet names from an XLSX file as a table with columns:
+**   sheet_num  - 1-based sheet number
+**   sheet_name - Name of the sheet
+**   sheet_path - (hidden) Worksheet part the sheet is imported from, resolved
+**                through xl/_rels/workbook.xml.rels; NULL for chartsheets
+**
+** Usage:
+**   SELECT * FROM xlsx_import_sheetnames('filename.xlsx');
+**   SELECT sheet_name, sheet_path FROM xlsx_import_sheetnames('filename.xlsx');
+*/
+
+/* Virtual table cursor structure */
+typedef struct sheetnames_cursor {
+  sqlite3_vtab_cursor base; /* Base class - must be first */
+  Workbook wb;              /* Parsed workbook with sheet info */
+  int current;              /* Current row index (0-based) */
+  int eof;                  /* True if past last row */
+} sheetnames_cursor;
+
+/* Virtual table structure */
+typedef struct sheetnames_vtab {
+  sqlite3_vtab base; /* Base class - must be first */
+  sqlite3 *db;       /* Database connection */
+} sheetnames_vtab;
+
+/* xConnect/xCreate - Create a new virtual table instance */
+static int sheetnamesConnect(sqlite3 *db, void *pAux, int argc,
+                             const char *const *argv, sqlite3_vtab **ppVtab,
+                             char **pzErr) {
+  (void)pAux;
+  (void)argc;
+  (void)argv;
+  (void)pzErr;
+
+  int rc = sqlite3_declare_vtab(
+      db, "CREATE TABLE x(sheet_num INTEGER, sheet_name TEXT, "
+          "filename HIDDEN, sheet_path TEXT HIDDEN)");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  sheetnames_vtab *pNew = sqlite3_malloc(sizeof(*pNew));
+  if (!pNew) {
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->db = db;
+
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/* xDisconnect/xDestroy - Destroy virtual table instance */
+static int sheetnamesDisconnect(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/* xOpen - Create a new cursor */
+static int sheetnamesOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  (void)pVtab;
+
+  sheetnames_cursor *pCur = sqlite3_malloc(sizeof(*pCur));
+  if (!pCur) {
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+/* xClose - Close and free a cursor */
+static int sheetnamesClose(sqlite3_vtab_cursor *cur) {
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+  wb_free(&pCur->wb);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+/* xNext - Advance cursor to next row */
+static int sheetnamesNext(sqlite3_vtab_cursor *cur) {
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+  pCur->current++;
+  if (pCur->current >= pCur->wb.count) {
+    pCur->eof = 1;
+  }
+  return SQLITE_OK;
+}
+
+/* xColumn - Return value for column iCol of current row */
+static int sheetnamesColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
+                            int iCol) {
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+
+  if (pCur->current >= pCur->wb.count) {
+    sqlite3_result_null(ctx);
+    return SQLITE_OK;
+  }
+
+  switch (iCol) {
+  case 0: /* sheet_num (1-based) */
+    sqlite3_result_int(ctx, pCur->current + 1);
+    break;
+  case 1: /* sheet_name */
+    sqlite3_result_text(ctx, pCur->wb.sheets[pCur->current].name, -1,
+                        SQLITE_TRANSIENT);
+    break;
+  case 3: /* sheet_path */
+    if (pCur->wb.sheets[pCur->current].path)
+      sqlite3_result_text(ctx, pCur->wb.sheets[pCur->current].path, -1,
+                          SQLITE_TRANSIENT);
+    else
+      sqlite3_result_null(ctx);
+    break;
+  default:
+    sqlite3_result_null(ctx);
+    break;
+  }
+  return SQLITE_OK;
+}
+
+/* xRowid - Return rowid for current row */
+static int sheetnamesRowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid) {
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+  *pRowid = pCur->current + 1;
+  return SQLITE_OK;
+}
+
+/* xEof - Return true if cursor is past last row */
+static int sheetnamesEof(sqlite3_vtab_cursor *cur) {
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+  return pCur->eof;
+}
+
+/* xFilter - Begin a search; parse the XLSX file */
+static int sheetnamesFilter(sqlite3_vtab_cursor *cur, int idxNum,
+                            const char *idxStr, int argc,
+                            sqlite3_value **argv) {
+  (void)idxNum;
+  (void)idxStr;
+
+  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
+  sheetnames_vtab *pVtab = (sheetnames_vtab *)cur->pVtab;
+
+  /* Free any previous workbook data */
+  wb_free(&pCur->wb);
+  pCur->current = 0;
+  pCur->eof = 0;
+
+  if (argc < 1) {
+    pVtab->base.zErrMsg =
+        sqlite3_mprintf("xlsx_import_sheetnames requires a filename argument");
+    return SQLITE_ERROR;
+  }
+
+  ZipSource src;
+  if (zip_source_init(&src, argv[0]) != SQLITE_OK) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Invalid filename");
+    return SQLITE_ERROR;
+  }
+
+  /* Read workbook.xml to get sheet names */
+  ZipArchive za;
+  int rc = zip_open(&za, &src);
+  if (rc != SQLITE_OK) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to read workbook from %s", src.label);
+    return SQLITE_ERROR;
+  }
+
+  rc = parse_workbook(&za, &pCur->wb);
+  zip_close(&za);
+  if (rc == SQLITE_NOTFOUND) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to read workbook from %s", src.label);
+    return SQLITE_ERROR;
+  }
+  if (rc != SQLITE_OK) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to parse workbook");
+    return SQLITE_ERROR;
+  }
+
+  /* Check if we have any sheets */
+  if (pCur->wb.count == 0) {
+    pCur->eof = 1;
+  }
+
+  return SQLITE_OK;
+}
+
+/* xBestIndex - Determine query plan; require filename parameter */
+static int sheetnames_BestIndex(sqlite3_vtab *pVtab,
+                                sqlite3_index_info *pIdxInfo) {
+  (void)pVtab;
+
+  /* Look for equality constraint on filename (column 2, the hidden column) */
+  int filenameIdx = -1;
+  for (int i = 0; i < pIdxInfo->nConstraint; i++) {
+    if (pIdxInfo->aConstraint[i].usable &&
+        pIdxInfo->aConstraint[i].iColumn == 2 &&
+        pIdxInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ) {
+      filenameIdx = i;
+      break;
+    }
+  }
+
+  if (filenameIdx < 0) {
+    /* Filename is required */
+    return SQLITE_CONSTRAINT;
+  }
+
+  pIdxInfo->aConstraintUsage[filenameIdx].argvIndex = 1;
+  pIdxInfo->aConstraintUsage[filenameIdx].omit = 1;
+  pIdxInfo->estimatedCost = 1000.0;
+  pIdxInfo->estimatedRows = 10;
+
+  return SQLITE_OK;
+}
+
+/* Virtual table module definition */
+static sqlite3_module sheetnamesModule = {
+    0,                    /* iVersion */
+    sheetnamesConnect,    /* xCreate */
+    sheetnamesConnect,    /* xConnect */
+    sheetnames_BestIndex, /* xBestIndex */
+    sheetnamesDisconnect, /* xDisconnect */
+    sheetnamesDisconnect, /* xDestroy */
+    sheetnamesOpen,       /* xOpen */
+    sheetnamesClose,      /* xClose */
+    sheetnamesFilter,     /* xFilter */
+    sheetnamesNext,       /* xNext */
+    sheetnamesEof,        /* xEof */
+    sheetnamesColumn,     /* xColumn */
+    sheetnamesRowid,      /* xRowid */
+    0,                    /* xUpdate */
+    0,                    /* xBegin */
+    0,                    /* xSync */
+    0,                    /* xCommit */
+    0,                    /* xRollback */
+    0,                    /* xFindFunction */
+    0,                    /* xRename */
+    0,                    /* xSavepoint */
+    0,                    /* xRelease */
+    0,                    /* xRollbackTo */
+    0,                    /* xShadowName */
+    0                     /* xIntegrity */
+};
+
+/*
+** ============================================================================
+** Virtual Table: xlsx_sheet
+** ============================================================================
+**
+** Queries a sheet in place. Rows are parsed only as the cursor advances:
+** the worksheet parser is suspended (XML_StopParser with resumable set) at
+** every </row> and resumed by xNext, so a LIMIT or an early exit stops the
+** decompression and parsing as well.
+**
+** Number and boolean cells are returned as INTEGER or REAL, other cells as
+** TEXT, empty cells as NULL.
+**
+** The colUsed mask from xBestIndex reaches the worksheet parser, which does
+** not collect the text of cells in unused columns.
+**
+** Two forms are supported:
+**
+**   CREATE VIRTUAL TABLE t USING xlsx_sheet('filename.xlsx' [, sheet]);
+**   SELECT * FROM t LIMIT 10;
+**     The columns are named after the header row (row 1) of the sheet,
+**     which is not returned as data. Cells beyond the header are ignored.
+**
+**   SELECT row_num, cells FROM xlsx_sheet('filename.xlsx' [, sheet]);
+**     An eponymous table-valued function cannot take its columns from the
+**     file, so it returns every row, header included, as its row number
+**     and a JSON array of the cell values (use cells->>0, cells->>1...).
+**
+** sheet is a sheet name or a 1-based sheet number; the default is the first
+** sheet.
+*/
+
+/* Streaming reader for the rows of one sheet */
+typedef struct {
+  ZipArchive za;
+  int za_open;
+  SharedStrings ss;
+  ZipStream stream;
+  int stream_open;
+  WorksheetParser wsp;
+  XML_Parser parser;
+  char *sheet_name;  /* Name of the sheet being read */
+  int skip_row1;     /* Row 1 holds column names; do not return it */
+  Row row;           /* Current row */
+  int row_num;       /* Number of the current row */
+  int have_row;      /* A row arrived during the current sr_next() */
+  int eof;
+} SheetReader;
+
+/* RowCallback: keep the row and suspend the parser until the next xNext */
+static int sr_emit_row(void *udata, int row_num, Row *row) {
+  SheetReader *sr = (SheetReader *)udata;
+
+  if (row_num == 1 && sr->skip_row1)
+    return SQLITE_OK;
+
+  /* Swap buffers instead of copying; the parser resets the old row */
+  Row tmp = sr->row;
+  sr->row = *row;
+  *row = tmp;
+  sr->row_num = row_num;
+  sr->have_row = 1;
+  XML_StopParser(sr->parser, XML_TRUE);
+  return SQLITE_OK;
+}
+
+static void sr_close(SheetReader *sr) {
+  if (sr->parser)
+    XML_ParserFree(sr->parser);
+  wsp_free(&sr->wsp);
+  if (sr->stream_open)
+    zip_stream_close(&sr->stream);
+  ss_free(&sr->ss);
+  if (sr->za_open)
+    zip_close(&sr->za);
+  row_free(&sr->row);
+  sqlite3_free(sr->sheet_name);
+  memset(sr, 0, sizeof(*sr));
+}
+
+/*
+** Open sheet sheet_name, or sheet number sheet_num (1-based) when sheet_name
+** is NULL, of the archive src. On error *pzErr is set.
+**
+** The rows are read after xFilter returns, when a BLOB argument is no
+** longer valid, so an image is copied first.
+*/
+static int sr_open(SheetReader *sr, const ZipSource *src,
+                   const char *sheet_name, int sheet_num, char **pzErr) {
+  const char *filename = src->label;
+  ZipSource copy = *src;
+  unsigned char *image = NULL;
+
+  memset(sr, 0, sizeof(*sr));
+  wsp_init(&sr->wsp, &sr->ss, sr_emit_row, sr);
+
+  if (!src->filename && src->size > 0) {
+    image = malloc((size_t)src->size);
+    if (!image)
+      return SQLITE_NOMEM;
+    memcpy(image, src->data, (size_t)src->size);
+    copy.data = image;
+  }
+  int rc = zip_open(&sr->za, &copy);
+  if (rc != SQLITE_OK) {
+    free(image);
+    *pzErr = sqlite3_mprintf(rc == SQLITE_CANTOPEN
+                                 ? "Cannot open XLSX file '%s'"
+                                 : "Failed to read XLSX file '%s'",
+                             filename);
+    return SQLITE_ERROR;
+  }
+  sr->za.map_owned = image;
+  sr->za_open = 1;
+
+  Workbook wb;
+  rc = parse_workbook(&sr->za, &wb);
+  if (rc != SQLITE_OK) {
+    *pzErr = sqlite3_mprintf("Failed to read workbook from %s", filename);
+    return SQLITE_ERROR;
+  }
+  int index = -1;
+  char *sheet_path = NULL;
+  for (int i = 0; i < wb.count; i++) {
+    if (sheet_name ? strcmp(wb.sheets[i].name, sheet_name) == 0
+                   : i + 1 == sheet_num) {
+      index = i;
+      break;
+    }
+  }
+  if (index >= 0) {
+    sr->sheet_name = sqlite3_mprintf("%s", wb.sheets[index].name);
+    if (wb.sheets[index].path)
+      sheet_path = sqlite3_mprintf("%s", wb.sheets[index].path);
+  }
+  wb_free(&wb);
+  if (index < 0) {
+    if (sheet_name)
+      *pzErr = sqlite3_mprintf("No sheet named '%s' in %s", sheet_name,
+                               filename);
+    else
+      *pzErr = sqlite3_mprintf("No sheet number %d in %s", sheet_num,
+                               filename);
+    return SQLITE_ERROR;
+  }
+
+  rc = parse_shared_strings(&sr->za, &sr->ss, 0);
+  if (rc != SQLITE_OK) {
+    sqlite3_free(sheet_path);
+    *pzErr = sqlite3_mprintf("Failed to parse shared strings");
+    return SQLITE_ERROR;
+  }
+
+  ZipEntry entry;
+  rc = sheet_path ? zip_find(&sr->za, sheet_path, &entry) : SQLITE_NOTFOUND;
+  sqlite3_free(sheet_path);
+  if (rc == SQLITE_NOTFOUND || (rc == SQLITE_OK && entry.uncomp_size == 0)) {
+    /* A sheet without a worksheet part has no rows */
+    sr->eof = 1;
+    return SQLITE_OK;
+  }
+  if (rc == SQLITE_OK)
+    rc = zip_stream_open(&sr->stream, &sr->za, &entry);
+  if (rc != SQLITE_OK) {
+    *pzErr = sqlite3_mprintf("Corrupt worksheet '%s' in archive",
+                             sr->sheet_name);
+    return SQLITE_ERROR;
+  }
+  sr->stream_open = 1;
+
+  sr->parser = ws_parser_create(&sr->wsp);
+  return sr->parser ? SQLITE_OK : SQLITE_NOMEM;
+}
 
-  rc = sqlite3_step(stmt);
-  if (rc == SQLITE_ROW) {
-    const void *blob = sqlite3_column_blob(stmt, 0);
-    int blob_len = sqlite3_column_bytes(stmt, 0);
+/* Advance to the next row. Sets sr->eof after the last one. */
+static int sr_next(SheetReader *sr, char **pzErr) {
+  sr->have_row = 0;
 
-    *data = malloc(blob_len + 1);
-    if (*data) {
-      memcpy(*data, blob, blob_len);
-      (*data)[blob_len] = '\0';
-      *data_len = blob_len;
-      rc = SQLITE_OK;
+  while (!sr->eof) {
+    XML_ParsingStatus status;
+    enum XML_Status xs;
+    int rc = SQLITE_OK;
+
+    XML_GetParsingStatus(sr->parser, &status);
+    if (status.parsing == XML_FINISHED) {
+      sr->eof = 1;
+      break;
+    } else if (status.parsing == XML_SUSPENDED) {
+      xs = XML_ResumeParser(sr->parser);
     } else {
-      rc = SQLITE_NOMEM;
+      const char *data;
+      int len;
+      rc = zip_stream_read(&sr->stream, &data, &len);
+      if (rc != SQLITE_OK) {
+        *pzErr = sqlite3_mprintf("Corrupt worksheet '%s' in archive",
+                                 sr->sheet_name);
+        return SQLITE_ERROR;
+      }
+      xs = XML_Parse(sr->parser, data, len, len == 0);
     }
-  } else if (rc == SQLITE_DONE) {
-    /* Entry not found - not an error, just return empty */
-    *data = NULL;
-    *data_len = 0;
-    rc = SQLITE_OK;
+
+    if (xs == XML_STATUS_ERROR && sr->wsp.rc != SQLITE_OK) {
+      return sr->wsp.rc;
+    }
+    if (xs == XML_STATUS_ERROR) {
+      *pzErr = sqlite3_mprintf("Failed to parse worksheet '%s'",
+                               sr->sheet_name);
+      return SQLITE_ERROR;
+    }
+    if (sr->have_row)
+      return SQLITE_OK;
   }
 
-  sqlite3_finalize(stmt);
-  return rc;
+  return SQLITE_OK;
 }
 
-/*
-** Create a table from a worksheet.
-*/
-static int create_table_from_worksheet(sqlite3 *db, const char *table_name,
-                                       Worksheet *ws, char **pzErrMsg) {
-  if (ws->count == 0 || ws->max_col == 0) {
-    /* Empty worksheet */
-    return SQLITE_OK;
+/* Return cell col of the current row with its natural storage class */
+static void sr_result_cell(sqlite3_context *ctx, const Row *row, int col) {
+  sqlite3_int64 iv;
+  double rv;
+  int len = 0;
+  const char *text = row_cell_text(row, col, &len);
+
+  switch (text ? cell_class(row, col, &iv, &rv) : SQLITE_NULL) {
+  case SQLITE_INTEGER:
+    sqlite3_result_int64(ctx, iv);
+    break;
+  case SQLITE_FLOAT:
+    sqlite3_result_double(ctx, rv);
+    break;
+  case SQLITE_TEXT:
+    sqlite3_result_text(ctx, text, len, SQLITE_TRANSIENT);
+    break;
+  default:
+    sqlite3_result_null(ctx);
+    break;
   }
+}
 
-  /* Build column names from first row */
-  Row *first_row = &ws->rows[0];
+/* Return the current row as a JSON array */
+/* Append len bytes of text to json as a JSON string */
+static void json_append_string(sqlite3_str *json, const char *text, int len) {
+  sqlite3_str_appendchar(json, 1, '"');
+  for (int i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)text[i];
+    if (c == '"' || c == '\\') {
+      sqlite3_str_appendchar(json, 1, '\\');
+      sqlite3_str_appendchar(json, 1, (char)c);
+    } else if (c < 0x20) {
+      sqlite3_str_appendf(json, "\\u%04x", c);
+    } else {
+      sqlite3_str_appendchar(json, 1, (char)c);
+    }
+  }
+  sqlite3_str_appendchar(json, 1, '"');
+}
 
-  /* Start building CREATE TABLE statement */
-  sqlite3_str *sql = sqlite3_str_new(db);
+static void sr_result_json(sqlite3_context *ctx, const Row *row) {
+  sqlite3_str *json = sqlite3_str_new(NULL);
 
-  char *escaped_table = escape_identifier(table_name);
-  sqlite3_str_appendf(sql, "CREATE TABLE IF NOT EXISTS %s (", escaped_table);
-  free(escaped_table);
+  sqlite3_str_appendchar(json, 1, '[');
+  for (int col = 0; col < row->count; col++) {
+    sqlite3_int64 iv;
+    double rv;
+    int len = 0;
+    const char *text = row_cell_text(row, col, &len);
 
-  for (int col = 0; col < ws->max_col; col++) {
     if (col > 0)
-      sqlite3_str_appendall(sql, ", ");
-
-    const char *col_name = NULL;
-    if (col < first_row->count && first_row->cells[col].value) {
-      col_name = first_row->cells[col].value;
+      sqlite3_str_appendchar(json, 1, ',');
+    switch (text ? cell_class(row, col, &iv, &rv) : SQLITE_NULL) {
+    case SQLITE_INTEGER:
+      sqlite3_str_appendf(json, "%lld", iv);
+      break;
+    case SQLITE_FLOAT: {
+      /* Shortest of the two that reads back as the same double */
+      char buf[32];
+      sqlite3_snprintf(sizeof(buf), buf, "%!.15g", rv);
+      if (!xlsx_same_double(buf, rv))
+        sqlite3_snprintf(sizeof(buf), buf, "%!.17g", rv);
+      sqlite3_str_appendall(json, buf);
+      break;
     }
-
-    if (col_name && *col_name) {
-      char *escaped_col = escape_identifier(col_name);
-      sqlite3_str_appendall(sql, escaped_col);
-      free(escaped_col);
-    } else {
-      /* Generate default column name */
-      sqlite3_str_appendf(sql, "\"col%d\"", col + 1);
+    case SQLITE_TEXT:
+      json_append_string(json, text, len);
+      break;
+    default:
+      sqlite3_str_appendall(json, "null");
+      break;
     }
   }
+  sqlite3_str_appendchar(json, 1, ']');
 
-  sqlite3_str_appendall(sql, ")");
+  int len = sqlite3_str_length(json);
+  char *text = sqlite3_str_finish(json);
+  if (!text) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  sqlite3_result_text(ctx, text, len, sqlite3_free);
+  sqlite3_result_subtype(ctx, 'J');
+}
 
-  char *create_sql = sqlite3_str_finish(sql);
-  if (!create_sql) {
-    return SQLITE_NOMEM;
+/* Eponymous schema: columns 2 and 3 are the arguments */
+#define XSHEET_COL_PATH 2
+#define XSHEET_COL_SHEET 3
+
+typedef struct xsheet_vtab {
+  sqlite3_vtab base;  /* Base class - must be first */
+  int eponymous;      /* Table-valued function form (row_num, cells) */
+  char *filename;     /* CREATE VIRTUAL TABLE form: file and sheet */
+  char *sheet_name;
+  int sheet_num;
+  int ncols;          /* CREATE VIRTUAL TABLE form: number of columns */
+} xsheet_vtab;
+
+typedef struct xsheet_cursor {
+  sqlite3_vtab_cursor base; /* Base class - must be first */
+  SheetReader sr;
+} xsheet_cursor;
+
+/* Remove the quotes from a CREATE VIRTUAL TABLE argument, if any */
+static char *xsheet_dequote(const char *arg, int *pQuoted) {
+  size_t n = strlen(arg);
+  char q = arg[0];
+
+  *pQuoted = 0;
+  if (n < 2 || (q != '\'' && q != '"') || arg[n - 1] != q)
+    return sqlite3_mprintf("%s", arg);
+
+  *pQuoted = 1;
+  char *out = sqlite3_malloc64(n);
+  if (!out)
+    return NULL;
+  size_t j = 0;
+  for (size_t i = 1; i < n - 1; i++) {
+    out[j++] = arg[i];
+    if (arg[i] == q && arg[i + 1] == q)
+      i++;
   }
+  out[j] = '\0';
+  return out;
+}
 
-  int rc = sqlite3_exec(db, create_sql, NULL, NULL, pzErrMsg);
-  sqlite3_free(create_sql);
+static int xsheetDisconnect(sqlite3_vtab *pVtab) {
+  xsheet_vtab *p = (xsheet_vtab *)pVtab;
+  sqlite3_free(p->filename);
+  sqlite3_free(p->sheet_name);
+  sqlite3_free(p);
+  return SQLITE_OK;
+}
 
+/* Declare the columns of the CREATE VIRTUAL TABLE form from row 1 */
+static int xsheet_declare_from_header(sqlite3 *db, xsheet_vtab *p,
+                                      char **pzErr) {
+  SheetReader sr;
+  ZipSource src;
+  zip_source_file(&src, p->filename);
+  int rc = sr_open(&sr, &src, p->sheet_name, p->sheet_num, pzErr);
+  if (rc == SQLITE_OK)
+    rc = sr_next(&sr, pzErr);
   if (rc != SQLITE_OK) {
+    sr_close(&sr);
     return rc;
   }
 
-  /* Build INSERT statement */
-  sql = sqlite3_str_new(db);
-  escaped_table = escape_identifier(table_name);
-  sqlite3_str_appendf(sql, "INSERT INTO %s VALUES (", escaped_table);
-  free(escaped_table);
+  /* Without a header row, the first row only gives the number of columns */
+  int has_header = !sr.eof && sr.row_num == 1;
+  p->ncols = sr.eof || sr.row.count == 0 ? 1 : sr.row.count;
 
-  for (int col = 0; col < ws->max_col; col++) {
+  sqlite3_str *sql = sqlite3_str_new(db);
+  sqlite3_str_appendall(sql, "CREATE TABLE x(");
+  for (int col = 0; col < p->ncols; col++) {
+    int len = 0;
+    const char *name = has_header ? row_cell_text(&sr.row, col, &len) : NULL;
     if (col > 0)
       sqlite3_str_appendall(sql, ", ");
-    sqlite3_str_appendall(sql, "?");
+    if (name && *name) {
+      char *escaped = escape_identifier(name);
+      sqlite3_str_appendall(sql, escaped);
+      free(escaped);
+    } else {
+      sqlite3_str_appendf(sql, "\"col%d\"", col + 1);
+    }
   }
   sqlite3_str_appendall(sql, ")");
+  sr_close(&sr);
 
-  char *insert_sql = sqlite3_str_finish(sql);
-  if (!insert_sql) {
+  char *create_sql = sqlite3_str_finish(sql);
+  if (!create_sql)
     return SQLITE_NOMEM;
-  }
+  rc = sqlite3_declare_vtab(db, create_sql);
+  sqlite3_free(create_sql);
+  if (rc != SQLITE_OK)
+    *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  return rc;
+}
 
-  sqlite3_stmt *stmt = NULL;
-  rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, NULL);
-  sqlite3_free(insert_sql);
+/* xConnect/xCreate - argv[3..] are the CREATE VIRTUAL TABLE arguments */
+static int xsheetConnect(sqlite3 *db, void *pAux, int argc,
+                         const char *const *argv, sqlite3_vtab **ppVtab,
+                         char **pzErr) {
+  (void)pAux;
+  int rc;
+
+  xsheet_vtab *pNew = sqlite3_malloc(sizeof(*pNew));
+  if (!pNew)
+    return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(*pNew));
+
+  if (argc <= 3) {
+    pNew->eponymous = 1;
+    rc = sqlite3_declare_vtab(db, "CREATE TABLE x(row_num INTEGER, cells TEXT, "
+                                  "path HIDDEN, sheet HIDDEN)");
+  } else if (argc > 5) {
+    *pzErr = sqlite3_mprintf("xlsx_sheet takes a filename and a sheet");
+    rc = SQLITE_ERROR;
+  } else {
+    int quoted;
+    pNew->filename = xsheet_dequote(argv[3], &quoted);
+    pNew->sheet_num = 1;
+    if (argc == 5) {
+      char *sheet = xsheet_dequote(argv[4], &quoted);
+      if (sheet && !quoted && sheet[0] && strspn(sheet, "0123456789") ==
+                                              strlen(sheet)) {
+        pNew->sheet_num = atoi(sheet);
+        sqlite3_free(sheet);
+      } else {
+        pNew->sheet_name = sheet;
+      }
+    }
+    rc = pNew->filename ? xsheet_declare_from_header(db, pNew, pzErr)
+                        : SQLITE_NOMEM;
+  }
 
   if (rc != SQLITE_OK) {
+    xsheetDisconnect(&pNew->base);
     return rc;
   }
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
 
-  /* Insert data rows (skip first row which is headers) */
-  for (int row_idx = 1; row_idx < ws->count; row_idx++) {
-    Row *row = &ws->rows[row_idx];
+static int xsheetOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  (void)pVtab;
 
-    /* Check if row has any data */
-    int has_data = 0;
-    for (int col = 0; col < row->count; col++) {
-      if (!row->cells[col].is_null) {
-        has_data = 1;
-        break;
-      }
-    }
-    if (!has_data && row->count == 0)
-      continue;
+  xsheet_cursor *pCur = sqlite3_malloc(sizeof(*pCur));
+  if (!pCur)
+    return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  pCur->sr.eof = 1;
 
-    sqlite3_reset(stmt);
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
 
-    for (int col = 0; col < ws->max_col; col++) {
-      if (col < row->count && !row->cells[col].is_null &&
-          row->cells[col].value) {
-        sqlite3_bind_text(stmt, col + 1, row->cells[col].value, -1,
-                          SQLITE_TRANSIENT);
-      } else {
-        sqlite3_bind_null(stmt, col + 1);
-      }
-    }
+static int xsheetClose(sqlite3_vtab_cursor *cur) {
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  sr_close(&pCur->sr);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-      sqlite3_finalize(stmt);
-      return rc;
-    }
+static int xsheetNext(sqlite3_vtab_cursor *cur) {
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  return sr_next(&pCur->sr, &cur->pVtab->zErrMsg);
+}
+
+static int xsheetColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
+                        int iCol) {
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  xsheet_vtab *pVtab = (xsheet_vtab *)cur->pVtab;
+
+  if (!pVtab->eponymous) {
+    sr_result_cell(ctx, &pCur->sr.row, iCol);
+  } else if (iCol == 0) {
+    sqlite3_result_int(ctx, pCur->sr.row_num);
+  } else if (iCol == 1) {
+    sr_result_json(ctx, &pCur->sr.row);
+  } else {
+    sqlite3_result_null(ctx);
   }
+  return SQLITE_OK;
+}
 
-  sqlite3_finalize(stmt);
+static int xsheetRowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid) {
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  *pRowid = pCur->sr.row_num;
   return SQLITE_OK;
 }
 
+static int xsheetEof(sqlite3_vtab_cursor *cur) {
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  return pCur->sr.eof;
+}
+
 /*
-** Helper function to check if a sheet should be imported based on the
-** optional sheetname1..sheetnameN parameters.
-** If no sheet parameters are provided (argc == 1), all sheets are imported.
-** If sheet parameters are provided:
-**   - Integer parameter: import sheet with that 1-based index
-**   - String parameter: import sheet with that name
-** Returns 1 if the sheet should be imported, 0 otherwise.
+** idxNum bits: 1 = path is argv[0], 2 = sheet follows it.
+** idxStr is the mask of the sheet columns that are used, in hex.
 */
-static int should_import_sheet(int argc, sqlite3_value **argv,
-                               int sheet_index,   /* 0-based index */
-                               const char *sheet_name) {
-  /* If no sheet parameters provided, import all sheets */
-  if (argc <= 1) {
-    return 1;
+static int xsheetFilter(sqlite3_vtab_cursor *cur, int idxNum,
+                        const char *idxStr, int argc, sqlite3_value **argv) {
+  (void)argc;
+
+  xsheet_cursor *pCur = (xsheet_cursor *)cur;
+  xsheet_vtab *pVtab = (xsheet_vtab *)cur->pVtab;
+  ZipSource src;
+  const char *sheet_name = pVtab->sheet_name;
+  int sheet_num = pVtab->sheet_num;
+
+  sr_close(&pCur->sr);
+
+  zip_source_file(&src, pVtab->filename);
+  if (pVtab->eponymous) {
+    if (!(idxNum & 1) || zip_source_init(&src, argv[0]) != SQLITE_OK) {
+      pVtab->base.zErrMsg =
+          sqlite3_mprintf("xlsx_sheet requires a filename argument");
+      pCur->sr.eof = 1;
+      return SQLITE_ERROR;
+    }
+    sheet_name = NULL;
+    sheet_num = 1;
+    if (idxNum & 2) {
+      if (sqlite3_value_type(argv[1]) == SQLITE_INTEGER)
+        sheet_num = sqlite3_value_int(argv[1]);
+      else
+        sheet_name = (const char *)sqlite3_value_text(argv[1]);
+    }
   }
 
-  /* Check each sheet parameter (argv[1] through argv[argc-1]) */
-  for (int i = 1; i < argc; i++) {
-    int value_type = sqlite3_value_type(argv[i]);
+  int rc = sr_open(&pCur->sr, &src, sheet_name, sheet_num,
+                   &pVtab->base.zErrMsg);
+  pCur->sr.skip_row1 = !pVtab->eponymous;
+  if (idxStr) {
+    pCur->sr.wsp.cols = (sqlite3_uint64)strtoull(idxStr, NULL, 16);
+  }
+  pCur->sr.wsp.col_limit = pVtab->ncols;
+  if (rc == SQLITE_OK)
+    rc = sr_next(&pCur->sr, &pVtab->base.zErrMsg);
+  if (rc != SQLITE_OK)
+    pCur->sr.eof = 1;
+  return rc;
+}
 
-    if (value_type == SQLITE_INTEGER) {
-      /* Integer parameter: compare with 1-based sheet number */
-      int sheet_num = sqlite3_value_int(argv[i]);
-      if (sheet_num == sheet_index + 1) {
-        return 1;
-      }
-    } else if (value_type == SQLITE_TEXT) {
-      /* String parameter: compare with sheet name */
-      const char *param_name = (const char *)sqlite3_value_text(argv[i]);
-      if (param_name && sheet_name && strcmp(param_name, sheet_name) == 0) {
-        return 1;
-      }
-    }
+static int xsheetBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo) {
+  xsheet_vtab *p = (xsheet_vtab *)pVtab;
+  int pathIdx = -1, sheetIdx = -1;
+
+  pIdxInfo->estimatedCost = 1000000.0;
+
+  /*
+  ** Pass the columns needed down to the parser, which then skips the text
+  ** of the other cells. The JSON column of the eponymous form needs all of
+  ** them; with only row_num used no cell is collected.
+  */
+  sqlite3_uint64 cols = pIdxInfo->colUsed;
+  if (p->eponymous)
+    cols = (cols & 2) ? ~(sqlite3_uint64)0 : 0;
+  if (cols != ~(sqlite3_uint64)0) {
+    pIdxInfo->idxStr = sqlite3_mprintf("%llx", (unsigned long long)cols);
+    if (!pIdxInfo->idxStr)
+      return SQLITE_NOMEM;
+    pIdxInfo->needToFreeIdxStr = 1;
   }
+  if (!p->eponymous)
+    return SQLITE_OK;
 
-  return 0;
+  for (int i = 0; i < pIdxInfo->nConstraint; i++) {
+    if (!pIdxInfo->aConstraint[i].usable ||
+        pIdxInfo->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_EQ)
+      continue;
+    if (pIdxInfo->aConstraint[i].iColumn == XSHEET_COL_PATH)
+      pathIdx = i;
+    else if (pIdxInfo->aConstraint[i].iColumn == XSHEET_COL_SHEET)
+      sheetIdx = i;
+  }
+
+  if (pathIdx < 0) {
+    /* Filename is required */
+    return SQLITE_CONSTRAINT;
+  }
+
+  pIdxInfo->aConstraintUsage[pathIdx].argvIndex = 1;
+  pIdxInfo->aConstraintUsage[pathIdx].omit = 1;
+  pIdxInfo->idxNum = 1;
+  if (sheetIdx >= 0) {
+    pIdxInfo->aConstraintUsage[sheetIdx].argvIndex = 2;
+    pIdxInfo->aConstraintUsage[sheetIdx].omit = 1;
+    pIdxInfo->idxNum |= 2;
+  }
+  return SQLITE_OK;
 }
 
+/* Virtual table module definition */
+static sqlite3_module xsheetModule = {
+    0,                /* iVersion */
+    xsheetConnect,    /* xCreate */
+    xsheetConnect,    /* xConnect */
+    xsheetBestIndex,  /* xBestIndex */
+    xsheetDisconnect, /* xDisconnect */
+    xsheetDisconnect, /* xDestroy */
+    xsheetOpen,       /* xOpen */
+    xsheetClose,      /* xClose */
+    xsheetFilter,     /* xFilter */
+    xsheetNext,       /* xNext */
+    xsheetEof,        /* xEof */
+    xsheetColumn,     /* xColumn */
+    xsheetRowid,      /* xRowid */
+    0,                /* xUpdate */
+    0,                /* xBegin */
+    0,                /* xSync */
+    0,                /* xCommit */
+    0,                /* xRollback */
+    0,                /* xFindFunction */
+    0,                /* xRename */
+    0,                /* xSavepoint */
+    0,                /* xRelease */
+    0,                /* xRollbackTo */
+    0,                /* xShadowName */
+    0                 /* xIntegrity */
+};
+
 /*
-** xlsx_import(filename, [sheetname1, sheetname2, ...]) - Import sheets from
-** an XLSX file as tables.
+** ============================================================================
+** Table-Valued Function: xlsx_import_sheetinfo
+** ============================================================================
 **
-** Parameters:
-**   filename    - Path to the XLSX file to import
-**   sheetname1..sheetnameN - Optional sheet selectors (string name or integer
-**                            number). If none provided, all sheets are
-**                            imported. Integer parameters specify 1-based
-**                            sheet numbers.
+** xlsx_import_sheetnames plus what an import of each sheet would find, read
+** without importing anything:
+**   rows        - Last row of the <dimension ref> range, 0 for a sheet with
+**                 no rows, NULL when the sheet has no dimension
+**   cols        - Last column of the <dimension ref> range, or else the
+**                 number of cells of the first row
+**   header_json - Row 1, the column names, as a JSON array of strings (null
+**                 for empty cells); NULL when the sheet has no row 1
+**
+** Each worksheet is parsed only up to its first </row>: the parser is then
+** stopped, so probing a sheet costs the same whatever its size. The shared
+** strings are read only up to the highest index used by a header cell.
+**
+** Usage:
+**   SELECT * FROM xlsx_import_sheetinfo('filename.xlsx');
 */
-static void xlsx_import_func(sqlite3_context *ctx, int argc,
-                             sqlite3_value **argv) {
-  if (argc < 1) {
-    sqlite3_result_error(ctx, "xlsx_import requires a filename argument", -1);
+
+typedef struct {
+  sqlite3_int64 rows; /* -1 when unknown */
+  int cols;           /* -1 when unknown */
+  Row header;         /* Row 1; shared strings are still indexes */
+  int has_header;     /* header holds row 1 */
+  char *header_json;  /* From sqlite3_str_finish() */
+} SheetProbe;
+
+typedef struct {
+  WorksheetParser wsp; /* Must be first: the ws_* handlers get this */
+  SheetProbe *probe;
+  int done;            /* The first row was seen */
+} ProbeParser;
+
+static void XMLCALL probe_start_element(void *userData, const XML_Char *name,
+                                        const XML_Char **atts) {
+  ProbeParser *pp = (ProbeParser *)userData;
+
+  if (strcmp(name, "dimension") != 0) {
+    ws_start_element(&pp->wsp, name, atts);
     return;
   }
+  for (int i = 0; atts[i]; i += 2) {
+    if (strcmp(atts[i], "ref") == 0) {
+      /* "A1:C100" or a single cell; the last cell bounds the sheet */
+      const char *last = strchr(atts[i + 1], ':');
+      int row = 0;
+      int col = xlsx_parse_ref(last ? last + 1 : atts[i + 1], &row);
+      if (col > 0 && row > 0) {
+        pp->probe->rows = row;
+        pp->probe->cols = col;
+      }
+    }
+  }
+}
 
-  const char *filename = (const char *)sqlite3_value_text(argv[0]);
-  if (!filename) {
-    sqlite3_result_error(ctx, "Invalid filename", -1);
-    return;
+/* RowCallback: keep row 1 and stop at the first row the sheet has */
+static int probe_emit_row(void *udata, int row_num, Row *row) {
+  ProbeParser *pp = (ProbeParser *)udata;
+
+  if (row_num == 1) {
+    int rc = row_copy(&pp->probe->header, row);
+    if (rc != SQLITE_OK)
+      return rc;
+    pp->probe->has_header = 1;
   }
+  if (pp->probe->cols < 0)
+    pp->probe->cols = row->count;
+  pp->done = 1;
+  return SQLITE_DONE;
+}
 
-  sqlite3 *db = sqlite3_context_db_handle(ctx);
-  int rc;
-  char *errmsg = NULL;
+/* Fill probe from the prolog and the first row of the worksheet at path */
+static int probe_sheet(ZipArchive *za, const char *path, SheetProbe *probe) {
+  probe->rows = -1;
+  probe->cols = -1;
+  if (!path)
+    return SQLITE_OK; /* Not a worksheet */
 
-  /* Read shared strings */
-  SharedStrings ss;
-  ss_init(&ss);
+  ProbeParser pp;
+  memset(&pp, 0, sizeof(pp));
+  pp.probe = probe;
+  wsp_init(&pp.wsp, NULL, probe_emit_row, &pp);
 
-  char *ss_data = NULL;
-  int ss_len = 0;
-  rc = read_zip_entry(db, filename, "xl/sharedStrings.xml", &ss_data, &ss_len);
-  if (rc != SQLITE_OK) {
-    sqlite3_result_error(
-        ctx, "Failed to read XLSX file (is zipfile extension loaded?)", -1);
-    return;
+  XML_Parser parser = XML_ParserCreate(NULL);
+  if (!parser)
+    return SQLITE_NOMEM;
+  pp.wsp.parser = parser;
+  XML_SetUserData(parser, &pp);
+  XML_SetElementHandler(parser, probe_start_element, ws_end_element);
+  XML_SetCharacterDataHandler(parser, ws_char_data);
+
+  int rc = zip_parse_xml(za, path, parser);
+  XML_ParserFree(parser);
+
+  if (pp.done) {
+    rc = SQLITE_OK;
+  } else if (rc == SQLITE_OK) {
+    /* The whole sheet was read without finding a row */
+    probe->rows = 0;
+    probe->cols = 0;
+  } else if (rc == SQLITE_NOTFOUND) {
+    rc = SQLITE_OK; /* No worksheet part; xlsx_import skips the sheet */
+  } else if (pp.wsp.rc != SQLITE_OK) {
+    rc = pp.wsp.rc;
   }
+  wsp_free(&pp.wsp);
+  return rc;
+}
 
-  if (ss_data && ss_len > 0) {
-    if (parse_shared_strings(ss_data, ss_len, &ss) != 0) {
-      free(ss_data);
-      sqlite3_result_error(ctx, "Failed to parse shared strings", -1);
-      return;
-    }
+/* Build probe->header_json, looking shared strings up in ss */
+static int probe_header_json(SheetProbe *probe, const SharedStrings *ss) {
+  const Row *row = &probe->header;
+  sqlite3_str *json = sqlite3_str_new(NULL);
+
+  sqlite3_str_appendchar(json, 1, '[');
+  for (int col = 0; col < row->count; col++) {
+    int len = 0;
+    const char *text = row_cell_text(row, col, &len);
+    if (text && row_cell_type(row, col) == 's')
+      text = ss_get(ss, xlsx_parse_uint(text), &len);
+
+    if (col > 0)
+      sqlite3_str_appendchar(json, 1, ',');
+    if (text)
+      json_append_string(json, text, len);
+    else
+      sqlite3_str_appendall(json, "null");
   }
-  free(ss_data);
+  sqlite3_str_appendchar(json, 1, ']');
 
-  /* Read workbook to get sheet names */
-  Workbook wb;
-  wb_init(&wb);
+  probe->header_json = sqlite3_str_finish(json);
+  return probe->header_json ? SQLITE_OK : SQLITE_NOMEM;
+}
 
-  char *wb_data = NULL;
-  int wb_len = 0;
-  rc = read_zip_entry(db, filename, "xl/workbook.xml", &wb_data, &wb_len);
-  if (rc != SQLITE_OK || !wb_data) {
-    ss_free(&ss);
-    sqlite3_result_error(ctx, "Failed to read workbook", -1);
-    return;
+/* The sheetnames cursor, with one probe per sheet */
+typedef struct sheetinfo_cursor {
+  sheetnames_cursor names; /* Base: sheet numbers, names and paths */
+  SheetProbe *probes;      /* One per sheet of names.wb */
+  int n_probes;
+} sheetinfo_cursor;
+
+static void sheetinfo_free_probes(sheetinfo_cursor *pCur) {
+  for (int i = 0; i < pCur->n_probes; i++) {
+    row_free(&pCur->probes[i].header);
+    sqlite3_free(pCur->probes[i].header_json);
   }
+  sqlite3_free(pCur->probes);
+  pCur->probes = NULL;
+  pCur->n_probes = 0;
+}
 
-  if (parse_workbook(wb_data, wb_len, &wb) != 0) {
-    free(wb_data);
-    ss_free(&ss);
-    sqlite3_result_error(ctx, "Failed to parse workbook", -1);
-    return;
+/* xConnect/xCreate - columns 0 to 3 are those of xlsx_import_sheetnames */
+static int sheetinfoConnect(sqlite3 *db, void *pAux, int argc,
+                            const char *const *argv, sqlite3_vtab **ppVtab,
+                            char **pzErr) {
+  (void)pAux;
+  (void)argc;
+  (void)argv;
+  (void)pzErr;
+
+  int rc = sqlite3_declare_vtab(
+      db, "CREATE TABLE x(sheet_num INTEGER, sheet_name TEXT, "
+          "filename HIDDEN, sheet_path TEXT HIDDEN, \"rows\" INTEGER, "
+          "cols INTEGER, header_json TEXT)");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  sheetnames_vtab *pNew = sqlite3_malloc(sizeof(*pNew));
+  if (!pNew) {
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->db = db;
+
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+static int sheetinfoOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  (void)pVtab;
+
+  sheetinfo_cursor *pCur = sqlite3_malloc(sizeof(*pCur));
+  if (!pCur) {
+    return SQLITE_NOMEM;
   }
-  free(wb_data);
+  memset(pCur, 0, sizeof(*pCur));
 
-  /* Process each sheet */
-  int tables_created = 0;
-  for (int i = 0; i < wb.count; i++) {
-    /* Check if this sheet should be imported based on optional parameters */
-    if (!should_import_sheet(argc, argv, i, wb.sheets[i].name)) {
-      continue;
-    }
+  *ppCursor = &pCur->names.base;
+  return SQLITE_OK;
+}
 
-    char sheet_path[64];
-    snprintf(sheet_path, sizeof(sheet_path), "xl/worksheets/sheet%d.xml",
-             i + 1);
+static int sheetinfoClose(sqlite3_vtab_cursor *cur) {
+  sheetinfo_free_probes((sheetinfo_cursor *)cur);
+  return sheetnamesClose(cur);
+}
 
-    char *sheet_data = NULL;
-    int sheet_len = 0;
-    rc = read_zip_entry(db, filename, sheet_path, &sheet_data, &sheet_len);
+static int sheetinfoColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
+                           int iCol) {
+  sheetinfo_cursor *pCur = (sheetinfo_cursor *)cur;
+  int i = pCur->names.current;
 
-    if (rc != SQLITE_OK || !sheet_data || sheet_len == 0) {
-      free(sheet_data);
-      continue;
-    }
+  if (iCol < 4 || i >= pCur->n_probes) {
+    return sheetnamesColumn(cur, ctx, iCol);
+  }
 
-    Worksheet ws;
-    if (parse_worksheet(sheet_data, sheet_len, &ss, &ws) != 0) {
-      free(sheet_data);
-      continue;
+  const SheetProbe *probe = &pCur->probes[i];
+  switch (iCol) {
+  case 4: /* rows */
+    if (probe->rows >= 0)
+      sqlite3_result_int64(ctx, probe->rows);
+    break;
+  case 5: /* cols */
+    if (probe->cols >= 0)
+      sqlite3_result_int(ctx, probe->cols);
+    break;
+  case 6: /* header_json */
+    if (probe->header_json) {
+      sqlite3_result_text(ctx, probe->header_json, -1, SQLITE_TRANSIENT);
+      sqlite3_result_subtype(ctx, 'J');
     }
-    free(sheet_data);
+    break;
+  }
+  return SQLITE_OK;
+}
 
-    rc = create_table_from_worksheet(db, wb.sheets[i].name, &ws, &errmsg);
-    ws_free(&ws);
+/* xFilter - read the sheet names, then probe every sheet */
+static int sheetinfoFilter(sqlite3_vtab_cursor *cur, int idxNum,
+                           const char *idxStr, int argc,
+                           sqlite3_value **argv) {
+  sheetinfo_cursor *pCur = (sheetinfo_cursor *)cur;
+  sheetnames_vtab *pVtab = (sheetnames_vtab *)cur->pVtab;
 
-    if (rc != SQLITE_OK) {
-      wb_free(&wb);
-      ss_free(&ss);
-      if (errmsg) {
-        sqlite3_result_error(ctx, errmsg, -1);
-        sqlite3_free(errmsg);
-      } else {
-        sqlite3_result_error(ctx, "Failed to create table", -1);
-      }
-      return;
-    }
+  sheetinfo_free_probes(pCur);
+  int rc = sheetnamesFilter(cur, idxNum, idxStr, argc, argv);
+  if (rc != SQLITE_OK || pCur->names.wb.count == 0) {
+    return rc;
+  }
 
-    tables_created++;
+  ZipSource src;
+  zip_source_init(&src, argv[0]);
+  const Workbook *wb = &pCur->names.wb;
+  ZipArchive za;
+  if (zip_open(&za, &src) != SQLITE_OK) {
+    pVtab->base.zErrMsg =
+        sqlite3_mprintf("Failed to read XLSX file '%s'", src.label);
+    return SQLITE_ERROR;
   }
 
-  wb_free(&wb);
+  pCur->probes = sqlite3_malloc64(wb->count * sizeof(SheetProbe));
+  if (!pCur->probes) {
+    zip_close(&za);
+    return SQLITE_NOMEM;
+  }
+  memset(pCur->probes, 0, wb->count * sizeof(SheetProbe));
+  pCur->n_probes = wb->count;
+
+  /* Probe the sheets, noting how many shared strings their headers need */
+  int n_strings = 0;
+  int i;
+  for (i = 0; i < wb->count; i++) {
+    SheetProbe *probe = &pCur->probes[i];
+    rc = probe_sheet(&za, wb->sheets[i].path, probe);
+    if (rc != SQLITE_OK)
+      break;
+    for (int col = 0; col < probe->header.count; col++) {
+      int len = 0;
+      const char *text = row_cell_text(&probe->header, col, &len);
+      int idx = text && row_cell_type(&probe->header, col) == 's'
+                    ? xlsx_parse_uint(text)
+                    : -1;
+      if (idx >= n_strings && idx < XLSX_MAX_NUMBER)
+        n_strings = idx + 1;
+    }
+  }
+
+  SharedStrings ss;
+  ss_init(&ss);
+  if (rc == SQLITE_OK && n_strings > 0) {
+    rc = parse_shared_strings(&za, &ss, n_strings);
+  }
+  for (int k = 0; rc == SQLITE_OK && k < wb->count; k++) {
+    if (pCur->probes[k].has_header)
+      rc = probe_header_json(&pCur->probes[k], &ss);
+  }
   ss_free(&ss);
+  zip_close(&za);
 
-  sqlite3_result_int(ctx, tables_created);
+  if (rc == SQLITE_NOMEM) {
+    return SQLITE_NOMEM;
+  }
+  if (rc == SQLITE_CORRUPT && i < wb->count) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Corrupt worksheet '%s' in archive",
+                                          wb->sheets[i].name);
+    return SQLITE_ERROR;
+  }
+  if (rc != SQLITE_OK && i < wb->count) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to parse worksheet '%s'",
+                                          wb->sheets[i].name);
+    return SQLITE_ERROR;
+  }
+  if (rc != SQLITE_OK) {
+    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to parse shared strings");
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
 }
 
-/*
-** xlsx_import_version() - Return the version string.
-*/
-static void xlsx_import_version_func(sqlite3_context *ctx, int argc,
-                                     sqlite3_value **argv) {
-  (void)argc;
-  (void)argv;
-  sqlite3_result_text(ctx, "2025-12-30 Claude Opus 4.5 (Thinking)", -1,
-                      SQLITE_STATIC);
-}
+/* Virtual table module definition */
+static sqlite3_module sheetinfoModule = {
+    0,                    /* iVersion */
+    sheetinfoConnect,     /* xCreate */
+    sheetinfoConnect,     /* xConnect */
+    sheetnames_BestIndex, /* xBestIndex */
+    sheetnamesDisconnect, /* xDisconnect */
+    sheetnamesDisconnect, /* xDestroy */
+    sheetinfoOpen,        /* xOpen */
+    sheetinfoClose,       /* xClose */
+    sheetinfoFilter,      /* xFilter */
+    sheetnamesNext,       /* xNext */
+    sheetnamesEof,        /* xEof */
+    sheetinfoColumn,      /* xColumn */
+    sheetnamesRowid,      /* xRowid */
+    0,                    /* xUpdate */
+    0,                    /* xBegin */
+    0,                    /* xSync */
+    0,                    /* xCommit */
+    0,                    /* xRollback */
+    0,                    /* xFindFunction */
+    0,                    /* xRename */
+    0,                    /* xSavepoint */
+    0,                    /* xRelease */
+    0,                    /* xRollbackTo */
+    0,                    /* xShadowName */
+    0                     /* xIntegrity */
+};
 
 /*
 ** ============================================================================
-** Table-Valued Function: xlsx_import_sheetnames
+** Table-Valued Function: xlsx_import_stats
 ** ============================================================================
 **
-** Returns the sheet names from an XLSX file as a table with columns:
-**   sheet_num  - 1-based sheet number
-**   sheet_name - Name of the sheet
+** Returns the statistics of the last xlsx_import() call on this connection,
+** one row per counter, with columns:
+**   name  - Counter name, e.g. "rows" or "inflate_ns"
+**   value - Its value; all zero before the first import
 **
 ** Usage:
-**   SELECT * FROM xlsx_import_sheetnames('filename.xlsx');
+**   SELECT * FROM xlsx_import_stats;
+**   SELECT json_group_object(name, value) FROM xlsx_import_stats;
 */
 
-/* Virtual table cursor structure */
-typedef struct sheetnames_cursor {
-  sqlite3_vtab_cursor base; /* Base class - must be first */
-  Workbook wb;              /* Parsed workbook with sheet info */
-  int current;              /* Current row index (0-based) */
-  int eof;                  /* True if past last row */
-} sheetnames_cursor;
+static const struct {
+  const char *name;
+  size_t offset;
+} import_stat_fields[] = {
+    {"result", offsetof(ImportStats, result)},
+    {"total_ns", offsetof(ImportStats, total_ns)},
+    {"open_ns", offsetof(ImportStats, open_ns)},
+    {"shared_strings_ns", offsetof(ImportStats, shared_strings_ns)},
+    {"workbook_ns", offsetof(ImportStats, workbook_ns)},
+    {"sheets_ns", offsetof(ImportStats, sheets_ns)},
+    {"inflate_ns", offsetof(ImportStats, inflate_ns)},
+    {"parse_ns", offsetof(ImportStats, parse_ns)},
+    {"insert_ns", offsetof(ImportStats, insert_ns)},
+    {"commit_ns", offsetof(ImportStats, commit_ns)},
+    {"bytes_compressed", offsetof(ImportStats, bytes_compressed)},
+    {"bytes_inflated", offsetof(ImportStats, bytes_inflated)},
+    {"shared_strings", offsetof(ImportStats, shared_strings)},
+    {"sheets", offsetof(ImportStats, sheets)},
+    {"sheets_unchanged", offsetof(ImportStats, sheets_unchanged)},
+    {"rows", offsetof(ImportStats, rows)},
+    {"cells", offsetof(ImportStats, cells)},
+    {"threads", offsetof(ImportStats, threads)},
+};
 
-/* Virtual table structure */
-typedef struct sheetnames_vtab {
-  sqlite3_vtab base; /* Base class - must be first */
-  sqlite3 *db;       /* Database connection */
-} sheetnames_vtab;
+#define N_IMPORT_STATS                                                         \
+  ((int)(sizeof(import_stat_fields) / sizeof(import_stat_fields[0])))
 
-/* xConnect/xCreate - Create a new virtual table instance */
-static int sheetnamesConnect(sqlite3 *db, void *pAux, int argc,
-                             const char *const *argv, sqlite3_vtab **ppVtab,
-                             char **pzErr) {
-  (void)pAux;
+typedef struct stats_vtab {
+  sqlite3_vtab base;         /* Base class - must be first */
+  const ImportConfig *cfg;   /* Connection settings holding the statistics */
+} stats_vtab;
+
+typedef struct stats_cursor {
+  sqlite3_vtab_cursor base; /* Base class - must be first */
+  ImportStats stats;        /* Copy taken by xFilter */
+  int current;              /* Index into import_stat_fields */
+} stats_cursor;
+
+static int statsConnect(sqlite3 *db, void *pAux, int argc,
+                        const char *const *argv, sqlite3_vtab **ppVtab,
+                        char **pzErr) {
   (void)argc;
   (void)argv;
   (void)pzErr;
 
-  int rc = sqlite3_declare_vtab(
-      db, "CREATE TABLE x(sheet_num INTEGER, sheet_name TEXT, "
-          "filename HIDDEN)");
+  int rc =
+      sqlite3_declare_vtab(db, "CREATE TABLE x(name TEXT, value INTEGER)");
   if (rc != SQLITE_OK) {
     return rc;
   }
 
-  sheetnames_vtab *pNew = sqlite3_malloc(sizeof(*pNew));
+  stats_vtab *pNew = sqlite3_malloc(sizeof(*pNew));
   if (!pNew) {
     return SQLITE_NOMEM;
   }
   memset(pNew, 0, sizeof(*pNew));
-  pNew->db = db;
+  pNew->cfg = (const ImportConfig *)pAux;
 
   *ppVtab = &pNew->base;
   return SQLITE_OK;
 }
 
-/* xDisconnect/xDestroy - Destroy virtual table instance */
-static int sheetnamesDisconnect(sqlite3_vtab *pVtab) {
-  sqlite3_free(pVtab);
-  return SQLITE_OK;
-}
-
-/* xOpen - Create a new cursor */
-static int sheetnamesOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+static int statsOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
   (void)pVtab;
 
-  sheetnames_cursor *pCur = sqlite3_malloc(sizeof(*pCur));
+  stats_cursor *pCur = sqlite3_malloc(sizeof(*pCur));
   if (!pCur) {
     return SQLITE_NOMEM;
   }
@@ -993,158 +5860,79 @@ static int sheetnamesOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
   return SQLITE_OK;
 }
 
-/* xClose - Close and free a cursor */
-static int sheetnamesClose(sqlite3_vtab_cursor *cur) {
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-  wb_free(&pCur->wb);
-  sqlite3_free(pCur);
+static int statsClose(sqlite3_vtab_cursor *cur) {
+  sqlite3_free(cur);
   return SQLITE_OK;
 }
 
-/* xNext - Advance cursor to next row */
-static int sheetnamesNext(sqlite3_vtab_cursor *cur) {
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-  pCur->current++;
-  if (pCur->current >= pCur->wb.count) {
-    pCur->eof = 1;
-  }
+static int statsNext(sqlite3_vtab_cursor *cur) {
+  ((stats_cursor *)cur)->current++;
   return SQLITE_OK;
 }
 
-/* xColumn - Return value for column iCol of current row */
-static int sheetnamesColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
-                            int iCol) {
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-
-  if (pCur->current >= pCur->wb.count) {
-    sqlite3_result_null(ctx);
-    return SQLITE_OK;
-  }
+static int statsEof(sqlite3_vtab_cursor *cur) {
+  return ((stats_cursor *)cur)->current >= N_IMPORT_STATS;
+}
 
-  switch (iCol) {
-  case 0: /* sheet_num (1-based) */
-    sqlite3_result_int(ctx, pCur->current + 1);
-    break;
-  case 1: /* sheet_name */
-    sqlite3_result_text(ctx, pCur->wb.sheets[pCur->current].name, -1,
-                        SQLITE_TRANSIENT);
-    break;
-  default:
-    sqlite3_result_null(ctx);
-    break;
+static int statsColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
+                       int iCol) {
+  stats_cursor *pCur = (stats_cursor *)cur;
+
+  if (iCol == 0) {
+    sqlite3_result_text(ctx, import_stat_fields[pCur->current].name, -1,
+                        SQLITE_STATIC);
+  } else {
+    const char *base = (const char *)&pCur->stats;
+    sqlite3_int64 value;
+    memcpy(&value, base + import_stat_fields[pCur->current].offset,
+           sizeof(value));
+    sqlite3_result_int64(ctx, value);
   }
   return SQLITE_OK;
 }
 
-/* xRowid - Return rowid for current row */
-static int sheetnamesRowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid) {
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-  *pRowid = pCur->current + 1;
+static int statsRowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid) {
+  *pRowid = ((stats_cursor *)cur)->current + 1;
   return SQLITE_OK;
 }
 
-/* xEof - Return true if cursor is past last row */
-static int sheetnamesEof(sqlite3_vtab_cursor *cur) {
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-  return pCur->eof;
-}
-
-/* xFilter - Begin a search; parse the XLSX file */
-static int sheetnamesFilter(sqlite3_vtab_cursor *cur, int idxNum,
-                            const char *idxStr, int argc,
-                            sqlite3_value **argv) {
+/* xFilter - Take a copy, so a concurrent import cannot mix two calls */
+static int statsFilter(sqlite3_vtab_cursor *cur, int idxNum,
+                       const char *idxStr, int argc, sqlite3_value **argv) {
   (void)idxNum;
   (void)idxStr;
+  (void)argc;
+  (void)argv;
 
-  sheetnames_cursor *pCur = (sheetnames_cursor *)cur;
-  sheetnames_vtab *pVtab = (sheetnames_vtab *)cur->pVtab;
-
-  /* Free any previous workbook data */
-  wb_free(&pCur->wb);
+  stats_cursor *pCur = (stats_cursor *)cur;
+  stats_vtab *pVtab = (stats_vtab *)cur->pVtab;
+  pCur->stats = pVtab->cfg->last;
   pCur->current = 0;
-  pCur->eof = 0;
-
-  if (argc < 1) {
-    pVtab->base.zErrMsg =
-        sqlite3_mprintf("xlsx_import_sheetnames requires a filename argument");
-    return SQLITE_ERROR;
-  }
-
-  const char *filename = (const char *)sqlite3_value_text(argv[0]);
-  if (!filename) {
-    pVtab->base.zErrMsg = sqlite3_mprintf("Invalid filename");
-    return SQLITE_ERROR;
-  }
-
-  /* Read workbook.xml to get sheet names */
-  char *wb_data = NULL;
-  int wb_len = 0;
-  int rc =
-      read_zip_entry(pVtab->db, filename, "xl/workbook.xml", &wb_data, &wb_len);
-  if (rc != SQLITE_OK || !wb_data) {
-    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to read workbook from %s", filename);
-    return SQLITE_ERROR;
-  }
-
-  if (parse_workbook(wb_data, wb_len, &pCur->wb) != 0) {
-    free(wb_data);
-    pVtab->base.zErrMsg = sqlite3_mprintf("Failed to parse workbook");
-    return SQLITE_ERROR;
-  }
-  free(wb_data);
-
-  /* Check if we have any sheets */
-  if (pCur->wb.count == 0) {
-    pCur->eof = 1;
-  }
-
   return SQLITE_OK;
 }
 
-/* xBestIndex - Determine query plan; require filename parameter */
-static int sheetnames_BestIndex(sqlite3_vtab *pVtab,
-                                sqlite3_index_info *pIdxInfo) {
+static int statsBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo) {
   (void)pVtab;
-
-  /* Look for equality constraint on filename (column 2, the hidden column) */
-  int filenameIdx = -1;
-  for (int i = 0; i < pIdxInfo->nConstraint; i++) {
-    if (pIdxInfo->aConstraint[i].usable &&
-        pIdxInfo->aConstraint[i].iColumn == 2 &&
-        pIdxInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ) {
-      filenameIdx = i;
-      break;
-    }
-  }
-
-  if (filenameIdx < 0) {
-    /* Filename is required */
-    return SQLITE_CONSTRAINT;
-  }
-
-  pIdxInfo->aConstraintUsage[filenameIdx].argvIndex = 1;
-  pIdxInfo->aConstraintUsage[filenameIdx].omit = 1;
-  pIdxInfo->estimatedCost = 1000.0;
-  pIdxInfo->estimatedRows = 10;
-
+  pIdxInfo->estimatedCost = 1.0;
+  pIdxInfo->estimatedRows = N_IMPORT_STATS;
   return SQLITE_OK;
 }
 
-/* Virtual table module definition */
-static sqlite3_module sheetnamesModule = {
+/* Eponymous only: there is nothing to CREATE VIRTUAL TABLE from */
+static sqlite3_module statsModule = {
     0,                    /* iVersion */
-    sheetnamesConnect,    /* xCreate */
-    sheetnamesConnect,    /* xConnect */
-    sheetnames_BestIndex, /* xBestIndex */
+    0,                    /* xCreate */
+    statsConnect,         /* xConnect */
+    statsBestIndex,       /* xBestIndex */
     sheetnamesDisconnect, /* xDisconnect */
-    sheetnamesDisconnect, /* xDestroy */
-    sheetnamesOpen,       /* xOpen */
-    sheetnamesClose,      /* xClose */
-    sheetnamesFilter,     /* xFilter */
-    sheetnamesNext,       /* xNext */
-    sheetnamesEof,        /* xEof */
-    sheetnamesColumn,     /* xColumn */
-    sheetnamesRowid,      /* xRowid */
+    0,                    /* xDestroy */
+    statsOpen,            /* xOpen */
+    statsClose,           /* xClose */
+    statsFilter,          /* xFilter */
+    statsNext,            /* xNext */
+    statsEof,             /* xEof */
+    statsColumn,          /* xColumn */
+    statsRowid,           /* xRowid */
     0,                    /* xUpdate */
     0,                    /* xBegin */
     0,                    /* xSync */
@@ -1173,11 +5961,29 @@ int sqlite3_xlsximport_init(sqlite3 *db, char **pzErrMsg,
   SQLITE_EXTENSION_INIT2(pApi);
   (void)pzErrMsg;
 
+  ImportConfig *cfg = sqlite3_malloc(sizeof(ImportConfig));
+  if (!cfg)
+    return SQLITE_NOMEM;
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->threads = 1;
+  cfg->progress_rows = DEFAULT_PROGRESS_ROWS;
+  cfg->memory_budget = DEFAULT_MEMORY_BUDGET;
+
   /* Register xlsx_import with -1 for nArg to accept variable number of
-   * arguments (filename plus optional sheet selectors) */
-  int rc = sqlite3_create_function(db, "xlsx_import", -1,
-                                   SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
-                                   xlsx_import_func, NULL, NULL);
+   * arguments (filename plus optional sheet selectors). The configuration
+   * is owned by this registration and freed with it. */
+  int rc = sqlite3_create_function_v2(db, "xlsx_import", -1,
+                                      SQLITE_UTF8 | SQLITE_DETERMINISTIC, cfg,
+                                      xlsx_import_func, NULL, NULL,
+                                      import_config_free);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  rc = sqlite3_create_function(db, "xlsx_import_config", 1, SQLITE_UTF8, cfg,
+                               xlsx_import_config_func, NULL, NULL);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_create_function(db, "xlsx_import_config", 2, SQLITE_UTF8, cfg,
+                                 xlsx_import_config_func, NULL, NULL);
   if (rc != SQLITE_OK)
     return rc;
 
@@ -1190,6 +5996,21 @@ int sqlite3_xlsximport_init(sqlite3 *db, char **pzErrMsg,
   /* Register xlsx_import_sheetnames as an eponymous table-valued function */
   rc = sqlite3_create_module(db, "xlsx_import_sheetnames", &sheetnamesModule,
                              NULL);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  rc = sqlite3_create_module(db, "xlsx_import_sheetinfo", &sheetinfoModule,
+                             NULL);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  /* The statistics live in cfg, which outlives every vtab of the module */
+  rc = sqlite3_create_module(db, "xlsx_import_stats", &statsModule, cfg);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  /* xlsx_sheet is both eponymous and usable with CREATE VIRTUAL TABLE */
+  rc = sqlite3_create_module(db, "xlsx_sheet", &xsheetModule, NULL);
 
   return rc;
 }
@@ -37,6 +37,8 @@ USAGE IN SQLITE:
     SELECT xlsx_export('output.xlsx', 'table1', 'table2', 'table3');
     -- or with a single table:
     SELECT xlsx_export('output.xlsx', 'mytable');
+    -- or with the rows of queries, one sheet per name and query pair:
+    SELECT xlsx_export_query('output.xlsx', 'Paid', 'SELECT * FROM orders WHERE paid');
 */
 
 #include <stdio.h>
@@ -47,14 +49,57 @@ USAGE IN SQLITE:
 
 SQLITE_EXTENSION_INIT1
 
+/*
+** Directory for the temporary files of libxlsxwriter: $TMPDIR, or on
+** Windows %TEMP% or %TMP%. NULL when none is set, or set to an empty
+** string, which libxlsxwriter would take as the root directory; it then
+** falls back to tmpfile(). The Windows tmpfile() writes to the root of
+** the current drive, hence the extra variables there.
+*/
+static char *temp_dir(void) {
+    static const char *const vars[] = {
+        "TMPDIR",
+#ifdef _WIN32
+        "TEMP", "TMP",
+#endif
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        char *dir = getenv(vars[i]);
+        if (dir && dir[0]) return dir;
+    }
+    return NULL;
+}
+
+/*
+** Create a workbook in constant_memory mode: each row is written to a
+** temporary file in temp_dir() as soon as the next row starts, instead of
+** every cell being kept in memory until workbook_close(). Rows must
+** therefore be written in order, which export_table_to_sheet() does.
+** Strings are written inline rather than to a shared string table.
+*/
+static lxw_workbook *new_workbook(const char *filename) {
+    lxw_workbook_options options = {
+        .constant_memory = LXW_TRUE,
+        .tmpdir = temp_dir()
+    };
+    return workbook_new_opt(filename, &options);
+}
+
 /*
 ** Helper function to export a single table to a worksheet.
+** When query is not NULL its rows are exported instead, and table_name
+** is only the sheet name. header_format is the bold format of the
+** workbook, created once by the caller.
 ** Returns 0 on success, non-zero on error.
 */
 static int export_table_to_sheet(
     sqlite3 *db,
     lxw_workbook *workbook,
+    lxw_format *header_format,
     const char *table_name,
+    const char *query,
     char **err_msg
 ) {
     lxw_worksheet *worksheet;
@@ -64,36 +109,51 @@ static int export_table_to_sheet(
     int col_count;
     lxw_row_t row_num;
     lxw_col_t col_num;
-    lxw_format *header_format;
+    const char *what = query ? "sheet" : "table";
+    const char *tail = NULL;
     
     /* Create a worksheet with the table name */
     worksheet = workbook_add_worksheet(workbook, table_name);
     if (!worksheet) {
-        *err_msg = sqlite3_mprintf("Failed to create worksheet for table '%s'", table_name);
+        *err_msg = sqlite3_mprintf("Failed to create worksheet for %s '%s'", what, table_name);
         return 1;
     }
     
-    /* Create a bold format for headers */
-    header_format = workbook_add_format(workbook);
-    format_set_bold(header_format);
-    
     /* Build the SELECT query */
-    sql = sqlite3_mprintf("SELECT * FROM \"%w\"", table_name);
+    sql = query ? sqlite3_mprintf("%s", query)
+                : sqlite3_mprintf("SELECT * FROM \"%w\"", table_name);
     if (!sql) {
         *err_msg = sqlite3_mprintf("Out of memory");
         return 1;
     }
     
     /* Prepare the statement */
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    sqlite3_free(sql);
+    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
     
     if (rc != SQLITE_OK) {
-        *err_msg = sqlite3_mprintf("Failed to prepare query for table '%s': %s",
-                                    table_name, sqlite3_errmsg(db));
+        sqlite3_free(sql);
+        *err_msg = sqlite3_mprintf("Failed to prepare query for %s '%s': %s",
+                                    what, table_name, sqlite3_errmsg(db));
         return 1;
     }
     
+    /* A query must be a single statement that only reads */
+    if (query) {
+        while (tail && (*tail == ' ' || *tail == '\t' || *tail == '\n' ||
+                        *tail == '\r' || *tail == ';')) {
+            tail++;
+        }
+        if (!stmt || (tail && *tail) || !sqlite3_stmt_readonly(stmt)) {
+            sqlite3_finalize(stmt);
+            sqlite3_free(sql);
+            *err_msg = sqlite3_mprintf(
+                "Query for sheet '%s' must be a single read-only statement",
+                table_name);
+            return 1;
+        }
+    }
+    sqlite3_free(sql);
+    
     /* Get column count */
     col_count = sqlite3_column_count(stmt);
     
@@ -160,8 +220,8 @@ static int export_table_to_sheet(
     sqlite3_finalize(stmt);
     
     if (rc != SQLITE_DONE) {
-        *err_msg = sqlite3_mprintf("Error reading table '%s': %s",
-                                    table_name, sqlite3_errmsg(db));
+        *err_msg = sqlite3_mprintf("Error reading %s '%s': %s",
+                                    what, table_name, sqlite3_errmsg(db));
         return 1;
     }
     
@@ -192,7 +252,7 @@ static void xlsx_export_func(
 ) {
     sqlite3 *db;
     lxw_workbook *workbook;
-    lxw_workbook_options options = {.constant_memory = LXW_FALSE};
+    lxw_format *header_format;
     const char *filename;
     char *err_msg = NULL;
     int i;
@@ -216,12 +276,16 @@ static void xlsx_export_func(
     db = sqlite3_context_db_handle(context);
     
     /* Create the workbook */
-    workbook = workbook_new_opt(filename, &options);
+    workbook = new_workbook(filename);
     if (!workbook) {
         sqlite3_result_error(context, "Failed to create workbook", -1);
         return;
     }
     
+    /* One bold format for the headers of every sheet */
+    header_format = workbook_add_format(workbook);
+    format_set_bold(header_format);
+    
     if (argc == 1) {
         /* No table names provided - export all tables from schema */
         sqlite3_stmt *stmt = NULL;
@@ -242,7 +306,8 @@ static void xlsx_export_func(
         while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
             const char *table_name = (const char *)sqlite3_column_text(stmt, 0);
             
-            if (export_table_to_sheet(db, workbook, table_name, &err_msg) != 0) {
+            if (export_table_to_sheet(db, workbook, header_format,
+                                      table_name, NULL, &err_msg) != 0) {
                 sqlite3_result_error(context, err_msg, -1);
                 sqlite3_free(err_msg);
                 sqlite3_finalize(stmt);
@@ -271,7 +336,8 @@ static void xlsx_export_func(
             
             table_name = (const char *)sqlite3_value_text(argv[i]);
             
-            if (export_table_to_sheet(db, workbook, table_name, &err_msg) != 0) {
+            if (export_table_to_sheet(db, workbook, header_format,
+                                      table_name, NULL, &err_msg) != 0) {
                 sqlite3_result_error(context, err_msg, -1);
                 sqlite3_free(err_msg);
                 workbook_close(workbook);
@@ -293,6 +359,85 @@ static void xlsx_export_func(
     sqlite3_result_text(context, filename, -1, SQLITE_TRANSIENT);
 }
 
+/*
+** SQL function: xlsx_export_query(filename, sheet1, sql1 [, sheet2, sql2, ...])
+**
+** Exports the rows of SELECT statements to an XLSX file, one worksheet per
+** pair of arguments, without copying them to a table first. Each statement
+** must be a single read-only statement; its result column names form the
+** bold header row.
+**
+** Returns the filename on success, or raises an error on failure.
+*/
+static void xlsx_export_query_func(
+    sqlite3_context *context,
+    int argc,
+    sqlite3_value **argv
+) {
+    sqlite3 *db;
+    lxw_workbook *workbook;
+    lxw_format *header_format;
+    const char *filename;
+    char *err_msg = NULL;
+    int i;
+    lxw_error error;
+    
+    /* Need the filename and at least one sheet name, query pair */
+    if (argc < 3 || argc % 2 == 0) {
+        sqlite3_result_error(context,
+            "xlsx_export_query requires a filename and sheet name, query pairs", -1);
+        return;
+    }
+    
+    for (i = 0; i < argc; i++) {
+        if (sqlite3_value_type(argv[i]) != SQLITE_TEXT) {
+            sqlite3_result_error(context,
+                "The filename, sheet names and queries must be strings", -1);
+            return;
+        }
+    }
+    filename = (const char *)sqlite3_value_text(argv[0]);
+    
+    /* Get database connection */
+    db = sqlite3_context_db_handle(context);
+    
+    /* Create the workbook */
+    workbook = new_workbook(filename);
+    if (!workbook) {
+        sqlite3_result_error(context, "Failed to create workbook", -1);
+        return;
+    }
+    
+    /* One bold format for the headers of every sheet */
+    header_format = workbook_add_format(workbook);
+    format_set_bold(header_format);
+    
+    for (i = 1; i < argc; i += 2) {
+        const char *sheet_name = (const char *)sqlite3_value_text(argv[i]);
+        const char *query = (const char *)sqlite3_value_text(argv[i + 1]);
+        
+        if (export_table_to_sheet(db, workbook, header_format, sheet_name, query,
+                                  &err_msg) != 0) {
+            sqlite3_result_error(context, err_msg, -1);
+            sqlite3_free(err_msg);
+            workbook_close(workbook);
+            return;
+        }
+    }
+    
+    /* Close the workbook and write the file */
+    error = workbook_close(workbook);
+    if (error != LXW_NO_ERROR) {
+        char *msg = sqlite3_mprintf("Error closing workbook: %s", lxw_strerror(error));
+        sqlite3_result_error(context, msg, -1);
+        sqlite3_free(msg);
+        return;
+    }
+    
+    /* Return the filename on success */
+    sqlite3_result_text(context, filename, -1, SQLITE_TRANSIENT);
+}
+
 /*
 ** SQL function: xlsx_export_version()
 **
@@ -336,6 +481,19 @@ int sqlite3_xlsxexport_init(
         NULL                /* Final (for aggregate functions) */
     );
 
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(
+            db,
+            "xlsx_export_query",
+            -1,
+            SQLITE_UTF8,
+            NULL,
+            xlsx_export_query_func,
+            NULL,
+            NULL
+        );
+    }
+
     if (rc == SQLITE_OK) {
         rc = sqlite3_create_function(
             db,
@@ -0,0 +1,141 @@
+#!/bin/bash
+
+# Import/export benchmark for every backend, run from the test folder (or with `make bench`).
+# Synthetic tables of several shapes are generated with the SQLite shell, exported with each
+# xlsxexport, and the opus export of every shape is imported again with each xlsximport.
+# Every run prints one JSON object per line, also appended to bench_results.jsonl, with
+# rows/s, MB/s (of XLSX file) and peak RSS so results can be compared across commits.
+#
+# Usage: ./bench_linux.sh [backend ...]     e.g. ./bench_linux.sh opus gemini
+#   BENCH_SCALE=N  multiply the row counts (default 1)
+#   SQLITE3=path   SQLite shell to use (default ./sqlite3, downloaded as in test_linux.sh)
+# Peak RSS comes from GNU time when installed, else from polling VmHWM in /proc.
+
+BACKENDS=${*:-"opus gemini copilot opus_libxlsxwriter copilot_libxlsxwriter"}
+SCALE=${BENCH_SCALE:-1}
+RESULTS=bench_results.jsonl
+
+if [ -z "$SQLITE3" ]; then
+  if [ ! -x ./sqlite3 ]; then
+    curl -C - --remote-name  https://sqlite.org/2025/sqlite-tools-linux-x64-3510100.zip
+    unzip -u sqlite-tools-linux-x64-3510100.zip sqlite3
+  fi
+  SQLITE3=./sqlite3
+fi
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+STAMP=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+SQLITE_VERSION=$($SQLITE3 --version | cut -d' ' -f1)
+
+# Shapes: name, number of tables, rows per table, columns per table, SELECT producing the rows
+# from generate_series (value is the row number). Columns are c1..cN.
+select_columns() {  # select_columns N EXPR: N columns, each EXPR with {} replaced by the column number
+  local n=$1 expr=$2 cols="" i
+  for ((i = 1; i <= n; i++)); do
+    cols+="${cols:+, }${expr//\{\}/$i} AS c$i"
+  done
+  echo "$cols"
+}
+
+SHAPES=(
+  "narrow_numeric 1 $((500000 * SCALE)) 3 value, value * 0.25, value % 1000"
+  "wide_text 1 $((10000 * SCALE)) 100 $(select_columns 100 "'r' || value || 'c{}'")"
+  "text_high_cardinality 1 $((200000 * SCALE)) 4 $(select_columns 4 "printf('item-%08d-{}', value)")"
+  "text_low_cardinality 1 $((200000 * SCALE)) 4 $(select_columns 4 "'category ' || ((value * {}) % 16)")"
+  "many_sheets 100 $((2000 * SCALE)) 3 value, 'row ' || value, value * 1.5"
+  "million_rows 1 1048575 1 'row'"  # As 14_headermillionrows_01.xlsx, Excel's limit, not scaled
+)
+
+# run_measured CMD...: sets STATUS, SECONDS_TAKEN and PEAK_RSS_KB
+run_measured() {
+  local start end pid hwm
+  PEAK_RSS_KB=0
+  start=$(date +%s%N)
+  if [ -x /usr/bin/time ]; then
+    /usr/bin/time -f '%M' -o bench_time.txt "$@" > bench_cmd.txt 2>&1
+    STATUS=$?
+    PEAK_RSS_KB=$(tail -n 1 bench_time.txt)
+  else
+    "$@" > bench_cmd.txt 2>&1 &
+    pid=$!
+    while kill -0 $pid 2>/dev/null; do
+      hwm=$(awk '/^VmHWM/ {print $2}' /proc/$pid/status 2>/dev/null)
+      [ -n "$hwm" ] && PEAK_RSS_KB=$hwm
+      sleep 0.01
+    done
+    wait $pid
+    STATUS=$?
+  fi
+  end=$(date +%s%N)
+  # The SQLite shell exits 0 even when a statement fails, so look for its error messages too
+  if grep -q '^\(Error\|Parse error\|Runtime error\)' bench_cmd.txt; then
+    STATUS=1
+  fi
+  SECONDS_TAKEN=$(awk -v ns=$((end - start)) 'BEGIN { printf "%.3f", ns / 1e9 }')
+}
+
+# report BACKEND OP SHAPE TABLES ROWS COLS FILE
+report() {
+  local bytes=0 status=ok line
+  [ -f "$7" ] && bytes=$(stat -c %s "$7")
+  [ $STATUS -ne 0 ] && status=error
+  line=$(awk -v ts="$STAMP" -v commit="$COMMIT" -v sqlite="$SQLITE_VERSION" -v backend="$1" \
+    -v op="$2" -v shape="$3" -v tables="$4" -v rows="$5" -v cols="$6" -v bytes="$bytes" \
+    -v secs="$SECONDS_TAKEN" -v rss="$PEAK_RSS_KB" -v status="$status" 'BEGIN {
+      ok = status == "ok" && secs > 0
+      rps = ok ? rows / secs : 0; mbps = ok ? bytes / 1e6 / secs : 0
+      printf "{\"time\":\"%s\",\"commit\":\"%s\",\"sqlite\":\"%s\",\"backend\":\"%s\",\"op\":\"%s\",", ts, commit, sqlite, backend, op
+      printf "\"shape\":\"%s\",\"tables\":%d,\"rows\":%d,\"cols\":%d,\"bytes\":%d,\"seconds\":%s,", shape, tables, rows, cols, bytes, secs
+      printf "\"rows_per_s\":%.0f,\"mb_per_s\":%.2f,\"peak_rss_kb\":%d,\"status\":\"%s\"}\n", rps, mbps, rss, status
+    }')
+  echo "$line" | tee -a $RESULTS
+  if [ $status != ok ]; then
+    head -n 3 bench_cmd.txt >&2
+  fi
+}
+
+for shape in "${SHAPES[@]}"
+do
+  read -r name tables rows cols select <<< "$shape"
+  total_rows=$((tables * rows))
+  db=bench_${name}.db
+  rm -f $db bench_${name}_*.xlsx
+
+  sql="BEGIN;"
+  names=""  # SQL list of the table names, as copilot's xlsx_export needs them spelled out
+  for ((t = 1; t <= tables; t++)); do
+    table=$name
+    [ $tables -gt 1 ] && table=$(printf "%s_%03d" $name $t)
+    names+=", '$table'"
+    sql+="CREATE TABLE \"$table\"($(seq -s, -f 'c%g' 1 $cols));"
+    sql+="INSERT INTO \"$table\" SELECT $select FROM generate_series(1, $rows);"
+  done
+  sql+="COMMIT;"
+  $SQLITE3 $db "$sql" || exit 1
+
+  for llm in $BACKENDS
+  do
+    if [ -f ../${llm}/xlsxexport.so ]; then
+      out=bench_${name}_${llm}.xlsx
+      run_measured $SQLITE3 $db ".load ../${llm}/xlsxexport.so" "SELECT xlsx_export('$out'$names);"
+      report $llm export $name $tables $total_rows $cols $out
+    fi
+  done
+
+  # Every importer reads the same file, written by the opus exporter
+  source=bench_${name}_opus.xlsx
+  if [ ! -f $source ]; then
+    $SQLITE3 $db ".load ../opus/xlsxexport.so" "SELECT xlsx_export('$source'$names);" > /dev/null 2>&1
+  fi
+  for llm in $BACKENDS
+  do
+    if [ -f ../${llm}/xlsximport.so ] && [ -f $source ]; then
+      run_measured $SQLITE3 ':memory:' ".load ../${llm}/xlsximport.so" "SELECT xlsx_import('$source');"
+      report $llm import $name $tables $total_rows $cols $source
+    fi
+  done
+
+  rm -f $db bench_${name}_*.xlsx
+done
+
+rm -f bench_cmd.txt bench_time.txt
@@ -69,6 +69,41 @@ do
   done
 done
 
+echo -e "+++++++++++++++++++++++++++++++\nTesting opus xlsximport features"
+# Sheets listed out of part order, one of them with an absolute Target
+printf 'first\nsecond\nthird\n' > expected_rels_reordered.txt
+./sqlite3 ':memory:' '.load ../opus/xlsximport.so' "SELECT xlsx_import('rels_reordered.xlsx');" '.output importing_rels_reordered.txt' 'SELECT * FROM First;' 'SELECT * FROM Second;' 'SELECT * FROM Third;' '.output'
+cmp expected_rels_reordered.txt importing_rels_reordered.txt
+if [ $? -eq 0 ]
+then echo "Passed rels_reordered"
+else echo "Failed rels_reordered"
+fi
+echo
+
+# Date and time formats, including the nonexistent 1900-02-29 kept as a number
+printf '2024-03-15|2024-03-15 12:00:00|18:00:00|45366\n60|1900-03-01 06:00:00|12:00:00|1.5\n' > expected_dates_formats.txt
+./sqlite3 ':memory:' '.load ../opus/xlsximport.so' "SELECT xlsx_import_config('dates', 'iso');" "SELECT xlsx_import('dates_formats.xlsx');" '.once importing_dates_formats.txt' 'SELECT * FROM Sheet1;'
+cmp expected_dates_formats.txt importing_dates_formats.txt
+if [ $? -eq 0 ]
+then echo "Passed dates_formats"
+else echo "Failed dates_formats"
+fi
+echo
+
+# Re-import after sheet One changed and the part of sheet Two went missing
+rm -f incremental.db
+cp incremental_1.xlsx incremental.xlsx
+./sqlite3 incremental.db '.load ../opus/xlsximport.so' "SELECT xlsx_import_config('incremental', 1);" "SELECT xlsx_import('incremental.xlsx');"
+cp incremental_2.xlsx incremental.xlsx
+printf 'one changed\ntwo\n' > expected_incremental.txt
+./sqlite3 incremental.db '.load ../opus/xlsximport.so' "SELECT xlsx_import_config('incremental', 1);" "SELECT xlsx_import('incremental.xlsx');" '.output importing_incremental.txt' 'SELECT * FROM One;' 'SELECT * FROM Two;' '.output'
+cmp expected_incremental.txt importing_incremental.txt
+if [ $? -eq 0 ]
+then echo "Passed incremental"
+else echo "Failed incremental"
+fi
+echo
+
 exit
 
 # Minimal test of xlsx_import, xlsx_import_sheetnames, xlsx_import_version
@@ -87,4 +122,4 @@ SELECT xlsx_import('WDIEXCEL.xlsx');
 ssconvert --import-type=Gnumeric_stf:stf_csvtab --export-type=Gnumeric_Excel:xlsx2 14_headermillionrows_01.csv 14_headermillionrows_01.xlsx
 
 # make clean
-rm expected_* importing_* exporting_*
+rm expected_* importing_* exporting_* incremental.xlsx incremental.db